@@ -48,6 +48,14 @@ public:
 		wxID_BACKGROUND,
 		wxID_BOUNDINGS,
 		wxID_AABBTREE,
+		wxID_OCCLUSION,
+		wxID_SMALLFEATURES,
+		wxID_PROXIES,
+		wxID_MESHLETS,
+		wxID_INSTANCING,
+		wxID_SORT_TRIANGLES,
+		wxID_PARALLEL,
+		wxID_DRIVER_THREAD,
 		wxID_FULLSCREEN,
 		wxID_CAMERA_RESET,
 		wxID_PERSPECTIVE,
@@ -61,7 +69,14 @@ public:
 		wxID_CAMERA7,
 		wxID_CAMERA8,
 		wxID_CAMERA9,
-		wxEVT_NEWVERSION
+		wxID_COMPACT_VERTICES,
+		wxID_FLATTEN_TRANSFORMS,
+		wxID_SHARE_INSTANCES,
+		wxID_BATCH_SHAPES,
+		wxID_GENERATE_LODS,
+		wxID_BUILD_MESHLETS,
+		wxEVT_NEWVERSION,
+		wxEVT_STATUSTEXT
 	};
 
 	MainFrame():
@@ -96,6 +111,21 @@ public:
 		pFileMenu->Append(wxID_SAVE, _T("&Export..\tCtrl-S"));
 		Connect( wxID_SAVE, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnSaveFile));
 
+		wxMenu* pImportMenu = new wxMenu;
+		pImportMenu->AppendCheckItem(wxID_COMPACT_VERTICES, _T("&Compact Vertices"))->Check(false);
+		Connect( wxID_COMPACT_VERTICES, wxID_COMPACT_VERTICES, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnImportOption));
+		pImportMenu->AppendCheckItem(wxID_FLATTEN_TRANSFORMS, _T("&Flatten Transforms"))->Check(false);
+		Connect( wxID_FLATTEN_TRANSFORMS, wxID_FLATTEN_TRANSFORMS, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnImportOption));
+		pImportMenu->AppendCheckItem(wxID_SHARE_INSTANCES, _T("&Share Instances"))->Check(false);
+		Connect( wxID_SHARE_INSTANCES, wxID_SHARE_INSTANCES, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnImportOption));
+		pImportMenu->AppendCheckItem(wxID_BATCH_SHAPES, _T("&Batch Small Shapes"))->Check(false);
+		Connect( wxID_BATCH_SHAPES, wxID_BATCH_SHAPES, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnImportOption));
+		pImportMenu->AppendCheckItem(wxID_GENERATE_LODS, _T("&Levels of Detail"))->Check(false);
+		Connect( wxID_GENERATE_LODS, wxID_GENERATE_LODS, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnImportOption));
+		pImportMenu->AppendCheckItem(wxID_BUILD_MESHLETS, _T("&Meshlets"))->Check(false);
+		Connect( wxID_BUILD_MESHLETS, wxID_BUILD_MESHLETS, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnImportOption));
+		pFileMenu->AppendSubMenu(pImportMenu, _T("&Import Options"));
+
 		pFileMenu->AppendSeparator();
 		pFileMenu->Append(wxID_EXIT, _T("&Exit\tAlt-F4"));
 		Connect( wxID_EXIT, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnExit));
@@ -108,8 +138,16 @@ public:
 		pViewMenu->AppendSeparator();
 		pViewMenu->AppendCheckItem(wxID_BOUNDINGS, _T("&BoundingBoxes\tB"))->Check(false);
 		pViewMenu->AppendCheckItem(wxID_AABBTREE, _T("Sce&ne-AABB-Tree\tN"))->Check(false);
+		pViewMenu->AppendCheckItem(wxID_OCCLUSION, _T("&Occlusion Culling"))->Check(false);
+		pViewMenu->AppendCheckItem(wxID_SMALLFEATURES, _T("Skip Small &Features"))->Check(false);
+		pViewMenu->AppendCheckItem(wxID_PROXIES, _T("Small Features as Bo&xes"))->Check(false);
+		pViewMenu->AppendCheckItem(wxID_MESHLETS, _T("&Meshlet Culling"))->Check(false);
+		pViewMenu->AppendCheckItem(wxID_INSTANCING, _T("&Instanced Drawing"))->Check(false);
+		pViewMenu->AppendCheckItem(wxID_SORT_TRIANGLES, _T("Sort Blended &Triangles"))->Check(false);
+		pViewMenu->AppendCheckItem(wxID_PARALLEL, _T("&Cull on All Cores"))->Check(false);
+		pViewMenu->AppendCheckItem(wxID_DRIVER_THREAD, _T("&Draw on a Separate Thread"))->Check(false);
 		pViewMenu->AppendSeparator();
-		Connect( wxID_WIREFRAME, wxID_AABBTREE, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnView));
+		Connect( wxID_WIREFRAME, wxID_DRIVER_THREAD, wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::OnView));
 
 		wxMenu* pCameraMenu = new wxMenu;
 		pCameraMenu->AppendRadioItem(wxID_PERSPECTIVE, _T("&Perspective Projection\tP"));
@@ -148,6 +186,8 @@ public:
 #endif
 		}
 
+		menuBar->Enable(wxID_DRIVER_THREAD, dynamic_cast<OpenGLWnd*>(m_p3DWnd) != NULL);
+
 		/////////////////////////
 
         class CheckForNewVersionThread: public wxThread
@@ -257,9 +297,23 @@ public:
 
 	void SetStatusText(const std::wstring& text)
 	{
+		// e.g. from the driver thread of the viewport
+		if(!wxThread::IsMain())
+		{
+			wxThreadEvent* te = new wxThreadEvent(wxEVT_THREAD, wxEVT_STATUSTEXT);
+			te->SetString(text);
+			wxQueueEvent(this, te);
+			return;
+		}
+
 		GetStatusBar()->SetStatusText( text );
 	}
 
+	void OnStatusText(wxThreadEvent& evt)
+	{
+		GetStatusBar()->SetStatusText( evt.GetString() );
+	}
+
 	SceneIO* getSceneIO()
 	{
 		SceneIO::setSetStatusTextCallback( boost::bind(&MainFrame::SetStatusText, this, _1) );
@@ -392,6 +446,10 @@ public:
 		ResetView();
 
 		this->SetTitle( SceneIO::File(sFile).getName() );
+
+		const Scene::Statistics& stats = pScene->getStatistics();
+		SetStatusText( std::wstring(wxString::Format(wxT("%u Nodes, %u Draws, %u Triangles, %u Vertices"),
+			stats.nNodes, stats.nDraws, stats.nTriangles, stats.nVertices).c_str()) );
 		return ret;
 	}
 
@@ -407,6 +465,13 @@ protected:
 #endif
 	}
 
+	// the Direct3D 9 device isn't created for calls from several threads
+	void EnableDriverThread(bool bEnable)
+	{
+		if(OpenGLWnd* wnd = dynamic_cast<OpenGLWnd*>(m_p3DWnd))
+			return wnd->EnableDriverThread(bEnable);
+	}
+
 	Viewport* GetViewport()
 	{
 		if(OpenGLWnd* wnd = dynamic_cast<OpenGLWnd*>(m_p3DWnd))
@@ -463,11 +528,60 @@ protected:
 		case wxID_AABBTREE:
 			GetViewport()->setModeFlag( Viewport::MODE_DRAWAABBTREE, event.IsChecked() );
 			break;
+		case wxID_OCCLUSION:
+			GetViewport()->setModeFlag( Viewport::MODE_OCCLUSION, event.IsChecked() );
+			break;
+		case wxID_SMALLFEATURES:
+			GetViewport()->setModeFlag( Viewport::MODE_SMALLFEATURES, event.IsChecked() );
+			break;
+		case wxID_PROXIES:
+			GetViewport()->setModeFlag( Viewport::MODE_PROXIES, event.IsChecked() );
+			break;
+		case wxID_MESHLETS:
+			GetViewport()->setModeFlag( Viewport::MODE_MESHLETS, event.IsChecked() );
+			break;
+		case wxID_INSTANCING:
+			GetViewport()->setModeFlag( Viewport::MODE_INSTANCING, event.IsChecked() );
+			break;
+		case wxID_SORT_TRIANGLES:
+			GetViewport()->setModeFlag( Viewport::MODE_SORTTRIANGLES, event.IsChecked() );
+			break;
+		case wxID_PARALLEL:
+			GetViewport()->setModeFlag( Viewport::MODE_PARALLEL, event.IsChecked() );
+			break;
+		case wxID_DRIVER_THREAD:
+			EnableDriverThread( event.IsChecked() );
+			break;
 		}
 
 		m_p3DWnd->Refresh();
 	}
 
+	void OnImportOption(wxCommandEvent& event)
+	{
+		switch( event.GetId() )
+		{
+		case wxID_COMPACT_VERTICES:
+			getSceneIO()->setLoadFlag( SceneIO::LOAD_COMPACT_VERTICES, event.IsChecked() );
+			break;
+		case wxID_FLATTEN_TRANSFORMS:
+			getSceneIO()->setLoadFlag( SceneIO::LOAD_FLATTEN_TRANSFORMS, event.IsChecked() );
+			break;
+		case wxID_SHARE_INSTANCES:
+			getSceneIO()->setLoadFlag( SceneIO::LOAD_SHARE_INSTANCES, event.IsChecked() );
+			break;
+		case wxID_BATCH_SHAPES:
+			getSceneIO()->setLoadFlag( SceneIO::LOAD_BATCH_SHAPES, event.IsChecked() );
+			break;
+		case wxID_GENERATE_LODS:
+			getSceneIO()->setLoadFlag( SceneIO::LOAD_GENERATE_LODS, event.IsChecked() );
+			break;
+		case wxID_BUILD_MESHLETS:
+			getSceneIO()->setLoadFlag( SceneIO::LOAD_BUILD_MESHLETS, event.IsChecked() );
+			break;
+		}
+	}
+
 	void OnProgress(float p)
 	{
 		if(p == 1.f)
@@ -498,6 +612,7 @@ protected:
 
 wxBEGIN_EVENT_TABLE(MainFrame, wxFrame)
 EVT_THREAD(wxEVT_NEWVERSION, MainFrame::OnNewVersion)
+EVT_THREAD(wxEVT_STATUSTEXT, MainFrame::OnStatusText)
 wxEND_EVENT_TABLE()
 
 MainFrame* MainFrame::m_pInstance = NULL;
@@ -505,6 +620,14 @@ MainFrame* MainFrame::m_pInstance = NULL;
 class MyApp : public wxApp
 {
 public:
+#if !defined(_MSC_VER)
+	// before the display is opened, the driver thread of the viewport swaps the buffers of its window
+	MyApp()
+	{
+		XInitThreads();
+	}
+#endif
+
 	virtual bool OnInit()
 	{
 		MainFrame* pFrame = new MainFrame();
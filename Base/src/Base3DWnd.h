@@ -56,7 +56,8 @@ public:
 
 		Refresh();
 
-		if (m_aViewport.getScene()->isAnimated())
+		// the timer also picks up geometry refined in the background
+		if (m_aViewport.getScene()->isAnimated() || !m_aViewport.getScene()->getRefiners().empty())
 			m_aTimer.Start(20, true);
 		else
 			m_aTimer.Stop();
@@ -71,7 +72,7 @@ public:
 	{
 		m_aViewport.control().Animate();
 
-		if (!m_aViewport.isValid())
+		if (!m_aViewport.isValid() || m_aViewport.isRefinementPending())
 			this->Refresh();
 
 		m_aTimer.Start(20, true);
@@ -94,7 +95,7 @@ public:
 #endif
 			Refresh();
 		}
-		else if (event.LeftUp() || event.RightDown())
+		else if (event.LeftUp() || event.RightUp())
 		{
 #if defined(_MSC_VER)
 			if ( ::GetCapture() == (HWND)this->GetHWND() )
@@ -19,14 +19,16 @@
 #include <wx/wx.h>
 #include <wx/glcanvas.h>
 #include "Base3DWnd.h"
+#include <DriverThread.h>
 
 #if defined(_MSC_VER)
 #include <windows.h>
 #else
 #include <dlfcn.h>
+#include <GL/glx.h>
 #endif
 
-class OpenGLWnd: public Base3DWnd<wxGLCanvas>
+class OpenGLWnd: public Base3DWnd<wxGLCanvas>, public IDriverContext
 {
     typedef IDriver* (*CreateDriverFunc)(int* pWindow);
     CreateDriverFunc CreateOpenGL1Driver;
@@ -56,6 +58,45 @@ public:
 
         this->SetFocus();
     }
+    virtual ~OpenGLWnd()
+    {
+        // the thread calls back into the window
+        GetViewport().setDriverThread(false);
+    }
+
+    // the context moves to the driver thread and comes back when it stops
+    void EnableDriverThread(bool bEnable)
+    {
+        if (GetViewport().getDriver() == NULL || !GetContext())
+            return;
+
+        SetCurrent();
+        GetViewport().setDriverThread(bEnable, this);
+
+        if (bEnable)
+            release();
+        else
+            SetCurrent();
+    }
+
+    // IDriverContext, on the driver thread or under its lock
+    virtual void acquire()
+    {
+        SetCurrent();
+    }
+    virtual void present()
+    {
+        SwapBuffers();
+    }
+    virtual void release()
+    {
+#if defined(_MSC_VER)
+        wglMakeCurrent(NULL, NULL);
+#else
+        if (Display* pDisplay = glXGetCurrentDisplay())
+            glXMakeCurrent(pDisplay, None, NULL);
+#endif
+    }
 
 
     void OnEraseBG(wxEraseEvent& event)
@@ -66,6 +107,13 @@ public:
         if (!GetContext())
             return;
 
+        // the driver thread makes the context current and swaps the buffers itself
+        if (GetViewport().isDriverThreadEnabled())
+        {
+            GetViewport().drawScene();
+            return;
+        }
+
         SetCurrent();
 
         if (GetViewport().getDriver() == NULL)
@@ -94,6 +142,13 @@ public:
         if (!GetContext())
             return;
 
+        if (GetViewport().isDriverThreadEnabled())
+        {
+            GetViewport().drawScene();
+            event.Skip();
+            return;
+        }
+
         SetCurrent();
 
         if (GetViewport().getDriver() == NULL)
@@ -128,7 +183,9 @@ public:
             if (!GetContext())
                 return;
 
-            SetCurrent();
+            // the driver thread gets the new viewport with the next frame
+            if (!GetViewport().isDriverThreadEnabled())
+                SetCurrent();
             GetViewport().setDisplayRect(GetClientRect().x,
                                          GetClientRect().y,
                                          GetClientRect().width,
@@ -16,6 +16,7 @@
 
 #include "..\SceneGraph\src\IDriver.h"
 #include "..\SceneGraph\src\Geometry.h"
+#include "..\SceneGraph\src\Meshlets.h"
 #include "..\SceneGraph\src\Material.h"
 #include "..\SceneGraph\src\SceneIO.h"
 
@@ -101,7 +102,11 @@ public:
 		if( ret )
 			return ret;
 
-		UINT stride = pBuff->getStride();
+		// compact buffers are decoded to position, normal and texcoord floats while filling the buffer
+		bool bDecode = pBuff->getFormat() != IVertexBuffer::FORMAT_FLOAT;
+
+		UINT stride = bDecode ? sizeof(Vec3)*2+sizeof(Float)*2 : pBuff->getStride();
+		UINT size = bDecode ? stride * pBuff->getVertexCount() : pBuff->getBufferSize();
 		DWORD FVF = 0;
 
 		if(stride == sizeof(Vec3))
@@ -115,7 +120,7 @@ public:
 
 		IDirect3DVertexBuffer9* pVB = NULL;
 
-		HRESULT hr = m_pDevice->CreateVertexBuffer(pBuff->getBufferSize(), 
+		HRESULT hr = m_pDevice->CreateVertexBuffer(size, 
 			D3DUSAGE_WRITEONLY, 
 			FVF, 
 			D3DPOOL_MANAGED,
@@ -125,15 +130,18 @@ public:
 		if( SUCCEEDED(hr) && pVB)
 		{
 			void* vData = NULL;
-			if( SUCCEEDED( pVB->Lock(0, pBuff->getBufferSize(), &vData, 0) ))
+			if( SUCCEEDED( pVB->Lock(0, size, &vData, 0) ))
 			{
-				memcpy(vData, pBuff->getBuffer(), pBuff->getBufferSize());
+				if(bDecode)
+					pBuff->decode((Float*)vData, 0, pBuff->getVertexCount());
+				else
+					memcpy(vData, pBuff->getBuffer(), size);
 
 				// Hier wird die Texture Y Koordinate umgerechnet ...
 				if(stride == sizeof(Vec3)*2+sizeof(Float)*2)
 				{
 					Float* p = (Float*)vData;
-					for(size_t i = 7; i < pBuff->getBufferSize()/4; i+= 8)
+					for(size_t i = 7; i < size/4; i+= 8)
 						p[i] = 1.f - p[i];
 				}
 
@@ -314,7 +322,14 @@ class Direct3D9Driver: public IDriver
 	D3DPRESENT_PARAMETERS present; 
 	Rect	 m_viewport;
 
+	Matrix	m_world;
+	Matrix	m_view;
+	Matrix	m_proj;
+
 	bool	m_bShadow;
+	bool	m_bCullBack;
+	bool	m_bMeshletCulling;
+	std::vector<Uint> m_ranges;
 	HRESULT hr;
 	HWND hWnd;
 	Uint nAntialiasingLevel;
@@ -326,6 +341,8 @@ public:
 	Direct3D9Driver(HWND _hWnd):
 		hWnd(_hWnd),
 		m_bShadow(true),
+		m_bCullBack(false),
+		m_bMeshletCulling(false),
 		pSwapChain(NULL),
 		hr(0),
 		nAntialiasingLevel(8),
@@ -746,6 +763,7 @@ public:
 
 	virtual void setProjectionMatrix(const Matrix& mat)
 	{
+		m_proj = mat;
 		if(this->m_pShader)
 			this->m_pShader->SetMatrix( "matProj", reinterpret_cast<const D3DXMATRIX*>(&mat) );
 		else
@@ -755,6 +773,7 @@ public:
 
 	virtual void setViewMatrix(const Matrix& mat)
 	{
+		m_view = mat;
 		if(this->m_pShader)
 			this->m_pShader->SetMatrix( "matView", reinterpret_cast<const D3DXMATRIX*>(&mat) );
 		else
@@ -763,6 +782,7 @@ public:
 
 	virtual void setWorldMatrix(const Matrix& mat)
 	{
+		m_world = mat;
 		if(this->m_pShader)
 		{
 			Matrix proj(false);  
@@ -819,6 +839,7 @@ public:
 	}
 	virtual void enableCulling(bool bEnable)
 	{
+		m_bCullBack = bEnable;
 		if(bEnable)
 			this->m_pDevice->SetRenderState( D3DRS_CULLMODE, D3DCULL_CW );
 		else
@@ -826,6 +847,7 @@ public:
 	}
 	virtual void cullFace(bool bEnable)
 	{
+		m_bCullBack = !bEnable;
 		if(bEnable)
 			this->m_pDevice->SetRenderState( D3DRS_CULLMODE, D3DCULL_CCW );	//glCullFace(GL_FRONT);)
 		else
@@ -897,7 +919,9 @@ public:
 		}
 	}
 
-	virtual bool drawPrimitive(Geometry& node)
+private:
+	// ranges are pairs of first index and count, the shadow pass gets its own
+	bool bind(Geometry& node)
 	{
 		Ptr<Direct3D9IndexBuffer> pIB = node.m_resource;
 		Ptr<Direct3D9VertexBuffer> pVB = node.getVertexBuffer()->m_resource;
@@ -908,61 +932,24 @@ public:
 		if( pIB == NULL )
 			pIB = node.m_resource = Direct3D9IndexBuffer::create(this->m_pDevice, node.getIndices());
 
-		if( pVB && pIB && pVB->bind(this->m_pDevice) && pIB->bind(this->m_pDevice))
-		{
-			UINT nPrimitives = 0;
-
-			if(node.getIndices().size()>0)
-				nPrimitives = (UINT) node.getIndices().size();
-			else
-				nPrimitives = node.getVertexBuffer()->getVertexCount();
+		return pVB && pIB && pVB->bind(this->m_pDevice) && pIB->bind(this->m_pDevice);
+	}
 
-			D3DPRIMITIVETYPE mode = D3DPT_TRIANGLELIST;
-			switch(node.getType())
-			{
-			case Geometry::POINTS:		
-				mode = D3DPT_POINTLIST;	
-				break;
-			case Geometry::LINES:		
-				mode = D3DPT_LINELIST;		
-				nPrimitives /= 2;
-				break;
-			case Geometry::LINE_STRIP:		
-				mode = D3DPT_LINESTRIP;	
-				nPrimitives = nPrimitives-1;
-				break;
-			case Geometry::TRIANGLES:		
-				mode = D3DPT_TRIANGLELIST;
-				nPrimitives /= 3;
-				break;
-			case Geometry::TRIANGLE_STRIP:	
-				mode = D3DPT_TRIANGLESTRIP;	
-				nPrimitives = nPrimitives-2;
-				break;
-			case Geometry::TRIANGLE_FAN:	
-				mode = D3DPT_TRIANGLEFAN;	
-				nPrimitives = nPrimitives-2;
-				break;
-			default:
-				std::wcerr << L"Unknown D3DPRIMITIVETYPE" << std::endl;
-				break;
-			}
+	bool draw(Geometry& node, const Uint* pRanges, Uint nRanges, const Uint* pShadowRanges, Uint nShadowRanges)
+	{
+		if( bind(node) )
+		{
+			D3DPRIMITIVETYPE mode = getMode(node.getType());
 
 			for(UINT iPass = 0; iPass < this->cEffectPasses; iPass++ )
 			{	
 				if(this->m_pShader)
 					this->m_pShader->BeginPass( iPass );
 
-				if(node.getIndices().size()==0)
-				{
-					this->m_pDevice->DrawPrimitive( mode, 0, nPrimitives );
-					//					this->m_pDevice->DrawPrimitiveUP( mode, nPrimitives, node.getVertexBuffer()->getBuffer(), node.getVertexBuffer()->getStride() );
-				}
+				if(iPass == 0)
+					drawRanges(node, mode, pRanges, nRanges);
 				else
-				{
-					this->m_pDevice->DrawIndexedPrimitive(mode, 0, 0, node.getVertexBuffer()->getVertexCount(), 0, nPrimitives);
-					//					this->m_pDevice->DrawIndexedPrimitiveUP(mode, 0, node.getVertexBuffer()->getVertexCount(), nPrimitives, &node.getIndices()[0], D3DFMT_INDEX32, node.getVertexBuffer()->getBuffer(), node.getVertexBuffer()->getStride() );
-				}
+					drawRanges(node, mode, pShadowRanges, nShadowRanges);
 
 				if(this->m_pShader)
 					this->m_pShader->EndPass();
@@ -977,6 +964,127 @@ public:
 		return false;
 	}
 
+	void drawRanges(Geometry& node, D3DPRIMITIVETYPE mode, const Uint* pRanges, Uint nRanges)
+	{
+		for(Uint r = 0; r < nRanges; r++)
+		{
+			UINT nPrimitives = getPrimitiveCount(node.getType(), pRanges[2*r+1]);
+
+			if(node.getIndices().size()==0)
+			{
+				this->m_pDevice->DrawPrimitive( mode, pRanges[2*r], nPrimitives );
+				//					this->m_pDevice->DrawPrimitiveUP( mode, nPrimitives, node.getVertexBuffer()->getBuffer(), node.getVertexBuffer()->getStride() );
+			}
+			else
+			{
+				this->m_pDevice->DrawIndexedPrimitive(mode, 0, 0, node.getVertexBuffer()->getVertexCount(), pRanges[2*r], nPrimitives);
+				//					this->m_pDevice->DrawIndexedPrimitiveUP(mode, 0, node.getVertexBuffer()->getVertexCount(), nPrimitives, &node.getIndices()[0], D3DFMT_INDEX32, node.getVertexBuffer()->getBuffer(), node.getVertexBuffer()->getStride() );
+			}
+		}
+	}
+
+	static D3DPRIMITIVETYPE getMode(Geometry::TYPE type)
+	{
+		switch(type)
+		{
+		case Geometry::POINTS:		
+			return D3DPT_POINTLIST;	
+		case Geometry::LINES:		
+			return D3DPT_LINELIST;		
+		case Geometry::LINE_STRIP:		
+			return D3DPT_LINESTRIP;	
+		case Geometry::TRIANGLES:		
+			return D3DPT_TRIANGLELIST;
+		case Geometry::TRIANGLE_STRIP:	
+			return D3DPT_TRIANGLESTRIP;	
+		case Geometry::TRIANGLE_FAN:	
+			return D3DPT_TRIANGLEFAN;	
+		default:
+			std::wcerr << L"Unknown D3DPRIMITIVETYPE" << std::endl;
+			return D3DPT_TRIANGLELIST;
+		}
+	}
+
+	static UINT getPrimitiveCount(Geometry::TYPE type, UINT nVertices)
+	{
+		switch(type)
+		{
+		case Geometry::LINES:
+			return nVertices / 2;
+		case Geometry::LINE_STRIP:
+			return nVertices > 1 ? nVertices - 1 : 0;
+		case Geometry::TRIANGLES:
+			return nVertices / 3;
+		case Geometry::TRIANGLE_STRIP:
+		case Geometry::TRIANGLE_FAN:
+			return nVertices > 2 ? nVertices - 2 : 0;
+		default:
+			return nVertices;
+		}
+	}
+public:
+	virtual bool drawPrimitive(Geometry& node)
+	{
+		Uint all[2] = { 0, node.getVertexCount() };
+
+		// the meshlets outside the view or facing away are left out, the shadow pass needs all of them
+		if(m_bMeshletCulling && !node.getMeshlets().empty())
+		{
+			Meshlets::cull(node, m_world*m_view, m_proj, m_bCullBack, m_ranges);
+			return draw(node, m_ranges.empty() ? NULL : &m_ranges[0], (Uint)m_ranges.size()/2, all, 1);
+		}
+
+		return draw(node, all, 1, all, 1);
+	}
+
+	virtual bool drawPrimitive(Geometry& node, const Uint* pRanges, Uint nRanges)
+	{
+		return draw(node, pRanges, nRanges, pRanges, nRanges);
+	}
+
+	virtual void enableMeshletCulling(bool bEnable)
+	{
+		m_bMeshletCulling = bEnable;
+	}
+
+	// the effect has no instance stream, the buffers are bound and each pass begun once for all instances
+	virtual void drawInstances(Geometry& node, const Matrix* pWorlds, Uint nInstances)
+	{
+		if( nInstances == 0 || !bind(node) )
+			return;
+
+		D3DPRIMITIVETYPE mode = getMode(node.getType());
+		Uint all[2] = { 0, node.getVertexCount() };
+		bool bMeshlets = m_bMeshletCulling && !node.getMeshlets().empty();
+
+		for(UINT iPass = 0; iPass < this->cEffectPasses; iPass++ )
+		{	
+			if(this->m_pShader)
+				this->m_pShader->BeginPass( iPass );
+
+			for(Uint i = 0; i < nInstances; i++)
+			{
+				setWorldMatrix(pWorlds[i]);
+				if(this->m_pShader)
+					this->m_pShader->CommitChanges();
+
+				if(iPass == 0 && bMeshlets)
+				{
+					Meshlets::cull(node, pWorlds[i]*m_view, m_proj, m_bCullBack, m_ranges);
+					drawRanges(node, mode, m_ranges.empty() ? NULL : &m_ranges[0], (Uint)m_ranges.size()/2);
+				}
+				else
+					drawRanges(node, mode, all, 1);
+			}
+
+			if(this->m_pShader)
+				this->m_pShader->EndPass();
+
+			if(!m_bShadow)	//Kein Shadow pass zeichnen...
+				break;
+		}
+	}
+
 	virtual void draw2DText(const char* text, int x, int y)
 	{
 		RECT rc;
@@ -16,6 +16,7 @@
 
 #include <IDriver.h>
 #include <Geometry.h>
+#include <Meshlets.h>
 #include <Material.h>
 #include <SceneIO.h>
 
@@ -25,6 +26,7 @@ using namespace eh;
 
 #include <iostream>
 #include <sstream>
+#include <cstring>
 
 #if defined(_MSC_VER)
 #	include <windows.h>
@@ -69,9 +71,24 @@ public:
             GLuint id = 0;
             glGenBuffersARB(1, &id);
             glBindBufferARB(GL_ARRAY_BUFFER_ARB, id);
-            glBufferDataARB(GL_ARRAY_BUFFER_ARB, pBuff->getBufferSize(), pBuff->getBuffer(), GL_STATIC_DRAW_ARB);
 
-            ret = new OpenGLVBO(id, pBuff->getStride());
+            if (pBuff->getFormat() == IVertexBuffer::FORMAT_FLOAT)
+            {
+                glBufferDataARB(GL_ARRAY_BUFFER_ARB, pBuff->getBufferSize(), pBuff->getBuffer(), GL_STATIC_DRAW_ARB);
+
+                ret = new OpenGLVBO(id, pBuff->getStride());
+            }
+            else
+            {
+                // the fixed function pipeline can't read the compact layout, decode to position/normal/texcoord floats
+                std::vector<Float> decoded( pBuff->getVertexCount() * 8 );
+                if (!decoded.empty())
+                    pBuff->decode(&decoded[0], 0, pBuff->getVertexCount());
+
+                glBufferDataARB(GL_ARRAY_BUFFER_ARB, decoded.size() * sizeof(Float), decoded.empty() ? NULL : &decoded[0], GL_STATIC_DRAW_ARB);
+
+                ret = new OpenGLVBO(id, 8 * sizeof(Float));
+            }
         }
 
         return ret;
@@ -244,15 +261,263 @@ private:
 };
 
 
+// ARB_draw_instanced and ARB_instanced_arrays, newer than the glext.h shipped with the driver
+typedef void (APIENTRY * DrawElementsInstancedProc)(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei primcount);
+typedef void (APIENTRY * DrawArraysInstancedProc)(GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+typedef void (APIENTRY * VertexAttribDivisorProc)(GLuint index, GLuint divisor);
+
+// Draws all instances of a geometry with one call: the world matrices go to a buffer read once per
+// instance by a vertex shader doing what the fixed function vertex stage does with the state the
+// driver sets (two directional lights, local viewer, the reflection sphere map on unit 1), the
+// fragments stay with the fixed function.
+class OpenGLInstancing
+{
+public:
+    // NULL without the extensions or if the shader doesn't compile
+    static OpenGLInstancing* create()
+    {
+        OpenGLInstancing* p = new OpenGLInstancing();
+        if (p->init())
+            return p;
+
+        delete p;
+        return NULL;
+    }
+
+    ~OpenGLInstancing()
+    {
+        if (m_buffer)
+            glDeleteBuffersARB(1, &m_buffer);
+        if (m_program)
+            glDeleteObjectARB(m_program);
+    }
+
+    // the vertex buffer of the geometry is bound
+    void begin(const Matrix* pWorlds, Uint nInstances, const Matrix& view, const Matrix& shadow)
+    {
+        glUseProgramObjectARB(m_program);
+        glUniformMatrix4fvARB(m_view, 1, GL_FALSE, &view[0]);
+        glUniformMatrix4fvARB(m_shadow, 1, GL_FALSE, &shadow[0]);
+        glUniform1iARB(m_bShadow, 0);
+        glUniform1iARB(m_bLighting, glIsEnabled(GL_LIGHTING));
+
+        glBindBufferARB(GL_ARRAY_BUFFER_ARB, m_buffer);
+        glBufferDataARB(GL_ARRAY_BUFFER_ARB, nInstances * sizeof(Matrix), pWorlds, GL_STREAM_DRAW_ARB);
+
+        for (GLuint i = 0; i < 4; i++)
+        {
+            glEnableVertexAttribArrayARB(WORLD + i);
+            glVertexAttribPointerARB(WORLD + i, 4, GL_FLOAT, GL_FALSE, sizeof(Matrix), (GLvoid*)(i * 4 * sizeof(Float)));
+            glVertexAttribDivisorARB(WORLD + i, 1);
+        }
+    }
+
+    // the instances projected by the shadow matrix
+    void beginShadow()
+    {
+        glUniform1iARB(m_bShadow, 1);
+    }
+
+    void draw(Geometry& node, GLenum mode, Uint nInstances)
+    {
+        if (node.getIndices().size() > 0)
+            glDrawElementsInstancedARB(mode, (GLsizei)node.getVertexCount(), GL_UNSIGNED_INT, &node.getIndices()[0], (GLsizei)nInstances);
+        else
+            glDrawArraysInstancedARB(mode, 0, (GLsizei)node.getVertexCount(), (GLsizei)nInstances);
+
+        s_vertices += node.getVertexCount() * nInstances;
+    }
+
+    void end()
+    {
+        for (GLuint i = 0; i < 4; i++)
+        {
+            glVertexAttribDivisorARB(WORLD + i, 0);
+            glDisableVertexAttribArrayARB(WORLD + i);
+        }
+
+        glUseProgramObjectARB(0);
+    }
+
+private:
+    // not aliased with the conventional attributes the driver uses
+    static const GLuint WORLD = 4;
+
+    OpenGLInstancing(): m_program(0), m_buffer(0)
+    {}
+
+    bool init()
+    {
+        const char* ext = (const char*)glGetString(GL_EXTENSIONS);
+        if (ext == NULL || !strstr(ext, "GL_ARB_draw_instanced") || !strstr(ext, "GL_ARB_instanced_arrays") ||
+            !strstr(ext, "GL_ARB_shader_objects") || !strstr(ext, "GL_ARB_vertex_shader") || glGenBuffersARB == NULL)
+            return false;
+
+        glDrawElementsInstancedARB = (DrawElementsInstancedProc) glGetProcAddress("glDrawElementsInstancedARB");
+        glDrawArraysInstancedARB = (DrawArraysInstancedProc) glGetProcAddress("glDrawArraysInstancedARB");
+        glVertexAttribDivisorARB = (VertexAttribDivisorProc) glGetProcAddress("glVertexAttribDivisorARB");
+        glCreateShaderObjectARB = (PFNGLCREATESHADEROBJECTARBPROC) glGetProcAddress("glCreateShaderObjectARB");
+        glShaderSourceARB = (PFNGLSHADERSOURCEARBPROC) glGetProcAddress("glShaderSourceARB");
+        glCompileShaderARB = (PFNGLCOMPILESHADERARBPROC) glGetProcAddress("glCompileShaderARB");
+        glCreateProgramObjectARB = (PFNGLCREATEPROGRAMOBJECTARBPROC) glGetProcAddress("glCreateProgramObjectARB");
+        glAttachObjectARB = (PFNGLATTACHOBJECTARBPROC) glGetProcAddress("glAttachObjectARB");
+        glBindAttribLocationARB = (PFNGLBINDATTRIBLOCATIONARBPROC) glGetProcAddress("glBindAttribLocationARB");
+        glLinkProgramARB = (PFNGLLINKPROGRAMARBPROC) glGetProcAddress("glLinkProgramARB");
+        glGetObjectParameterivARB = (PFNGLGETOBJECTPARAMETERIVARBPROC) glGetProcAddress("glGetObjectParameterivARB");
+        glGetInfoLogARB = (PFNGLGETINFOLOGARBPROC) glGetProcAddress("glGetInfoLogARB");
+        glDeleteObjectARB = (PFNGLDELETEOBJECTARBPROC) glGetProcAddress("glDeleteObjectARB");
+        glUseProgramObjectARB = (PFNGLUSEPROGRAMOBJECTARBPROC) glGetProcAddress("glUseProgramObjectARB");
+        glGetUniformLocationARB = (PFNGLGETUNIFORMLOCATIONARBPROC) glGetProcAddress("glGetUniformLocationARB");
+        glUniformMatrix4fvARB = (PFNGLUNIFORMMATRIX4FVARBPROC) glGetProcAddress("glUniformMatrix4fvARB");
+        glUniform1iARB = (PFNGLUNIFORM1IARBPROC) glGetProcAddress("glUniform1iARB");
+        glEnableVertexAttribArrayARB = (PFNGLENABLEVERTEXATTRIBARRAYARBPROC) glGetProcAddress("glEnableVertexAttribArrayARB");
+        glDisableVertexAttribArrayARB = (PFNGLDISABLEVERTEXATTRIBARRAYARBPROC) glGetProcAddress("glDisableVertexAttribArrayARB");
+        glVertexAttribPointerARB = (PFNGLVERTEXATTRIBPOINTERARBPROC) glGetProcAddress("glVertexAttribPointerARB");
+
+        if (!glDrawElementsInstancedARB || !glDrawArraysInstancedARB || !glVertexAttribDivisorARB || !glCreateShaderObjectARB ||
+            !glShaderSourceARB || !glCompileShaderARB || !glCreateProgramObjectARB || !glAttachObjectARB || !glBindAttribLocationARB ||
+            !glLinkProgramARB || !glGetObjectParameterivARB || !glGetInfoLogARB || !glDeleteObjectARB || !glUseProgramObjectARB ||
+            !glGetUniformLocationARB || !glUniformMatrix4fvARB || !glUniform1iARB || !glEnableVertexAttribArrayARB ||
+            !glDisableVertexAttribArrayARB || !glVertexAttribPointerARB)
+            return false;
+
+        // the matrices are eh::Matrix for row vectors, GL reads them as their transposes for column vectors
+        static const char* source =
+            "#version 110\n"
+            "attribute vec4 world0;\n"
+            "attribute vec4 world1;\n"
+            "attribute vec4 world2;\n"
+            "attribute vec4 world3;\n"
+            "uniform mat4 view;\n"
+            "uniform mat4 shadow;\n"
+            "uniform bool bShadow;\n"
+            "uniform bool bLighting;\n"
+            "\n"
+            "vec4 light(vec3 n, vec3 eye)\n"
+            "{\n"
+            "    vec4 color = gl_FrontLightModelProduct.sceneColor;\n"
+            "    for (int i = 0; i < 2; i++)\n"
+            "    {\n"
+            "        vec3 l = normalize(gl_LightSource[i].position.xyz);\n"
+            "        float d = dot(n, l);\n"
+            "        color += gl_FrontLightProduct[i].ambient;\n"
+            "        if (d > 0.0)\n"
+            "        {\n"
+            "            vec3 h = normalize(l - normalize(eye));\n"
+            "            float s = gl_FrontMaterial.shininess > 0.0 ? pow(max(dot(n, h), 0.0), gl_FrontMaterial.shininess) : 1.0;\n"
+            "            color += gl_FrontLightProduct[i].diffuse * d + gl_FrontLightProduct[i].specular * s;\n"
+            "        }\n"
+            "    }\n"
+            "    color.a = gl_FrontMaterial.diffuse.a;\n"
+            "    return clamp(color, 0.0, 1.0);\n"
+            "}\n"
+            "\n"
+            "void main()\n"
+            "{\n"
+            "    mat4 world = mat4(world0, world1, world2, world3);\n"
+            "    if (bShadow)\n"
+            "        world = shadow * world;\n"
+            "\n"
+            "    vec4 eye = view * (world * gl_Vertex);\n"
+            "    gl_Position = gl_ProjectionMatrix * eye;\n"
+            "\n"
+            "    // the inverse transpose up to its scale, the normalization takes that out\n"
+            "    mat3 m = mat3(view[0].xyz, view[1].xyz, view[2].xyz) * mat3(world[0].xyz, world[1].xyz, world[2].xyz);\n"
+            "    vec3 n = mat3(cross(m[1], m[2]), cross(m[2], m[0]), cross(m[0], m[1])) * gl_Normal;\n"
+            "    if (dot(m[0], cross(m[1], m[2])) < 0.0)\n"
+            "        n = -n;\n"
+            "    if (dot(n, n) > 0.0)\n"
+            "        n = normalize(n);\n"
+            "\n"
+            "    gl_FrontColor = bLighting ? light(n, eye.xyz) : gl_Color;\n"
+            "\n"
+            "    vec3 r = reflect(normalize(eye.xyz), n);\n"
+            "    float f = 2.0 * sqrt(r.x*r.x + r.y*r.y + (r.z + 1.0)*(r.z + 1.0));\n"
+            "    gl_TexCoord[0] = gl_TextureMatrix[0] * gl_MultiTexCoord0;\n"
+            "    gl_TexCoord[1] = gl_TextureMatrix[1] * vec4(r.x/f + 0.5, r.y/f + 0.5, 0.0, 1.0);\n"
+            "    gl_TexCoord[2] = gl_TextureMatrix[2] * gl_MultiTexCoord2;\n"
+            "    gl_TexCoord[3] = gl_TextureMatrix[3] * gl_MultiTexCoord3;\n"
+            "}\n";
+
+        GLhandleARB shader = glCreateShaderObjectARB(GL_VERTEX_SHADER_ARB);
+        glShaderSourceARB(shader, 1, &source, NULL);
+        glCompileShaderARB(shader);
+
+        m_program = glCreateProgramObjectARB();
+        glAttachObjectARB(m_program, shader);
+        glDeleteObjectARB(shader);
+
+        const char* attributes[4] = { "world0", "world1", "world2", "world3" };
+        for (GLuint i = 0; i < 4; i++)
+            glBindAttribLocationARB(m_program, WORLD + i, attributes[i]);
+
+        glLinkProgramARB(m_program);
+
+        GLint bLinked = 0;
+        glGetObjectParameterivARB(m_program, GL_OBJECT_LINK_STATUS_ARB, &bLinked);
+        if (!bLinked)
+        {
+            char log[1024] = "";
+            glGetInfoLogARB(m_program, sizeof(log), NULL, log);
+            std::cerr << "OpenGLInstancing: " << log << std::endl;
+            return false;
+        }
+
+        m_view = glGetUniformLocationARB(m_program, "view");
+        m_shadow = glGetUniformLocationARB(m_program, "shadow");
+        m_bShadow = glGetUniformLocationARB(m_program, "bShadow");
+        m_bLighting = glGetUniformLocationARB(m_program, "bLighting");
+
+        glGenBuffersARB(1, &m_buffer);
+        return true;
+    }
+
+    GLhandleARB m_program;
+    GLuint m_buffer;
+    GLint m_view, m_shadow, m_bShadow, m_bLighting;
+
+    DrawElementsInstancedProc glDrawElementsInstancedARB;
+    DrawArraysInstancedProc glDrawArraysInstancedARB;
+    VertexAttribDivisorProc glVertexAttribDivisorARB;
+    PFNGLCREATESHADEROBJECTARBPROC glCreateShaderObjectARB;
+    PFNGLSHADERSOURCEARBPROC glShaderSourceARB;
+    PFNGLCOMPILESHADERARBPROC glCompileShaderARB;
+    PFNGLCREATEPROGRAMOBJECTARBPROC glCreateProgramObjectARB;
+    PFNGLATTACHOBJECTARBPROC glAttachObjectARB;
+    PFNGLBINDATTRIBLOCATIONARBPROC glBindAttribLocationARB;
+    PFNGLLINKPROGRAMARBPROC glLinkProgramARB;
+    PFNGLGETOBJECTPARAMETERIVARBPROC glGetObjectParameterivARB;
+    PFNGLGETINFOLOGARBPROC glGetInfoLogARB;
+    PFNGLDELETEOBJECTARBPROC glDeleteObjectARB;
+    PFNGLUSEPROGRAMOBJECTARBPROC glUseProgramObjectARB;
+    PFNGLGETUNIFORMLOCATIONARBPROC glGetUniformLocationARB;
+    PFNGLUNIFORMMATRIX4FVARBPROC glUniformMatrix4fvARB;
+    PFNGLUNIFORM1IARBPROC glUniform1iARB;
+    PFNGLENABLEVERTEXATTRIBARRAYARBPROC glEnableVertexAttribArrayARB;
+    PFNGLDISABLEVERTEXATTRIBARRAYARBPROC glDisableVertexAttribArrayARB;
+    PFNGLVERTEXATTRIBPOINTERARBPROC glVertexAttribPointerARB;
+};
+
 class OpenGLDriver: public IDriver
 {
     Matrix m_world;
     Matrix m_view;
+    Matrix m_proj;
     Matrix m_shadow;
     bool m_bDrawShadow;
+    bool m_bCulling;
+    bool m_bCullFront;
+    bool m_bMeshletCulling;
+    std::vector<Uint> m_ranges;
+    OpenGLInstancing* m_pInstancing;
 public:
 
-    OpenGLDriver(int* hWnd)
+    OpenGLDriver(int* hWnd):
+        m_bDrawShadow(false),
+        m_bCulling(false),
+        m_bCullFront(false),
+        m_bMeshletCulling(false),
+        m_pInstancing(NULL)
     {
         //////////////////////////////////////////////////////////////////////////
         // Set clear Z-Buffer value
@@ -291,10 +556,12 @@ public:
         glBufferDataARB = (PFNGLBUFFERDATAARBPROC) glGetProcAddress("glBufferDataARB");
         glDeleteBuffersARB = (PFNGLDELETEBUFFERSARBPROC) glGetProcAddress("glDeleteBuffersARB");
 
+        m_pInstancing = OpenGLInstancing::create();
     }
 
     virtual ~OpenGLDriver()
     {
+        delete m_pInstancing;
         ilShutDown();
     }
 
@@ -495,6 +762,7 @@ public:
 
     virtual void setProjectionMatrix(const Matrix& mat)
     {
+        m_proj = mat;
         glMatrixMode(GL_PROJECTION);
         glLoadMatrixf(&mat[0]);
         glMatrixMode(GL_MODELVIEW);
@@ -560,8 +828,10 @@ public:
     }
     virtual void enableCulling(bool bEnable)
     {
+        m_bCulling = bEnable;
         if (bEnable)
         {
+            m_bCullFront = false;
             glEnable(GL_CULL_FACE);
             glCullFace(GL_BACK);
         }
@@ -571,6 +841,7 @@ public:
 
     virtual void cullFace(bool bEnable)
     {
+        m_bCullFront = bEnable;
         if (bEnable)
             glCullFace(GL_FRONT);
         else
@@ -622,51 +893,139 @@ public:
 
     virtual bool drawPrimitive(Geometry& node)
     {
-        GLenum mode = GL_TRIANGLES;
-        switch (node.getType())
+        Uint all[2] = { 0, node.getVertexCount() };
+
+        // the meshlets outside the view or facing away are left out, the shadow needs all of them
+        if (m_bMeshletCulling && !node.getMeshlets().empty())
+        {
+            Meshlets::cull(node, m_world*m_view, m_proj, m_bCulling && !m_bCullFront, m_ranges);
+            return draw(node, m_ranges.empty() ? NULL : &m_ranges[0], (Uint)m_ranges.size()/2, all, 1);
+        }
+
+        return draw(node, all, 1, all, 1);
+    }
+
+    virtual bool drawPrimitive(Geometry& node, const Uint* pRanges, Uint nRanges)
+    {
+        return draw(node, pRanges, nRanges, pRanges, nRanges);
+    }
+
+    virtual void enableMeshletCulling(bool bEnable)
+    {
+        m_bMeshletCulling = bEnable;
+    }
+
+    // one call for all instances with OpenGLInstancing, else the buffers are bound once for all
+    // and each instance drawn with its own matrix
+    virtual void drawInstances(Geometry& node, const Matrix* pWorlds, Uint nInstances)
+    {
+        Ptr<OpenGLVBO> pVB = getVBO(node);
+        if (pVB == NULL || nInstances == 0)
+        {
+            IDriver::drawInstances(node, pWorlds, nInstances);
+            return;
+        }
+
+        GLenum mode = getMode(node.getType());
+        Uint all[2] = { 0, node.getVertexCount() };
+        bool bMeshlets = m_bMeshletCulling && !node.getMeshlets().empty();
+
+        pVB->bind();
+        glMatrixMode(GL_MODELVIEW);
+
+        // the meshlets are culled per instance, which the shader can't
+        if (m_pInstancing && !bMeshlets && nInstances > 1)
+        {
+            m_pInstancing->begin(pWorlds, nInstances, m_view, m_shadow);
+            m_pInstancing->draw(node, mode, nInstances);
+
+            if (m_bDrawShadow)
+            {
+                glDisableClientState(GL_NORMAL_ARRAY);
+                glNormal3f(0,0,0);  //black color
+
+                m_pInstancing->beginShadow();
+                m_pInstancing->draw(node, mode, nInstances);
+            }
+
+            m_pInstancing->end();
+        }
+        else
+        {
+            for (Uint i = 0; i < nInstances; i++)
+            {
+                glLoadMatrixf(&(pWorlds[i]*m_view)[0]);
+
+                if (bMeshlets)
+                {
+                    Meshlets::cull(node, pWorlds[i]*m_view, m_proj, m_bCulling && !m_bCullFront, m_ranges);
+                    drawRanges(node, mode, m_ranges.empty() ? NULL : &m_ranges[0], (Uint)m_ranges.size()/2);
+                }
+                else
+                    drawRanges(node, mode, all, 1);
+            }
+
+            if (m_bDrawShadow)
+            {
+                glDisableClientState(GL_NORMAL_ARRAY);
+                glNormal3f(0,0,0);  //black color
+
+                for (Uint i = 0; i < nInstances; i++)
+                {
+                    glLoadMatrixf(&(pWorlds[i]*m_shadow*m_view)[0]);
+                    drawRanges(node, mode, all, 1);
+                }
+            }
+        }
+
+        pVB->unbind();
+
+        m_world = pWorlds[nInstances-1];
+        glLoadMatrixf(&(m_world*m_view)[0]);
+    }
+
+private:
+    static GLenum getMode(Geometry::TYPE type)
+    {
+        switch (type)
         {
         case Geometry::POINTS:
-            mode = GL_POINTS;
-            break;
+            return GL_POINTS;
         case Geometry::LINES:
-            mode = GL_LINES;
-            break;
+            return GL_LINES;
         case Geometry::LINE_STRIP:
-            mode = GL_LINE_STRIP;
-            break;
+            return GL_LINE_STRIP;
         case Geometry::TRIANGLES:
-            mode = GL_TRIANGLES;
-            break;
+            return GL_TRIANGLES;
         case Geometry::TRIANGLE_STRIP:
-            mode = GL_TRIANGLE_STRIP;
-            break;
+            return GL_TRIANGLE_STRIP;
         case Geometry::TRIANGLE_FAN:
-            mode = GL_TRIANGLE_FAN;
-            break;
+            return GL_TRIANGLE_FAN;
         default:
-            mode = GL_TRIANGLES;
+            return GL_TRIANGLES;
         }
+    }
 
+    Ptr<OpenGLVBO> getVBO(Geometry& node)
+    {
         Ptr<OpenGLVBO> pVB = node.getVertexBuffer()->m_resource;
 
         if (pVB == NULL)
             pVB = node.getVertexBuffer()->m_resource = OpenGLVBO::create(node.getVertexBuffer());
 
+        return pVB;
+    }
+
+    bool draw(Geometry& node, const Uint* pRanges, Uint nRanges, const Uint* pShadowRanges, Uint nShadowRanges)
+    {
+        GLenum mode = getMode(node.getType());
+        Ptr<OpenGLVBO> pVB = getVBO(node);
+
         if (pVB != NULL)
         {
             pVB->bind();
 
-            if (node.getIndices().size()>0)
-            {
-                glDrawElements(mode, (GLsizei)node.getIndices().size(), GL_UNSIGNED_INT, &node.getIndices()[0]);
-                s_vertices += node.getIndices().size();
-            }
-            else
-            {
-                glDrawArrays(mode, 0, node.getVertexBuffer()->getVertexCount() );
-                s_vertices += node.getVertexBuffer()->getVertexCount();
-            }
-
+            drawRanges(node, mode, pRanges, nRanges);
 
             if (m_bDrawShadow)
             {
@@ -677,17 +1036,7 @@ public:
                 glDisableClientState(GL_NORMAL_ARRAY);
                 glNormal3f(0,0,0);  //black color
 
-                if (node.getIndices().size()>0)
-                {
-                    glDrawElements(mode, (GLsizei)node.getIndices().size(), GL_UNSIGNED_INT, &node.getIndices()[0]);
-                    s_vertices += node.getIndices().size();
-                }
-                else
-                {
-                    glDrawArrays(mode, 0, node.getVertexBuffer()->getVertexCount() );
-                    s_vertices += node.getVertexBuffer()->getVertexCount();
-                }
-
+                drawRanges(node, mode, pShadowRanges, nShadowRanges);
 
                 glPopMatrix();
             }
@@ -698,11 +1047,20 @@ public:
         {
             glBegin(mode);
 
-            for (Uint i = 0; i < node.getIndices().size(); i++ )
+            for (Uint r = 0; r < nRanges; r++)
             {
-                glNormal3fv( &node.getVertexBuffer()->getNormal( node.getIndices()[i] ).x );
-                glTexCoord2fv( &node.getVertexBuffer()->getTexCoord( node.getIndices()[i] ).x );
-                glVertex3fv( &node.getVertexBuffer()->getCoord( node.getIndices()[i] ).x );
+                for (Uint i = pRanges[2*r]; i < pRanges[2*r] + pRanges[2*r+1]; i++ )
+                {
+                    Uint index = node.getIndices().size()>0 ? node.getIndices()[i] : i;
+
+                    Vec3 n = node.getVertexBuffer()->getNormal( index );
+                    Vec3 t = node.getVertexBuffer()->getTexCoord( index );
+                    Vec3 v = node.getVertexBuffer()->getCoord( index );
+
+                    glNormal3fv( &n.x );
+                    glTexCoord2fv( &t.x );
+                    glVertex3fv( &v.x );
+                }
             }
 
             glEnd();
@@ -710,6 +1068,20 @@ public:
         return true;
     }
 
+    void drawRanges(Geometry& node, GLenum mode, const Uint* pRanges, Uint nRanges)
+    {
+        for (Uint r = 0; r < nRanges; r++)
+        {
+            if (node.getIndices().size()>0)
+                glDrawElements(mode, (GLsizei)pRanges[2*r+1], GL_UNSIGNED_INT, &node.getIndices()[pRanges[2*r]]);
+            else
+                glDrawArrays(mode, (GLint)pRanges[2*r], (GLsizei)pRanges[2*r+1]);
+
+            s_vertices += pRanges[2*r+1];
+        }
+    }
+
+public:
     bool verifyNoErrors(const char* call_function = "")
     {
         GLenum errCode = glGetError();
@@ -0,0 +1,384 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "Animation.h"
+#include "Parallel.h"
+
+#include <boost/functional/hash.hpp>
+#include <algorithm>
+#include <cmath>
+
+namespace eh
+{
+    namespace
+    {
+        struct Key
+        {
+            Float time;
+            Vec3 t;
+            Float q[4];     // x, y, z, w
+            Vec3 s;
+        };
+
+        // m = scale * rotation * translation for row vectors, a shear is dropped
+        Key decompose(const Matrix& m, Float time)
+        {
+            Key key;
+            key.time = time;
+            key.t = Vec3(m[12], m[13], m[14]);
+
+            Vec3 r0(m[0], m[1], m[2]), r1(m[4], m[5], m[6]), r2(m[8], m[9], m[10]);
+            key.s = Vec3(r0.getLen(), r1.getLen(), r2.getLen());
+            if (dot(cross(r0, r1), r2) < 0)
+                key.s.x = -key.s.x;
+
+            // a[j][k] is the rotation for column vectors
+            Float a[3][3];
+            for (int k = 0; k < 3; k++)
+            {
+                Float s = fequal(key.s[k], 0) ? 1.f : key.s[k];
+                for (int j = 0; j < 3; j++)
+                    a[j][k] = m[4*k+j] / s;
+            }
+
+            Float trace = a[0][0] + a[1][1] + a[2][2];
+            Float* q = key.q;
+            if (trace > 0)
+            {
+                Float s = sqrt(trace + 1.f) * 2.f;
+                q[3] = 0.25f * s;
+                q[0] = (a[2][1] - a[1][2]) / s;
+                q[1] = (a[0][2] - a[2][0]) / s;
+                q[2] = (a[1][0] - a[0][1]) / s;
+            }
+            else if (a[0][0] > a[1][1] && a[0][0] > a[2][2])
+            {
+                Float s = sqrt(1.f + a[0][0] - a[1][1] - a[2][2]) * 2.f;
+                q[3] = (a[2][1] - a[1][2]) / s;
+                q[0] = 0.25f * s;
+                q[1] = (a[0][1] + a[1][0]) / s;
+                q[2] = (a[0][2] + a[2][0]) / s;
+            }
+            else if (a[1][1] > a[2][2])
+            {
+                Float s = sqrt(1.f + a[1][1] - a[0][0] - a[2][2]) * 2.f;
+                q[3] = (a[0][2] - a[2][0]) / s;
+                q[0] = (a[0][1] + a[1][0]) / s;
+                q[1] = 0.25f * s;
+                q[2] = (a[1][2] + a[2][1]) / s;
+            }
+            else
+            {
+                Float s = sqrt(1.f + a[2][2] - a[0][0] - a[1][1]) * 2.f;
+                q[3] = (a[1][0] - a[0][1]) / s;
+                q[0] = (a[0][2] + a[2][0]) / s;
+                q[1] = (a[1][2] + a[2][1]) / s;
+                q[2] = 0.25f * s;
+            }
+
+            Float len = sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+            for (int i = 0; i < 4; i++)
+                q[i] /= len;
+
+            return key;
+        }
+
+        inline void compose(Float tx, Float ty, Float tz, Float x, Float y, Float z, Float w, Float sx, Float sy, Float sz, Matrix& m)
+        {
+            m[0] = (1.f - 2.f*(y*y + z*z)) * sx;
+            m[1] = (2.f*(x*y + w*z)) * sx;
+            m[2] = (2.f*(x*z - w*y)) * sx;
+            m[3] = 0;
+
+            m[4] = (2.f*(x*y - w*z)) * sy;
+            m[5] = (1.f - 2.f*(x*x + z*z)) * sy;
+            m[6] = (2.f*(y*z + w*x)) * sy;
+            m[7] = 0;
+
+            m[8] = (2.f*(x*z + w*y)) * sz;
+            m[9] = (2.f*(y*z - w*x)) * sz;
+            m[10] = (1.f - 2.f*(x*x + y*y)) * sz;
+            m[11] = 0;
+
+            m[12] = tx;
+            m[13] = ty;
+            m[14] = tz;
+            m[15] = 1;
+        }
+
+        Key interpolate(const Key& a, const Key& b, Float alpha)
+        {
+            Key key;
+            key.time = a.time + (b.time - a.time) * alpha;
+            key.t = a.t + (b.t - a.t) * alpha;
+            key.s = a.s + (b.s - a.s) * alpha;
+
+            Float sign = (a.q[0]*b.q[0] + a.q[1]*b.q[1] + a.q[2]*b.q[2] + a.q[3]*b.q[3]) < 0 ? -1.f : 1.f;
+            Float len = 0;
+            for (int i = 0; i < 4; i++)
+            {
+                key.q[i] = a.q[i] + (sign*b.q[i] - a.q[i]) * alpha;
+                len += key.q[i] * key.q[i];
+            }
+            len = sqrt(len);
+            for (int i = 0; i < 4; i++)
+                key.q[i] /= len;
+
+            return key;
+        }
+
+        // true if the keys between first and last are reproduced by interpolating first and last
+        bool fits(const std::vector<Key>& keys, size_t first, size_t last, Float fTolT, Float fTolerance)
+        {
+            for (size_t k = first + 1; k < last; k++)
+            {
+                Key key = interpolate(keys[first], keys[last], (Float)(k - first) / (last - first));
+
+                Float dq = 0;
+                for (int c = 0; c < 4; c++)
+                    dq += (key.q[c] - keys[k].q[c]) * (key.q[c] - keys[k].q[c]);
+
+                if ((key.t - keys[k].t).getLen() > fTolT ||
+                    (key.s - keys[k].s).getLen() > fTolerance * std::max(keys[k].s.getLen(), 1.f) ||
+                    2.f * sqrt(dq) > fTolerance)
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    AnimationClip::AnimationClip(Float fFrameRate):
+        m_fFrameRate(fFrameRate),
+        m_fDuration(0),
+        m_bEvaluated(false),
+        m_nFrame(0)
+    {
+        m_offsets.push_back(0);
+    }
+
+    Uint AnimationClip::addTrack(const std::vector<Matrix>& samples, Float fTolerance)
+    {
+        if (samples.empty())
+            return addTrack(std::vector<Matrix>(1, Matrix::Identity()), fTolerance);
+
+        std::vector<Key> keys(samples.size());
+        Vec3 t_min, t_max;
+        Float fScale = 0;
+
+        for (size_t i = 0; i < samples.size(); i++)
+        {
+            keys[i] = decompose(samples[i], i / m_fFrameRate);
+
+            // same hemisphere as the previous key, the interpolation takes the short way
+            if (i > 0 && keys[i-1].q[0]*keys[i].q[0] + keys[i-1].q[1]*keys[i].q[1] + keys[i-1].q[2]*keys[i].q[2] + keys[i-1].q[3]*keys[i].q[3] < 0)
+                for (int k = 0; k < 4; k++)
+                    keys[i].q[k] = -keys[i].q[k];
+
+            const Vec3& t = keys[i].t;
+            if (i == 0)
+                t_min = t_max = t;
+            t_min = Vec3(std::min(t_min.x, t.x), std::min(t_min.y, t.y), std::min(t_min.z, t.z));
+            t_max = Vec3(std::max(t_max.x, t.x), std::max(t_max.y, t.y), std::max(t_max.z, t.z));
+            fScale = std::max(fScale, std::max(fabs(t.x), std::max(fabs(t.y), fabs(t.z))));
+        }
+
+        Float fTolT = fTolerance * std::max(std::max((t_max - t_min).getLen(), fScale), 1e-3f);
+
+        // keeps a key where linear interpolation from the previous one misses a sample,
+        // the end of each segment is found by doubling and then bisecting its length
+        std::vector<size_t> selected(1, 0);
+        for (size_t i = 0; i + 1 < keys.size(); )
+        {
+            size_t good = i + 1, bad = keys.size();
+            for (size_t step = 1; good + step < keys.size(); step *= 2)
+            {
+                if (!fits(keys, i, good + step, fTolT, fTolerance))
+                {
+                    bad = good + step;
+                    break;
+                }
+                good += step;
+            }
+            while (bad - good > 1)
+            {
+                size_t mid = (good + bad) / 2;
+                if (fits(keys, i, mid, fTolT, fTolerance))
+                    good = mid;
+                else
+                    bad = mid;
+            }
+
+            selected.push_back(good);
+            i = good;
+        }
+
+        size_t hash = selected.size();
+        for (size_t i = 0; i < selected.size(); i++)
+        {
+            const Key& key = keys[selected[i]];
+            boost::hash_combine(hash, key.time);
+            boost::hash_combine(hash, key.t.x); boost::hash_combine(hash, key.t.y); boost::hash_combine(hash, key.t.z);
+            boost::hash_combine(hash, key.q[0]); boost::hash_combine(hash, key.q[1]); boost::hash_combine(hash, key.q[2]); boost::hash_combine(hash, key.q[3]);
+            boost::hash_combine(hash, key.s.x); boost::hash_combine(hash, key.s.y); boost::hash_combine(hash, key.s.z);
+        }
+
+        Uint first = (Uint)m_times.size();
+        for (size_t i = 0; i < selected.size(); i++)
+        {
+            const Key& key = keys[selected[i]];
+            m_times.push_back(key.time);
+            m_tx.push_back(key.t.x); m_ty.push_back(key.t.y); m_tz.push_back(key.t.z);
+            m_qx.push_back(key.q[0]); m_qy.push_back(key.q[1]); m_qz.push_back(key.q[2]); m_qw.push_back(key.q[3]);
+            m_sx.push_back(key.s.x); m_sy.push_back(key.s.y); m_sz.push_back(key.s.z);
+        }
+        Uint last = (Uint)m_times.size();
+
+        // an identical track is shared, the keys just appended are dropped again
+        typedef boost::unordered_multimap<size_t, Uint>::const_iterator iterator;
+        std::pair<iterator, iterator> range = m_trackHashes.equal_range(hash);
+        for (iterator it = range.first; it != range.second; ++it)
+        {
+            if (isSameTrack(it->second, first, last))
+            {
+                m_times.resize(first);
+                m_tx.resize(first); m_ty.resize(first); m_tz.resize(first);
+                m_qx.resize(first); m_qy.resize(first); m_qz.resize(first); m_qw.resize(first);
+                m_sx.resize(first); m_sy.resize(first); m_sz.resize(first);
+                return it->second;
+            }
+        }
+
+        Uint nTrack = getTrackCount();
+        m_offsets.push_back(last);
+        m_trackHashes.insert(std::make_pair(hash, nTrack));
+
+        m_fDuration = std::max(m_fDuration, samples.size() / m_fFrameRate);
+        m_bEvaluated = false;
+
+        return nTrack;
+    }
+
+    bool AnimationClip::isSameTrack(Uint nTrack, Uint first, Uint last) const
+    {
+        Uint begin = m_offsets[nTrack];
+        if (m_offsets[nTrack+1] - begin != last - first)
+            return false;
+
+        for (Uint i = 0; i < last - first; i++)
+        {
+            Uint a = begin + i, b = first + i;
+            if (m_times[a] != m_times[b] ||
+                m_tx[a] != m_tx[b] || m_ty[a] != m_ty[b] || m_tz[a] != m_tz[b] ||
+                m_qx[a] != m_qx[b] || m_qy[a] != m_qy[b] || m_qz[a] != m_qz[b] || m_qw[a] != m_qw[b] ||
+                m_sx[a] != m_sx[b] || m_sy[a] != m_sy[b] || m_sz[a] != m_sz[b])
+                return false;
+        }
+        return true;
+    }
+
+    size_t AnimationClip::getMemoryUsage() const
+    {
+        return m_times.size() * 11 * sizeof(Float) + m_offsets.size() * sizeof(Uint);
+    }
+
+    void AnimationClip::getKeyMatrices(Uint nTrack, std::vector<Matrix>& matrices) const
+    {
+        matrices.resize(m_offsets[nTrack+1] - m_offsets[nTrack]);
+        for (Uint k = m_offsets[nTrack], i = 0; k < m_offsets[nTrack+1]; k++, i++)
+            compose(m_tx[k], m_ty[k], m_tz[k], m_qx[k], m_qy[k], m_qz[k], m_qw[k], m_sx[k], m_sy[k], m_sz[k], matrices[i]);
+    }
+
+    Matrix AnimationClip::getMatrix(Uint nTrack, Uint t) const
+    {
+        if (m_bEvaluated && t == m_nFrame)
+            return m_matrices[nTrack];
+
+        Matrix m;
+        evaluateTracks(getLoopTime(t / m_fFrameRate), nTrack, nTrack + 1, &m);
+        return m;
+    }
+
+    void AnimationClip::update(Uint t)
+    {
+        if (m_bEvaluated && t == m_nFrame)
+            return;
+
+        m_matrices.resize(getTrackCount());
+        if (!m_matrices.empty())
+            evaluate(t / m_fFrameRate, &m_matrices[0]);
+
+        m_nFrame = t;
+        m_bEvaluated = true;
+    }
+
+    Float AnimationClip::getLoopTime(Float fTime) const
+    {
+        return m_fDuration > 0 ? fmod(fTime, m_fDuration) : fTime;
+    }
+
+    void AnimationClip::evaluate(Float fTime, Matrix* pMatrices) const
+    {
+        parallelFor(getTrackCount(), boost::bind(&AnimationClip::evaluateRange, this, getLoopTime(fTime), pMatrices, _1, _2));
+    }
+
+    void AnimationClip::evaluateRange(Float fTime, Matrix* pMatrices, Uint begin, Uint end) const
+    {
+        evaluateTracks(fTime, begin, end, pMatrices + begin);
+    }
+
+    // pOut[i - begin] for the tracks i in [begin, end)
+    void AnimationClip::evaluateTracks(Float fTime, Uint begin, Uint end, Matrix* pOut) const
+    {
+        // The key search is per track, the interpolation then runs over a block of tracks
+        // without branches on the structure of arrays.
+        const Uint BLOCK = 64;
+        Uint ka[BLOCK], kb[BLOCK];
+        Float alpha[BLOCK];
+
+        for (Uint block = begin; block < end; block += BLOCK)
+        {
+            Uint n = std::min(BLOCK, end - block);
+
+            for (Uint i = 0; i < n; i++)
+            {
+                Uint first = m_offsets[block + i], last = m_offsets[block + i + 1] - 1;
+                Uint k = (Uint)(std::upper_bound(m_times.begin() + first, m_times.begin() + last + 1, fTime) - m_times.begin());
+
+                if (k == first || k > last)
+                {
+                    ka[i] = kb[i] = (k == first) ? first : last;
+                    alpha[i] = 0;
+                }
+                else
+                {
+                    ka[i] = k - 1;
+                    kb[i] = k;
+                    alpha[i] = (fTime - m_times[k-1]) / (m_times[k] - m_times[k-1]);
+                }
+            }
+
+            for (Uint i = 0; i < n; i++)
+            {
+                Uint a = ka[i], b = kb[i];
+                Float w = alpha[i];
+
+                Float d = m_qx[a]*m_qx[b] + m_qy[a]*m_qy[b] + m_qz[a]*m_qz[b] + m_qw[a]*m_qw[b];
+                Float sign = d < 0 ? -1.f : 1.f;
+
+                Float qx = m_qx[a] + (sign*m_qx[b] - m_qx[a]) * w;
+                Float qy = m_qy[a] + (sign*m_qy[b] - m_qy[a]) * w;
+                Float qz = m_qz[a] + (sign*m_qz[b] - m_qz[a]) * w;
+                Float qw = m_qw[a] + (sign*m_qw[b] - m_qw[a]) * w;
+                Float len = 1.f / sqrt(qx*qx + qy*qy + qz*qz + qw*qw);
+
+                compose(m_tx[a] + (m_tx[b] - m_tx[a]) * w,
+                        m_ty[a] + (m_ty[b] - m_ty[a]) * w,
+                        m_tz[a] + (m_tz[b] - m_tz[a]) * w,
+                        qx*len, qy*len, qz*len, qw*len,
+                        m_sx[a] + (m_sx[b] - m_sx[a]) * w,
+                        m_sy[a] + (m_sy[b] - m_sy[a]) * w,
+                        m_sz[a] + (m_sz[b] - m_sz[a]) * w,
+                        pOut[block + i - begin]);
+            }
+        }
+    }
+}
@@ -0,0 +1,84 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "RefCounted.h"
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+namespace eh
+{
+    // Keyframe animation of many transforms. Each track is a list of translation/rotation/scale keys,
+    // interpolated linearly (normalized lerp of the rotation quaternion). The keys of all tracks are
+    // stored as a structure of arrays, so all tracks of a clip are evaluated together in one pass.
+    class API_3D AnimationClip: public RefCounted
+    {
+    public:
+        // fFrameRate is the rate of the samples passed to addTrack()
+        static Ptr<AnimationClip> create(Float fFrameRate = 30.f)
+        {
+            return new AnimationClip(fFrameRate);
+        }
+
+        // Reduces samples taken at the frame rate to the keys needed to reproduce them within fTolerance
+        // (radians for the rotation, relative for scale and translation) and returns the index of the track.
+        // Tracks with identical keys are stored once.
+        Uint addTrack(const std::vector<Matrix>& samples, Float fTolerance = 1e-3f);
+
+        Uint getTrackCount() const
+        {
+            return (Uint)m_offsets.size() - 1;
+        }
+        Uint getKeyCount() const
+        {
+            return (Uint)m_times.size();
+        }
+        // in seconds, the clip loops after it
+        Float getDuration() const
+        {
+            return m_fDuration;
+        }
+        // bytes used by the keys
+        size_t getMemoryUsage() const;
+
+        // transforms at the keys of nTrack
+        void getKeyMatrices(Uint nTrack, std::vector<Matrix>& matrices) const;
+
+        // Transform of nTrack at frame t of the viewport clock (advanced by Controller::Animate()),
+        // from the matrices of update() if it was called for frame t, else evaluated for the track alone.
+        // Returned by value, the matrices of update() are overwritten by the next frame.
+        Matrix getMatrix(Uint nTrack, Uint t) const;
+
+        // Evaluates all tracks at frame t together. Once per frame on the render thread before the
+        // scene is traversed (see TransformCache::update()), not while getMatrix() runs elsewhere.
+        void update(Uint t);
+
+        // evaluates all tracks at fTime seconds (looped) into pMatrices, one per track
+        void evaluate(Float fTime, Matrix* pMatrices) const;
+
+    private:
+        AnimationClip(Float fFrameRate);
+
+        Float getLoopTime(Float fTime) const;
+        void evaluateRange(Float fTime, Matrix* pMatrices, Uint begin, Uint end) const;
+        void evaluateTracks(Float fTime, Uint begin, Uint end, Matrix* pOut) const;
+        bool isSameTrack(Uint nTrack, Uint first, Uint last) const;
+
+        Float m_fFrameRate;
+        Float m_fDuration;
+
+        // keys of track i are [m_offsets[i], m_offsets[i+1])
+        Uint_vec m_offsets;
+        std::vector<Float> m_times;
+        std::vector<Float> m_tx, m_ty, m_tz;
+        std::vector<Float> m_qx, m_qy, m_qz, m_qw;
+        std::vector<Float> m_sx, m_sy, m_sz;
+        boost::unordered_multimap<size_t, Uint> m_trackHashes;
+
+        // the frame of the last update()
+        bool m_bEvaluated;
+        Uint m_nFrame;
+        std::vector<Matrix> m_matrices;
+    };
+}
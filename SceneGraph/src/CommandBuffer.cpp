@@ -0,0 +1,325 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "CommandBuffer.h"
+#include "Geometry.h"
+#include "Material.h"
+
+#include <cstring>
+
+namespace eh
+{
+    namespace
+    {
+        // an opcode word, then its arguments
+        enum Op
+        {
+            BEGIN_SCENE,        // bDrawBG, index of the words after the matching END_SCENE
+            END_SCENE,          // bShowFPS
+            DRAW,               // geometry
+            DRAW_RANGES,        // geometry, nRanges, the pairs
+            DRAW_INSTANCES,     // geometry, first matrix, nInstances
+            TEXT,               // x, y, length, the characters in words
+            MATERIAL,           // material or NULL
+            VIEWPORT,           // x, y, dx, dy
+            PROJECTION,         // matrix
+            VIEW,
+            WORLD,
+            SHADOW_MATRIX,
+            SHADOW,             // bEnable
+            WIREFRAME,
+            LIGHTING,
+            BLENDING,
+            ZWRITING,
+            CULLING,
+            CULL_FACE,
+            DEPTH_TEST,
+            DEPTH_OFFSET,       // n, f
+            MESHLET_CULLING
+        };
+
+        const Uint POINTER_WORDS = (sizeof(void*) + sizeof(Uint) - 1) / sizeof(Uint);
+
+        inline void writePointer(std::vector<Uint>& stream, const void* p)
+        {
+            Uint words[POINTER_WORDS] = { 0 };
+            memcpy(words, &p, sizeof(p));
+            stream.insert(stream.end(), words, words + POINTER_WORDS);
+        }
+
+        template<class T>
+        inline T* readPointer(const Uint*& p)
+        {
+            T* pointer;
+            memcpy(&pointer, p, sizeof(pointer));
+            p += POINTER_WORDS;
+            return pointer;
+        }
+
+        inline Uint floatWord(Float f)
+        {
+            Uint n;
+            memcpy(&n, &f, sizeof(n));
+            return n;
+        }
+
+        inline Float wordFloat(Uint n)
+        {
+            Float f;
+            memcpy(&f, &n, sizeof(f));
+            return f;
+        }
+    }
+
+    CommandBuffer::CommandBuffer(const Rect& viewport, const std::string& info):
+        m_nScene(0),
+        m_viewport(viewport),
+        m_info(info)
+    {
+        m_pLastKept[0] = m_pLastKept[1] = NULL;
+    }
+
+    void CommandBuffer::writeMatrix(Uint nOp, const Matrix& m)
+    {
+        write(nOp);
+        write((Uint)m_matrices.size());
+        m_matrices.push_back(m);
+    }
+
+    // neighbouring draws of one geometry keep it once
+    void CommandBuffer::writeGeometry(Uint nOp, Geometry& geometry)
+    {
+        if (m_pLastKept[0] != &geometry)
+        {
+            m_kept.push_back(&geometry);
+            m_pLastKept[0] = &geometry;
+        }
+
+        write(nOp);
+        writePointer(m_stream, &geometry);
+    }
+
+    bool CommandBuffer::beginScene(bool bDrawBG)
+    {
+        write(BEGIN_SCENE);
+        write(bDrawBG);
+        m_nScene = (Uint)m_stream.size();
+        write(0);
+        return true;
+    }
+
+    bool CommandBuffer::endScene(bool bShowFPS)
+    {
+        write(END_SCENE);
+        write(bShowFPS);
+        if (m_nScene > 0)
+            m_stream[m_nScene] = (Uint)m_stream.size();
+        m_nScene = 0;
+        return true;
+    }
+
+    bool CommandBuffer::drawPrimitive(Geometry& primitive)
+    {
+        writeGeometry(DRAW, primitive);
+        return true;
+    }
+
+    bool CommandBuffer::drawPrimitive(Geometry& primitive, const Uint* pRanges, Uint nRanges)
+    {
+        writeGeometry(DRAW_RANGES, primitive);
+        write(nRanges);
+        m_stream.insert(m_stream.end(), pRanges, pRanges + 2 * nRanges);
+        return true;
+    }
+
+    void CommandBuffer::drawInstances(Geometry& primitive, const Matrix* pWorlds, Uint nInstances)
+    {
+        writeGeometry(DRAW_INSTANCES, primitive);
+        write((Uint)m_matrices.size());
+        write(nInstances);
+        m_matrices.insert(m_matrices.end(), pWorlds, pWorlds + nInstances);
+    }
+
+    void CommandBuffer::draw2DText(const char* text, int x, int y)
+    {
+        Uint nLength = (Uint)strlen(text);
+        write(TEXT);
+        write((Uint)x);
+        write((Uint)y);
+        write(nLength);
+
+        size_t nFirst = m_stream.size();
+        m_stream.resize(nFirst + nLength / sizeof(Uint) + 1, 0);
+        memcpy(&m_stream[nFirst], text, nLength);
+    }
+
+    void CommandBuffer::setMaterial(const Material* pMaterial)
+    {
+        if (pMaterial != NULL && m_pLastKept[1] != pMaterial)
+        {
+            m_kept.push_back(const_cast<Material*>(pMaterial));
+            m_pLastKept[1] = pMaterial;
+        }
+
+        write(MATERIAL);
+        writePointer(m_stream, pMaterial);
+    }
+
+    void CommandBuffer::setViewport(int x, int y, int dx, int dy)
+    {
+        m_viewport = Rect((Float)x, (Float)y, (Float)dx, (Float)dy);
+
+        write(VIEWPORT);
+        write((Uint)x);
+        write((Uint)y);
+        write((Uint)dx);
+        write((Uint)dy);
+    }
+
+    void CommandBuffer::setProjectionMatrix(const Matrix& mat) { writeMatrix(PROJECTION, mat); }
+    void CommandBuffer::setViewMatrix(const Matrix& mat) { writeMatrix(VIEW, mat); }
+    void CommandBuffer::setWorldMatrix(const Matrix& m) { writeMatrix(WORLD, m); }
+    void CommandBuffer::setShadowMatrix(const Matrix& m) { writeMatrix(SHADOW_MATRIX, m); }
+
+    void CommandBuffer::enableShadow(bool bEnable) { write(SHADOW); write(bEnable); }
+    void CommandBuffer::enableWireframe(bool bEnable) { write(WIREFRAME); write(bEnable); }
+    void CommandBuffer::enableLighting(bool bEnable) { write(LIGHTING); write(bEnable); }
+    void CommandBuffer::enableBlending(bool bEnable) { write(BLENDING); write(bEnable); }
+    void CommandBuffer::enableZWriting(bool bEnable) { write(ZWRITING); write(bEnable); }
+    void CommandBuffer::enableCulling(bool bEnable) { write(CULLING); write(bEnable); }
+    void CommandBuffer::cullFace(bool bEnable) { write(CULL_FACE); write(bEnable); }
+    void CommandBuffer::enableDepthTest(bool enable) { write(DEPTH_TEST); write(enable); }
+    void CommandBuffer::enableMeshletCulling(bool bEnable) { write(MESHLET_CULLING); write(bEnable); }
+
+    void CommandBuffer::setDepthOffset(Uint n, Float f)
+    {
+        write(DEPTH_OFFSET);
+        write(n);
+        write(floatWord(f));
+    }
+
+    void CommandBuffer::replay(IDriver& driver) const
+    {
+        if (m_stream.empty())
+            return;
+
+        const Uint* pBegin = &m_stream[0];
+        const Uint* pEnd = pBegin + m_stream.size();
+
+        for (const Uint* p = pBegin; p < pEnd; )
+        {
+            switch (*p++)
+            {
+            case BEGIN_SCENE:
+                if (driver.beginScene(p[0] != 0))
+                    p += 2;
+                else
+                    p = p[1] > 0 ? pBegin + p[1] : pEnd;
+                break;
+            case END_SCENE:
+                driver.endScene(*p++ != 0);
+                break;
+            case DRAW:
+                driver.drawPrimitive(*readPointer<Geometry>(p));
+                break;
+            case DRAW_RANGES:
+                {
+                    Geometry* pGeometry = readPointer<Geometry>(p);
+                    Uint nRanges = *p++;
+                    driver.drawPrimitive(*pGeometry, p, nRanges);
+                    p += 2 * nRanges;
+                }
+                break;
+            case DRAW_INSTANCES:
+                {
+                    Geometry* pGeometry = readPointer<Geometry>(p);
+                    driver.drawInstances(*pGeometry, &m_matrices[p[0]], p[1]);
+                    p += 2;
+                }
+                break;
+            case TEXT:
+                // the characters end with a zero in their last word
+                driver.draw2DText(reinterpret_cast<const char*>(p + 3), (int)p[0], (int)p[1]);
+                p += 3 + p[2] / sizeof(Uint) + 1;
+                break;
+            case MATERIAL:
+                driver.setMaterial(readPointer<const Material>(p));
+                break;
+            case VIEWPORT:
+                driver.setViewport((int)p[0], (int)p[1], (int)p[2], (int)p[3]);
+                p += 4;
+                break;
+            case PROJECTION:
+                driver.setProjectionMatrix(m_matrices[*p++]);
+                break;
+            case VIEW:
+                driver.setViewMatrix(m_matrices[*p++]);
+                break;
+            case WORLD:
+                driver.setWorldMatrix(m_matrices[*p++]);
+                break;
+            case SHADOW_MATRIX:
+                driver.setShadowMatrix(m_matrices[*p++]);
+                break;
+            case SHADOW:
+                driver.enableShadow(*p++ != 0);
+                break;
+            case WIREFRAME:
+                driver.enableWireframe(*p++ != 0);
+                break;
+            case LIGHTING:
+                driver.enableLighting(*p++ != 0);
+                break;
+            case BLENDING:
+                driver.enableBlending(*p++ != 0);
+                break;
+            case ZWRITING:
+                driver.enableZWriting(*p++ != 0);
+                break;
+            case CULLING:
+                driver.enableCulling(*p++ != 0);
+                break;
+            case CULL_FACE:
+                driver.cullFace(*p++ != 0);
+                break;
+            case DEPTH_TEST:
+                driver.enableDepthTest(*p++ != 0);
+                break;
+            case DEPTH_OFFSET:
+                driver.setDepthOffset(p[0], wordFloat(p[1]));
+                p += 2;
+                break;
+            case MESHLET_CULLING:
+                driver.enableMeshletCulling(*p++ != 0);
+                break;
+            default:
+                return;
+            }
+        }
+    }
+
+    void CommandBuffer::swap(CommandBuffer& other)
+    {
+        m_stream.swap(other.m_stream);
+        m_matrices.swap(other.m_matrices);
+        m_kept.swap(other.m_kept);
+        std::swap(m_nScene, other.m_nScene);
+
+        m_pLastKept[0] = m_pLastKept[1] = NULL;
+        other.m_pLastKept[0] = other.m_pLastKept[1] = NULL;
+    }
+
+    void CommandBuffer::keepAll(CommandBuffer& other)
+    {
+        m_kept.insert(m_kept.end(), other.m_kept.begin(), other.m_kept.end());
+        other.clear();
+    }
+
+    void CommandBuffer::clear()
+    {
+        m_stream.clear();
+        m_matrices.clear();
+        m_kept.clear();
+        m_nScene = 0;
+        m_pLastKept[0] = m_pLastKept[1] = NULL;
+    }
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "IDriver.h"
+#include <string>
+#include <vector>
+
+namespace eh
+{
+    // An IDriver recording the calls of a frame into a stream of words, replay() makes them on
+    // another driver, see DriverThread. Matrices and index ranges are copied; geometries and
+    // materials go by pointer and are kept alive by the buffer until it is cleared.
+    class API_3D CommandBuffer: public IDriver
+    {
+    public:
+        // of the driver the calls are replayed on, getViewport() and getDriverInformation() answer
+        // from them without asking it
+        CommandBuffer(const Rect& viewport, const std::string& info);
+
+        virtual std::string getDriverInformation() const
+        {
+            return m_info;
+        }
+
+        virtual bool beginScene(bool bDrawBG);
+        virtual bool endScene(bool bShowFPS);
+
+        virtual bool drawPrimitive(Geometry& primitive);
+        virtual bool drawPrimitive(Geometry& primitive, const Uint* pRanges, Uint nRanges);
+        virtual void drawInstances(Geometry& primitive, const Matrix* pWorlds, Uint nInstances);
+        virtual void draw2DText(const char* text, int x, int y);
+        virtual void setMaterial(const Material* pMaterial);
+
+        virtual void setViewport(int x, int y, int dx, int dy);
+        virtual const Rect& getViewport() const
+        {
+            return m_viewport;
+        }
+
+        virtual void setProjectionMatrix(const Matrix& mat);
+        virtual void setViewMatrix(const Matrix& mat);
+        virtual void setWorldMatrix(const Matrix& m);
+        virtual void setShadowMatrix(const Matrix& m);
+
+        virtual void enableShadow(bool bEnable);
+        virtual void enableWireframe(bool bEnable);
+        virtual void enableLighting(bool bEnable);
+        virtual void enableBlending(bool bEnable);
+        virtual void enableZWriting(bool bEnable);
+        virtual void enableCulling(bool bEnable);
+
+        virtual void cullFace(bool bEnable);
+        virtual void enableDepthTest(bool enable);
+        virtual void setDepthOffset(Uint n, Float f);
+
+        virtual void enableMeshletCulling(bool bEnable);
+
+        // makes the recorded calls on driver, a scene whose beginScene() fails is skipped up to
+        // and with its endScene() like Viewport does
+        void replay(IDriver& driver) const;
+
+        // exchanges the recorded calls and the objects kept for them, the viewports stay
+        void swap(CommandBuffer& other);
+
+        // drops the calls and releases the objects kept for them
+        void clear();
+
+        // keeps pObject until the buffer is cleared as if a call had used it, e.g. geometry the
+        // scene dropped that an earlier frame draws
+        void keep(Ptr<RefCounted> pObject)
+        {
+            if (pObject != NULL)
+                m_kept.push_back(pObject);
+        }
+
+        // takes over the objects kept by other, whose calls are dropped
+        void keepAll(CommandBuffer& other);
+
+        bool empty() const
+        {
+            return m_stream.empty();
+        }
+
+        // bytes of the recorded calls
+        Uint getSize() const
+        {
+            return (Uint)(m_stream.size() * sizeof(Uint) + m_matrices.size() * sizeof(Matrix));
+        }
+
+    private:
+        void write(Uint nWord)
+        {
+            m_stream.push_back(nWord);
+        }
+        void writeMatrix(Uint nOp, const Matrix& m);
+        void writeGeometry(Uint nOp, Geometry& geometry);
+
+        std::vector<Uint> m_stream;
+        std::vector<Matrix> m_matrices;         // referred to by index from the stream
+        std::vector< Ptr<RefCounted> > m_kept;
+        const void* m_pLastKept[2];             // geometry and material, kept already
+        Uint m_nScene;                          // of the open beginScene(), its end is filled in later
+
+        Rect m_viewport;
+        std::string m_info;
+    };
+}
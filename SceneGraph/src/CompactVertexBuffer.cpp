@@ -0,0 +1,418 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "VertexBuffer.h"
+#include "StopWatch.h"
+
+#include <vector>
+#include <algorithm>
+
+namespace eh
+{
+	typedef unsigned short Uint16;
+	typedef short Int16;
+
+	static Uint16 floatToHalf(Float f)
+	{
+		union { Float f; Uint u; } v;
+		v.f = f;
+
+		Uint sign = (v.u >> 16) & 0x8000;
+		int exp = int((v.u >> 23) & 0xff) - 127 + 15;
+		Uint mant = v.u & 0x7fffff;
+
+		if(exp <= 0)	// too small for a normalized half
+			return (Uint16)sign;
+		if(exp >= 31)	// clamp to the largest half instead of inf
+			return (Uint16)(sign | 0x7bff);
+
+		Uint h = sign | (exp << 10) | (mant >> 13);
+		if(mant & 0x1000)
+			h++;	// round, may carry into the exponent
+
+		if((h & 0x7c00) == 0x7c00)
+			h = sign | 0x7bff;
+
+		return (Uint16)h;
+	}
+
+	static Float halfToFloat(Uint16 h)
+	{
+		union { Float f; Uint u; } v;
+
+		Uint sign = Uint(h & 0x8000) << 16;
+		Uint exp = (h >> 10) & 0x1f;
+		Uint mant = h & 0x3ff;
+
+		if(exp == 0)
+			v.u = sign;
+		else
+			v.u = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+
+		return v.f;
+	}
+
+	static Int16 toSnorm16(Float f)
+	{
+		f = std::max(-1.f, std::min(1.f, f));
+		return (Int16)(f >= 0 ? f * 32767.f + 0.5f : f * 32767.f - 0.5f);
+	}
+
+	// octahedral mapping: project onto |x|+|y|+|z| = 1 and fold the lower half over
+	static void encodeNormal(const Vec3& n, Int16* p)
+	{
+		Float l = fabs(n.x) + fabs(n.y) + fabs(n.z);
+		if(l == 0)
+		{
+			p[0] = p[1] = 0;
+			return;
+		}
+
+		Float x = n.x / l;
+		Float y = n.y / l;
+
+		if(n.z < 0)
+		{
+			Float ox = (1 - fabs(y)) * (x >= 0 ? 1.f : -1.f);
+			y = (1 - fabs(x)) * (y >= 0 ? 1.f : -1.f);
+			x = ox;
+		}
+
+		p[0] = toSnorm16(x);
+		p[1] = toSnorm16(y);
+	}
+
+	static Vec3 decodeNormal(const Int16* p)
+	{
+		Float x = p[0] / 32767.f;
+		Float y = p[1] / 32767.f;
+		Float z = 1 - fabs(x) - fabs(y);
+
+		Float t = std::max(-z, 0.f);
+		x += x >= 0 ? -t : t;
+		y += y >= 0 ? -t : t;
+
+		return Vec3(x, y, z).normalized();
+	}
+
+	class CompactVertexBuffer: public IVertexBuffer
+	{
+		enum
+		{
+			BLOCK_SHIFT = 8,
+			BLOCK_SIZE = 1 << BLOCK_SHIFT
+		};
+
+		// position = min + q * scale, q in [0, 65535]
+		struct Block
+		{
+			Vec3 min;
+			Vec3 scale;
+		};
+
+	public:
+		CompactVertexBuffer(bool bNormals, bool bTexCoords):
+			m_bNormals(bNormals), m_bTexCoords(bTexCoords), m_nCount(0)
+		{
+			m_nNormalOffset = 3*sizeof(Uint16);
+			m_nTexCoordOffset = m_nNormalOffset + (m_bNormals ? 2*sizeof(Int16) : 0);
+			m_nStride = m_nTexCoordOffset + (m_bTexCoords ? 2*sizeof(Uint16) : 0);
+		}
+
+		// encodes a whole block at once, the bounds are taken from the vertices, n and t may be NULL
+		void appendBlock(const Vec3* v, const Vec3* n, const Vec3* t, Uint nCount)
+		{
+			Vec3 min = v[0], max = v[0];
+			for(Uint i = 1; i < nCount; i++)
+			{
+				min = Vec3(std::min(min.x, v[i].x), std::min(min.y, v[i].y), std::min(min.z, v[i].z));
+				max = Vec3(std::max(max.x, v[i].x), std::max(max.y, v[i].y), std::max(max.z, v[i].z));
+			}
+
+			Block block;
+			block.min = min;
+			block.scale = (max - min) / 65535.f;
+			m_blocks.push_back(block);
+
+			Uint first = m_nCount;
+			m_nCount += nCount;
+			m_data.resize(m_nCount * m_nStride);
+
+			for(Uint i = 0; i < nCount; i++)
+			{
+				encodeCoord(first + i, v[i]);
+				if(m_bNormals)
+					encodeNormal(n ? n[i] : Vec3(), (Int16*)at(first + i, m_nNormalOffset));
+				if(m_bTexCoords)
+					encodeTexCoord(first + i, t ? t[i] : Vec3());
+			}
+		}
+
+		virtual Uint addVertex(const Vec3& v, const Vec3& n = Vec3(), const Vec3& t = Vec3())
+		{
+			return pushVertex(v, n, t);
+		}
+
+		virtual Uint pushVertex(const Vec3& v, const Vec3& n = Vec3(), const Vec3& t = Vec3())
+		{
+			Uint i = m_nCount;
+
+			if((i & (BLOCK_SIZE-1)) == 0)
+			{
+				Block block;
+				block.min = v;
+				m_blocks.push_back(block);
+			}
+			else if(!fits(m_blocks.back(), v))
+				growBlock(v);
+
+			m_nCount++;
+			m_data.resize(m_nCount * m_nStride);
+
+			encodeCoord(i, v);
+			if(m_bNormals)
+				encodeNormal(n, (Int16*)at(i, m_nNormalOffset));
+			if(m_bTexCoords)
+				encodeTexCoord(i, t);
+
+			return i;
+		}
+
+		// appendVertices() reserves for each call, growing by the call only would copy the
+		// buffer every time
+		virtual void reserve(Uint nCount)
+		{
+			size_t nSize = (m_nCount + nCount) * m_nStride;
+			if(nSize > m_data.capacity())
+				m_data.reserve(std::max(nSize, m_data.capacity() * 2));
+
+			size_t nBlocks = ((m_nCount + nCount) >> BLOCK_SHIFT) + 1;
+			if(nBlocks > m_blocks.capacity())
+				m_blocks.reserve(std::max(nBlocks, m_blocks.capacity() * 2));
+		}
+
+		// the open block is filled one by one, the rest goes block by block
+		virtual Uint appendVertices(Uint nCount, const Vec3* pCoords, const Vec3* pNormals = NULL, const Vec3* pTexCoords = NULL)
+		{
+			Uint first = m_nCount;
+			reserve(nCount);
+
+			Uint i = 0;
+			for(; i < nCount && (m_nCount & (BLOCK_SIZE-1)) != 0; i++)
+				pushVertex(pCoords[i], pNormals ? pNormals[i] : Vec3(), pTexCoords ? pTexCoords[i] : Vec3());
+
+			for(; i < nCount; i += BLOCK_SIZE)
+				appendBlock(pCoords + i, pNormals ? pNormals + i : NULL, pTexCoords ? pTexCoords + i : NULL, std::min<Uint>(BLOCK_SIZE, nCount - i));
+
+			return first;
+		}
+
+		virtual Vec3 getCoord(Uint i) const
+		{
+			const Block& b = m_blocks[i >> BLOCK_SHIFT];
+			const Uint16* q = (const Uint16*)at(i, 0);
+			return Vec3(b.min.x + q[0] * b.scale.x, b.min.y + q[1] * b.scale.y, b.min.z + q[2] * b.scale.z);
+		}
+
+		virtual Vec3 getNormal(Uint i) const
+		{
+			if(!m_bNormals)
+				return Vec3();
+			return decodeNormal((const Int16*)at(i, m_nNormalOffset));
+		}
+
+		virtual Vec3 getTexCoord(Uint i) const
+		{
+			if(!m_bTexCoords)
+				return Vec3();
+			const Uint16* h = (const Uint16*)at(i, m_nTexCoordOffset);
+			return Vec3(halfToFloat(h[0]), halfToFloat(h[1]), 0);
+		}
+
+		virtual Uint getVertexCount() const
+		{
+			return m_nCount;
+		}
+
+		virtual const void* getBuffer(Uint offset = 0) const
+		{
+			return m_data.empty() ? NULL : at(offset, 0);
+		}
+
+		virtual Uint getStride() const
+		{
+			return m_nStride;
+		}
+
+		virtual Uint getBufferSize() const
+		{
+			return (Uint)m_data.size();
+		}
+
+		virtual FORMAT getFormat() const
+		{
+			return FORMAT_COMPACT;
+		}
+
+		virtual void decode(Float* pDest, Uint first, Uint nCount) const
+		{
+			for(Uint i = first; i < first + nCount; i++, pDest += 8)
+			{
+				const Block& b = m_blocks[i >> BLOCK_SHIFT];
+				const Uint16* q = (const Uint16*)at(i, 0);
+				pDest[0] = b.min.x + q[0] * b.scale.x;
+				pDest[1] = b.min.y + q[1] * b.scale.y;
+				pDest[2] = b.min.z + q[2] * b.scale.z;
+
+				Vec3 n = m_bNormals ? decodeNormal((const Int16*)at(i, m_nNormalOffset)) : Vec3();
+				pDest[3] = n.x;
+				pDest[4] = n.y;
+				pDest[5] = n.z;
+
+				if(m_bTexCoords)
+				{
+					const Uint16* h = (const Uint16*)at(i, m_nTexCoordOffset);
+					pDest[6] = halfToFloat(h[0]);
+					pDest[7] = halfToFloat(h[1]);
+				}
+				else
+					pDest[6] = pDest[7] = 0;
+			}
+		}
+
+		size_t getMemoryUsage() const
+		{
+			return m_data.size() + m_blocks.size() * sizeof(Block);
+		}
+
+	private:
+		const unsigned char* at(Uint i, Uint offset) const
+		{
+			return &m_data[i * m_nStride + offset];
+		}
+		unsigned char* at(Uint i, Uint offset)
+		{
+			return &m_data[i * m_nStride + offset];
+		}
+
+		static bool fits(const Block& b, const Vec3& v)
+		{
+			Vec3 max = b.min + b.scale * 65535.f;
+			return v.x >= b.min.x && v.y >= b.min.y && v.z >= b.min.z &&
+				v.x <= max.x && v.y <= max.y && v.z <= max.z;
+		}
+
+		static Uint16 quantize(Float f, Float min, Float scale)
+		{
+			if(scale <= 0)
+				return 0;
+			Float q = (f - min) / scale + 0.5f;
+			return (Uint16)std::max(0.f, std::min(65535.f, q));
+		}
+
+		void encodeCoord(Uint i, const Vec3& v)
+		{
+			const Block& b = m_blocks[i >> BLOCK_SHIFT];
+			Uint16* q = (Uint16*)at(i, 0);
+			q[0] = quantize(v.x, b.min.x, b.scale.x);
+			q[1] = quantize(v.y, b.min.y, b.scale.y);
+			q[2] = quantize(v.z, b.min.z, b.scale.z);
+		}
+
+		void encodeTexCoord(Uint i, const Vec3& t)
+		{
+			Uint16* h = (Uint16*)at(i, m_nTexCoordOffset);
+			h[0] = floatToHalf(t.x);
+			h[1] = floatToHalf(t.y);
+		}
+
+		// widens the bounds of the last block and requantizes the positions already in it
+		void growBlock(const Vec3& v)
+		{
+			Uint first = (m_nCount >> BLOCK_SHIFT) << BLOCK_SHIFT;
+
+			std::vector<Vec3> coords;
+			for(Uint i = first; i < m_nCount; i++)
+				coords.push_back(getCoord(i));
+
+			// grow by at least the current size, so a block is requantized only a few times
+			Block& b = m_blocks.back();
+			Vec3 max = b.min + b.scale * 65535.f;
+			Vec3 size = max - b.min;
+			Vec3 min(v.x < b.min.x ? std::min(v.x, b.min.x - size.x) : b.min.x,
+					 v.y < b.min.y ? std::min(v.y, b.min.y - size.y) : b.min.y,
+					 v.z < b.min.z ? std::min(v.z, b.min.z - size.z) : b.min.z);
+			max = Vec3(v.x > max.x ? std::max(v.x, max.x + size.x) : max.x,
+					   v.y > max.y ? std::max(v.y, max.y + size.y) : max.y,
+					   v.z > max.z ? std::max(v.z, max.z + size.z) : max.z);
+			b.min = min;
+			b.scale = (max - min) / 65535.f;
+
+			for(Uint i = first; i < m_nCount; i++)
+				encodeCoord(i, coords[i - first]);
+		}
+
+		bool m_bNormals;
+		bool m_bTexCoords;
+		Uint m_nNormalOffset;
+		Uint m_nTexCoordOffset;
+		Uint m_nStride;
+		Uint m_nCount;
+
+		std::vector<unsigned char> m_data;
+		std::vector<Block> m_blocks;
+	};
+
+	Ptr<IVertexBuffer> CreateCompactVertexBuffer(Ptr<IVertexBuffer> pSource, CompactStatistics* pStatistics)
+	{
+		if(pSource == NULL || pSource->getFormat() == IVertexBuffer::FORMAT_COMPACT)
+			return pSource;
+
+		const Uint nStride = pSource->getStride();
+		const Uint nCount = pSource->getVertexCount();
+
+		StopWatch watch;
+
+		CompactVertexBuffer* pCompact = new CompactVertexBuffer(nStride >= sizeof(Vec3)*2, nStride > sizeof(Vec3)*2);
+		Ptr<IVertexBuffer> ret = pCompact;
+
+		std::vector<Vec3> v, n, t;
+		for(Uint first = 0; first < nCount; first += 256)
+		{
+			Uint nBlock = std::min<Uint>(256, nCount - first);
+			v.resize(nBlock); n.resize(nBlock); t.resize(nBlock);
+
+			for(Uint i = 0; i < nBlock; i++)
+			{
+				v[i] = pSource->getCoord(first + i);
+				n[i] = pSource->getNormal(first + i);
+				t[i] = pSource->getTexCoord(first + i);
+			}
+
+			pCompact->appendBlock(&v[0], &n[0], &t[0], nBlock);
+		}
+
+		if(pStatistics == NULL)
+			return ret;
+
+		pStatistics->fEncodeTime = watch.elapsed();
+		pStatistics->nSourceBytes = pSource->getBufferSize();
+		pStatistics->nCompactBytes = pCompact->getMemoryUsage();
+		watch.restart();
+
+		// decode everything once to get the per vertex cost
+		std::vector<Float> decoded(256*8);
+		for(Uint first = 0; first < nCount; first += 256)
+			pCompact->decode(&decoded[0], first, std::min<Uint>(256, nCount - first));
+
+		pStatistics->fDecodeTime = watch.elapsed();
+
+		pStatistics->fMaxError = 0;
+		for(Uint i = 0; i < nCount; i++)
+		{
+			Vec3 d = pSource->getCoord(i) - pCompact->getCoord(i);
+			pStatistics->fMaxError = std::max(pStatistics->fMaxError, std::max(fabs(d.x), std::max(fabs(d.y), fabs(d.z))));
+		}
+
+		return ret;
+	}
+}
@@ -17,7 +17,9 @@ namespace eh{
 Controller::Controller():
 	m_pViewport(NULL),
 	m_zoom(1.f),
-	m_axis( NULL )
+	m_axis( NULL ),
+	m_bDragging(false),
+	m_bInput(false)
 {
 	Ptr<Scene> scene = Scene::create();
 	std::auto_ptr<SceneIO::IPlugIn> objloader( XcreatePlugIn() );
@@ -36,10 +38,20 @@ void Controller::attachViewport(Viewport& pViewport)
 {
 	m_pViewport = &pViewport;
 }
+void Controller::markInput()
+{
+	if(!m_bInput)
+		m_input.restart();
+	m_bInput = true;
+}
 void Controller::OnMouseMove(Flags nFlags, int x, int y)
 {
 	Point point(x,y);
 
+	m_bDragging = (nFlags & (LBUTTON|RBUTTON|MBUTTON)) != 0;
+	if(m_bDragging)
+		markInput();
+
 	if (nFlags == LBUTTON)
 	{
 		Vec3 r;
@@ -90,24 +102,26 @@ void Controller::OnMouseMove(Flags nFlags, int x, int y)
 void Controller::OnMouseDown(Flags nFlags, int x, int y)
 {
 	down = mouse = Point(x,y);
+	markInput();
 
 	Ptr<SceneNode> pSelected = doHitTest( getViewport().DPtoRay(x, y), *getViewport().getScene(), NULL );
 
 	if(pSelected)
-	{
-		if(pSelected->Flags() & SceneNode::FLAG_SELECTED)
-			pSelected->Flags() &= ~SceneNode::FLAG_SELECTED;
-		else
-			pSelected->Flags() |= SceneNode::FLAG_SELECTED;
-	}
+		getViewport().getScene()->setNodeFlag(pSelected, SceneNode::FLAG_SELECTED, !(pSelected->getFlags() & SceneNode::FLAG_SELECTED));
 }
 void Controller::OnMouseUp(Flags nFlags, int x, int y)
 {
 	mouse = Point(x,y);
+	markInput();
+
+	// the next frame is drawn in full detail again
+	m_bDragging = false;
 }
 
 void Controller::OnMouseWheel(Flags nFlags, short zDelta, int x, int y)
 {
+	markInput();
+
 	if(zDelta<0)
 		this->zoom(true);
 	else
@@ -122,6 +136,8 @@ void Controller::Animate()
 
 void Controller::OnKeyDown(int keycode)
 {
+	markInput();
+
 	Vec3 center = getViewport().getScene()->getBounding().getCenter();
 	Float f = (getViewport().m_pCamera->m_pos - center).getLen()/100;
 	Matrix r = m_Rotation2 *  Matrix::Scale(Vec3(f,f,f));
@@ -1,6 +1,7 @@
 #pragma once
 #include "config.h"
 #include "RefCounted.h"
+#include "StopWatch.h"
 
 namespace eh
 {
@@ -42,10 +43,19 @@ namespace eh
         Matrix getViewMatrix() const;
         Matrix getProjectionMatrix() const;
 
+        // a mouse button is held while the mouse moves
+        bool isDragging() const
+        {
+            return m_bDragging;
+        }
+
     protected:
         void zoom(bool in);
         void zoom(Float faktor);
 
+        // starts m_input unless there is input not drawn yet
+        void markInput();
+
         friend class Viewport;
         Viewport*	m_pViewport;
 
@@ -58,6 +68,11 @@ namespace eh
 
         Point down;
         Point mouse;
+        bool  m_bDragging;
+
+        // since the oldest input not drawn yet, Viewport takes it for the latency of its frame
+        StopWatch m_input;
+        bool  m_bInput;
     };
 
 } //end namespace
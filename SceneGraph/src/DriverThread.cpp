@@ -0,0 +1,213 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "DriverThread.h"
+
+#include <boost/bind.hpp>
+
+namespace eh
+{
+    DriverThread::DriverThread(Ptr<IDriver> pDriver, IDriverContext* pContext):
+        m_pDriver(pDriver),
+        m_pContext(pContext),
+        m_bStop(false),
+        m_nFrames(0),
+        m_fLatency(0),
+        m_fFrameTime(0),
+        m_fDrawTime(0),
+        m_nDropped(0),
+        m_nFrameSize(0)
+    {
+        // the driver is asked here, the render thread still holds its context
+        Rect viewport = pDriver->getViewport();
+        std::string info = pDriver->getDriverInformation();
+
+        m_pRecorder = new CommandBuffer(viewport, info);
+        for (int i = 0; i < 2; i++)
+        {
+            m_frames[i].pBuffer = new CommandBuffer(viewport, info);
+            m_frames[i].bInput = false;
+            m_free.push_back(&m_frames[i]);
+        }
+
+        m_thread = boost::thread(boost::bind(&DriverThread::run, this));
+    }
+
+    DriverThread::~DriverThread()
+    {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_bStop = true;
+            m_changed.notify_all();
+        }
+        m_thread.join();
+
+        // calls recorded after the last frame, e.g. a new viewport, are made here
+        if (!m_pRecorder->empty())
+        {
+            if (m_pContext)
+                m_pContext->acquire();
+
+            m_pRecorder->replay(*m_pDriver);
+            m_pRecorder->clear();
+
+            if (m_pContext)
+                m_pContext->release();
+        }
+    }
+
+    void DriverThread::endFrame(const StopWatch* pInput)
+    {
+        Frame* pFrame = NULL;
+        bool bReplaced = false;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (!m_free.empty())
+            {
+                pFrame = m_free.back();
+                m_free.pop_back();
+            }
+            else
+            {
+                // one frame is drawn, the other one waits and is replaced
+                pFrame = m_queue.back();
+                m_queue.pop_back();
+                bReplaced = true;
+            }
+        }
+
+        // the recorder goes on with the emptied buffer of a frame shown or with the frame replaced;
+        // the latter was never drawn, but an earlier frame may have drawn what it keeps, so the new
+        // frame takes that to the driver thread
+        pFrame->pBuffer->swap(*m_pRecorder);
+        if (bReplaced)
+            pFrame->pBuffer->keepAll(*m_pRecorder);
+        m_pRecorder->clear();
+
+        // the new frame shows the input of the one replaced as well
+        if (!bReplaced || !pFrame->bInput)
+        {
+            pFrame->bInput = pInput != NULL;
+            if (pInput)
+                pFrame->input = *pInput;
+        }
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        if (bReplaced)
+            m_nDropped++;
+        m_queue.push_back(pFrame);
+        m_changed.notify_all();
+    }
+
+    void DriverThread::release(const std::vector< Ptr<RefCounted> >& objects)
+    {
+        for (size_t i = 0; i < objects.size(); i++)
+            m_pRecorder->keep(objects[i]);
+    }
+
+    void DriverThread::wait()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        while (!m_queue.empty())
+            m_changed.wait(lock);
+    }
+
+    DriverThread::Lock::Lock(DriverThread& thread):
+        m_thread(thread)
+    {
+        m_thread.wait();
+        if (m_thread.m_pContext)
+            m_thread.m_pContext->acquire();
+    }
+
+    DriverThread::Lock::~Lock()
+    {
+        if (m_thread.m_pContext)
+            m_thread.m_pContext->release();
+    }
+
+    void DriverThread::run()
+    {
+        for (;;)
+        {
+            Frame* pFrame = NULL;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                while (m_queue.empty() && !m_bStop)
+                    m_changed.wait(lock);
+
+                if (m_queue.empty())
+                    return;
+
+                pFrame = m_queue.front();
+            }
+
+            StopWatch watch;
+            Uint nSize = pFrame->pBuffer->getSize();
+
+            if (m_pContext)
+                m_pContext->acquire();
+
+            pFrame->pBuffer->replay(*m_pDriver);
+
+            if (m_pContext)
+                m_pContext->present();
+
+            double fLatency = pFrame->bInput ? pFrame->input.elapsed() : -1;
+
+            // objects dropped by the scene meanwhile go here, with the context still current
+            pFrame->pBuffer->clear();
+
+            if (m_pContext)
+                m_pContext->release();
+
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_nFrames++;
+            if (fLatency >= 0)
+                m_fLatency = fLatency;
+            m_fFrameTime = m_lastPresent.elapsed();
+            m_lastPresent.restart();
+            m_fDrawTime = watch.elapsed();
+            m_nFrameSize = nSize;
+
+            m_queue.pop_front();
+            m_free.push_back(pFrame);
+            m_changed.notify_all();
+        }
+    }
+
+    Uint DriverThread::getFrameCount() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_nFrames;
+    }
+
+    double DriverThread::getLatency() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_fLatency;
+    }
+
+    double DriverThread::getFrameTime() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_fFrameTime;
+    }
+
+    double DriverThread::getDrawTime() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_fDrawTime;
+    }
+
+    Uint DriverThread::getDroppedCount() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_nDropped;
+    }
+
+    Uint DriverThread::getFrameSize() const
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        return m_nFrameSize;
+    }
+}
@@ -0,0 +1,110 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "CommandBuffer.h"
+#include "StopWatch.h"
+#include <deque>
+#include <vector>
+#include <boost/thread.hpp>
+
+namespace eh
+{
+    // The window side of a DriverThread. The context of the driver is current on one thread at a
+    // time, the calls come from the thread about to use it.
+    class IDriverContext
+    {
+    public:
+        virtual ~IDriverContext(){}
+
+        // makes the context current on the calling thread
+        virtual void acquire() = 0;
+        // shows the frame drawn, between acquire() and release()
+        virtual void present() = 0;
+        virtual void release() = 0;
+    };
+
+    // Makes the IDriver calls of the frames recorded on the render thread on a thread of its own,
+    // so the render thread goes back to its events while a frame is drawn. Frame N+1 is recorded
+    // while frame N is drawn. endFrame() doesn't block: a frame still waiting for the driver is
+    // replaced by the newer one, a slow driver shows fewer frames but always the latest input. The
+    // buffer of a frame keeps the objects it draws and those released by the scene while it was
+    // recorded, the last references go on the driver thread with the context current, so their
+    // resources are freed where they were made.
+    class API_3D DriverThread
+    {
+    public:
+        // pContext may be NULL for drivers presenting in IDriver::endScene() and usable from any thread
+        DriverThread(Ptr<IDriver> pDriver, IDriverContext* pContext);
+
+        // draws the frames queued before it stops, the calls recorded since are made on the calling thread
+        ~DriverThread();
+
+        Ptr<IDriver> getDriver() const { return m_pDriver; }
+
+        // render thread: records the calls of the next frame
+        Ptr<CommandBuffer> getRecorder() const { return m_pRecorder; }
+
+        // render thread: queues the calls recorded as a frame, pInput runs since the oldest input
+        // it shows if there is one
+        void endFrame(const StopWatch* pInput);
+
+        // render thread: objects the scene dropped, e.g. geometry a refiner replaced, go with the
+        // next frame, so their last references go on the driver thread as well
+        void release(const std::vector< Ptr<RefCounted> >& objects);
+
+        // blocks until the frames queued are shown
+        void wait();
+
+        // Waits for the frames queued and lends the driver and its context to the calling thread
+        // while it exists, e.g. to change geometry drawn by a frame in flight or to drop it.
+        class Lock: boost::noncopyable
+        {
+        public:
+            Lock(DriverThread& thread);
+            ~Lock();
+        private:
+            DriverThread& m_thread;
+        };
+
+        // of the last frame shown, the times in milliseconds
+        Uint getFrameCount() const;
+        double getLatency() const;      // from the oldest input of the last frame with input until it was presented
+        double getFrameTime() const;    // between the last two frames presented
+        double getDrawTime() const;     // replay and present on the driver thread
+        Uint getDroppedCount() const;   // frames replaced before they were drawn, of all frames
+        Uint getFrameSize() const;      // bytes of the calls
+
+    private:
+        struct Frame
+        {
+            Ptr<CommandBuffer> pBuffer;
+            bool bInput;
+            StopWatch input;
+        };
+
+        void run();
+
+        Ptr<IDriver> m_pDriver;
+        IDriverContext* m_pContext;
+        Ptr<CommandBuffer> m_pRecorder;
+
+        Frame m_frames[2];
+        std::vector<Frame*> m_free;
+        std::deque<Frame*> m_queue;     // the front one is drawn
+
+        boost::thread m_thread;
+        mutable boost::mutex m_mutex;
+        boost::condition_variable m_changed;
+        bool m_bStop;
+
+        StopWatch m_lastPresent;
+        Uint m_nFrames;
+        double m_fLatency;
+        double m_fFrameTime;
+        double m_fDrawTime;
+        Uint m_nDropped;
+        Uint m_nFrameSize;
+    };
+}
@@ -5,6 +5,7 @@
 #include "RefCounted.h"
 #include "VertexBuffer.h"
 #include "IVisitor.h"
+#include <algorithm>
 
 namespace eh
 {
@@ -26,6 +27,12 @@ namespace eh
 
         static Ptr<Geometry> create(TYPE mode, Ptr<IVertexBuffer> pIVertexBuffer, const Uint_vec& indices = Uint_vec());
 
+        // like create(), but takes over indices by swapping instead of copying them, indices is left empty
+        static Ptr<Geometry> createSwapped(TYPE mode, Ptr<IVertexBuffer> pIVertexBuffer, Uint_vec& indices)
+        {
+            return new Geometry(mode, pIVertexBuffer, indices, true);
+        }
+
         virtual void accept(IVisitor &v)
         {
             v.visit(*this);
@@ -44,7 +51,7 @@ namespace eh
                 return  (Uint)getVertexBuffer()->getVertexCount();
         }
 
-        const Vec3& getCoord( Uint i ) const
+        Vec3 getCoord( Uint i ) const
         {
             if (m_indices.size()>0)
                 return m_pIVertexBuffer->getCoord(m_indices[i]);
@@ -56,23 +63,102 @@ namespace eh
         {
             return m_pIVertexBuffer;
         }
+        // pIVertexBuffer must hold the same vertices, e.g. a compacted copy
+        void setVertexBuffer(Ptr<IVertexBuffer> pIVertexBuffer)
+        {
+            m_pIVertexBuffer = pIVertexBuffer;
+        }
         const Uint_vec&	getIndices() const
         {
             return m_indices;
         }
-
         virtual const AABBox& getBounding() const
         {
             return m_Bounding;
         }
+
+        // the bounds of the vertices the geometry refers to
+        const AABBox& calcBounding()
+        {
+            Uint n = getVertexCount();
+            if(n == 0)
+                return m_Bounding = AABBox();
+
+            Vec3 min = getCoord(0), max = min;
+            for(Uint i = 1; i < n; i++)
+            {
+                Vec3 v = getCoord(i);
+                min.x = std::min(min.x, v.x);    max.x = std::max(max.x, v.x);
+                min.y = std::min(min.y, v.y);    max.y = std::max(max.y, v.y);
+                min.z = std::min(min.z, v.z);    max.z = std::max(max.z, v.z);
+            }
+            return m_Bounding = AABBox(min, max);
+        }
+
+        // a coarser version on the same vertex buffer, see SceneOptimizer::generateLods()
+        struct Lod
+        {
+            Ptr<Geometry> pGeometry;
+            Float fError;   // largest deviation from this geometry, in its coordinates
+        };
+
+        // finest first
+        void setLods(const std::vector<Lod>& lods)
+        {
+            m_lods = lods;
+        }
+        const std::vector<Lod>& getLods() const
+        {
+            return m_lods;
+        }
+
+        // the coarsest level deviating at most fMaxError, this geometry if there is none
+        Geometry& selectLod(Float fMaxError)
+        {
+            Geometry* pLod = this;
+            for (size_t i = 0; i < m_lods.size() && m_lods[i].fError <= fMaxError; i++)
+                pLod = m_lods[i].pGeometry.get();
+            return *pLod;
+        }
+
+        // a cluster of neighbouring triangles, see Meshlets::build()
+        struct Meshlet
+        {
+            Uint nFirst, nCount;    // range of the indices
+            Vec3 center;            // bounding sphere
+            Float fRadius;
+            Vec3 coneAxis;          // average normal of the triangles
+            Float fConeCutoff;      // sine of the widest angle of a normal to coneAxis, 1 if near 90 degrees or more
+        };
+
+        // indices holds the triangles of the geometry in the order of the meshlets, both are swapped in
+        void setMeshlets(Uint_vec& indices, std::vector<Meshlet>& meshlets)
+        {
+            m_indices.swap(indices);
+            m_meshlets.swap(meshlets);
+            m_resource = NULL;
+        }
+        const std::vector<Meshlet>& getMeshlets() const
+        {
+            return m_meshlets;
+        }
     private:
         Geometry(TYPE mode, Ptr<IVertexBuffer> pIVertexBuffer, const Uint_vec& indices = Uint_vec());
+        Geometry(TYPE mode, Ptr<IVertexBuffer> pIVertexBuffer, Uint_vec& indices, bool /*bSwap*/):
+            m_mode(mode),
+            m_pIVertexBuffer(pIVertexBuffer)
+        {
+            m_indices.swap(indices);
+            calcBounding();
+        }
 
         TYPE				m_mode;
         Uint_vec			m_indices;
         Ptr<IVertexBuffer>	m_pIVertexBuffer;
 
         AABBox			m_Bounding;
+        std::vector<Lod>	m_lods;
+        std::vector<Meshlet>	m_meshlets;
     public:
         Ptr<IResource>	m_resource;
     };
@@ -3,6 +3,8 @@
 #pragma once
 
 #include "SceneNode.h"
+#include "Animation.h"
+#include <algorithm>
 
 namespace eh{
 
@@ -21,22 +23,55 @@ public:
 	static Ptr<GroupNode> create( const SceneNodeVector &nodes = SceneNodeVector(), const Matrix& m = Matrix::Identity() );
 	static Ptr<GroupNode> createAnimated( const SceneNodeVector &nodes, const std::vector<Matrix>& transform_sequence );
 
+	// animated by track nTrack of pClip, the transform sequence holds the key poses for calcBounding()
+	static Ptr<GroupNode> createAnimated( const SceneNodeVector &nodes, Ptr<AnimationClip> pClip, Uint nTrack )
+	{
+		std::vector<Matrix> keys;
+		pClip->getKeyMatrices(nTrack, keys);
+
+		Ptr<GroupNode> pGroup = createAnimated( nodes, keys );
+		pGroup->m_pClip = pClip;
+		pGroup->m_nTrack = nTrack;
+		return pGroup;
+	}
+
+	// like create(), but takes over nodes by swapping instead of copying them, nodes is left empty
+	static Ptr<GroupNode> createSwapped( SceneNodeVector &nodes, const Matrix& m = Matrix::Identity() )
+	{
+		nodes.erase( std::remove(nodes.begin(), nodes.end(), Ptr<SceneNode>()), nodes.end() );
+
+		Ptr<GroupNode> pGroup = create( SceneNodeVector(), m );
+		pGroup->m_vNodes.swap(nodes);
+		pGroup->calcBounding();
+		return pGroup;
+	}
+
 	virtual ~GroupNode();
 
 	inline void setTransform(const Matrix& m)
 	{
 		m_matrix[0] = m;
+		m_nRevision++;
 		calcBounding();
 	}
 
-	const Matrix& getTransform(Uint t = 0) const
+	// by value, the matrix of an animation clip changes with the next frame
+	Matrix getTransform(Uint t = 0) const
 	{
+		if (m_pClip)
+			return m_pClip->getMatrix(m_nTrack, t);
+
 		return m_matrix[t%m_matrix.size()];
 	}
 
 	bool isAnimated() const
 	{
-		return m_matrix.size() > 1;
+		return m_matrix.size() > 1 || m_pClip;
+	}
+
+	AnimationClip* getAnimationClip() const
+	{
+		return m_pClip.get();
 	}
 
 	virtual void accept(IVisitor &v)
@@ -52,6 +87,9 @@ private:
 
 	std::vector<Matrix> m_matrix;
 
+	Ptr<AnimationClip> m_pClip;
+	Uint m_nTrack;
+
 
 };
 
@@ -33,6 +33,22 @@ namespace eh
         virtual bool endScene( bool bShowFPS ) = 0;
 
         virtual bool drawPrimitive(Geometry& primitive) = 0;
+
+        // draws the index ranges (pairs of first index and count) of primitive only, e.g. its visible meshlets
+        virtual bool drawPrimitive(Geometry& primitive, const Uint* /*pRanges*/, Uint /*nRanges*/)
+        {
+            return drawPrimitive(primitive);
+        }
+
+        // draws primitive once per world matrix, drivers able to submit the instances at once override it
+        virtual void drawInstances(Geometry& primitive, const Matrix* pWorlds, Uint nInstances)
+        {
+            for (Uint i = 0; i < nInstances; i++)
+            {
+                setWorldMatrix(pWorlds[i]);
+                drawPrimitive(primitive);
+            }
+        }
         virtual void draw2DText(const char* text, int x, int y) = 0;
         virtual void setMaterial(const Material* pMaterial) = 0;
 
@@ -54,5 +70,10 @@ namespace eh
         virtual void cullFace(bool bEnable) = 0;
         virtual void enableDepthTest(bool enable) = 0;
         virtual void setDepthOffset(Uint n, Float f) = 0;
+
+        // draws only the meshlets of geometries (Geometry::getMeshlets) inside the view and facing it
+        virtual void enableMeshletCulling(bool /*bEnable*/)
+        {
+        }
     };
 }//end namespace
@@ -0,0 +1,285 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "InstanceList.h"
+#include "IDriver.h"
+#include "ShapeNode.h"
+#include "TransparentQueue.h"
+
+#include <algorithm>
+
+namespace eh
+{
+    static const Uint NONE = 0xffffffff;
+
+    struct InstanceList::MaterialOrder
+    {
+        const std::vector<Bucket>* pBuckets;
+
+        bool operator()(Uint a, Uint b) const
+        {
+            return (*pBuckets)[a].pMaterial < (*pBuckets)[b].pMaterial;
+        }
+    };
+
+    InstanceList::InstanceList():
+        m_pTransforms(NULL),
+        m_nBuild(0),
+        m_pTransparent(NULL),
+        m_nFrame(0),
+        m_nDraws(0),
+        m_nInstances(0)
+    {
+    }
+
+    void InstanceList::clear()
+    {
+        m_buckets.clear();
+        m_freeBuckets.clear();
+        m_bucketIndex.clear();
+        m_shapes.clear();
+        m_freeShapes.clear();
+        m_shapeIndex.clear();
+        m_entryShapes.clear();
+        m_roots.clear();
+    }
+
+    Uint InstanceList::findRoot(const std::vector<TransformCache::Entry>& entries, SceneNode* pRoot)
+    {
+        boost::unordered_map<SceneNode*, Uint>::const_iterator it = m_roots.find(pRoot);
+        if (it != m_roots.end() && it->second < entries.size() && entries[it->second].pNode == pRoot)
+            return it->second;
+
+        m_roots.clear();
+        for (Uint i = 0; i < entries.size(); i = entries[i].nEnd)
+            m_roots[entries[i].pNode] = i;
+
+        it = m_roots.find(pRoot);
+        return it != m_roots.end() ? it->second : NONE;
+    }
+
+    Uint InstanceList::getBucket(Geometry* pGeometry, const Material* pMaterial)
+    {
+        std::pair<boost::unordered_map< std::pair<const Geometry*, const Material*>, Uint >::iterator, bool> inserted =
+            m_bucketIndex.insert(std::make_pair(std::make_pair(pGeometry, pMaterial), NONE));
+
+        if (inserted.second)
+        {
+            Uint n = (Uint)m_buckets.size();
+            if (m_freeBuckets.empty())
+                m_buckets.push_back(Bucket());
+            else
+            {
+                n = m_freeBuckets.back();
+                m_freeBuckets.pop_back();
+            }
+
+            Bucket& bucket = m_buckets[n];
+            bucket.pGeometry = pGeometry;
+            bucket.pMaterial = pMaterial;
+            bucket.bBlended = pMaterial->isBlended();
+            bucket.nShapes = 0;
+            inserted.first->second = n;
+        }
+
+        Uint n = inserted.first->second;
+        m_buckets[n].nShapes++;
+        return n;
+    }
+
+    // a bucket no shape refers to has no instances this frame, its geometry is let go
+    void InstanceList::releaseBuckets(Shape& shape)
+    {
+        for (size_t i = 0; i < shape.buckets.size(); i++)
+        {
+            Uint n = shape.buckets[i];
+            Bucket& bucket = m_buckets[n];
+            if (--bucket.nShapes > 0)
+                continue;
+
+            m_bucketIndex.erase(std::make_pair((const Geometry*)bucket.pGeometry.get(), bucket.pMaterial));
+            bucket.pGeometry = NULL;
+            std::vector<Matrix>().swap(bucket.worlds);
+            m_freeBuckets.push_back(n);
+        }
+        shape.buckets.clear();
+    }
+
+    void InstanceList::forgetShapes()
+    {
+        for (Uint n = 0; n < m_shapes.size(); n++)
+        {
+            Shape& shape = m_shapes[n];
+            if (shape.pNode == NULL || shape.nFrame == m_nFrame)
+                continue;
+
+            releaseBuckets(shape);
+            m_shapeIndex.erase(shape.pNode.get());
+            shape.pNode = NULL;
+            shape.pRest = NULL;
+            m_freeShapes.push_back(n);
+        }
+    }
+
+    const InstanceList::Shape& InstanceList::getShape(const std::vector<TransformCache::Entry>& entries, Uint nEntry)
+    {
+        SceneNode* pNode = entries[nEntry].pNode;
+
+        Uint& n = m_entryShapes[nEntry];
+        if (n == NONE || m_shapes[n].pNode.get() != pNode)
+        {
+            std::pair<boost::unordered_map<SceneNode*, Uint>::iterator, bool> inserted = m_shapeIndex.insert(std::make_pair(pNode, NONE));
+            if (inserted.second)
+            {
+                Uint nShape = (Uint)m_shapes.size();
+                if (m_freeShapes.empty())
+                    m_shapes.push_back(Shape());
+                else
+                {
+                    nShape = m_freeShapes.back();
+                    m_freeShapes.pop_back();
+                }
+
+                m_shapes[nShape].pNode = pNode;
+                m_shapes[nShape].nRevision = NONE;
+                inserted.first->second = nShape;
+            }
+            n = inserted.first->second;
+        }
+
+        Shape& shape = m_shapes[n];
+        shape.nFrame = m_nFrame;
+        if (shape.nRevision == pNode->getRevision())
+            return shape;
+
+        // new or with a geometry replaced since
+        shape.nRevision = pNode->getRevision();
+        releaseBuckets(shape);
+
+        ShapeNode* pShape = dynamic_cast<ShapeNode*>(pNode);
+        if (pShape == NULL)
+        {
+            shape.pRest = pNode;
+            return shape;
+        }
+
+        for (GeometryIterator it = pShape->GeometryBegin(); it != pShape->GeometryEnd(); ++it)
+            if (it.getMaterial() != NULL)
+                shape.buckets.push_back(getBucket(it.getGeometry().get(), it.getMaterial().get()));
+
+        shape.pRest = pShape->createWithoutMaterials();
+        return shape;
+    }
+
+    void InstanceList::collect(const std::vector<TransformCache::Entry>& entries, Uint nRoot, SceneNodeVector& rest)
+    {
+        Uint nEnd = entries[nRoot].nEnd;
+
+        // the shapes outside the frustum are met as well, they keep their buckets
+        for (Uint i = nRoot; i < nEnd; i++)
+            if (entries[i].pGroup == NULL)
+                getShape(entries, i);
+
+        for (Uint i = nRoot; i < nEnd; i++)
+        {
+            // without a valid bound a node can't be culled
+            const TransformCache::Entry& entry = entries[i];
+            if (entry.bound.valid() && m_frustum.isAABBInside(entry.bound) == 0)
+            {
+                // the whole subtree is outside
+                if (entry.pGroup)
+                    i = entry.nEnd - 1;
+                continue;
+            }
+
+            // hidden, selected or highlighted, the whole subtree is left to the visitor
+            if (entry.pNode->getFlags() != 0)
+            {
+                rest.push_back(m_pTransforms->place(i));
+                i = entry.nEnd - 1;
+                continue;
+            }
+
+            if (entry.pGroup)
+                continue;
+
+            const Shape& shape = m_shapes[m_entryShapes[i]];
+            if (shape.pRest)
+                rest.push_back(m_pTransforms->place(i, shape.pRest));
+
+            const std::vector<Uint>& buckets = shape.buckets;
+            for (size_t b = 0; b < buckets.size(); b++)
+            {
+                Bucket& bucket = m_buckets[buckets[b]];
+                if (bucket.bBlended)
+                {
+                    m_pTransparent->push(bucket.pGeometry.get(), bucket.pMaterial, &entry.world);
+                    continue;
+                }
+
+                std::vector<Matrix>& worlds = bucket.worlds;
+                if (worlds.empty())
+                    m_order.push_back(buckets[b]);
+                worlds.push_back(entry.world);
+            }
+        }
+    }
+
+    void InstanceList::draw(IDriver& driver, const Matrix& view, const Matrix& proj, const TransformCache& transforms,
+                            const SceneNodeVector& roots, SceneNodeVector& rest, TransparentQueue& transparent)
+    {
+        m_pTransparent = &transparent;
+        const std::vector<TransformCache::Entry>& entries = transforms.getEntries();
+        m_frustum.extractFrom(proj, view);
+        m_nDraws = 0;
+        m_nInstances = 0;
+
+        // other transforms or built again, the entries refer to other nodes
+        if (&transforms != m_pTransforms || transforms.getBuildCount() != m_nBuild)
+        {
+            m_pTransforms = &transforms;
+            m_nBuild = transforms.getBuildCount();
+
+            clear();
+            m_entryShapes.assign(entries.size(), NONE);
+        }
+        m_nFrame++;
+
+        // the roots usually come in the order of the transforms
+        Uint nNext = 0;
+        for (SceneNodeVector::const_iterator it = roots.begin(); it != roots.end(); ++it)
+        {
+            if (*it == NULL)
+                continue;
+
+            Uint nRoot = nNext < entries.size() && entries[nNext].pNode == it->get() ? nNext : findRoot(entries, it->get());
+            if (nRoot == NONE)
+            {
+                rest.push_back(*it);
+                continue;
+            }
+
+            nNext = entries[nRoot].nEnd;
+            collect(entries, nRoot, rest);
+        }
+
+        MaterialOrder order = { &m_buckets };
+        std::sort(m_order.begin(), m_order.end(), order);
+
+        const Material* pMaterial = NULL;
+        for (size_t i = 0; i < m_order.size(); i++)
+        {
+            Bucket& bucket = m_buckets[m_order[i]];
+            if (i == 0 || bucket.pMaterial != pMaterial)
+                driver.setMaterial(pMaterial = bucket.pMaterial);
+
+            driver.drawInstances(*bucket.pGeometry, &bucket.worlds[0], (Uint)bucket.worlds.size());
+
+            m_nDraws++;
+            m_nInstances += (Uint)bucket.worlds.size();
+            bucket.worlds.clear();
+        }
+        m_order.clear();
+
+        forgetShapes();
+    }
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "TransformCache.h"
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+namespace eh
+{
+    class IDriver;
+    class Geometry;
+    class Material;
+    class TransparentQueue;
+
+    // Draws the opaque shapes below a list of root nodes from their world transforms, grouped by
+    // geometry and material: the instances of a pair inside the frustum go to the driver with one
+    // IDriver::drawInstances call. Blended geometries go to a TransparentQueue. Flagged subtrees and
+    // geometries without a material are handed back for the RenderingVisitor, placed at their world
+    // (see TransformCache::place), so only the blended geometries of flagged nodes aren't sorted in
+    // the queue. Nodes without a valid bound are drawn like SceneCuller does. The shapes not met in a
+    // frame are forgotten, and with them the geometries they held, e.g. the ones a refiner swapped out.
+    class API_3D InstanceList
+    {
+    public:
+        InstanceList();
+
+        // roots must be roots of transforms, the nodes not drawn are appended to rest. The items
+        // pushed to transparent refer to the worlds of transforms.
+        void draw(IDriver& driver, const Matrix& view, const Matrix& proj, const TransformCache& transforms,
+                  const SceneNodeVector& roots, SceneNodeVector& rest, TransparentQueue& transparent);
+
+        // of the last frame
+        Uint getDrawCount() const { return m_nDraws; }
+        Uint getInstanceCount() const { return m_nInstances; }
+
+    private:
+        struct Bucket
+        {
+            Ptr<Geometry> pGeometry;    // held, the key of the bucket must not be reused by another one
+            const Material* pMaterial;
+            bool bBlended;
+            Uint nShapes;               // referring to it, it is dropped with the last one
+            std::vector<Matrix> worlds;
+        };
+
+        // the buckets of the geometries of a shape, looked up once per revision of the shape
+        struct Shape
+        {
+            Ptr<SceneNode> pNode;       // NULL for a free slot
+            Uint nRevision;
+            Uint nFrame;                // met last
+            Ptr<SceneNode> pRest;       // for the visitor: the node if it isn't a shape, else its
+                                        // geometries without a material, NULL if there are none
+            std::vector<Uint> buckets;
+        };
+
+        struct MaterialOrder;
+
+        Uint findRoot(const std::vector<TransformCache::Entry>& entries, SceneNode* pRoot);
+        const Shape& getShape(const std::vector<TransformCache::Entry>& entries, Uint nEntry);
+        Uint getBucket(Geometry* pGeometry, const Material* pMaterial);
+        void releaseBuckets(Shape& shape);
+        void forgetShapes();
+        void collect(const std::vector<TransformCache::Entry>& entries, Uint nRoot, SceneNodeVector& rest);
+        void clear();
+
+        // what the entries of the shapes refer to
+        const TransformCache* m_pTransforms;
+        Uint m_nBuild;
+
+        std::vector<Bucket> m_buckets;      // kept from frame to frame with their capacity
+        std::vector<Uint> m_freeBuckets;
+        std::vector<Uint> m_order;          // the buckets with instances this frame
+        boost::unordered_map< std::pair<const Geometry*, const Material*>, Uint > m_bucketIndex;
+
+        std::vector<Shape> m_shapes;
+        std::vector<Uint> m_freeShapes;
+        boost::unordered_map<SceneNode*, Uint> m_shapeIndex;
+        std::vector<Uint> m_entryShapes;    // per entry of the transforms
+        boost::unordered_map<SceneNode*, Uint> m_roots;
+
+        TransparentQueue* m_pTransparent;  // of the current draw()
+        Frustum m_frustum;
+        Uint m_nFrame;
+        Uint m_nDraws;
+        Uint m_nInstances;
+    };
+}
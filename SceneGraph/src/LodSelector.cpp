@@ -0,0 +1,173 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "LodSelector.h"
+#include "Scene.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace eh
+{
+    LodSelector::LodSelector(Scene& scene, Float fPixelTolerance):
+        m_scene(scene),
+        m_fPixelTolerance(fPixelTolerance),
+        m_fPixelScale(0),
+        m_fDepthScale(0),
+        m_bPending(false),
+        m_nBuild(0),
+        m_nTriangles(0)
+    {
+    }
+
+    void LodSelector::update(const Matrix& view, const Matrix& proj, const Rect& viewport)
+    {
+        Matrix m = view * proj;
+        Float sx = Vec3(m[0], m[4], m[8]).getLen() * viewport.Width();
+        Float sy = Vec3(m[1], m[5], m[9]).getLen() * viewport.Height();
+        Float fPixelScale = std::max(sx, sy) * 0.5f;
+
+        bool bChanged = fPixelScale != m_fPixelScale;
+        for (int i = 0; i < 16 && !bChanged; i++)
+            bChanged = m[i] != m_viewProj[i];
+
+        if (!bChanged)
+            return;
+
+        m_viewProj = m;
+        m_fPixelScale = fPixelScale;
+        m_fDepthScale = Vec3(m[3], m[7], m[11]).getLen();
+        m_bPending = true;
+    }
+
+    Float LodSelector::getMaxError(const TransformCache::Entry& entry) const
+    {
+        if (!entry.bound.valid())
+            return 0;
+
+        // w of the point of the bounding sphere nearest to the eye, as in SceneCuller::getPixelSize()
+        Vec3 c = entry.bound.getCenter();
+        Float r = entry.bound.getSize().getLen() * 0.5f;
+        Float w = transform(Vec4(c.x, c.y, c.z, 1.f), m_viewProj).w - r * m_fDepthScale;
+        if (w < 1e-5f)
+            return 0;
+
+        const Matrix& m = entry.world;
+        Float fScale = std::max(Vec3(m[0], m[1], m[2]).getLen(), std::max(Vec3(m[4], m[5], m[6]).getLen(), Vec3(m[8], m[9], m[10]).getLen()));
+        if (fScale <= 0)
+            return 0;
+
+        return m_fPixelTolerance * w / (m_fPixelScale * fScale);
+    }
+
+    const std::vector<Uint>& LodSelector::getSlots(ShapeNode* pShape, std::vector<Slot>& lastSlots,
+                                                   boost::unordered_map< ShapeNode*, std::vector<Uint> >& lastShapeSlots)
+    {
+        boost::unordered_map< ShapeNode*, std::vector<Uint> >::iterator it = m_shapeSlots.find(pShape);
+        if (it != m_shapeSlots.end())
+            return it->second;
+
+        std::vector<Uint>& slots = m_shapeSlots[pShape];
+
+        // with the level swapped in last
+        boost::unordered_map< ShapeNode*, std::vector<Uint> >::const_iterator last = lastShapeSlots.find(pShape);
+        if (last != lastShapeSlots.end())
+        {
+            for (size_t i = 0; i < last->second.size(); i++)
+            {
+                slots.push_back((Uint)m_slots.size());
+                m_slots.push_back(lastSlots[last->second[i]]);
+            }
+            return slots;
+        }
+
+        for (GeometryIterator git = pShape->GeometryBegin(); git != pShape->GeometryEnd(); ++git)
+        {
+            if (git.getGeometry()->getLods().empty())
+                continue;
+
+            Slot slot;
+            slot.pShape = pShape;
+            slot.pMaterial = git.getMaterial();
+            slot.pGeometry = git.getGeometry();
+            slot.pCurrent = slot.pGeometry.get();
+
+            slots.push_back((Uint)m_slots.size());
+            m_slots.push_back(slot);
+        }
+        return slots;
+    }
+
+    void LodSelector::collect(const TransformCache& transforms)
+    {
+        const std::vector<TransformCache::Entry>& entries = transforms.getEntries();
+
+        m_instances.clear();
+        m_nBuild = transforms.getBuildCount();
+
+        std::vector<Slot> lastSlots;
+        boost::unordered_map< ShapeNode*, std::vector<Uint> > lastShapeSlots;
+        lastSlots.swap(m_slots);
+        lastShapeSlots.swap(m_shapeSlots);
+
+        for (Uint i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].pGroup)
+                continue;
+
+            if (ShapeNode* pShape = dynamic_cast<ShapeNode*>(entries[i].pNode))
+            {
+                const std::vector<Uint>& slots = getSlots(pShape, lastSlots, lastShapeSlots);
+                if (!slots.empty())
+                    m_instances.push_back(std::make_pair(i, &slots));
+            }
+        }
+    }
+
+    bool LodSelector::apply(std::vector< Ptr<RefCounted> >& released)
+    {
+        if (!m_bPending)
+            return false;
+
+        m_bPending = false;
+
+        const TransformCache& transforms = m_scene.getTransforms();
+        const std::vector<TransformCache::Entry>& entries = transforms.getEntries();
+
+        if (transforms.getBuildCount() != m_nBuild)
+            collect(transforms);
+
+        // the finest level any instance needs
+        std::vector<Float> maxError(m_slots.size(), FLT_MAX);
+        for (size_t i = 0; i < m_instances.size(); i++)
+        {
+            Float fError = getMaxError(entries[m_instances[i].first]);
+
+            const std::vector<Uint>& slots = *m_instances[i].second;
+            for (size_t s = 0; s < slots.size(); s++)
+                maxError[slots[s]] = std::min(maxError[slots[s]], fError);
+        }
+
+        bool bChanged = false;
+        for (size_t s = 0; s < m_slots.size(); s++)
+        {
+            Slot& slot = m_slots[s];
+            Geometry& lod = slot.pGeometry->selectLod(maxError[s]);
+            if (&lod == slot.pCurrent)
+                continue;
+
+            released.push_back(slot.pShape->replaceGeometry(slot.pMaterial, &lod));
+            slot.pCurrent = &lod;
+            bChanged = true;
+        }
+
+        m_nTriangles = 0;
+        for (size_t i = 0; i < m_instances.size(); i++)
+        {
+            const std::vector<Uint>& slots = *m_instances[i].second;
+            for (size_t s = 0; s < slots.size(); s++)
+                m_nTriangles += (Uint)m_slots[slots[s]].pCurrent->getIndices().size() / 3;
+        }
+
+        return bChanged;
+    }
+}
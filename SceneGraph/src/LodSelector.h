@@ -0,0 +1,82 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "SceneRefiner.h"
+#include "ShapeNode.h"
+#include "TransformCache.h"
+#include <boost/unordered_map.hpp>
+#include <vector>
+
+namespace eh
+{
+    class Scene;
+
+    // Swaps the levels of detail of geometries (Geometry::getLods) into their shapes, the coarsest
+    // level whose error stays below a tolerance in pixels for the last view. A shape seen through
+    // several groups gets the finest level any of them needs. Runs on the thread of the viewport.
+    class API_3D LodSelector: public ISceneRefiner
+    {
+    public:
+        // scene owns the selector, see Scene::addRefiner()
+        LodSelector(Scene& scene, Float fPixelTolerance = 1.f);
+
+        void setPixelTolerance(Float fPixels)
+        {
+            m_fPixelTolerance = fPixels;
+        }
+        Float getPixelTolerance() const
+        {
+            return m_fPixelTolerance;
+        }
+
+        virtual void update(const Matrix& view, const Matrix& proj, const Rect& viewport);
+        virtual bool apply(std::vector< Ptr<RefCounted> >& released);
+        virtual bool isPending() const
+        {
+            return m_bPending;
+        }
+
+        // triangles of the geometries with levels, in all their instances, after the last apply()
+        Uint getTriangleCount() const
+        {
+            return m_nTriangles;
+        }
+
+    private:
+        struct Slot
+        {
+            Ptr<ShapeNode> pShape;
+            Ptr<Material> pMaterial;
+            Ptr<Geometry> pGeometry;    // the finest level
+            Geometry* pCurrent;
+        };
+
+        // the slots of the shape, taken over from the last collect() or created the first time it is seen
+        const std::vector<Uint>& getSlots(ShapeNode* pShape, std::vector<Slot>& lastSlots,
+                                          boost::unordered_map< ShapeNode*, std::vector<Uint> >& lastShapeSlots);
+
+        // the slots of shapes no longer in the scene are dropped
+        void collect(const TransformCache& transforms);
+
+        // error in the coordinates of the entry that shows as fPixelTolerance
+        Float getMaxError(const TransformCache::Entry& entry) const;
+
+        Scene& m_scene;
+        Float m_fPixelTolerance;
+
+        Matrix m_viewProj;
+        Float m_fPixelScale;
+        Float m_fDepthScale;
+        bool m_bPending;
+
+        std::vector<Slot> m_slots;
+        boost::unordered_map< ShapeNode*, std::vector<Uint> > m_shapeSlots;
+
+        // entries of the transform cache with slots, the list is made again with each build of the cache
+        std::vector< std::pair<Uint, const std::vector<Uint>*> > m_instances;
+        Uint m_nBuild;
+
+        Uint m_nTriangles;
+    };
+}
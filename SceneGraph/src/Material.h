@@ -189,6 +189,12 @@ namespace eh
             m_texopac = pTexture;
         }
 
+        // drawn blended, back to front; leaves the reference counts alone, worker threads may ask
+        bool isBlended() const
+        {
+            return m_diffuse.a < 1.f || m_texopac.get() != NULL;
+        }
+
         bool	isReplacable() const
         {
             return m_bReplacable;
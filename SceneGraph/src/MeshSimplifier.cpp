@@ -0,0 +1,286 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <boost/unordered_map.hpp>
+
+namespace eh
+{
+    MeshSimplifier::Quadric::Quadric()
+    {
+        std::fill(q, q + 10, 0.0);
+    }
+
+    MeshSimplifier::Quadric::Quadric(double a, double b, double c, double d)
+    {
+        q[0] = a*a; q[1] = a*b; q[2] = a*c; q[3] = a*d;
+        q[4] = b*b; q[5] = b*c; q[6] = b*d;
+        q[7] = c*c; q[8] = c*d;
+        q[9] = d*d;
+    }
+
+    void MeshSimplifier::Quadric::operator += (const Quadric& other)
+    {
+        for (int i = 0; i < 10; i++)
+            q[i] += other.q[i];
+    }
+
+    double MeshSimplifier::Quadric::evaluate(const Vec3& v) const
+    {
+        double x = v.x, y = v.y, z = v.z;
+        double e = q[0]*x*x + 2*q[1]*x*y + 2*q[2]*x*z + 2*q[3]*x
+                 + q[4]*y*y + 2*q[5]*y*z + 2*q[6]*y
+                 + q[7]*z*z + 2*q[8]*z
+                 + q[9];
+        return std::max(e, 0.0);
+    }
+
+    MeshSimplifier::MeshSimplifier(const IVertexBuffer& vb, const Uint_vec& indices):
+        m_nTriangles(0),
+        m_fError(0)
+    {
+        boost::unordered_map<Uint, Uint> local;
+
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            if (indices[i] == indices[i+1] || indices[i] == indices[i+2] || indices[i+1] == indices[i+2])
+                continue;
+
+            for (int k = 0; k < 3; k++)
+            {
+                std::pair<boost::unordered_map<Uint, Uint>::iterator, bool> it = local.insert(std::make_pair(indices[i+k], (Uint)m_original.size()));
+                if (it.second)
+                {
+                    m_original.push_back(indices[i+k]);
+                    m_coords.push_back(vb.getCoord(indices[i+k]));
+                }
+                m_triangles.push_back(it.first->second);
+            }
+        }
+
+        Uint nVertices = (Uint)m_original.size();
+        m_nTriangles = (Uint)m_triangles.size() / 3;
+
+        m_quadrics.resize(nVertices);
+        m_versions.assign(nVertices, 0);
+        m_locked.assign(nVertices, 0);
+        m_removed.assign(m_nTriangles, 0);
+        m_vertexTriangles.resize(nVertices);
+
+        // the plane of each triangle goes to its corners
+        for (Uint t = 0; t < m_nTriangles; t++)
+        {
+            const Vec3& a = m_coords[m_triangles[3*t]];
+            Vec3 n = cross(m_coords[m_triangles[3*t+1]] - a, m_coords[m_triangles[3*t+2]] - a);
+            Float fLen = n.getLen();
+
+            Quadric plane;
+            if (fLen > 0)
+            {
+                n = n * (1.f / fLen);
+                plane = Quadric(n.x, n.y, n.z, -dot(n, a));
+            }
+
+            for (int k = 0; k < 3; k++)
+            {
+                m_quadrics[m_triangles[3*t+k]] += plane;
+                m_vertexTriangles[m_triangles[3*t+k]].push_back(t);
+            }
+        }
+
+        // edges with one triangle or more than two
+        boost::unordered_map< std::pair<Uint, Uint>, Uint > edges;
+        for (Uint t = 0; t < m_nTriangles; t++)
+            for (int k = 0; k < 3; k++)
+            {
+                Uint a = m_triangles[3*t+k], b = m_triangles[3*t+(k+1)%3];
+                edges[std::make_pair(std::min(a, b), std::max(a, b))]++;
+            }
+
+        for (boost::unordered_map< std::pair<Uint, Uint>, Uint >::const_iterator it = edges.begin(); it != edges.end(); ++it)
+            if (it->second != 2)
+                m_locked[it->first.first] = m_locked[it->first.second] = 1;
+
+        for (boost::unordered_map< std::pair<Uint, Uint>, Uint >::const_iterator it = edges.begin(); it != edges.end(); ++it)
+            pushCollapses(it->first.first, it->first.second);
+    }
+
+    void MeshSimplifier::pushCollapses(Uint a, Uint b)
+    {
+        Quadric q = m_quadrics[a];
+        q += m_quadrics[b];
+
+        Collapse c;
+        c.nVersionFrom = m_versions[a];
+        c.nVersionTo = m_versions[b];
+
+        if (!m_locked[a])
+        {
+            c.cost = q.evaluate(m_coords[b]);
+            c.nFrom = a;
+            c.nTo = b;
+            m_heap.push_back(c);
+            std::push_heap(m_heap.begin(), m_heap.end());
+        }
+
+        if (!m_locked[b])
+        {
+            c.cost = q.evaluate(m_coords[a]);
+            c.nFrom = b;
+            c.nTo = a;
+            std::swap(c.nVersionFrom, c.nVersionTo);
+            m_heap.push_back(c);
+            std::push_heap(m_heap.begin(), m_heap.end());
+        }
+    }
+
+    bool MeshSimplifier::collapse(const Collapse& c)
+    {
+        // either vertex changed since the collapse was queued
+        if (m_versions[c.nFrom] != c.nVersionFrom || m_versions[c.nTo] != c.nVersionTo)
+            return false;
+
+        const std::vector<Uint>& from = m_vertexTriangles[c.nFrom];
+        Uint nShared = 0;
+
+        for (size_t i = 0; i < from.size(); i++)
+        {
+            const Uint* t = &m_triangles[3*from[i]];
+            if (m_removed[from[i]])
+                continue;
+
+            if (t[0] == c.nTo || t[1] == c.nTo || t[2] == c.nTo)
+            {
+                nShared++;
+                continue;
+            }
+
+            // the triangles moving with the vertex must not fold over
+            Vec3 p[3], q[3];
+            for (int k = 0; k < 3; k++)
+            {
+                p[k] = m_coords[t[k]];
+                q[k] = t[k] == c.nFrom ? m_coords[c.nTo] : p[k];
+            }
+
+            if (dot(cross(p[1] - p[0], p[2] - p[0]), cross(q[1] - q[0], q[2] - q[0])) <= 0)
+                return false;
+        }
+
+        if (nShared == 0)
+            return false;
+
+        // the link condition: the vertices next to both are the ones across the edge only, else the
+        // collapse pinches the surface into non-manifold edges or duplicate triangles
+        getLink(c.nFrom, m_linkFrom);
+        getLink(c.nTo, m_linkTo);
+
+        Uint nCommon = 0;
+        for (size_t i = 0, j = 0; i < m_linkFrom.size() && j < m_linkTo.size(); )
+        {
+            if (m_linkFrom[i] < m_linkTo[j])
+                i++;
+            else if (m_linkTo[j] < m_linkFrom[i])
+                j++;
+            else
+            {
+                nCommon++;
+                i++;
+                j++;
+            }
+        }
+
+        if (nCommon != nShared)
+            return false;
+
+        std::vector<Uint>& to = m_vertexTriangles[c.nTo];
+        for (size_t i = 0; i < from.size(); i++)
+        {
+            Uint* t = &m_triangles[3*from[i]];
+            if (m_removed[from[i]])
+                continue;
+
+            if (t[0] == c.nTo || t[1] == c.nTo || t[2] == c.nTo)
+            {
+                m_removed[from[i]] = 1;
+                m_nTriangles--;
+                continue;
+            }
+
+            for (int k = 0; k < 3; k++)
+                if (t[k] == c.nFrom)
+                    t[k] = c.nTo;
+            to.push_back(from[i]);
+        }
+
+        m_quadrics[c.nTo] += m_quadrics[c.nFrom];
+        m_versions[c.nTo]++;
+        m_versions[c.nFrom]++;
+        m_vertexTriangles[c.nFrom].clear();
+        m_fError = std::max(m_fError, (Float)sqrt(c.cost));
+
+        // drop the removed triangles and requeue the edges around the vertex
+        size_t n = 0;
+        for (size_t i = 0; i < to.size(); i++)
+            if (!m_removed[to[i]])
+                to[n++] = to[i];
+        to.resize(n);
+
+        m_neighbours.clear();
+        for (size_t i = 0; i < to.size(); i++)
+        {
+            const Uint* t = &m_triangles[3*to[i]];
+            for (int k = 0; k < 3; k++)
+                if (t[k] != c.nTo)
+                    m_neighbours.push_back(t[k]);
+        }
+
+        std::sort(m_neighbours.begin(), m_neighbours.end());
+        m_neighbours.erase(std::unique(m_neighbours.begin(), m_neighbours.end()), m_neighbours.end());
+        for (size_t i = 0; i < m_neighbours.size(); i++)
+            pushCollapses(c.nTo, m_neighbours[i]);
+
+        return true;
+    }
+
+    void MeshSimplifier::getLink(Uint v, std::vector<Uint>& link) const
+    {
+        link.clear();
+
+        const std::vector<Uint>& triangles = m_vertexTriangles[v];
+        for (size_t i = 0; i < triangles.size(); i++)
+        {
+            if (m_removed[triangles[i]])
+                continue;
+
+            const Uint* t = &m_triangles[3*triangles[i]];
+            for (int k = 0; k < 3; k++)
+                if (t[k] != v)
+                    link.push_back(t[k]);
+        }
+
+        std::sort(link.begin(), link.end());
+        link.erase(std::unique(link.begin(), link.end()), link.end());
+    }
+
+    void MeshSimplifier::simplify(Uint nTriangles, Uint_vec& result)
+    {
+        while (m_nTriangles > nTriangles && !m_heap.empty())
+        {
+            Collapse c = m_heap.front();
+            std::pop_heap(m_heap.begin(), m_heap.end());
+            m_heap.pop_back();
+
+            collapse(c);
+        }
+
+        result.clear();
+        result.reserve(m_nTriangles * 3);
+        for (Uint t = 0; t < m_removed.size(); t++)
+            if (!m_removed[t])
+                for (int k = 0; k < 3; k++)
+                    result.push_back(m_original[m_triangles[3*t+k]]);
+    }
+}
@@ -0,0 +1,82 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "VertexBuffer.h"
+#include <vector>
+
+namespace eh
+{
+    // Quadric error simplification of a triangle list (Garland, Heckbert). Edges collapse onto one of
+    // their two vertices, so every result still indexes the original vertex buffer. Vertices on edges
+    // with a single triangle, i.e. borders and seams of normals or texture coordinates, stay in place.
+    // Collapses breaking the link condition are left out, the surface stays manifold.
+    // Only reads the vertex buffer, several simplifiers may run in parallel on the same one.
+    class API_3D MeshSimplifier
+    {
+    public:
+        MeshSimplifier(const IVertexBuffer& vb, const Uint_vec& indices);
+
+        // collapses edges until at most nTriangles are left or no edge can go without folding a
+        // triangle over, and writes the remaining triangles to result. Calls continue from the last one.
+        void simplify(Uint nTriangles, Uint_vec& result);
+
+        Uint getTriangleCount() const
+        {
+            return m_nTriangles;
+        }
+
+        // distance of the removed surface to the remaining one, estimated by the largest quadric error
+        Float getError() const
+        {
+            return m_fError;
+        }
+
+    private:
+        // sum of squared distances to a set of planes, the upper half of a symmetric 4x4 matrix
+        struct Quadric
+        {
+            double q[10];
+
+            Quadric();
+            Quadric(double a, double b, double c, double d);
+            void operator += (const Quadric& other);
+            double evaluate(const Vec3& v) const;
+        };
+
+        struct Collapse
+        {
+            double cost;
+            Uint nFrom, nTo;
+            Uint nVersionFrom, nVersionTo;
+
+            bool operator < (const Collapse& other) const
+            {
+                return cost > other.cost;   // the cheapest first
+            }
+        };
+
+        void pushCollapses(Uint a, Uint b);
+        bool collapse(const Collapse& c);
+
+        // the vertices sharing a triangle with v, sorted
+        void getLink(Uint v, std::vector<Uint>& link) const;
+
+        std::vector<Uint> m_original;       // index into the vertex buffer of each vertex
+        std::vector<Vec3> m_coords;
+        std::vector<Quadric> m_quadrics;
+        std::vector<Uint> m_versions;       // counts the changes of the quadric of each vertex
+        std::vector<char> m_locked;
+
+        std::vector<Uint> m_triangles;      // three vertices each
+        std::vector<char> m_removed;
+        std::vector< std::vector<Uint> > m_vertexTriangles;
+
+        std::vector<Collapse> m_heap;
+        std::vector<Uint> m_neighbours;
+        std::vector<Uint> m_linkFrom, m_linkTo;
+        Uint m_nTriangles;
+        Float m_fError;
+    };
+}
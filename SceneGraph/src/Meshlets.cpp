@@ -0,0 +1,215 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "Meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace eh
+{
+    static const Uint NONE = 0xffffffff;
+
+    // bounding sphere and normal cone of the triangles of a meshlet
+    static void bound(const IVertexBuffer& vb, const Uint* pIndices, Uint nCount, Geometry::Meshlet& meshlet)
+    {
+        Vec3 min = vb.getCoord(pIndices[0]), max = min;
+        for (Uint i = 1; i < nCount; i++)
+        {
+            Vec3 v = vb.getCoord(pIndices[i]);
+            min.x = std::min(min.x, v.x);    max.x = std::max(max.x, v.x);
+            min.y = std::min(min.y, v.y);    max.y = std::max(max.y, v.y);
+            min.z = std::min(min.z, v.z);    max.z = std::max(max.z, v.z);
+        }
+
+        meshlet.center = (min + max) * 0.5f;
+        meshlet.fRadius = 0;
+        for (Uint i = 0; i < nCount; i++)
+            meshlet.fRadius = std::max(meshlet.fRadius, distance(meshlet.center, vb.getCoord(pIndices[i])));
+
+        std::vector<Vec3> normals;
+        Vec3 axis(0, 0, 0);
+        for (Uint i = 0; i + 2 < nCount; i += 3)
+        {
+            Vec3 a = vb.getCoord(pIndices[i]);
+            Vec3 n = cross(vb.getCoord(pIndices[i+1]) - a, vb.getCoord(pIndices[i+2]) - a);
+            Float fLen = n.getLen();
+            if (fLen <= 0)
+                continue;
+
+            normals.push_back(n * (1.f / fLen));
+            axis = axis + normals.back();
+        }
+
+        meshlet.fConeCutoff = 1.f;
+        meshlet.coneAxis = Vec3(0, 0, 1);
+
+        Float fLen = axis.getLen();
+        if (normals.empty() || fLen <= 0)
+            return;
+
+        meshlet.coneAxis = axis * (1.f / fLen);
+
+        Float fMinDot = 1.f;
+        for (size_t i = 0; i < normals.size(); i++)
+            fMinDot = std::min(fMinDot, dot(normals[i], meshlet.coneAxis));
+
+        // a cone of nearly 90 degrees or more has an eye in front of some triangle wherever the eye is
+        if (fMinDot > 0.1f)
+            meshlet.fConeCutoff = sqrt(1.f - fMinDot * fMinDot);
+    }
+
+    void Meshlets::build(const IVertexBuffer& vb, Uint_vec& indices, std::vector<Geometry::Meshlet>& meshlets)
+    {
+        meshlets.clear();
+
+        Uint nTriangles = (Uint)indices.size() / 3;
+        if (nTriangles == 0)
+            return;
+
+        Uint nVertices = *std::max_element(indices.begin(), indices.begin() + nTriangles * 3) + 1;
+
+        // the triangles around each vertex
+        std::vector<Uint> offsets(nVertices + 1, 0);
+        for (Uint i = 0; i < nTriangles * 3; i++)
+            offsets[indices[i] + 1]++;
+        for (Uint v = 0; v < nVertices; v++)
+            offsets[v + 1] += offsets[v];
+
+        std::vector<Uint> adjacency(nTriangles * 3);
+        std::vector<Uint> fill(offsets.begin(), offsets.end() - 1);
+        for (Uint i = 0; i < nTriangles * 3; i++)
+            adjacency[fill[indices[i]]++] = i / 3;
+
+        std::vector<char> emitted(nTriangles, 0);
+        std::vector<Uint> queued(nTriangles, NONE);    // meshlet a triangle is a candidate for
+        std::vector<Uint> used(nVertices, NONE);       // meshlet a vertex is part of
+
+        Uint_vec result;
+        result.reserve(nTriangles * 3);
+
+        std::vector<Uint> candidates;
+        Uint nSeed = 0;
+
+        for (;;)
+        {
+            while (nSeed < nTriangles && emitted[nSeed])
+                nSeed++;
+            if (nSeed == nTriangles)
+                break;
+
+            Uint nMeshlet = (Uint)meshlets.size();
+            Uint nFirst = (Uint)result.size();
+            Uint nTriangleCount = 0, nVertexCount = 0;
+
+            candidates.clear();
+            candidates.push_back(nSeed);
+            queued[nSeed] = nMeshlet;
+
+            // grows by the neighbour adding the fewest vertices
+            while (nTriangleCount < MAX_TRIANGLES && !candidates.empty())
+            {
+                size_t nBest = 0;
+                Uint nBestNew = 4;
+                for (size_t i = 0; i < candidates.size() && nBestNew > 0; i++)
+                {
+                    const Uint* t = &indices[3 * candidates[i]];
+                    Uint nNew = (used[t[0]] != nMeshlet) + (used[t[1]] != nMeshlet) + (used[t[2]] != nMeshlet);
+                    if (nNew < nBestNew)
+                    {
+                        nBestNew = nNew;
+                        nBest = i;
+                    }
+                }
+
+                if (nVertexCount + nBestNew > MAX_VERTICES)
+                    break;
+
+                Uint nTriangle = candidates[nBest];
+                candidates[nBest] = candidates.back();
+                candidates.pop_back();
+
+                emitted[nTriangle] = 1;
+                nTriangleCount++;
+
+                for (int k = 0; k < 3; k++)
+                {
+                    Uint v = indices[3 * nTriangle + k];
+                    result.push_back(v);
+
+                    if (used[v] == nMeshlet)
+                        continue;
+
+                    used[v] = nMeshlet;
+                    nVertexCount++;
+
+                    for (Uint a = offsets[v]; a < offsets[v + 1]; a++)
+                        if (!emitted[adjacency[a]] && queued[adjacency[a]] != nMeshlet)
+                        {
+                            queued[adjacency[a]] = nMeshlet;
+                            candidates.push_back(adjacency[a]);
+                        }
+                }
+            }
+
+            Geometry::Meshlet meshlet;
+            meshlet.nFirst = nFirst;
+            meshlet.nCount = (Uint)result.size() - nFirst;
+            bound(vb, &result[nFirst], meshlet.nCount, meshlet);
+            meshlets.push_back(meshlet);
+        }
+
+        // a partial triangle at the end stays where it was
+        result.insert(result.end(), indices.begin() + nTriangles * 3, indices.end());
+        indices.swap(result);
+    }
+
+    Uint Meshlets::cull(const Geometry& geometry, const Matrix& worldView, const Matrix& proj, bool bBackfaces, std::vector<Uint>& ranges)
+    {
+        ranges.clear();
+
+        // in the coordinates of the geometry
+        Frustum frustum;
+        frustum.extractFrom(proj, worldView);
+
+        Matrix inv = Matrix::Inverse(worldView);
+        Vec3 eye(inv[12], inv[13], inv[14]);
+
+        // an orthographic view has no eye point to test the cones against
+        bool bCones = bBackfaces && proj[15] == 0;
+
+        // a mirroring world turns the winding over, the driver then culls the triangles facing the eye
+        const Matrix& wv = worldView;
+        Float fDet = wv[0] * (wv[5] * wv[10] - wv[6] * wv[9]) - wv[1] * (wv[4] * wv[10] - wv[6] * wv[8]) + wv[2] * (wv[4] * wv[9] - wv[5] * wv[8]);
+        Float fFacing = fDet < 0 ? -1.f : 1.f;
+
+        Uint nVisible = 0;
+        const std::vector<Geometry::Meshlet>& meshlets = geometry.getMeshlets();
+        for (size_t i = 0; i < meshlets.size(); i++)
+        {
+            const Geometry::Meshlet& m = meshlets[i];
+            Vec3 r(m.fRadius, m.fRadius, m.fRadius);
+
+            if (frustum.isAABBInside(AABBox(m.center - r, m.center + r)) == 0)
+                continue;
+
+            // all triangles face away from an eye inside the cone behind the meshlet, or mirrored in front
+            if (bCones)
+            {
+                Vec3 d = (m.center - eye) * fFacing;
+                if (dot(d, m.coneAxis) >= m.fConeCutoff * d.getLen() + m.fRadius)
+                    continue;
+            }
+
+            if (!ranges.empty() && ranges[ranges.size() - 2] + ranges.back() == m.nFirst)
+                ranges.back() += m.nCount;
+            else
+            {
+                ranges.push_back(m.nFirst);
+                ranges.push_back(m.nCount);
+            }
+            nVisible += m.nCount;
+        }
+
+        return nVisible;
+    }
+}
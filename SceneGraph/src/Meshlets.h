@@ -0,0 +1,27 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "Geometry.h"
+#include <vector>
+
+namespace eh
+{
+    // Splits triangle lists into meshlets (Geometry::Meshlet) and finds those a view can see, so a
+    // large geometry is culled piece by piece instead of as a whole.
+    class API_3D Meshlets
+    {
+    public:
+        static const Uint MAX_TRIANGLES = 124;
+        static const Uint MAX_VERTICES = 64;
+
+        // reorders the triangles of indices into meshlets of neighbouring triangles
+        static void build(const IVertexBuffer& vb, Uint_vec& indices, std::vector<Geometry::Meshlet>& meshlets);
+
+        // The index ranges (first, count) of the meshlets of geometry inside the frustum and, with
+        // bBackfaces, not facing away from the eye (towards it if worldView mirrors, as the winding
+        // turns over). Ranges next to each other are merged.
+        // Returns the number of indices in the ranges.
+        static Uint cull(const Geometry& geometry, const Matrix& worldView, const Matrix& proj, bool bBackfaces, std::vector<Uint>& ranges);
+    };
+}
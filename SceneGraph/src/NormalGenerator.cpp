@@ -0,0 +1,158 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "NormalGenerator.h"
+#include "Parallel.h"
+
+#include <cmath>
+
+namespace eh
+{
+    NormalGenerator::NormalGenerator(Float fCreaseAngle, WEIGHTING weighting):
+        m_fCosCrease(fCreaseAngle >= 180.f ? -2.f : cos(DEG2RAD(fCreaseAngle))),
+        m_weighting(weighting),
+        m_pCoords(NULL),
+        m_pCorners(NULL)
+    {
+    }
+
+    void NormalGenerator::generate(const Vec3* pCoords, Uint nCoords, const Uint* pCorners, Uint nCorners)
+    {
+        m_pCoords = pCoords;
+        m_pCorners = pCorners;
+
+        nCorners -= nCorners % 3;
+        Uint nTriangles = nCorners / 3;
+
+        m_faceNormals.resize(nTriangles);
+        m_cornerWeighted.resize(nCorners);
+        m_cornerGroups.resize(nCorners);
+        m_cornerVertices.resize(nCorners);
+
+        parallelFor(nTriangles, boost::bind(&NormalGenerator::weightCorners, this, _1, _2));
+
+        // corners by coordinate, in corner order so the result doesn't depend on the threads
+        m_coordOffsets.assign(nCoords + 1, 0);
+        for (Uint i = 0; i < nCorners; i++)
+            m_coordOffsets[ pCorners[i] + 1 ]++;
+        for (Uint c = 0; c < nCoords; c++)
+            m_coordOffsets[c + 1] += m_coordOffsets[c];
+
+        m_coordCorners.resize(nCorners);
+        std::vector<Uint> fill(m_coordOffsets.begin(), m_coordOffsets.end() - 1);
+        for (Uint i = 0; i < nCorners; i++)
+            m_coordCorners[ fill[pCorners[i]]++ ] = i;
+
+        // m_coordVertices[c] is the group count of c until the prefix sum below
+        m_coordVertices.assign(nCoords + 1, 0);
+        parallelFor(nCoords, boost::bind(&NormalGenerator::groupCorners, this, _1, _2));
+
+        Uint nVertices = 0;
+        for (Uint c = 0; c < nCoords; c++)
+        {
+            Uint n = m_coordVertices[c];
+            m_coordVertices[c] = nVertices;
+            nVertices += n;
+        }
+        m_coordVertices[nCoords] = nVertices;
+
+        m_vertexCoords.resize(nVertices);
+        m_normals.assign(nVertices, Vec3::Null());
+        parallelFor(nCoords, boost::bind(&NormalGenerator::sumNormals, this, _1, _2));
+
+        m_faceNormals.clear();
+        m_cornerWeighted.clear();
+        m_coordOffsets.clear();
+        m_coordCorners.clear();
+        m_cornerGroups.clear();
+        m_coordVertices.clear();
+    }
+
+    void NormalGenerator::weightCorners(Uint begin, Uint end)
+    {
+        for (Uint t = begin; t < end; t++)
+        {
+            const Vec3& a = m_pCoords[ m_pCorners[3*t+0] ];
+            const Vec3& b = m_pCoords[ m_pCorners[3*t+1] ];
+            const Vec3& c = m_pCoords[ m_pCorners[3*t+2] ];
+
+            Vec3 n = cross(b-a, c-a);   // length is twice the area
+            m_faceNormals[t] = n.normalized();
+
+            if (m_weighting == WEIGHT_AREA)
+            {
+                m_cornerWeighted[3*t+0] = n;
+                m_cornerWeighted[3*t+1] = n;
+                m_cornerWeighted[3*t+2] = n;
+            }
+            else
+            {
+                Vec3 ab = (b-a).normalized(), bc = (c-b).normalized(), ca = (a-c).normalized();
+
+                Float wa = acos( std::max(-1.f, std::min(1.f, -dot(ca, ab))) );
+                Float wb = acos( std::max(-1.f, std::min(1.f, -dot(ab, bc))) );
+                Float wc = PI - wa - wb;
+
+                m_cornerWeighted[3*t+0] = m_faceNormals[t] * wa;
+                m_cornerWeighted[3*t+1] = m_faceNormals[t] * wb;
+                m_cornerWeighted[3*t+2] = m_faceNormals[t] * wc;
+            }
+        }
+    }
+
+    void NormalGenerator::groupCorners(Uint begin, Uint end)
+    {
+        std::vector<Vec3> seeds;
+
+        for (Uint c = begin; c < end; c++)
+        {
+            seeds.clear();
+
+            for (Uint k = m_coordOffsets[c]; k < m_coordOffsets[c+1]; k++)
+            {
+                Uint corner = m_coordCorners[k];
+                const Vec3& n = m_faceNormals[corner/3];
+
+                // degenerate triangles join the first group, they add nothing to it
+                Uint g = 0;
+                if (!(n == Vec3::Null()))
+                {
+                    if (seeds.size() > 0 && seeds[0] == Vec3::Null())
+                        seeds[0] = n;
+
+                    while (g < seeds.size() && dot(seeds[g], n) < m_fCosCrease)
+                        g++;
+                }
+
+                if (g == seeds.size())
+                    seeds.push_back(n);
+
+                m_cornerGroups[corner] = g;
+            }
+
+            m_coordVertices[c] = (Uint)seeds.size();
+        }
+    }
+
+    void NormalGenerator::sumNormals(Uint begin, Uint end)
+    {
+        for (Uint c = begin; c < end; c++)
+        {
+            Uint first = m_coordVertices[c];
+
+            for (Uint v = first; v < m_coordVertices[c+1]; v++)
+                m_vertexCoords[v] = c;
+
+            for (Uint k = m_coordOffsets[c]; k < m_coordOffsets[c+1]; k++)
+            {
+                Uint corner = m_coordCorners[k];
+                Uint v = first + m_cornerGroups[corner];
+
+                m_cornerVertices[corner] = v;
+                m_normals[v] += m_cornerWeighted[corner];
+            }
+
+            for (Uint v = first; v < m_coordVertices[c+1]; v++)
+                m_normals[v] = m_normals[v].normalized();
+        }
+    }
+}
@@ -0,0 +1,69 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include <vector>
+
+namespace eh
+{
+    // Smooth vertex normals for indexed triangles, shared by the loaders.
+    // The weighted face normals around each coordinate are summed once and normalized once,
+    // corners whose faces differ by more than the crease angle get a vertex of their own.
+    class API_3D NormalGenerator
+    {
+    public:
+        enum WEIGHTING
+        {
+            WEIGHT_ANGLE,   // by the corner angle, independent of the tessellation
+            WEIGHT_AREA     // by the triangle area
+        };
+
+        // fCreaseAngle in degrees, 180 never splits
+        NormalGenerator(Float fCreaseAngle = 180.f, WEIGHTING weighting = WEIGHT_ANGLE);
+
+        // pCorners holds nCorners indices into pCoords, three per triangle
+        void generate(const Vec3* pCoords, Uint nCoords, const Uint* pCorners, Uint nCorners);
+
+        Uint getVertexCount() const
+        {
+            return (Uint)m_normals.size();
+        }
+        // vertex of each corner
+        const Uint_vec& getCornerVertices() const
+        {
+            return m_cornerVertices;
+        }
+        // coordinate index of each vertex
+        const Uint_vec& getVertexCoords() const
+        {
+            return m_vertexCoords;
+        }
+        const std::vector<Vec3>& getNormals() const
+        {
+            return m_normals;
+        }
+
+    private:
+        void weightCorners(Uint begin, Uint end);
+        void groupCorners(Uint begin, Uint end);
+        void sumNormals(Uint begin, Uint end);
+
+        Float m_fCosCrease;
+        WEIGHTING m_weighting;
+
+        const Vec3* m_pCoords;
+        const Uint* m_pCorners;
+
+        std::vector<Vec3> m_faceNormals;    // unit normal per triangle
+        std::vector<Vec3> m_cornerWeighted; // weighted normal per corner
+        Uint_vec m_coordOffsets;            // corners of coordinate c are m_coordCorners[m_coordOffsets[c]..m_coordOffsets[c+1]]
+        Uint_vec m_coordCorners;
+        Uint_vec m_cornerGroups;            // crease group of the corner within its coordinate
+        Uint_vec m_coordVertices;           // first vertex of each coordinate
+
+        Uint_vec m_cornerVertices;
+        Uint_vec m_vertexCoords;
+        std::vector<Vec3> m_normals;
+    };
+}
@@ -0,0 +1,309 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "OcclusionCuller.h"
+#include "ShapeNode.h"
+#include "StopWatch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#include <xmmintrin.h>
+#define OCCLUSION_SSE
+#endif
+
+namespace eh
+{
+    OcclusionCuller::OcclusionCuller():
+        m_nTriangles(0),
+        m_nOccluders(0),
+        m_nTested(0),
+        m_nOccluded(0),
+        m_fRasterTime(0)
+    {
+    }
+
+    void OcclusionCuller::begin(const Matrix& view, const Matrix& proj, const Rect& viewport, const TransformCache& transforms)
+    {
+        StopWatch watch;
+
+        m_viewProj = view * proj;
+        m_frustum.extractFrom(proj, view);
+        m_nTriangles = 0;
+        m_nOccluders = 0;
+        m_nTested = 0;
+        m_nOccluded = 0;
+
+        Uint nHeight = WIDTH;
+        if (viewport.Width() > 0)
+            nHeight = (Uint)std::min(std::max(WIDTH * viewport.Height() / viewport.Width(), 8.f), 2.f * WIDTH);
+
+        m_levels.resize(1);
+        m_levels[0].nWidth = WIDTH;
+        m_levels[0].nHeight = nHeight;
+        m_levels[0].depth.assign(WIDTH * nHeight, 1.f);
+
+        // the largest shapes relative to their distance from the eye
+        Matrix inv = Matrix::Inverse(view);
+        Vec3 eye(inv[12], inv[13], inv[14]);
+
+        std::vector< std::pair<Float, Uint> > candidates;
+        const std::vector<TransformCache::Entry>& entries = transforms.getEntries();
+        for (Uint i = 0; i < entries.size(); i++)
+        {
+            const TransformCache::Entry& entry = entries[i];
+            if (entry.pGroup || !entry.bound.valid() || (entry.pNode->getFlags() & SceneNode::FLAG_UNVISIBLE))
+                continue;
+
+            if (m_frustum.isAABBInside(entry.bound) == 0)
+                continue;
+
+            Float fDistance = std::max(distance(eye, entry.bound.getCenter()), 1e-6f);
+            candidates.push_back(std::make_pair(entry.bound.getSize().getLen() / fDistance, i));
+        }
+
+        size_t nCandidates = std::min(candidates.size(), (size_t)MAX_OCCLUDERS);
+        std::partial_sort(candidates.begin(), candidates.begin() + nCandidates, candidates.end(),
+                          std::greater< std::pair<Float, Uint> >());
+
+        for (size_t i = 0; i < nCandidates && m_nTriangles < MAX_TRIANGLES; i++)
+        {
+            const TransformCache::Entry& entry = entries[candidates[i].second];
+            if (const ShapeNode* pShape = dynamic_cast<const ShapeNode*>(entry.pNode))
+            {
+                rasterize(*pShape, entry.world);
+                m_nOccluders++;
+            }
+        }
+
+        buildPyramid();
+
+        m_fRasterTime = watch.elapsed();
+    }
+
+    void OcclusionCuller::rasterize(const ShapeNode& shape, const Matrix& world)
+    {
+        Matrix m = world * m_viewProj;
+
+        for (GeometryIterator it = shape.GeometryBegin(); it != shape.GeometryEnd(); ++it)
+        {
+            // only opaque triangles hide what's behind them
+            Ptr<Material> pMaterial = it.getMaterial();
+            if (it.getType() != Geometry::TRIANGLES || (pMaterial && pMaterial->isBlended()))
+                continue;
+
+            const Geometry& geo = *it.getGeometry();
+            for (Uint i = 0, n = geo.getVertexCount(); i + 2 < n && m_nTriangles < MAX_TRIANGLES; i += 3, m_nTriangles++)
+            {
+                clipTriangle( transform(Vec4(geo.getCoord(i), 1.f), m),
+                              transform(Vec4(geo.getCoord(i+1), 1.f), m),
+                              transform(Vec4(geo.getCoord(i+2), 1.f), m) );
+            }
+        }
+    }
+
+    void OcclusionCuller::clipTriangle(const Vec4& a, const Vec4& b, const Vec4& c)
+    {
+        // distances to the near plane z = -w, walls and floors around the eye always cross it
+        const Vec4* v[3] = { &a, &b, &c };
+        Float d[3] = { a.z + a.w, b.z + b.w, c.z + c.w };
+
+        if (d[0] >= 0 && d[1] >= 0 && d[2] >= 0)
+            return rasterizeTriangle(a, b, c);
+
+        Vec4 poly[4] = { a, a, a, a };
+        int n = 0;
+        for (int i = 0; i < 3; i++)
+        {
+            int j = (i + 1) % 3;
+            if (d[i] >= 0)
+                poly[n++] = *v[i];
+
+            if ((d[i] >= 0) != (d[j] >= 0))
+            {
+                Float t = d[i] / (d[i] - d[j]);
+                poly[n++] = Vec4( v[i]->x + (v[j]->x - v[i]->x) * t, v[i]->y + (v[j]->y - v[i]->y) * t,
+                                  v[i]->z + (v[j]->z - v[i]->z) * t, v[i]->w + (v[j]->w - v[i]->w) * t );
+            }
+        }
+
+        for (int i = 2; i < n; i++)
+            rasterizeTriangle(poly[0], poly[i-1], poly[i]);
+    }
+
+    void OcclusionCuller::rasterizeTriangle(const Vec4& a, const Vec4& b, const Vec4& c)
+    {
+        const Float fNear = 1e-6f;
+        if (a.w < fNear || b.w < fNear || c.w < fNear)
+            return;
+
+        Level& level = m_levels[0];
+        Float W = (Float)level.nWidth, H = (Float)level.nHeight;
+
+        Float x[3] = { (a.x / a.w * 0.5f + 0.5f) * W, (b.x / b.w * 0.5f + 0.5f) * W, (c.x / c.w * 0.5f + 0.5f) * W };
+        Float y[3] = { (a.y / a.w * 0.5f + 0.5f) * H, (b.y / b.w * 0.5f + 0.5f) * H, (c.y / c.w * 0.5f + 0.5f) * H };
+        Float z[3] = { a.z / a.w * 0.5f + 0.5f, b.z / b.w * 0.5f + 0.5f, c.z / c.w * 0.5f + 0.5f };
+
+        Float fArea = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+        if (fabs(fArea) < 1e-8f)
+            return;
+
+        // both faces occlude, the edge functions are made positive inside
+        if (fArea < 0)
+        {
+            std::swap(x[1], x[2]);
+            std::swap(y[1], y[2]);
+            std::swap(z[1], z[2]);
+            fArea = -fArea;
+        }
+
+        int x0 = std::max(0, (int)floor(std::min(x[0], std::min(x[1], x[2]))));
+        int x1 = std::min((int)level.nWidth - 1, (int)floor(std::max(x[0], std::max(x[1], x[2]))));
+        int y0 = std::max(0, (int)floor(std::min(y[0], std::min(y[1], y[2]))));
+        int y1 = std::min((int)level.nHeight - 1, (int)floor(std::max(y[0], std::max(y[1], y[2]))));
+        if (x0 > x1 || y0 > y1)
+            return;
+
+        // edge k is opposite of vertex k, e(px,py) = dx*px + dy*py + c
+        Float dx[3], dy[3], e[3];
+        for (int k = 0; k < 3; k++)
+        {
+            int i = (k + 1) % 3, j = (k + 2) % 3;
+            dx[k] = y[i] - y[j];
+            dy[k] = x[j] - x[i];
+            e[k] = x[i] * y[j] - x[j] * y[i];
+        }
+
+        Float fInv = 1.f / fArea;
+        Float dzdx = (dx[0] * z[0] + dx[1] * z[1] + dx[2] * z[2]) * fInv;
+        Float dzdy = (dy[0] * z[0] + dy[1] * z[1] + dy[2] * z[2]) * fInv;
+        Float z0 = (e[0] * z[0] + e[1] * z[1] + e[2] * z[2]) * fInv;
+
+        // conservative: the edges are tested at the texel corner farthest inside, so only texels
+        // the triangle covers completely are written, with the farthest depth it has over the texel
+        for (int k = 0; k < 3; k++)
+            e[k] -= 0.5f * (fabs(dx[k]) + fabs(dy[k]));
+        z0 += 0.5f * (fabs(dzdx) + fabs(dzdy));
+
+        x0 &= ~3;   // rows are processed 4 pixels at a time, the width is a multiple of 4
+
+        for (int py = y0; py <= y1; py++)
+        {
+            Float* pRow = &level.depth[py * level.nWidth];
+            Float fy = py + 0.5f, fx = x0 + 0.5f;
+
+            Float w0 = dx[0] * fx + dy[0] * fy + e[0];
+            Float w1 = dx[1] * fx + dy[1] * fy + e[1];
+            Float w2 = dx[2] * fx + dy[2] * fy + e[2];
+            Float wz = dzdx * fx + dzdy * fy + z0;
+
+#if defined(OCCLUSION_SSE)
+            const __m128 vStep = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+            const __m128 vZero = _mm_setzero_ps();
+
+            __m128 v0 = _mm_add_ps(_mm_set1_ps(w0), _mm_mul_ps(vStep, _mm_set1_ps(dx[0])));
+            __m128 v1 = _mm_add_ps(_mm_set1_ps(w1), _mm_mul_ps(vStep, _mm_set1_ps(dx[1])));
+            __m128 v2 = _mm_add_ps(_mm_set1_ps(w2), _mm_mul_ps(vStep, _mm_set1_ps(dx[2])));
+            __m128 vz = _mm_add_ps(_mm_set1_ps(wz), _mm_mul_ps(vStep, _mm_set1_ps(dzdx)));
+
+            const __m128 d0 = _mm_set1_ps(dx[0] * 4), d1 = _mm_set1_ps(dx[1] * 4), d2 = _mm_set1_ps(dx[2] * 4);
+            const __m128 dz = _mm_set1_ps(dzdx * 4);
+
+            for (int px = x0; px <= x1; px += 4)
+            {
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(v0, vZero), _mm_cmpge_ps(v1, vZero)), _mm_cmpge_ps(v2, vZero));
+                __m128 depth = _mm_loadu_ps(pRow + px);
+                __m128 nearer = _mm_min_ps(depth, vz);
+                _mm_storeu_ps(pRow + px, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, depth)));
+
+                v0 = _mm_add_ps(v0, d0);
+                v1 = _mm_add_ps(v1, d1);
+                v2 = _mm_add_ps(v2, d2);
+                vz = _mm_add_ps(vz, dz);
+            }
+#else
+            for (int px = x0; px <= x1; px++)
+            {
+                if (w0 >= 0 && w1 >= 0 && w2 >= 0 && wz < pRow[px])
+                    pRow[px] = wz;
+
+                w0 += dx[0];
+                w1 += dx[1];
+                w2 += dx[2];
+                wz += dzdx;
+            }
+#endif
+        }
+    }
+
+    void OcclusionCuller::buildPyramid()
+    {
+        while (m_levels.back().nWidth > 1 || m_levels.back().nHeight > 1)
+        {
+            const Level& src = m_levels.back();
+
+            Level dst;
+            dst.nWidth = (src.nWidth + 1) / 2;
+            dst.nHeight = (src.nHeight + 1) / 2;
+            dst.depth.resize(dst.nWidth * dst.nHeight);
+
+            for (Uint y = 0; y < dst.nHeight; y++)
+                for (Uint x = 0; x < dst.nWidth; x++)
+                {
+                    Uint sx = std::min(2*x + 1, src.nWidth - 1), sy = std::min(2*y + 1, src.nHeight - 1);
+                    dst.depth[y * dst.nWidth + x] = std::max( std::max(src.depth[2*y * src.nWidth + 2*x], src.depth[2*y * src.nWidth + sx]),
+                                                              std::max(src.depth[sy * src.nWidth + 2*x], src.depth[sy * src.nWidth + sx]) );
+                }
+
+            m_levels.push_back(dst);
+        }
+    }
+
+    bool OcclusionCuller::isVisible(const AABBox& box) const
+    {
+        m_nTested++;
+
+        if (!box.valid() || m_levels.empty())
+            return true;
+
+        const Level& level = m_levels[0];
+        const Vec3& bmin = box.getMin();
+        const Vec3& bmax = box.getMax();
+
+        Float x0 = FLT_MAX, y0 = FLT_MAX, x1 = -FLT_MAX, y1 = -FLT_MAX, fDepth = FLT_MAX;
+        for (int i = 0; i < 8; i++)
+        {
+            Vec4 v = transform(Vec4(i & 1 ? bmax.x : bmin.x, i & 2 ? bmax.y : bmin.y, i & 4 ? bmax.z : bmin.z, 1.f), m_viewProj);
+
+            // reaching behind the near plane, the box covers the eye
+            if (v.w < 1e-5f || v.z < -v.w)
+                return true;
+
+            Float sx = (v.x / v.w * 0.5f + 0.5f) * level.nWidth;
+            Float sy = (v.y / v.w * 0.5f + 0.5f) * level.nHeight;
+            x0 = std::min(x0, sx); x1 = std::max(x1, sx);
+            y0 = std::min(y0, sy); y1 = std::max(y1, sy);
+            fDepth = std::min(fDepth, v.z / v.w * 0.5f + 0.5f);
+        }
+
+        if (x1 < 0 || y1 < 0 || x0 >= level.nWidth || y0 >= level.nHeight)
+            return true;
+
+        Uint ix0 = (Uint)std::max(0.f, x0), ix1 = (Uint)std::min(x1, level.nWidth - 1.f);
+        Uint iy0 = (Uint)std::max(0.f, y0), iy1 = (Uint)std::min(y1, level.nHeight - 1.f);
+
+        // the level where the rectangle covers at most 2x2 texels
+        Uint l = 0;
+        while ((ix1 >> l) - (ix0 >> l) > 1 || (iy1 >> l) - (iy0 >> l) > 1)
+            l++;
+
+        const Level& test = m_levels[l];
+        for (Uint y = iy0 >> l; y <= iy1 >> l; y++)
+            for (Uint x = ix0 >> l; x <= ix1 >> l; x++)
+                if (test.depth[y * test.nWidth + x] >= fDepth)
+                    return true;
+
+        m_nOccluded++;
+        return false;
+    }
+}
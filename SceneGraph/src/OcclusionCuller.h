@@ -0,0 +1,59 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "TransformCache.h"
+#include <vector>
+
+namespace eh
+{
+    // Occlusion culling on the CPU: the largest nearby opaque shapes are rasterized into a small
+    // depth buffer, a pyramid of its farthest depths then answers whether a box is hidden behind them.
+    // Hidden boxes may be reported visible, visible ones are never reported hidden: a texel takes the
+    // depth of an occluder only where one triangle covers it completely.
+    class API_3D OcclusionCuller
+    {
+    public:
+        static const Uint WIDTH = 256;              // of the depth buffer, the height follows the viewport
+        static const Uint MAX_OCCLUDERS = 64;
+        static const Uint MAX_TRIANGLES = 32768;    // rasterized per frame
+
+        OcclusionCuller();
+
+        // rasterizes the occluders picked from the world transforms of the scene for this view
+        void begin(const Matrix& view, const Matrix& proj, const Rect& viewport, const TransformCache& transforms);
+
+        // false if box (world space) is hidden for certain
+        bool isVisible(const AABBox& box) const;
+
+        // of the last frame
+        Uint getOccluderCount() const { return m_nOccluders; }
+        Uint getTestedCount() const { return m_nTested; }
+        Uint getOccludedCount() const { return m_nOccluded; }
+        double getRasterTime() const { return m_fRasterTime; }
+
+    private:
+        void rasterize(const ShapeNode& shape, const Matrix& world);
+        void clipTriangle(const Vec4& a, const Vec4& b, const Vec4& c);
+        void rasterizeTriangle(const Vec4& a, const Vec4& b, const Vec4& c);
+        void buildPyramid();
+
+        Matrix m_viewProj;
+        Frustum m_frustum;
+
+        // level 0 is the depth buffer, each level holds the farthest depth of 2x2 texels of the one before
+        struct Level
+        {
+            Uint nWidth, nHeight;
+            std::vector<Float> depth;
+        };
+        std::vector<Level> m_levels;
+
+        Uint m_nTriangles;
+        Uint m_nOccluders;
+        mutable Uint m_nTested;
+        mutable Uint m_nOccluded;
+        double m_fRasterTime;
+    };
+}
@@ -0,0 +1,136 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "Parallel.h"
+
+namespace eh
+{
+    TaskPool::TaskPool(Uint nWorkers):
+        m_bStop(false)
+    {
+        for (Uint i = 0; i < nWorkers; i++)
+            m_workers.create_thread(boost::bind(&TaskPool::work, this));
+    }
+
+    TaskPool::~TaskPool()
+    {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_bStop = true;
+            m_queued.notify_all();
+        }
+        m_workers.join_all();
+    }
+
+    namespace
+    {
+        TaskPool* g_pPool = NULL;
+        boost::once_flag g_poolOnce = BOOST_ONCE_INIT;
+
+        void createPool()
+        {
+            // left to the end of the process, joining threads while a DLL unloads would hang
+            g_pPool = new TaskPool(std::max(1u, boost::thread::hardware_concurrency()) - 1);
+        }
+    }
+
+    TaskPool& TaskPool::global()
+    {
+        boost::call_once(g_poolOnce, &createPool);
+        return *g_pPool;
+    }
+
+    Uint TaskPool::take(Job*& pJob)
+    {
+        pJob = m_jobs.front();
+        Uint i = pJob->nNext++;
+        if (pJob->nNext == pJob->nTasks)
+            m_jobs.pop_front();
+        return i;
+    }
+
+    void TaskPool::call(Job& job, Uint i)
+    {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (job.error)
+                return;
+        }
+
+        // an exception must not leave a worker, nor run() while workers use the job
+        try
+        {
+            (*job.pFunction)(i);
+        }
+        catch (...)
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            if (!job.error)
+                job.error = boost::current_exception();
+        }
+    }
+
+    void TaskPool::run(Uint nTasks, const boost::function<void (Uint)>& f)
+    {
+        if (nTasks == 0)
+            return;
+
+        if (nTasks == 1 || m_workers.size() == 0)
+        {
+            for (Uint i = 0; i < nTasks; i++)
+                f(i);
+            return;
+        }
+
+        Job job;
+        job.pFunction = &f;
+        job.nTasks = nTasks;
+        job.nNext = 0;
+        job.nDone = 0;
+
+        boost::mutex::scoped_lock lock(m_mutex);
+        m_jobs.push_back(&job);
+        m_queued.notify_all();
+
+        // the tasks of this job only, a task of another one could take much longer
+        while (job.nNext < job.nTasks)
+        {
+            Uint i = job.nNext++;
+            if (job.nNext == job.nTasks)
+                m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), &job));
+
+            lock.unlock();
+            call(job, i);
+            lock.lock();
+            job.nDone++;
+        }
+
+        while (job.nDone < job.nTasks)
+            m_done.wait(lock);
+
+        if (job.error)
+            boost::rethrow_exception(job.error);
+    }
+
+    void TaskPool::work()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        for (;;)
+        {
+            while (m_jobs.empty() && !m_bStop)
+                m_queued.wait(lock);
+
+            if (m_bStop)
+                return;
+
+            Job* pJob = NULL;
+            Uint i = take(pJob);
+
+            lock.unlock();
+            call(*pJob, i);
+            lock.lock();
+
+            if (++pJob->nDone == pJob->nTasks)
+                m_done.notify_all();
+        }
+    }
+}
@@ -0,0 +1,89 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include <deque>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/exception_ptr.hpp>
+#include <algorithm>
+
+namespace eh
+{
+    // Worker threads started once and kept waiting for tasks, so a parallel loop doesn't create
+    // and join threads each time it runs. A thread calling run() works on its own tasks as well
+    // until they are all taken, so run() may be called from several threads and from within a task.
+    class API_3D TaskPool: boost::noncopyable
+    {
+    public:
+        explicit TaskPool(Uint nWorkers);
+        ~TaskPool();
+
+        // the pool of the process, a worker less than hardware threads, started on first use and
+        // never stopped
+        static TaskPool& global();
+
+        // the workers and the calling thread
+        Uint getThreadCount() const { return (Uint)m_workers.size() + 1; }
+
+        // calls f(i) for each i in [0, nTasks) and returns when all calls are done. If a call
+        // throws, the tasks not started yet are skipped and the first exception is thrown here.
+        void run(Uint nTasks, const boost::function<void (Uint)>& f);
+
+    private:
+        struct Job
+        {
+            const boost::function<void (Uint)>* pFunction;
+            Uint nTasks;
+            Uint nNext;         // the first task not taken
+            Uint nDone;
+            boost::exception_ptr error; // of the first task failed
+        };
+
+        // takes the next task of the front job, the lock is held
+        Uint take(Job*& pJob);
+        // calls task i of job unless one has failed, the lock isn't held
+        void call(Job& job, Uint i);
+        void work();
+
+        boost::thread_group m_workers;
+        boost::mutex m_mutex;
+        boost::condition_variable m_queued;
+        boost::condition_variable m_done;
+        std::deque<Job*> m_jobs;        // with tasks not taken yet
+        bool m_bStop;
+    };
+
+    namespace detail
+    {
+        inline void runRange(const boost::function<void (Uint, Uint)>& f, Uint nRange, Uint nCount, Uint i)
+        {
+            f(i * nRange, std::min((i + 1) * nRange, nCount));
+        }
+    }
+
+    // Splits [0, nCount) into one contiguous range per thread of the TaskPool and calls f(begin, end)
+    // for each of them, the calling thread takes part. Returns when all ranges are done.
+    // Ranges smaller than nMinRange aren't worth a thread, small counts run on the calling thread only.
+    // nMaxThreads other than 0 replaces the number of threads.
+    inline void parallelFor(Uint nCount, const boost::function<void (Uint, Uint)>& f, Uint nMinRange = 1024, Uint nMaxThreads = 0)
+    {
+        TaskPool& pool = TaskPool::global();
+
+        Uint nThreads = nMaxThreads ? nMaxThreads : pool.getThreadCount();
+        nThreads = std::min(nThreads, std::max(1u, nCount / std::max(1u, nMinRange)));
+
+        if (nThreads <= 1)
+        {
+            if (nCount > 0)
+                f(0, nCount);
+            return;
+        }
+
+        Uint nRange = (nCount + nThreads - 1) / nThreads;
+        pool.run((nCount + nRange - 1) / nRange, boost::bind(&detail::runRange, boost::cref(f), nRange, nCount, _1));
+    }
+}
@@ -0,0 +1,355 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "ParallelDrawList.h"
+#include "AABBTree.h"
+#include "IDriver.h"
+#include "ShapeNode.h"
+#include "TransparentQueue.h"
+#include "Parallel.h"
+#include "StopWatch.h"
+
+#include <algorithm>
+#include <deque>
+
+namespace eh
+{
+    static const Uint NONE = 0xffffffff;
+
+    ParallelDrawList::ParallelDrawList():
+        m_pTree(NULL),
+        m_pTransforms(NULL),
+        m_nBuild(0),
+        m_pEntries(NULL),
+        m_nTasks(0),
+        m_nLanes(1),
+        m_nThreads(0),
+        m_nDraws(0),
+        m_fCollectTime(0),
+        m_fMergeTime(0),
+        m_fSubmitTime(0)
+    {
+    }
+
+    Uint ParallelDrawList::mirror(const AABBTreeNode* pTree, const boost::unordered_map<const SceneNode*, Uint>& roots)
+    {
+        Uint n = (Uint)m_tree.size();
+        m_tree.push_back(TreeNode());
+        m_tree[n].box = *pTree;
+        m_tree[n].nFirst = (Uint)m_treeRoots.size();
+
+        for (SceneNodeList::const_iterator it = pTree->nodes().begin(); it != pTree->nodes().end(); ++it)
+        {
+            boost::unordered_map<const SceneNode*, Uint>::const_iterator found = roots.find(it->get());
+            if (found != roots.end())
+                m_treeRoots.push_back(found->second);
+            else
+                m_unknown.push_back(*it);
+        }
+        m_tree[n].nEnd = (Uint)m_treeRoots.size();
+
+        Uint nLeft = pTree->left() ? mirror(pTree->left(), roots) : NONE;
+        Uint nRight = pTree->right() ? mirror(pTree->right(), roots) : NONE;
+        m_tree[n].nLeft = nLeft;
+        m_tree[n].nRight = nRight;
+        return n;
+    }
+
+    void ParallelDrawList::addTask(Uint nTree, bool bSubtree, bool bInside)
+    {
+        if (m_nTasks == m_tasks.size())
+            m_tasks.push_back(Task());
+
+        Task& task = m_tasks[m_nTasks++];
+        task.nTree = nTree;
+        task.bSubtree = bSubtree;
+        task.bInside = bInside;
+        task.items.clear();
+        task.blended.clear();
+        task.rest.clear();
+    }
+
+    void ParallelDrawList::split()
+    {
+        // breadth first, the tree nodes above the cut are tested here and give their own roots to a task
+        std::deque< std::pair<Uint, bool> > open;
+        open.push_back(std::make_pair(0u, false));
+
+        while (!open.empty() && m_nTasks + open.size() < MIN_TASKS)
+        {
+            const TreeNode& node = m_tree[open.front().first];
+            bool bInside = open.front().second;
+            Uint nTree = open.front().first;
+            open.pop_front();
+
+            if (!bInside)
+            {
+                unsigned nResult = m_frustum.isAABBInside(node.box);
+                if (nResult == 0)
+                    continue;
+                bInside = nResult == 1;
+            }
+
+            if (node.nFirst < node.nEnd)
+                addTask(nTree, false, bInside);
+
+            if (node.nLeft != NONE)
+                open.push_back(std::make_pair(node.nLeft, bInside));
+            if (node.nRight != NONE)
+                open.push_back(std::make_pair(node.nRight, bInside));
+        }
+
+        for (size_t i = 0; i < open.size(); i++)
+            addTask(open[i].first, true, open[i].second);
+    }
+
+    // a lane takes every m_nLanes-th task, the tasks in one lane come from all over the tree
+    void ParallelDrawList::collectLanes(Uint begin, Uint end)
+    {
+        for (Uint nLane = begin; nLane < end; nLane++)
+        {
+            for (Uint t = nLane; t < m_nTasks; t += m_nLanes)
+            {
+                Task& task = m_tasks[t];
+                if (task.bSubtree)
+                    collect(task, task.nTree, task.bInside);
+                else
+                    for (Uint r = m_tree[task.nTree].nFirst; r < m_tree[task.nTree].nEnd; r++)
+                        collectRoot(task, m_treeRoots[r], task.bInside);
+
+                std::sort(task.items.begin(), task.items.end());
+            }
+        }
+    }
+
+    void ParallelDrawList::collect(Task& task, Uint nTree, bool bInside)
+    {
+        const TreeNode& node = m_tree[nTree];
+        if (!bInside)
+        {
+            unsigned nResult = m_frustum.isAABBInside(node.box);
+            if (nResult == 0)
+                return;
+            bInside = nResult == 1;
+        }
+
+        for (Uint r = node.nFirst; r < node.nEnd; r++)
+            collectRoot(task, m_treeRoots[r], bInside);
+
+        if (node.nLeft != NONE)
+            collect(task, node.nLeft, bInside);
+        if (node.nRight != NONE)
+            collect(task, node.nRight, bInside);
+    }
+
+    // worker thread: raw pointers only, counting references on all cores would contend for the counts
+    void ParallelDrawList::collectRoot(Task& task, Uint nRoot, bool bInside)
+    {
+        const std::vector<TransformCache::Entry>& entries = *m_pEntries;
+        Uint nEnd = entries[nRoot].nEnd;
+
+        Uint nInsideEnd = bInside ? nEnd : nRoot;
+        for (Uint i = nRoot; i < nEnd; i++)
+        {
+            const TransformCache::Entry& entry = entries[i];
+            if (i >= nInsideEnd)
+            {
+                // without a valid bound a node can't be culled, SceneCuller draws it as well
+                unsigned nResult = entry.bound.valid() ? m_frustum.isAABBInside(entry.bound) : 2;
+                if (nResult == 0)
+                {
+                    // the whole subtree is outside
+                    if (entry.pGroup)
+                        i = entry.nEnd - 1;
+                    continue;
+                }
+                if (nResult == 1)
+                    nInsideEnd = entry.nEnd;
+            }
+
+            // hidden, selected or highlighted, the whole subtree is left to the visitor
+            if (entry.pNode->getFlags() != 0)
+            {
+                task.rest.push_back(i);
+                i = entry.nEnd - 1;
+                continue;
+            }
+
+            if (entry.pGroup)
+                continue;
+
+            ShapeNode* pShape = dynamic_cast<ShapeNode*>(entry.pNode);
+            if (pShape == NULL)
+            {
+                task.rest.push_back(i);
+                continue;
+            }
+
+            bool bRest = false;
+            for (GeometryIterator it = pShape->GeometryBegin(); it != pShape->GeometryEnd(); ++it)
+            {
+                if (it->first.first.get() == NULL)
+                {
+                    bRest = true;
+                    continue;
+                }
+
+                Item item = { it->first.first.get(), it.getGeometry().get(), &entry.world };
+                if (item.pMaterial->isBlended())
+                    task.blended.push_back(item);
+                else
+                    task.items.push_back(item);
+            }
+
+            // the geometries without a material
+            if (bRest)
+                task.rest.push_back(i);
+        }
+    }
+
+    void ParallelDrawList::copyLists(Uint begin, Uint end)
+    {
+        for (Uint t = begin; t < end; t++)
+            std::copy(m_tasks[t].items.begin(), m_tasks[t].items.end(), m_merged.begin() + m_runs[t]);
+    }
+
+    // merges the runs 2p and 2p+1 into m_temp, a last run without a partner is copied
+    void ParallelDrawList::mergeRuns(Uint begin, Uint end)
+    {
+        Uint nRuns = (Uint)m_runs.size() - 1;
+        for (Uint p = begin; p < end; p++)
+        {
+            Uint a = m_runs[2*p];
+            Uint b = m_runs[std::min(2*p + 1, nRuns)];
+            Uint c = m_runs[std::min(2*p + 2, nRuns)];
+            std::merge(m_merged.begin() + a, m_merged.begin() + b, m_merged.begin() + b, m_merged.begin() + c, m_temp.begin() + a);
+        }
+    }
+
+    void ParallelDrawList::draw(IDriver& driver, const Matrix& view, const Matrix& proj, const AABBTreeNode* pTree,
+                                const TransformCache& transforms, SceneNodeVector& rest, TransparentQueue& transparent)
+    {
+        StopWatch watch;
+
+        m_pEntries = &transforms.getEntries();
+        m_frustum.extractFrom(proj, view);
+
+        // the tree is organized again whenever the transforms are built again
+        if (pTree != m_pTree || &transforms != m_pTransforms || transforms.getBuildCount() != m_nBuild)
+        {
+            m_pTree = pTree;
+            m_pTransforms = &transforms;
+            m_nBuild = transforms.getBuildCount();
+
+            m_tree.clear();
+            m_treeRoots.clear();
+            m_unknown.clear();
+
+            boost::unordered_map<const SceneNode*, Uint> roots;
+            for (Uint i = 0; i < m_pEntries->size(); i = (*m_pEntries)[i].nEnd)
+                roots[(*m_pEntries)[i].pNode] = i;
+
+            if (pTree)
+                mirror(pTree, roots);
+        }
+
+        m_nTasks = 0;
+        if (!m_tree.empty())
+            split();
+
+        Uint nThreads = m_nThreads ? m_nThreads : TaskPool::global().getThreadCount();
+        m_nLanes = std::max(1u, std::min(nThreads, m_nTasks));
+        parallelFor(m_nLanes, boost::bind(&ParallelDrawList::collectLanes, this, _1, _2), 1, m_nThreads);
+
+        for (Uint t = 0; t < m_nTasks; t++)
+        {
+            const Task& task = m_tasks[t];
+            for (size_t i = 0; i < task.rest.size(); i++)
+            {
+                Uint nEntry = task.rest[i];
+                const TransformCache::Entry& entry = (*m_pEntries)[nEntry];
+
+                ShapeNode* pShape = entry.pNode->getFlags() == 0 ? dynamic_cast<ShapeNode*>(entry.pNode) : NULL;
+                if (pShape)
+                    rest.push_back(transforms.place(nEntry, pShape->createWithoutMaterials()));
+                else
+                    rest.push_back(transforms.place(nEntry));
+            }
+
+            for (size_t i = 0; i < task.blended.size(); i++)
+                transparent.push(task.blended[i].pGeometry, task.blended[i].pMaterial, task.blended[i].pWorld);
+        }
+        rest.insert(rest.end(), m_unknown.begin(), m_unknown.end());
+
+        m_fCollectTime = watch.elapsed();
+        watch.restart();
+
+        m_runs.clear();
+        Uint nItems = 0;
+        for (Uint t = 0; t < m_nTasks; t++)
+        {
+            m_runs.push_back(nItems);
+            nItems += (Uint)m_tasks[t].items.size();
+        }
+        m_runs.push_back(nItems);
+
+        m_merged.resize(nItems);
+        m_temp.resize(nItems);
+        parallelFor(m_nTasks, boost::bind(&ParallelDrawList::copyLists, this, _1, _2), 4, m_nThreads);
+
+        // pairs of neighbouring runs until one is left, std::merge takes equal items from the first run first
+        while (m_runs.size() > 2)
+        {
+            Uint nRuns = (Uint)m_runs.size() - 1;
+            parallelFor((nRuns + 1) / 2, boost::bind(&ParallelDrawList::mergeRuns, this, _1, _2), 1, m_nThreads);
+            m_merged.swap(m_temp);
+
+            Uint n = 0;
+            for (Uint r = 0; r < nRuns; r += 2)
+                m_runs[n++] = m_runs[r];
+            m_runs[n++] = nItems;
+            m_runs.resize(n);
+        }
+
+        m_fMergeTime = watch.elapsed();
+        watch.restart();
+
+        submit(driver);
+
+        m_fSubmitTime = watch.elapsed();
+    }
+
+    void ParallelDrawList::submit(IDriver& driver)
+    {
+        m_nDraws = 0;
+
+        const Material* pMaterial = NULL;
+        for (size_t i = 0; i < m_merged.size(); )
+        {
+            const Item& item = m_merged[i];
+
+            size_t j = i + 1;
+            while (j < m_merged.size() && m_merged[j].pMaterial == item.pMaterial && m_merged[j].pGeometry == item.pGeometry)
+                j++;
+
+            if (i == 0 || item.pMaterial != pMaterial)
+                driver.setMaterial(pMaterial = item.pMaterial);
+
+            if (j - i == 1)
+            {
+                driver.setWorldMatrix(*item.pWorld);
+                driver.drawPrimitive(*item.pGeometry);
+            }
+            else
+            {
+                m_worlds.clear();
+                for (size_t k = i; k < j; k++)
+                    m_worlds.push_back(*m_merged[k].pWorld);
+
+                driver.drawInstances(*item.pGeometry, &m_worlds[0], (Uint)m_worlds.size());
+            }
+
+            m_nDraws++;
+            i = j;
+        }
+    }
+}
@@ -0,0 +1,117 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "TransformCache.h"
+#include <vector>
+#include <boost/unordered_map.hpp>
+
+namespace eh
+{
+    class IDriver;
+    class Geometry;
+    class Material;
+    class AABBTreeNode;
+    class TransparentQueue;
+
+    // Culls the AABB tree of a scene against the frustum and collects the draws of the visible nodes
+    // on all cores. The upper levels of the tree are cut into subtrees, each one a task filling its
+    // own draw list sorted by material and geometry. The lists are merged in task order, so the draws
+    // come out the same for any number of threads, and only the calling thread talks to the IDriver.
+    // Draws of one geometry and material next to each other go with one IDriver::drawInstances call.
+    class API_3D ParallelDrawList
+    {
+    public:
+        // the tree is cut until there are that many subtrees or it ends
+        static const Uint MIN_TASKS = 64;
+
+        ParallelDrawList();
+
+        // 0 for all threads of the TaskPool
+        void setThreadCount(Uint nThreads) { m_nThreads = nThreads; }
+
+        // Flagged subtrees and geometries without a material are appended to rest for the RenderingVisitor,
+        // placed at their world. Blended geometries go to transparent referring to the worlds of transforms.
+        void draw(IDriver& driver, const Matrix& view, const Matrix& proj, const AABBTreeNode* pTree,
+                  const TransformCache& transforms, SceneNodeVector& rest, TransparentQueue& transparent);
+
+        // of the last frame, the times in milliseconds
+        Uint getTaskCount() const { return m_nTasks; }
+        Uint getItemCount() const { return (Uint)m_merged.size(); }
+        Uint getDrawCount() const { return m_nDraws; }
+        double getCollectTime() const { return m_fCollectTime; }
+        double getMergeTime() const { return m_fMergeTime; }
+        double getSubmitTime() const { return m_fSubmitTime; }
+
+    private:
+        // the AABB tree with the entries of the transforms in place of its scene nodes, so the workers
+        // neither look nodes up nor touch the reference counts of the tree
+        struct TreeNode
+        {
+            AABBox box;
+            Uint nFirst, nEnd;      // into m_treeRoots
+            Uint nLeft, nRight;
+        };
+
+        struct Item
+        {
+            const Material* pMaterial;
+            Geometry* pGeometry;
+            const Matrix* pWorld;
+
+            bool operator < (const Item& other) const
+            {
+                return pMaterial < other.pMaterial || (pMaterial == other.pMaterial && pGeometry < other.pGeometry);
+            }
+        };
+
+        struct Task
+        {
+            Uint nTree;
+            bool bSubtree;          // else the roots of the tree node only
+            bool bInside;           // the tree node is inside the frustum as a whole
+
+            std::vector<Item> items;
+            std::vector<Item> blended;
+            std::vector<Uint> rest; // entries left to the visitor
+        };
+
+        Uint mirror(const AABBTreeNode* pTree, const boost::unordered_map<const SceneNode*, Uint>& roots);
+        void addTask(Uint nTree, bool bSubtree, bool bInside);
+        void split();
+        void collectLanes(Uint begin, Uint end);
+        void collect(Task& task, Uint nTree, bool bInside);
+        void collectRoot(Task& task, Uint nRoot, bool bInside);
+        void copyLists(Uint begin, Uint end);
+        void mergeRuns(Uint begin, Uint end);
+        void submit(IDriver& driver);
+
+        // what the mirror was built from
+        const AABBTreeNode* m_pTree;
+        const TransformCache* m_pTransforms;
+        Uint m_nBuild;
+
+        std::vector<TreeNode> m_tree;
+        std::vector<Uint> m_treeRoots;
+        SceneNodeVector m_unknown;      // in the tree, not in the transforms
+
+        const std::vector<TransformCache::Entry>* m_pEntries;
+        Frustum m_frustum;
+
+        std::vector<Task> m_tasks;      // the first m_nTasks, the others keep their capacity
+        Uint m_nTasks;
+        Uint m_nLanes;
+        Uint m_nThreads;
+
+        // the lists of all tasks one after the other, merged in place of pairs of runs
+        std::vector<Item> m_merged, m_temp;
+        std::vector<Uint> m_runs;       // offsets of the sorted runs, the end last
+        std::vector<Matrix> m_worlds;
+
+        Uint m_nDraws;
+        double m_fCollectTime;
+        double m_fMergeTime;
+        double m_fSubmitTime;
+    };
+}
@@ -4,6 +4,7 @@
 
 #include <boost/intrusive_ptr.hpp>
 #include <boost/utility.hpp>
+#include <boost/detail/atomic_count.hpp>
 
 namespace eh
 {
@@ -12,7 +13,9 @@ namespace eh
     private:
         friend void intrusive_ptr_add_ref(RefCounted* p);
         friend void intrusive_ptr_release(RefCounted* p);
-        size_t refcount;
+
+        // atomic, a DriverThread keeps the objects of its frames and may drop them last
+        boost::detail::atomic_count refcount;
     protected:
 
         RefCounted():refcount(0){}
@@ -3,6 +3,8 @@
 #include "Scene.h"
 #include "AABBTree.h"
 
+#include <boost/unordered_set.hpp>
+
 namespace eh
 {
 
@@ -12,7 +14,12 @@ namespace eh
     }
 
     Scene::Scene():
-            m_pAABBTree(NULL)
+            m_pAABBTree(NULL),
+            m_bTransformsValid(false),
+            m_bBoundingValid(false),
+            m_bStatisticsValid(false),
+            m_nGeometryRevision(0),
+            m_bAnimated(false)
     {
     }
     Scene::~Scene()
@@ -25,6 +32,7 @@ namespace eh
         if (object && std::find(m_objects.begin(), m_objects.end(), object) == m_objects.end())
         {
             m_objects.push_back(object);
+            invalidate();
 
             if (m_pAABBTree == NULL)
                 organizeAABBTree();
@@ -48,6 +56,7 @@ namespace eh
                 m_pAABBTree->deleteNode(object.get());
 
             m_objects.erase(it);
+            invalidate();
 
             return true;
         }
@@ -55,8 +64,31 @@ namespace eh
             return false;
     }
 
+    void Scene::replaceNodes(const SceneNodeVector& removed, const SceneNodeVector& inserted)
+    {
+        boost::unordered_set<const SceneNode*> gone;
+        for (SceneNodeVector::const_iterator it = removed.begin(); it != removed.end(); ++it)
+            gone.insert(it->get());
+
+        SceneNodeVector objects;
+        boost::unordered_set<const SceneNode*> present;
+        for (SceneNodeVector::const_iterator it = m_objects.begin(); it != m_objects.end(); ++it)
+            if (gone.find(it->get()) == gone.end() && present.insert(it->get()).second)
+                objects.push_back(*it);
+
+        for (SceneNodeVector::const_iterator it = inserted.begin(); it != inserted.end(); ++it)
+            if (*it && present.insert(it->get()).second)
+                objects.push_back(*it);
+
+        m_objects.swap(objects);
+        invalidate();
+        organizeAABBTree();
+    }
+
     bool Scene::updateNode(Ptr<SceneNode> object)
     {
+        invalidate();
+
         if (m_pAABBTree)
         {
             if (m_pAABBTree->isInside(object->getBounding()) == AABBox::INSIDE)
@@ -95,10 +127,38 @@ namespace eh
 
         m_objects.clear();
         m_cameras.clear();
+        m_refiners.clear();
+
+        m_transforms.clear();
+        invalidate();
+    }
+
+    void Scene::setNodeFlag(Ptr<SceneNode> object, SceneNode::FLAGS flag, bool bSet)
+    {
+        if (bSet)
+            object->Flags() |= flag;
+        else
+            object->Flags() &= ~flag;
+
+        if (flag & SceneNode::FLAG_UNVISIBLE)
+        {
+            m_bBoundingValid = false;
+            m_bStatisticsValid = false;
+        }
+    }
+
+    void Scene::invalidate()
+    {
+        m_bTransformsValid = false;
+        m_bBoundingValid = false;
+        m_bStatisticsValid = false;
     }
 
     AABBox Scene::getBounding() const
     {
+        if (m_bBoundingValid)
+            return m_bounding;
+
         Vec3 b_min, b_max;
 
         bool	first = true;
@@ -131,7 +191,10 @@ namespace eh
             }
         }
 
-        return AABBox(b_min, b_max);
+        m_bounding = AABBox(b_min, b_max);
+        m_bBoundingValid = true;
+
+        return m_bounding;
     }
 
     const AABBTreeNode* Scene::getAABBTree() const
@@ -144,29 +207,99 @@ namespace eh
         return m_objects;
     }
 
-    bool Scene::isAnimated() const
+    // counts every visible node instance, invisible nodes are skipped with everything below them
+    class StatisticsCollector: public IVisitor
     {
-        struct animated
+    public:
+        Scene::Statistics m_statistics;
+        bool m_bAnimated;
+
+        StatisticsCollector():
+            m_bAnimated(false)
         {
-            bool test(const SceneNodeVector& nodes)
+            m_statistics.nNodes = 0;
+            m_statistics.nDraws = 0;
+            m_statistics.nTriangles = 0;
+            m_statistics.nVertices = 0;
+        }
+
+        void collect(const SceneNodeVector& nodes)
+        {
+            for (SceneNodeVector::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+                if (*it && !((*it)->getFlags() & SceneNode::FLAG_UNVISIBLE))
+                    (*it)->accept(*this);
+        }
+
+        virtual void visit(Geometry& node)
+        {
+            m_statistics.nDraws++;
+
+            Uint n = node.getVertexCount();
+            switch (node.getType())
             {
-                for (SceneNodeVector::const_iterator it = nodes.begin(); it != nodes.end(); it++)
-                {
-                    if (Ptr<GroupNode> pGroup = *it)
-                    {
-                        if (pGroup->isAnimated())
-                            return true;
-
-                        if ( test( pGroup->getChildNodes()) )
-                            return true;
-                    }
-                }
-
-                return false;
+            case Geometry::TRIANGLES:
+                m_statistics.nTriangles += n / 3;
+                break;
+            case Geometry::TRIANGLE_STRIP:
+            case Geometry::TRIANGLE_FAN:
+                m_statistics.nTriangles += n > 2 ? n - 2 : 0;
+                break;
+            default:
+                break;
             }
-        };
 
-        return animated().test(getNodes());
+            if (node.getVertexBuffer() && m_buffers.insert(node.getVertexBuffer().get()).second)
+                m_statistics.nVertices += node.getVertexBuffer()->getVertexCount();
+        }
+        virtual void visit(ShapeNode& node)
+        {
+            m_statistics.nNodes++;
+
+            for (GeometryIterator it = node.GeometryBegin(); it != node.GeometryEnd(); ++it)
+                it.getGeometry()->accept(*this);
+        }
+        virtual void visit(GroupNode& node)
+        {
+            m_statistics.nNodes++;
+
+            if (node.isAnimated())
+                m_bAnimated = true;
+
+            collect(node.getChildNodes());
+        }
+
+    private:
+        boost::unordered_set<const IVertexBuffer*> m_buffers;
+    };
+
+    void Scene::updateStatistics() const
+    {
+        if (m_bStatisticsValid && m_nGeometryRevision == SceneNode::getGeometryRevision())
+            return;
+
+        // read before counting, a geometry replaced meanwhile counts again next time
+        m_nGeometryRevision = SceneNode::getGeometryRevision();
+
+        StatisticsCollector collector;
+        collector.collect(m_objects);
+
+        m_statistics = collector.m_statistics;
+        m_bAnimated = collector.m_bAnimated;
+        m_bStatisticsValid = true;
+    }
+
+    const Scene::Statistics& Scene::getStatistics() const
+    {
+        updateStatistics();
+        return m_statistics;
+    }
+
+    bool Scene::isAnimated() const
+    {
+        // replaced geometries don't animate anything, no need to count them again each frame
+        if (!m_bStatisticsValid)
+            updateStatistics();
+        return m_bAnimated;
     }
 
     Ptr<Camera> Scene::createOrbitalCamera() const
@@ -196,4 +329,30 @@ namespace eh
         return m_cameras;
     }
 
+    void Scene::addRefiner(Ptr<ISceneRefiner> pRefiner)
+    {
+        m_refiners.push_back(pRefiner);
+    }
+
+    const std::vector< Ptr<ISceneRefiner> >& Scene::getRefiners() const
+    {
+        return m_refiners;
+    }
+
+    const TransformCache& Scene::getTransforms(Uint t)
+    {
+        if (m_bTransformsValid)
+            m_transforms.update(t);
+        else
+            m_transforms.build(m_objects, t);
+
+        m_bTransformsValid = true;
+        return m_transforms;
+    }
+
+    const TransformCache& Scene::getTransforms()
+    {
+        return getTransforms(m_transforms.getTime());
+    }
+
 }	//end namespace
@@ -6,6 +6,8 @@
 #include "ShapeNode.h"
 #include "GroupNode.h"
 #include "Camera.h"
+#include "SceneRefiner.h"
+#include "TransformCache.h"
 
 namespace eh{
 
@@ -26,17 +28,46 @@ public:
 	bool deleteNode(Ptr<SceneNode> object);
 	bool updateNode(Ptr<SceneNode> object);
 
+	// removes and inserts many nodes at once, the AABB tree is built once instead of changed per node
+	void replaceNodes(const SceneNodeVector& removed, const SceneNodeVector& inserted);
+
+	// sets or clears flag of a node below the scene, FLAG_UNVISIBLE changes the bounding and statistics
+	void setNodeFlag(Ptr<SceneNode> object, SceneNode::FLAGS flag, bool bSet);
+
 	const SceneNodeVector& getNodes() const;
 
 	void clear();
 	bool isEmpty(){ return (m_objects.size()==0); }
 
+	// cached like isAnimated() and getStatistics(), call updateNode() after moving or changing a node,
+	// replaced geometries are noticed by getStatistics() itself
 	AABBox getBounding() const;
 
 	const AABBTreeNode* getAABBTree() const;
 
+	// true if a visible group is animated, groups below a FLAG_UNVISIBLE node don't count
 	bool isAnimated() const;
 
+	// totals over all visible node instances, a node referenced twice counts twice
+	struct Statistics
+	{
+		Uint nNodes;
+		Uint nDraws;		// geometries
+		Uint nTriangles;
+		Uint nVertices;		// of the vertex buffers, each buffer once
+	};
+	const Statistics& getStatistics() const;
+
+	// background refinement of the scene geometry, driven by the viewport
+	void addRefiner(Ptr<ISceneRefiner> pRefiner);
+	const std::vector< Ptr<ISceneRefiner> >& getRefiners() const;
+
+	// world matrices and bounds of all nodes at frame t, rebuilt after the node list changed
+	const TransformCache& getTransforms(Uint t);
+
+	// the same at the frame of the last call
+	const TransformCache& getTransforms();
+
 protected:
 	Scene();
 private:
@@ -44,6 +75,21 @@ private:
 	void organizeAABBTree();
 
 	std::vector< Ptr<Camera> > m_cameras;
+	std::vector< Ptr<ISceneRefiner> > m_refiners;
+
+	TransformCache m_transforms;
+	bool m_bTransformsValid;
+
+	// derived from the nodes on demand, valid until the next change of the node list
+	void invalidate();
+	void updateStatistics() const;
+
+	mutable bool m_bBoundingValid;
+	mutable AABBox m_bounding;
+	mutable bool m_bStatisticsValid;
+	mutable Uint m_nGeometryRevision;	// SceneNode::getGeometryRevision() when the statistics were counted
+	mutable bool m_bAnimated;
+	mutable Statistics m_statistics;
 	SceneNodeVector m_objects;
 };
 
@@ -0,0 +1,116 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "SceneCuller.h"
+#include "OcclusionCuller.h"
+#include "AABBTree.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace eh
+{
+    SceneCuller::SceneCuller():
+        m_pOcclusion(NULL),
+        m_fPixelThreshold(0),
+        m_fPixelScale(0),
+        m_fDepthScale(0),
+        m_nTested(0),
+        m_nSmall(0)
+    {
+    }
+
+    void SceneCuller::begin(const Matrix& view, const Matrix& proj, const Rect& viewport, const OcclusionCuller* pOcclusion)
+    {
+        m_viewProj = view * proj;
+        m_frustum.extractFrom(proj, view);
+        m_pOcclusion = pOcclusion;
+        m_nTested = 0;
+        m_nSmall = 0;
+
+        // columns of the view projection: x and y give the pixels, w the distance from the eye
+        const Matrix& m = m_viewProj;
+        Float sx = Vec3(m[0], m[4], m[8]).getLen() * viewport.Width();
+        Float sy = Vec3(m[1], m[5], m[9]).getLen() * viewport.Height();
+        m_fPixelScale = std::max(sx, sy) * 0.5f;
+        m_fDepthScale = Vec3(m[3], m[7], m[11]).getLen();
+    }
+
+    Float SceneCuller::getPixelSize(const AABBox& box) const
+    {
+        Vec3 c = box.getCenter();
+        Float r = box.getSize().getLen() * 0.5f;
+
+        // w of the point of the bounding sphere nearest to the eye
+        Float w = transform(Vec4(c.x, c.y, c.z, 1.f), m_viewProj).w - r * m_fDepthScale;
+        if (w < 1e-5f)
+            return FLT_MAX;
+
+        return 2.f * r * m_fPixelScale / w;
+    }
+
+    bool SceneCuller::isSmall(const AABBox& box, std::vector<AABBox>* pProxies)
+    {
+        if (m_fPixelThreshold <= 0)
+            return false;
+
+        m_nTested++;
+
+        Float fPixels = getPixelSize(box);
+        if (fPixels >= m_fPixelThreshold)
+            return false;
+
+        if (pProxies && fPixels >= PROXY_PIXELS)
+            pProxies->push_back(box);
+
+        m_nSmall++;
+        return true;
+    }
+
+    void SceneCuller::collectVisible(const AABBTreeNode* pTree, SceneNodeVector& visible, std::vector<AABBox>* pProxies)
+    {
+        collectVisible(pTree, visible, pProxies, false);
+    }
+
+    void SceneCuller::collectVisible(const AABBTreeNode* pTree, SceneNodeVector& visible, std::vector<AABBox>* pProxies, bool bInside)
+    {
+        if (pTree == NULL)
+            return;
+
+        if (!bInside)
+        {
+            unsigned nInside = m_frustum.isAABBInside(*pTree);
+            if (nInside == 0)
+                return;
+            bInside = nInside == 1;
+        }
+
+        // a small cell stands for its whole subtree
+        if (isSmall(*pTree, pProxies))
+            return;
+
+        if (m_pOcclusion && !m_pOcclusion->isVisible(*pTree))
+            return;
+
+        for (SceneNodeList::const_iterator it = pTree->nodes().begin(); it != pTree->nodes().end(); ++it)
+        {
+            const AABBox& box = (*it)->getBounding();
+            if (!box.valid())
+            {
+                visible.push_back(*it);
+                continue;
+            }
+
+            if (!bInside && m_frustum.isAABBInside(box) == 0)
+                continue;
+
+            if (isSmall(box, pProxies))
+                continue;
+
+            if (m_pOcclusion == NULL || m_pOcclusion->isVisible(box))
+                visible.push_back(*it);
+        }
+
+        collectVisible(pTree->left(), visible, pProxies, bInside);
+        collectVisible(pTree->right(), visible, pProxies, bInside);
+    }
+}
@@ -0,0 +1,57 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "SceneNode.h"
+#include <vector>
+
+namespace eh
+{
+    class AABBTreeNode;
+    class OcclusionCuller;
+
+    // Walks the AABB tree of a scene for one view and collects the nodes worth drawing: inside the
+    // frustum, not hidden behind the occluders of an OcclusionCuller and, with a pixel threshold set,
+    // covering at least that many pixels on the screen. Nodes below the threshold but not below
+    // PROXY_PIXELS can be handed back as boxes to draw in their place, smaller ones are dropped.
+    class API_3D SceneCuller
+    {
+    public:
+        static const Uint PROXY_PIXELS = 1;
+
+        SceneCuller();
+
+        // projected size in pixels below which nodes are culled, 0 culls none
+        void setPixelThreshold(Float fPixels) { m_fPixelThreshold = fPixels; }
+        Float getPixelThreshold() const { return m_fPixelThreshold; }
+
+        // pOcclusion (may be NULL) must have begun the same view
+        void begin(const Matrix& view, const Matrix& proj, const Rect& viewport, const OcclusionCuller* pOcclusion = NULL);
+
+        // pProxies (may be NULL) receives the world boxes of the culled nodes of at least PROXY_PIXELS
+        void collectVisible(const AABBTreeNode* pTree, SceneNodeVector& visible, std::vector<AABBox>* pProxies = NULL);
+
+        // diameter of box (world space) on the screen in pixels, FLT_MAX if it reaches to the eye
+        Float getPixelSize(const AABBox& box) const;
+
+        // of the last frame
+        Uint getTestedCount() const { return m_nTested; }
+        Uint getSmallCount() const { return m_nSmall; }
+
+    private:
+        bool isSmall(const AABBox& box, std::vector<AABBox>* pProxies);
+        void collectVisible(const AABBTreeNode* pTree, SceneNodeVector& visible, std::vector<AABBox>* pProxies, bool bInside);
+
+        Matrix m_viewProj;
+        Frustum m_frustum;
+        const OcclusionCuller* m_pOcclusion;
+
+        Float m_fPixelThreshold;
+        Float m_fPixelScale;    // pixels per world unit at w = 1
+        Float m_fDepthScale;    // change of w per world unit
+
+        Uint m_nTested;
+        Uint m_nSmall;
+    };
+}
@@ -15,12 +15,14 @@
 ****************************************************************************/
 
 #include "SceneIO.h"
+#include "SceneOptimizer.h"
 
 #include <iostream>
 #include <boost/filesystem.hpp>
 #include <boost/filesystem/path.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/thread/mutex.hpp>
 
 #if defined(_MSC_VER)
 #include <windows.h>
@@ -154,11 +156,16 @@ namespace eh
 
 	struct SceneIO::Impl
 	{
+		Impl():m_loadFlags(0){}
+
 		std::vector< IPlugIn* > m_plugins;
 		std::map< std::wstring, IPlugIn* > m_ext_plugin_map;
+		Uint m_loadFlags;
 	};
 
 	static SceneIO::status_callback s_printStatus = NULL;
+	static std::wstring s_statusText;
+	static boost::mutex s_statusMutex;
 
 	void SceneIO::setSetStatusTextCallback(status_callback cb)
 	{
@@ -167,10 +174,21 @@ namespace eh
 
 	void SceneIO::setStatusText(const std::wstring& text)
 	{
+		{
+			boost::mutex::scoped_lock lock(s_statusMutex);
+			s_statusText = text;
+		}
+
 		if(s_printStatus)
 			s_printStatus(text);
 	}
 
+	std::wstring SceneIO::getStatusText()
+	{
+		boost::mutex::scoped_lock lock(s_statusMutex);
+		return s_statusText;
+	}
+
 	SceneIO::~SceneIO()
 	{
 		for(size_t i = 0; i < m_pImpl->m_plugins.size(); i++)
@@ -419,11 +437,40 @@ namespace eh
 			std::cerr << "Unknown Exception in " << __FUNCTION__ << std::endl;
 		}
 
+		if(bLoading && ret)
+		{
+			if(m_pImpl->m_loadFlags & LOAD_FLATTEN_TRANSFORMS)
+				SceneOptimizer::flattenTransforms(pScene);
+			if(m_pImpl->m_loadFlags & LOAD_SHARE_INSTANCES)
+				SceneOptimizer::shareInstances(pScene);
+			if(m_pImpl->m_loadFlags & LOAD_BATCH_SHAPES)
+				SceneOptimizer::batchShapes(pScene);
+			if(m_pImpl->m_loadFlags & LOAD_COMPACT_VERTICES)
+				SceneOptimizer::compactVertices(pScene);
+			if(m_pImpl->m_loadFlags & LOAD_GENERATE_LODS)
+				SceneOptimizer::generateLods(pScene);
+			if(m_pImpl->m_loadFlags & LOAD_BUILD_MESHLETS)
+				SceneOptimizer::buildMeshlets(pScene);
+		}
+
 		progress(1.f);
 
 		return ret;
 	};
 
+	void SceneIO::setLoadFlag(Uint flag, bool bSet)
+	{
+		if(bSet)
+			m_pImpl->m_loadFlags |= flag;
+		else
+			m_pImpl->m_loadFlags &= ~flag;
+	}
+
+	Uint SceneIO::getLoadFlags() const
+	{
+		return m_pImpl->m_loadFlags;
+	}
+
 	static void dummy_callback(float f){}
 
 	bool SceneIO::read(const std::wstring& sFile, Ptr<Scene> pScene, progress_callback progress) const
@@ -34,6 +34,17 @@ namespace eh
         typedef boost::function<void (float)> progress_callback;
         typedef boost::function<void (const std::wstring&)> status_callback;
 
+        // SceneOptimizer passes run after reading a file
+        enum LOAD_FLAGS
+        {
+            LOAD_COMPACT_VERTICES = 0x0001,
+            LOAD_FLATTEN_TRANSFORMS = 0x0002,
+            LOAD_SHARE_INSTANCES = 0x0004,
+            LOAD_GENERATE_LODS = 0x0008,
+            LOAD_BUILD_MESHLETS = 0x0010,
+            LOAD_BATCH_SHAPES = 0x0020
+        };
+
     class API_3D File : public boost::noncopyable
         {
             std::wstring m_path;
@@ -73,6 +84,8 @@ namespace eh
 
         static void setSetStatusTextCallback(status_callback);
         static void setStatusText(const std::wstring& text);
+        // the last text set, from any thread
+        static std::wstring getStatusText();
 
 		static Ptr<Texture> createTexture(const std::wstring& text);
 		static Ptr<Texture> createTexture(const std::string& text);
@@ -80,6 +93,9 @@ namespace eh
         std::wstring getAboutString() const;
         std::wstring getFileWildcards(bool bLoading = true) const;
 
+        void setLoadFlag(Uint flag, bool bSet);
+        Uint getLoadFlags() const;
+
         bool read(const std::wstring& sFile, Ptr<Scene> pScene, progress_callback progress = NULL) const;
         bool write(const std::wstring& sFile, Ptr<Scene> pScene, progress_callback progress = NULL) const;
     private:
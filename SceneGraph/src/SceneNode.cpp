@@ -0,0 +1,23 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "SceneNode.h"
+#include <boost/detail/atomic_count.hpp>
+
+namespace eh
+{
+    namespace
+    {
+        // refiners replace geometries while other threads may read the revision
+        boost::detail::atomic_count g_nGeometryRevision(0);
+    }
+
+    Uint SceneNode::getGeometryRevision()
+    {
+        return (Uint)(long)g_nGeometryRevision;
+    }
+
+    void SceneNode::geometryReplaced()
+    {
+        ++g_nGeometryRevision;
+    }
+}
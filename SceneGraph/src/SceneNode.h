@@ -34,11 +34,23 @@ namespace eh
             return m_BoundingBox;
         };
 
+        // changes whenever the node's transform is set or a geometry replaced, caches compare it to find stale entries
+        Uint getRevision() const
+        {
+            return m_nRevision;
+        }
+
+        // changes whenever a geometry of any shape is replaced, totals cached over many nodes compare it
+        static Uint getGeometryRevision();
+
     protected:
+        static void geometryReplaced();
+
         AABBox m_BoundingBox;
         FLAGS m_flags;
+        Uint m_nRevision;
 
-        SceneNode():m_flags(0){}
+        SceneNode():m_flags(0),m_nRevision(0){}
         virtual ~SceneNode(){};
     };
 
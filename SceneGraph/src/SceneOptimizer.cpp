@@ -0,0 +1,1353 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "SceneOptimizer.h"
+#include "StopWatch.h"
+#include "Parallel.h"
+#include "MeshSimplifier.h"
+#include "LodSelector.h"
+#include "Meshlets.h"
+#include "AABBTree.h"
+
+#include <iostream>
+#include <cmath>
+#include <boost/unordered_set.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+
+namespace eh
+{
+    // collects every geometry once, shared nodes are visited only the first time
+    class GeometryCollector: public IVisitor
+    {
+    public:
+        std::vector<Geometry*> m_geometries;
+
+        void collect(const SceneNodeVector& nodes)
+        {
+            for (SceneNodeVector::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+                (*it)->accept(*this);
+        }
+
+        virtual void visit(Geometry& node)
+        {
+            if (m_visited.insert(&node).second)
+                m_geometries.push_back(&node);
+        }
+        virtual void visit(ShapeNode& node)
+        {
+            if (!m_visited.insert(&node).second)
+                return;
+
+            for (GeometryIterator it = node.GeometryBegin(); it != node.GeometryEnd(); ++it)
+                it.getGeometry()->accept(*this);
+        }
+        virtual void visit(GroupNode& node)
+        {
+            if (m_visited.insert(&node).second)
+                collect(node.getChildNodes());
+        }
+
+    private:
+        boost::unordered_set<const void*> m_visited;
+    };
+
+    // number of paths from the roots to each node and geometry, counting stops at 2 for groups
+    class PathCounter: public IVisitor
+    {
+    public:
+        void count(const SceneNodeVector& nodes)
+        {
+            for (SceneNodeVector::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+                if (*it)
+                    (*it)->accept(*this);
+        }
+
+        bool isShared(const void* p) const
+        {
+            boost::unordered_map<const void*, Uint>::const_iterator it = m_counts.find(p);
+            return it != m_counts.end() && it->second > 1;
+        }
+
+        virtual void visit(Geometry& node)
+        {
+            m_counts[&node]++;
+        }
+        virtual void visit(ShapeNode& node)
+        {
+            m_counts[&node]++;
+
+            for (GeometryIterator it = node.GeometryBegin(); it != node.GeometryEnd(); ++it)
+                it.getGeometry()->accept(*this);
+        }
+        virtual void visit(GroupNode& node)
+        {
+            // a second path makes everything below shared, more paths add nothing
+            if (++m_counts[&node] <= 2)
+                count(node.getChildNodes());
+        }
+
+    private:
+        boost::unordered_map<const void*, Uint> m_counts;
+    };
+
+    // walks all paths like a frame does: a matrix per group, a culling box per shape, a draw per geometry.
+    // Nothing goes to a driver, the time is the walk on the CPU only.
+    class FrameCounter: public IVisitor
+    {
+    public:
+        Uint m_nGroups, m_nShapes, m_nDraws;
+        double m_ms;        // of the walk
+        AABBox m_bound;
+
+        FrameCounter(const SceneNodeVector& nodes):
+            m_nGroups(0), m_nShapes(0), m_nDraws(0)
+        {
+            StopWatch watch;
+            for (SceneNodeVector::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+                if (*it)
+                    (*it)->accept(*this);
+            m_ms = watch.elapsed();
+        }
+
+        virtual void visit(Geometry& /*node*/)
+        {
+            m_nDraws++;
+        }
+        virtual void visit(ShapeNode& node)
+        {
+            m_nShapes++;
+            if (node.getBounding().valid())
+                m_bound = m_bound + transform(node.getBounding(), m_matrix);
+
+            for (GeometryIterator it = node.GeometryBegin(); it != node.GeometryEnd(); ++it)
+                it.getGeometry()->accept(*this);
+        }
+        virtual void visit(GroupNode& node)
+        {
+            m_nGroups++;
+
+            Matrix parent = m_matrix;
+            m_matrix = node.getTransform() * parent;
+
+            const SceneNodeVector& childs = node.getChildNodes();
+            for (SceneNodeVector::const_iterator it = childs.begin(); it != childs.end(); ++it)
+                if (*it)
+                    (*it)->accept(*this);
+
+            m_matrix = parent;
+        }
+
+    private:
+        Matrix m_matrix;
+    };
+
+    class TransformFlattener
+    {
+    public:
+        Uint m_nBaked, m_nKept;
+
+        TransformFlattener(const PathCounter& paths, bool bBake):
+            m_nBaked(0), m_nKept(0), m_paths(paths), m_bBake(bBake)
+        {
+        }
+
+        // appends nodes placed by the parent transform m to out, in world space where possible
+        void flatten(const SceneNodeVector& nodes, const Matrix& m, SceneNodeVector& out)
+        {
+            SceneNodeVector keep;   // still need m
+
+            for (SceneNodeVector::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+            {
+                if (*it == NULL)
+                    continue;
+
+                if (GroupNode* pGroup = dynamic_cast<GroupNode*>(it->get()))
+                {
+                    if (!pGroup->isAnimated() && pGroup->getFlags() == 0)
+                    {
+                        flatten(pGroup->getChildNodes(), pGroup->getTransform() * m, out);
+                        continue;
+                    }
+
+                    flattenChilds(pGroup);
+                }
+                else if (ShapeNode* pShape = dynamic_cast<ShapeNode*>(it->get()))
+                {
+                    Ptr<ShapeNode> pBaked = m == Matrix::Identity() ? NULL : bake(pShape, m);
+                    if (pBaked)
+                    {
+                        out.push_back(pBaked);
+                        m_nBaked++;
+                        continue;
+                    }
+                }
+
+                keep.push_back(*it);
+            }
+
+            if (keep.empty())
+                return;
+
+            if (m == Matrix::Identity())
+                out.insert(out.end(), keep.begin(), keep.end());
+            else
+            {
+                m_nKept += (Uint)keep.size();
+                out.push_back(GroupNode::createSwapped(keep, m));
+            }
+        }
+
+    private:
+        // the transform of an animated group stays, only what's below it is flattened (once if shared)
+        void flattenChilds(GroupNode* pGroup)
+        {
+            if (!m_flattened.insert(pGroup).second)
+                return;
+
+            SceneNodeVector childs;
+            flatten(pGroup->getChildNodes(), Matrix::Identity(), childs);
+
+            pGroup->deleteChildNodes();
+            pGroup->addChildNodes(childs);
+            pGroup->calcBounding();
+        }
+
+        // a copy of pShape in world space, NULL if pShape or one of its geometries is shared
+        Ptr<ShapeNode> bake(ShapeNode* pShape, const Matrix& m)
+        {
+            if (!m_bBake || m_paths.isShared(pShape))
+                return NULL;
+
+            Vec3 r0(m[0], m[1], m[2]), r1(m[4], m[5], m[6]), r2(m[8], m[9], m[10]);
+            bool bMirrored = dot(r0, cross(r1, r2)) < 0;
+
+            for (GeometryIterator it = pShape->GeometryBegin(); it != pShape->GeometryEnd(); ++it)
+            {
+                const Ptr<Geometry>& pGeo = it.getGeometry();
+                if (m_paths.isShared(pGeo.get()) || pGeo->getVertexBuffer() == NULL)
+                    return NULL;
+
+                // the winding of strips and fans can't be reversed by reordering indices
+                if (bMirrored && (pGeo->getType() == Geometry::TRIANGLE_STRIP || pGeo->getType() == Geometry::TRIANGLE_FAN))
+                    return NULL;
+            }
+
+            Ptr<ShapeNode> pBaked = ShapeNode::create();
+            pBaked->Flags() = pShape->getFlags();
+
+            for (GeometryIterator it = pShape->GeometryBegin(); it != pShape->GeometryEnd(); ++it)
+            {
+                const Ptr<Geometry>& pGeo = it.getGeometry();
+
+                Uint_vec indices = pGeo->getIndices();
+                if (bMirrored && pGeo->getType() == Geometry::TRIANGLES)
+                {
+                    if (indices.empty())
+                        for (Uint i = 0; i < pGeo->getVertexCount(); i++)
+                            indices.push_back(i);
+
+                    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+                        std::swap(indices[i+1], indices[i+2]);
+                }
+
+                pBaked->addGeometry(it.getMaterial(), Geometry::createSwapped(pGeo->getType(), bakeVertices(pGeo->getVertexBuffer(), m), indices));
+            }
+
+            return pBaked;
+        }
+
+        // geometries of a shape usually share one vertex buffer, it is transformed once per matrix
+        Ptr<IVertexBuffer> bakeVertices(Ptr<IVertexBuffer> pVB, const Matrix& m)
+        {
+            std::vector< std::pair<Matrix, Ptr<IVertexBuffer> > >& baked = m_vertices[pVB.get()];
+            for (size_t i = 0; i < baked.size(); i++)
+                if (baked[i].first == m)
+                    return baked[i].second;
+
+            // normals by the inverse transpose, from the cofactors of the upper 3x3
+            Vec3 r0(m[0], m[1], m[2]), r1(m[4], m[5], m[6]), r2(m[8], m[9], m[10]);
+            Vec3 n0 = cross(r1, r2), n1 = cross(r2, r0), n2 = cross(r0, r1);
+            Float fSign = dot(r0, n0) < 0 ? -1.f : 1.f;
+
+            Uint n = pVB->getVertexCount();
+            std::vector<Vec3> coords(n), normals(n), texcoords(n);
+            for (Uint i = 0; i < n; i++)
+            {
+                Vec3 normal = pVB->getNormal(i);
+                coords[i] = transform(pVB->getCoord(i), m);
+                normals[i] = ((n0 * normal.x + n1 * normal.y + n2 * normal.z) * fSign).normalized();
+                texcoords[i] = pVB->getTexCoord(i);
+            }
+
+            Uint nStride = pVB->getFormat() == IVertexBuffer::FORMAT_FLOAT ? pVB->getStride() : sizeof(Vec3)*2 + sizeof(Float)*2;
+            Ptr<IVertexBuffer> pBaked = CreateVertexBuffer(nStride);
+            if (n > 0)
+                pBaked->appendVertices(n, &coords[0], &normals[0], &texcoords[0]);
+
+            baked.push_back(std::make_pair(m, pBaked));
+            return pBaked;
+        }
+
+        const PathCounter& m_paths;
+        bool m_bBake;
+        boost::unordered_set<const GroupNode*> m_flattened;
+        boost::unordered_map< IVertexBuffer*, std::vector< std::pair<Matrix, Ptr<IVertexBuffer> > > > m_vertices;
+    };
+
+    void SceneOptimizer::flattenTransforms(Ptr<Scene> pScene)
+    {
+        StopWatch watch;
+
+        SceneNodeVector roots = pScene->getNodes();
+        FrameCounter before(roots);
+
+        PathCounter paths;
+        paths.count(roots);
+
+        // refiners hold on to the shapes they re-tessellate, those can't be replaced by baked copies
+        TransformFlattener flattener(paths, pScene->getRefiners().empty());
+
+        SceneNodeVector flat;
+        flattener.flatten(roots, Matrix::Identity(), flat);
+
+        pScene->replaceNodes(roots, flat);
+
+        FrameCounter after(flat);
+
+        std::cout << "SceneOptimizer::flattenTransforms: " << flattener.m_nBaked << " shapes baked, "
+                  << flattener.m_nKept << " instances kept in " << watch.elapsed() << " ms" << std::endl;
+        std::cout << "  nodes " << before.m_nGroups + before.m_nShapes << " -> " << after.m_nGroups + after.m_nShapes
+                  << ", draws " << before.m_nDraws << " -> " << after.m_nDraws
+                  << ", CPU walk " << before.m_ms << " ms -> " << after.m_ms << " ms" << std::endl;
+    }
+
+    // A shape reduced to raw pointers, the worker threads must not touch reference counts.
+    // Instances of the same mesh have the same canonical vertices: the shape's vertices relative to
+    // their centroid, in the frame of their principal axes where those are unique.
+    struct MeshInstance
+    {
+        struct Part
+        {
+            Material* pMaterial;
+            Geometry* pGeometry;
+            const IVertexBuffer* pVB;
+
+            bool operator<(const Part& other) const
+            {
+                if (pMaterial != other.pMaterial)
+                    return pMaterial < other.pMaterial;
+                return pGeometry->getType() < other.pGeometry->getType();
+            }
+        };
+
+        struct Canonical
+        {
+            Uint_vec topology;  // local vertex index per index of all parts
+            std::vector<Vec3> coords, normals, texcoords;
+            Float fTolerance;
+        };
+
+        ShapeNode* pShape;
+        std::vector<Part> parts;
+        size_t hash;
+        size_t nBytes;          // vertex and index data used by the shape
+        Matrix frame;           // canonical space to shape space
+        Uint nClass;            // index of the first instance of the same mesh
+        Uint nMembers;          // instances of the mesh, at the first one
+        Canonical canonical;    // kept at the first instance of meshes with more than one
+
+        Uint getIndex(const Part& part, Uint i) const
+        {
+            const Uint_vec& indices = part.pGeometry->getIndices();
+            return indices.empty() ? i : indices[i];
+        }
+        Uint getCount(const Part& part) const
+        {
+            const Uint_vec& indices = part.pGeometry->getIndices();
+            return indices.empty() ? part.pVB->getVertexCount() : (Uint)indices.size();
+        }
+    };
+
+    class InstanceDetector
+    {
+    public:
+        // meshes with fewer vertices aren't worth a transform node per instance
+        static const Uint MIN_VERTICES = 8;
+        // meshes with the same topology that are compared with each other before giving up
+        static const Uint MAX_CLASSES = 64;
+
+        std::vector<MeshInstance> m_meshes;
+        std::vector< std::pair<Uint, Uint> > m_buckets;     // ranges of m_order with the same hash
+        std::vector<Uint> m_order;
+
+        // the hash covers materials and topology only, the vertices are compared within a tolerance
+        void hashRange(Uint begin, Uint end)
+        {
+            MeshInstance::Canonical canonical;
+            for (Uint m = begin; m < end; m++)
+            {
+                MeshInstance& mesh = m_meshes[m];
+                Uint nVertices = collect(mesh, canonical, false);
+
+                size_t hash = nVertices;
+                for (size_t i = 0; i < mesh.parts.size(); i++)
+                {
+                    boost::hash_combine(hash, mesh.parts[i].pMaterial);
+                    boost::hash_combine(hash, (int)mesh.parts[i].pGeometry->getType());
+                    boost::hash_combine(hash, mesh.getCount(mesh.parts[i]));
+                }
+                boost::hash_range(hash, canonical.topology.begin(), canonical.topology.end());
+
+                mesh.hash = hash;
+                mesh.nBytes = nVertices * sizeof(Float) * 8 + canonical.topology.size() * sizeof(Uint);
+            }
+        }
+
+        // compares the meshes of a bucket with the first instance of each class found so far
+        void classifyRange(Uint begin, Uint end)
+        {
+            std::vector<Uint> classes;
+            MeshInstance::Canonical canonical;
+
+            for (Uint b = begin; b < end; b++)
+            {
+                if (m_buckets[b].second - m_buckets[b].first < 2)
+                    continue;
+
+                classes.clear();
+
+                for (Uint i = m_buckets[b].first; i < m_buckets[b].second; i++)
+                {
+                    MeshInstance& mesh = m_meshes[m_order[i]];
+                    collect(mesh, canonical, true);
+
+                    if (canonical.coords.size() < MIN_VERTICES)
+                        continue;
+
+                    size_t c = 0;
+                    while (c < classes.size() && !isSame(m_meshes[classes[c]], canonical))
+                        c++;
+
+                    if (c < classes.size())
+                    {
+                        mesh.nClass = classes[c];
+                        m_meshes[classes[c]].nMembers++;
+                    }
+                    else if (classes.size() < MAX_CLASSES)
+                    {
+                        classes.push_back(m_order[i]);
+                        std::swap(mesh.canonical, canonical);
+                    }
+                }
+
+                // only the meshes that are shared keep their vertices
+                for (size_t c = 0; c < classes.size(); c++)
+                    if (m_meshes[classes[c]].nMembers < 2)
+                        m_meshes[classes[c]].canonical = MeshInstance::Canonical();
+            }
+        }
+
+    private:
+        // the vertices used by the parts in the order of their first use, only the topology unless bCanonical
+        static Uint collect(MeshInstance& mesh, MeshInstance::Canonical& canonical, bool bCanonical)
+        {
+            boost::unordered_map< std::pair<const IVertexBuffer*, Uint>, Uint > local;
+            std::vector< std::pair<const IVertexBuffer*, Uint> > vertices;
+
+            canonical.topology.clear();
+            for (size_t p = 0; p < mesh.parts.size(); p++)
+            {
+                const MeshInstance::Part& part = mesh.parts[p];
+                for (Uint i = 0, n = mesh.getCount(part); i < n; i++)
+                {
+                    std::pair<const IVertexBuffer*, Uint> key(part.pVB, mesh.getIndex(part, i));
+                    std::pair<boost::unordered_map< std::pair<const IVertexBuffer*, Uint>, Uint >::iterator, bool> it =
+                        local.insert(std::make_pair(key, (Uint)vertices.size()));
+                    if (it.second)
+                        vertices.push_back(key);
+                    canonical.topology.push_back(it.first->second);
+                }
+            }
+
+            if (!bCanonical)
+                return (Uint)vertices.size();
+
+            canonical.coords.resize(vertices.size());
+            for (size_t i = 0; i < vertices.size(); i++)
+                canonical.coords[i] = vertices[i].first->getCoord(vertices[i].second);
+
+            mesh.frame = calcFrame(canonical.coords);
+
+            // the frame is a rotation and a translation, its transpose rotates back
+            const Matrix& f = mesh.frame;
+            Vec3 e0(f[0], f[1], f[2]), e1(f[4], f[5], f[6]), e2(f[8], f[9], f[10]), c(f[12], f[13], f[14]);
+
+            Float fExtent = 0;
+            canonical.normals.resize(vertices.size());
+            canonical.texcoords.resize(vertices.size());
+            for (size_t i = 0; i < vertices.size(); i++)
+            {
+                Vec3 v = canonical.coords[i] - c;
+                Vec3 n = vertices[i].first->getNormal(vertices[i].second);
+
+                canonical.coords[i] = Vec3(dot(v, e0), dot(v, e1), dot(v, e2));
+                canonical.normals[i] = Vec3(dot(n, e0), dot(n, e1), dot(n, e2));
+                canonical.texcoords[i] = vertices[i].first->getTexCoord(vertices[i].second);
+
+                fExtent = std::max(fExtent, canonical.coords[i].getLen());
+            }
+
+            // float precision of the original positions
+            canonical.fTolerance = 1e-4f * fExtent + 1e-6f * c.getLen();
+            return (Uint)vertices.size();
+        }
+
+        static bool isSame(const MeshInstance& first, const MeshInstance::Canonical& canonical)
+        {
+            const MeshInstance::Canonical& other = first.canonical;
+            if (other.topology != canonical.topology)
+                return false;
+
+            Float fTolerance = std::max(other.fTolerance, canonical.fTolerance);
+            for (size_t i = 0; i < canonical.coords.size(); i++)
+            {
+                Vec3 d = (other.coords[i] - canonical.coords[i]).abs();
+                if (d.x > fTolerance || d.y > fTolerance || d.z > fTolerance)
+                    return false;
+
+                Vec3 n = (other.normals[i] - canonical.normals[i]).abs();
+                if (n.x > 1e-3f || n.y > 1e-3f || n.z > 1e-3f)
+                    return false;
+
+                Vec3 t = (other.texcoords[i] - canonical.texcoords[i]).abs();
+                if (t.x > 1e-5f || t.y > 1e-5f)
+                    return false;
+            }
+            return true;
+        }
+
+        // Centroid and principal axes, sorted by variance and oriented by the sign of the third moment.
+        // Symmetric meshes have no unique axes, their frame is the translation to the centroid only.
+        static Matrix calcFrame(const std::vector<Vec3>& coords)
+        {
+            double c[3] = {0, 0, 0};
+            for (size_t i = 0; i < coords.size(); i++)
+            {
+                c[0] += coords[i].x; c[1] += coords[i].y; c[2] += coords[i].z;
+            }
+            for (int k = 0; k < 3; k++)
+                c[k] /= std::max((size_t)1, coords.size());
+
+            double a[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+            for (size_t i = 0; i < coords.size(); i++)
+            {
+                double d[3] = {coords[i].x - c[0], coords[i].y - c[1], coords[i].z - c[2]};
+                for (int j = 0; j < 3; j++)
+                    for (int k = 0; k < 3; k++)
+                        a[j][k] += d[j] * d[k];
+            }
+
+            Matrix frame = Matrix::Translation(Vec3((Float)c[0], (Float)c[1], (Float)c[2]));
+
+            double values[3], vectors[3][3];
+            eigenSymmetric(a, values, vectors);
+
+            double fMax = std::max(values[0], 1e-30);
+            if (values[0] - values[1] < 1e-3 * fMax || values[1] - values[2] < 1e-3 * fMax)
+                return frame;
+
+            // third moment along the two major axes, the third axis follows from them
+            double s[2] = {0, 0}, sAbs[2] = {0, 0};
+            for (size_t i = 0; i < coords.size(); i++)
+                for (int k = 0; k < 2; k++)
+                {
+                    double d = (coords[i].x - c[0]) * vectors[k][0] + (coords[i].y - c[1]) * vectors[k][1] + (coords[i].z - c[2]) * vectors[k][2];
+                    s[k] += d*d*d;
+                    sAbs[k] += fabs(d*d*d);
+                }
+
+            for (int k = 0; k < 2; k++)
+            {
+                if (fabs(s[k]) < 1e-3 * sAbs[k] || sAbs[k] == 0)
+                    return frame;
+
+                if (s[k] < 0)
+                    for (int j = 0; j < 3; j++)
+                        vectors[k][j] = -vectors[k][j];
+            }
+
+            Vec3 e0((Float)vectors[0][0], (Float)vectors[0][1], (Float)vectors[0][2]);
+            Vec3 e1((Float)vectors[1][0], (Float)vectors[1][1], (Float)vectors[1][2]);
+            Vec3 e2 = cross(e0, e1);
+
+            frame[0] = e0.x; frame[1] = e0.y; frame[2] = e0.z;
+            frame[4] = e1.x; frame[5] = e1.y; frame[6] = e1.z;
+            frame[8] = e2.x; frame[9] = e2.y; frame[10] = e2.z;
+            return frame;
+        }
+
+        // Jacobi rotations, values in descending order with the unit vectors[i] belonging to values[i]
+        static void eigenSymmetric(double a[3][3], double values[3], double vectors[3][3])
+        {
+            double v[3][3] = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+
+            for (int sweep = 0; sweep < 50; sweep++)
+            {
+                double off = a[0][1]*a[0][1] + a[0][2]*a[0][2] + a[1][2]*a[1][2];
+                if (off < 1e-24 * (a[0][0]*a[0][0] + a[1][1]*a[1][1] + a[2][2]*a[2][2]) || off == 0)
+                    break;
+
+                for (int p = 0; p < 2; p++)
+                    for (int q = p + 1; q < 3; q++)
+                    {
+                        if (a[p][q] == 0)
+                            continue;
+
+                        double theta = (a[q][q] - a[p][p]) / (2 * a[p][q]);
+                        double t = (theta >= 0 ? 1 : -1) / (fabs(theta) + sqrt(theta*theta + 1));
+                        double cs = 1 / sqrt(t*t + 1), sn = t * cs;
+
+                        for (int k = 0; k < 3; k++)
+                        {
+                            double akp = a[k][p], akq = a[k][q];
+                            a[k][p] = cs*akp - sn*akq;
+                            a[k][q] = sn*akp + cs*akq;
+                        }
+                        for (int k = 0; k < 3; k++)
+                        {
+                            double apk = a[p][k], aqk = a[q][k];
+                            a[p][k] = cs*apk - sn*aqk;
+                            a[q][k] = sn*apk + cs*aqk;
+                        }
+                        for (int k = 0; k < 3; k++)
+                        {
+                            double vkp = v[k][p], vkq = v[k][q];
+                            v[k][p] = cs*vkp - sn*vkq;
+                            v[k][q] = sn*vkp + cs*vkq;
+                        }
+                    }
+            }
+
+            int order[3] = {0, 1, 2};
+            for (int i = 0; i < 3; i++)
+                for (int j = i + 1; j < 3; j++)
+                    if (a[order[j]][order[j]] > a[order[i]][order[i]])
+                        std::swap(order[i], order[j]);
+
+            for (int i = 0; i < 3; i++)
+            {
+                values[i] = a[order[i]][order[i]];
+                for (int k = 0; k < 3; k++)
+                    vectors[i][k] = v[k][order[i]];
+            }
+        }
+    };
+
+    // every shape once, shapes with flags stay as they are
+    static void collectShapes(const SceneNodeVector& nodes, std::vector<ShapeNode*>& shapes, boost::unordered_set<SceneNode*>& visited)
+    {
+        for (SceneNodeVector::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+        {
+            if (*it == NULL || !visited.insert(it->get()).second)
+                continue;
+
+            if (GroupNode* pGroup = dynamic_cast<GroupNode*>(it->get()))
+                collectShapes(pGroup->getChildNodes(), shapes, visited);
+            else if (ShapeNode* pShape = dynamic_cast<ShapeNode*>(it->get()))
+                if (pShape->getFlags() == 0)
+                    shapes.push_back(pShape);
+        }
+    }
+
+    static Ptr<ShapeNode> createShape(const MeshInstance& mesh)
+    {
+        const MeshInstance::Canonical& canonical = mesh.canonical;
+
+        Ptr<IVertexBuffer> pVB = CreateVertexBuffer(sizeof(Vec3)*2 + sizeof(Float)*2);
+        pVB->appendVertices((Uint)canonical.coords.size(), &canonical.coords[0], &canonical.normals[0], &canonical.texcoords[0]);
+
+        Ptr<ShapeNode> pShape = ShapeNode::create();
+
+        Uint nOffset = 0;
+        for (size_t p = 0; p < mesh.parts.size(); p++)
+        {
+            Uint n = mesh.getCount(mesh.parts[p]);
+
+            Uint_vec indices;
+            indices.insert(indices.end(), canonical.topology.begin() + nOffset, canonical.topology.begin() + nOffset + n);
+            nOffset += n;
+
+            pShape->addGeometry(mesh.parts[p].pMaterial, Geometry::createSwapped(mesh.parts[p].pGeometry->getType(), pVB, indices));
+        }
+
+        return pShape;
+    }
+
+    // returns true if anything below nodes was replaced
+    static bool replaceShapes(const SceneNodeVector& nodes, const boost::unordered_map< SceneNode*, Ptr<SceneNode> >& replaced,
+                              boost::unordered_set<GroupNode*>& visited)
+    {
+        bool bReplaced = false;
+
+        for (SceneNodeVector::const_iterator it = nodes.begin(); it != nodes.end(); ++it)
+        {
+            GroupNode* pGroup = dynamic_cast<GroupNode*>(it->get());
+            if (pGroup == NULL || !visited.insert(pGroup).second)
+                continue;
+
+            if (replaceShapes(pGroup->getChildNodes(), replaced, visited))
+                bReplaced = true;
+
+            SceneNodeVector childs = pGroup->getChildNodes();
+            bool bChanged = false;
+            for (size_t i = 0; i < childs.size(); i++)
+            {
+                boost::unordered_map< SceneNode*, Ptr<SceneNode> >::const_iterator r = replaced.find(childs[i].get());
+                if (r != replaced.end())
+                {
+                    childs[i] = r->second;
+                    bChanged = true;
+                }
+            }
+
+            if (bChanged)
+            {
+                pGroup->deleteChildNodes();
+                pGroup->addChildNodes(childs);
+                pGroup->calcBounding();
+                bReplaced = true;
+            }
+        }
+
+        return bReplaced;
+    }
+
+    void SceneOptimizer::shareInstances(Ptr<Scene> pScene)
+    {
+        // refiners hold on to the shapes they re-tessellate
+        if (!pScene->getRefiners().empty())
+            return;
+
+        StopWatch watch;
+
+        InstanceDetector detector;
+        std::vector<ShapeNode*> shapes;
+        boost::unordered_set<SceneNode*> visited;
+        collectShapes(pScene->getNodes(), shapes, visited);
+
+        detector.m_meshes.resize(shapes.size());
+        for (size_t m = 0; m < shapes.size(); m++)
+        {
+            MeshInstance& mesh = detector.m_meshes[m];
+            mesh.pShape = shapes[m];
+            mesh.nClass = (Uint)m;
+            mesh.nMembers = 1;
+
+            for (GeometryIterator it = shapes[m]->GeometryBegin(); it != shapes[m]->GeometryEnd(); ++it)
+            {
+                MeshInstance::Part part;
+                part.pMaterial = it->first.first.get();
+                part.pGeometry = it.getGeometry().get();
+                part.pVB = part.pGeometry->getVertexBuffer().get();
+
+                if (part.pVB)
+                    mesh.parts.push_back(part);
+            }
+            std::sort(mesh.parts.begin(), mesh.parts.end());
+        }
+
+        parallelFor((Uint)shapes.size(), boost::bind(&InstanceDetector::hashRange, &detector, _1, _2), 16);
+
+        std::vector< std::pair<size_t, Uint> > hashes(shapes.size());
+        for (size_t m = 0; m < shapes.size(); m++)
+            hashes[m] = std::make_pair(detector.m_meshes[m].hash, (Uint)m);
+        std::sort(hashes.begin(), hashes.end());
+
+        for (size_t i = 0; i < hashes.size(); i++)
+        {
+            detector.m_order.push_back(hashes[i].second);
+            if (i == 0 || hashes[i].first != hashes[i-1].first)
+                detector.m_buckets.push_back(std::make_pair((Uint)i, (Uint)i));
+            detector.m_buckets.back().second = (Uint)i + 1;
+        }
+
+        parallelFor((Uint)detector.m_buckets.size(), boost::bind(&InstanceDetector::classifyRange, &detector, _1, _2), 16);
+
+        // one shape in canonical space per shared mesh, a transform node per instance
+        boost::unordered_map< SceneNode*, Ptr<SceneNode> > replaced;
+        std::vector< Ptr<ShapeNode> > canonical(shapes.size());
+        size_t before = 0, after = 0;
+        Uint nInstances = 0, nMeshes = 0;
+
+        for (size_t m = 0; m < shapes.size(); m++)
+        {
+            MeshInstance& mesh = detector.m_meshes[m];
+            before += mesh.nBytes;
+
+            MeshInstance& first = detector.m_meshes[mesh.nClass];
+            if (first.nMembers < 2)
+            {
+                after += mesh.nBytes;
+                continue;
+            }
+
+            Ptr<ShapeNode>& pCanonical = canonical[mesh.nClass];
+            if (pCanonical == NULL)
+            {
+                pCanonical = createShape(first);
+                after += first.nBytes;
+                nMeshes++;
+            }
+
+            replaced[mesh.pShape] = GroupNode::create(pCanonical, mesh.frame);
+            nInstances++;
+        }
+
+        // the roots go at once, the AABB tree is organized once for all of them
+        SceneNodeVector roots = pScene->getNodes();
+        SceneNodeVector removed, inserted;
+        bool bChanged = false;
+        boost::unordered_set<GroupNode*> groups;
+        for (SceneNodeVector::const_iterator it = roots.begin(); it != roots.end() && !replaced.empty(); ++it)
+        {
+            boost::unordered_map< SceneNode*, Ptr<SceneNode> >::const_iterator r = replaced.find(it->get());
+            if (r != replaced.end())
+            {
+                removed.push_back(*it);
+                inserted.push_back(r->second);
+                bChanged = true;
+            }
+            else if (replaceShapes(SceneNodeVector(*it), replaced, groups))
+                bChanged = true;
+        }
+
+        if (bChanged)
+            pScene->replaceNodes(removed, inserted);
+
+        std::cout << "SceneOptimizer::shareInstances: " << shapes.size() << " shapes, " << nInstances << " instances of "
+                  << nMeshes << " meshes (" << (nMeshes ? (float)nInstances / nMeshes : 0.f) << " per mesh), "
+                  << before/1024 << " KB -> " << after/1024 << " KB in " << watch.elapsed() << " ms" << std::endl;
+    }
+
+    // merges the small shapes in world space below each AABB tree node into one shape, a geometry per material
+    class StaticBatcher
+    {
+    public:
+        // shapes with more triangles are drawn on their own
+        static const Uint MAX_SHAPE_TRIANGLES = 512;
+        // subtrees with fewer triangles in small shapes become one batch
+        static const Uint MAX_BATCH_TRIANGLES = 8192;
+
+        SceneNodeVector m_batched;
+        SceneNodeVector m_batches;
+
+        StaticBatcher(const SceneNodeVector& roots)
+        {
+            PathCounter paths;
+            paths.count(roots);
+
+            for (SceneNodeVector::const_iterator it = roots.begin(); it != roots.end(); ++it)
+            {
+                ShapeNode* pShape = dynamic_cast<ShapeNode*>(it->get());
+                if (pShape == NULL || paths.isShared(pShape) || pShape->getFlags() != 0 || !pShape->getBounding().valid())
+                    continue;
+
+                Uint nTriangles = getTriangles(pShape);
+                if (nTriangles > 0 && nTriangles <= MAX_SHAPE_TRIANGLES)
+                {
+                    m_triangles[pShape] = nTriangles;
+                    m_shapes.push_back(*it);
+                    m_bound = m_bound + pShape->getBounding();
+                }
+            }
+        }
+
+        void batch()
+        {
+            if (m_shapes.size() < 2)
+                return;
+
+            AABBTreeRoot tree(m_bound.getMin(), m_bound.getMax(), m_shapes);
+            count(&tree);
+            batch(&tree);
+        }
+
+    private:
+        // triangles of a shape that can be merged, 0 if it can't
+        static Uint getTriangles(ShapeNode* pShape)
+        {
+            Uint nTriangles = 0;
+            for (GeometryIterator it = pShape->GeometryBegin(); it != pShape->GeometryEnd(); ++it)
+            {
+                const Ptr<Geometry>& pGeo = it.getGeometry();
+                const Ptr<Material>& pMat = it.getMaterial();
+
+                // blended geometries are sorted by depth one by one
+                if (pGeo->getType() != Geometry::TRIANGLES || pGeo->getVertexBuffer() == NULL
+                    || !pGeo->getLods().empty() || !pGeo->getMeshlets().empty()
+                    || (pMat && pMat->isBlended()))
+                    return 0;
+
+                nTriangles += pGeo->getVertexCount() / 3;
+            }
+            return nTriangles;
+        }
+
+        Uint count(const AABBTreeNode* pNode)
+        {
+            if (pNode == NULL)
+                return 0;
+
+            Uint n = count(pNode->left()) + count(pNode->right());
+            for (SceneNodeList::const_iterator it = pNode->nodes().begin(); it != pNode->nodes().end(); ++it)
+                n += m_triangles[it->get()];
+
+            m_counts[pNode] = n;
+            return n;
+        }
+
+        void collect(const AABBTreeNode* pNode, std::vector<ShapeNode*>& shapes)
+        {
+            if (pNode == NULL)
+                return;
+
+            for (SceneNodeList::const_iterator it = pNode->nodes().begin(); it != pNode->nodes().end(); ++it)
+                shapes.push_back(static_cast<ShapeNode*>(it->get()));
+
+            collect(pNode->left(), shapes);
+            collect(pNode->right(), shapes);
+        }
+
+        void batch(const AABBTreeNode* pNode)
+        {
+            if (pNode == NULL)
+                return;
+
+            std::vector<ShapeNode*> shapes;
+            if (m_counts[pNode] <= MAX_BATCH_TRIANGLES)
+            {
+                collect(pNode, shapes);
+                merge(shapes);
+                return;
+            }
+
+            batch(pNode->left());
+            batch(pNode->right());
+
+            // the shapes on the split planes of a large subtree, in batches of the same size
+            Uint nTriangles = 0;
+            for (SceneNodeList::const_iterator it = pNode->nodes().begin(); it != pNode->nodes().end(); ++it)
+            {
+                Uint n = m_triangles[it->get()];
+                if (nTriangles + n > MAX_BATCH_TRIANGLES)
+                {
+                    merge(shapes);
+                    shapes.clear();
+                    nTriangles = 0;
+                }
+
+                shapes.push_back(static_cast<ShapeNode*>(it->get()));
+                nTriangles += n;
+            }
+            merge(shapes);
+        }
+
+        struct Batch
+        {
+            Ptr<Material> pMaterial;
+            std::vector<Vec3> coords, normals, texcoords;
+            Uint_vec indices;
+            Uint nStride;
+        };
+
+        void merge(const std::vector<ShapeNode*>& shapes)
+        {
+            if (shapes.size() < 2)
+                return;
+
+            boost::unordered_map<Material*, Batch> batches;
+            for (size_t s = 0; s < shapes.size(); s++)
+            {
+                for (GeometryIterator it = shapes[s]->GeometryBegin(); it != shapes[s]->GeometryEnd(); ++it)
+                {
+                    const Ptr<Geometry>& pGeo = it.getGeometry();
+                    const IVertexBuffer& vb = *pGeo->getVertexBuffer();
+
+                    Batch& batch = batches[it.getMaterial().get()];
+                    if (batch.coords.empty())
+                    {
+                        batch.pMaterial = it.getMaterial();
+                        batch.nStride = 0;
+                    }
+                    batch.nStride = std::max(batch.nStride, vb.getFormat() == IVertexBuffer::FORMAT_FLOAT ? vb.getStride() : (Uint)(sizeof(Vec3)*2 + sizeof(Float)*2));
+
+                    // only the vertices the geometry uses, a vertex buffer may be shared by several shapes
+                    boost::unordered_map<Uint, Uint> remap;
+                    const Uint_vec& indices = pGeo->getIndices();
+                    Uint n = indices.empty() ? pGeo->getVertexCount() : (Uint)indices.size();
+
+                    for (Uint i = 0; i < n; i++)
+                    {
+                        Uint v = indices.empty() ? i : indices[i];
+                        std::pair<boost::unordered_map<Uint, Uint>::iterator, bool> inserted = remap.insert(std::make_pair(v, (Uint)batch.coords.size()));
+                        if (inserted.second)
+                        {
+                            batch.coords.push_back(vb.getCoord(v));
+                            batch.normals.push_back(vb.getNormal(v));
+                            batch.texcoords.push_back(vb.getTexCoord(v));
+                        }
+                        batch.indices.push_back(inserted.first->second);
+                    }
+                }
+
+                m_batched.push_back(shapes[s]);
+            }
+
+            Ptr<ShapeNode> pBatch = ShapeNode::create();
+            for (boost::unordered_map<Material*, Batch>::iterator it = batches.begin(); it != batches.end(); ++it)
+            {
+                Batch& batch = it->second;
+                if (batch.coords.empty())
+                    continue;
+
+                Ptr<IVertexBuffer> pVB = CreateVertexBuffer(batch.nStride);
+                pVB->appendVertices((Uint)batch.coords.size(), &batch.coords[0], &batch.normals[0], &batch.texcoords[0]);
+                pBatch->addGeometry(batch.pMaterial, Geometry::createSwapped(Geometry::TRIANGLES, pVB, batch.indices));
+            }
+
+            m_batches.push_back(pBatch);
+        }
+
+        SceneNodeList m_shapes;
+        AABBox m_bound;
+        boost::unordered_map<const SceneNode*, Uint> m_triangles;
+        boost::unordered_map<const AABBTreeNode*, Uint> m_counts;
+    };
+
+    void SceneOptimizer::batchShapes(Ptr<Scene> pScene)
+    {
+        StopWatch watch;
+
+        // refiners hold on to the shapes they re-tessellate, those can't be merged
+        if (!pScene->getRefiners().empty())
+        {
+            std::cout << "SceneOptimizer::batchShapes: skipped, the scene has refiners" << std::endl;
+            return;
+        }
+
+        SceneNodeVector roots = pScene->getNodes();
+        FrameCounter before(roots);
+
+        StaticBatcher batcher(roots);
+        batcher.batch();
+
+        pScene->replaceNodes(batcher.m_batched, batcher.m_batches);
+
+        FrameCounter after(pScene->getNodes());
+
+        std::cout << "SceneOptimizer::batchShapes: " << batcher.m_batched.size() << " shapes merged into "
+                  << batcher.m_batches.size() << " batches in " << watch.elapsed() << " ms" << std::endl;
+        std::cout << "  nodes " << before.m_nGroups + before.m_nShapes << " -> " << after.m_nGroups + after.m_nShapes
+                  << ", draws " << before.m_nDraws << " -> " << after.m_nDraws
+                  << ", CPU walk " << before.m_ms << " ms -> " << after.m_ms << " ms" << std::endl;
+    }
+
+    CompactStatistics SceneOptimizer::compactVertices(Ptr<Scene> pScene)
+    {
+        StopWatch watch;
+
+        GeometryCollector collector;
+        collector.collect(pScene->getNodes());
+
+        boost::unordered_map< IVertexBuffer*, Ptr<IVertexBuffer> > compacted;
+        CompactStatistics total = CompactStatistics();
+        Uint nVertices = 0;
+
+        for (size_t i = 0; i < collector.m_geometries.size(); i++)
+        {
+            Geometry* pGeo = collector.m_geometries[i];
+            Ptr<IVertexBuffer> pVB = pGeo->getVertexBuffer();
+
+            if (pVB == NULL)
+                continue;
+
+            Ptr<IVertexBuffer>& pCompact = compacted[pVB.get()];
+            if (pCompact == NULL)
+            {
+                // stays as it is if it's compact already
+                CompactStatistics stats = CompactStatistics();
+                stats.nSourceBytes = stats.nCompactBytes = pVB->getBufferSize();
+
+                pCompact = CreateCompactVertexBuffer(pVB, &stats);
+                total.nSourceBytes += stats.nSourceBytes;
+                total.nCompactBytes += stats.nCompactBytes;
+                total.fEncodeTime += stats.fEncodeTime;
+                total.fDecodeTime += stats.fDecodeTime;
+                total.fMaxError = std::max(total.fMaxError, stats.fMaxError);
+                nVertices += pVB->getVertexCount();
+            }
+
+            pGeo->setVertexBuffer(pCompact);
+        }
+
+        std::cout << "SceneOptimizer::compactVertices: " << compacted.size() << " VertexBuffers, " << nVertices << " vertices, "
+                  << total.nSourceBytes/1024 << " KB -> " << total.nCompactBytes/1024 << " KB in " << watch.elapsed() << " ms" << std::endl;
+        std::cout << "  encode " << total.fEncodeTime << " ms, decode " << (nVertices ? total.fDecodeTime * 1000000.0 / nVertices : 0)
+                  << " ns/vertex, max position error " << total.fMaxError << std::endl;
+
+        return total;
+    }
+
+    // simplifies geometries into chains of levels, each thread takes every nth of the jobs
+    class LodGenerator
+    {
+    public:
+        // geometries with fewer triangles are drawn as they are
+        static const Uint MIN_TRIANGLES = 256;
+        static const Uint MAX_LEVELS = 6;
+
+        struct Job
+        {
+            Geometry* pGeometry;
+            const IVertexBuffer* pVB;
+            Uint nTriangles;
+            Uint_vec indices;           // of a geometry without, its equal vertices welded
+            std::vector<Uint_vec> levels;
+            std::vector<Float> errors;
+
+            // the largest first, for the lanes to end at about the same time
+            bool operator<(const Job& other) const
+            {
+                return nTriangles > other.nTriangles;
+            }
+        };
+
+        // orders vertices by coordinate, normal and texture coordinate
+        struct VertexLess
+        {
+            const IVertexBuffer* pVB;
+
+            static int compare(const Vec3& a, const Vec3& b)
+            {
+                if (a.x != b.x)
+                    return a.x < b.x ? -1 : 1;
+                if (a.y != b.y)
+                    return a.y < b.y ? -1 : 1;
+                if (a.z != b.z)
+                    return a.z < b.z ? -1 : 1;
+                return 0;
+            }
+
+            int compare(Uint a, Uint b) const
+            {
+                int c = compare(pVB->getCoord(a), pVB->getCoord(b));
+                if (c == 0)
+                    c = compare(pVB->getNormal(a), pVB->getNormal(b));
+                if (c == 0)
+                    c = compare(pVB->getTexCoord(a), pVB->getTexCoord(b));
+                return c;
+            }
+
+            bool operator()(Uint a, Uint b) const
+            {
+                return compare(a, b) < 0;
+            }
+        };
+
+        std::vector<Job> m_jobs;
+        Uint m_nLanes;
+        Uint m_nLevels;
+
+        void simplifyLanes(Uint begin, Uint end)
+        {
+            for (Uint lane = begin; lane < end; lane++)
+                for (size_t j = lane; j < m_jobs.size(); j += m_nLanes)
+                    simplify(m_jobs[j]);
+        }
+
+        // a triangle list without indices has its own vertices per triangle, the equal ones get
+        // one index so the triangles are connected for the simplifier
+        static void weld(const IVertexBuffer* pVB, Uint nVertices, Uint_vec& indices)
+        {
+            std::vector<Uint> order(nVertices);
+            for (Uint i = 0; i < nVertices; i++)
+                order[i] = i;
+
+            VertexLess less = { pVB };
+            std::sort(order.begin(), order.end(), less);
+
+            indices.resize(nVertices);
+            for (Uint i = 0; i < nVertices; i++)
+                indices[order[i]] = i > 0 && less.compare(order[i-1], order[i]) == 0 ? indices[order[i-1]] : order[i];
+        }
+
+        void simplify(Job& job)
+        {
+            if (job.pGeometry->getIndices().empty())
+                weld(job.pVB, job.nTriangles * 3, job.indices);
+
+            const Uint_vec& indices = job.indices.empty() ? job.pGeometry->getIndices() : job.indices;
+            MeshSimplifier simplifier(*job.pVB, indices);
+
+            Uint nTriangles = simplifier.getTriangleCount();
+            for (Uint l = 0; l < m_nLevels && nTriangles >= MIN_TRIANGLES / 2; l++)
+            {
+                Uint_vec level;
+                simplifier.simplify(nTriangles / 2, level);
+
+                // not worth a level, the rest is held by borders and folds
+                if (simplifier.getTriangleCount() > nTriangles * 3 / 4)
+                    break;
+
+                nTriangles = simplifier.getTriangleCount();
+                job.levels.push_back(Uint_vec());
+                job.levels.back().swap(level);
+                job.errors.push_back(simplifier.getError());
+            }
+        }
+    };
+
+    void SceneOptimizer::generateLods(Ptr<Scene> pScene, Uint nLevels)
+    {
+        // other refiners replace the geometries of their shapes, a selector would swap stale levels back
+        const std::vector< Ptr<ISceneRefiner> >& refiners = pScene->getRefiners();
+        for (size_t i = 0; i < refiners.size(); i++)
+        {
+            if (dynamic_cast<LodSelector*>(refiners[i].get()) == NULL)
+            {
+                std::cout << "SceneOptimizer::generateLods: skipped, the scene has refiners" << std::endl;
+                return;
+            }
+        }
+
+        StopWatch watch;
+
+        GeometryCollector collector;
+        collector.collect(pScene->getNodes());
+
+        // the workers must not touch reference counts, they get raw vertex buffers
+        LodGenerator generator;
+        for (size_t i = 0; i < collector.m_geometries.size(); i++)
+        {
+            Geometry* pGeo = collector.m_geometries[i];
+            if (pGeo->getType() != Geometry::TRIANGLES || !pGeo->getLods().empty() || pGeo->getVertexBuffer() == NULL)
+                continue;
+
+            Uint nTriangles = pGeo->getVertexCount() / 3;
+            if (nTriangles < LodGenerator::MIN_TRIANGLES)
+                continue;
+
+            LodGenerator::Job job;
+            job.pGeometry = pGeo;
+            job.pVB = pGeo->getVertexBuffer().get();
+            job.nTriangles = nTriangles;
+            generator.m_jobs.push_back(job);
+        }
+
+        std::sort(generator.m_jobs.begin(), generator.m_jobs.end());
+        generator.m_nLevels = std::min(nLevels, LodGenerator::MAX_LEVELS);
+        generator.m_nLanes = std::min((Uint)generator.m_jobs.size(), TaskPool::global().getThreadCount());
+
+        parallelFor(generator.m_nLanes, boost::bind(&LodGenerator::simplifyLanes, &generator, _1, _2), 1);
+
+        size_t nTriangles = 0, nLevelTriangles = 0, nGeometries = 0;
+        for (size_t j = 0; j < generator.m_jobs.size(); j++)
+        {
+            LodGenerator::Job& job = generator.m_jobs[j];
+            if (job.levels.empty())
+                continue;
+
+            std::vector<Geometry::Lod> lods(job.levels.size());
+            for (size_t l = 0; l < job.levels.size(); l++)
+            {
+                nLevelTriangles += job.levels[l].size() / 3;
+                lods[l].pGeometry = Geometry::createSwapped(Geometry::TRIANGLES, job.pGeometry->getVertexBuffer(), job.levels[l]);
+                lods[l].fError = job.errors[l];
+            }
+
+            nTriangles += job.nTriangles;
+            job.pGeometry->setLods(lods);
+            nGeometries++;
+        }
+
+        // at most the selector added by an earlier call
+        if (nGeometries > 0 && refiners.empty())
+            pScene->addRefiner(new LodSelector(*pScene));
+
+        std::cout << "SceneOptimizer::generateLods: " << nGeometries << " of " << collector.m_geometries.size() << " geometries, "
+                  << nTriangles << " triangles, " << nLevelTriangles << " in their levels, in " << watch.elapsed() << " ms" << std::endl;
+    }
+
+    class MeshletBuilder
+    {
+    public:
+        // geometries with fewer triangles are culled as a whole
+        static const Uint MIN_TRIANGLES = 4 * Meshlets::MAX_TRIANGLES;
+
+        struct Job
+        {
+            Geometry* pGeometry;
+            const IVertexBuffer* pVB;
+            Uint_vec indices;
+            std::vector<Geometry::Meshlet> meshlets;
+        };
+
+        std::vector<Job> m_jobs;
+
+        void add(Geometry* pGeo)
+        {
+            if (pGeo->getType() != Geometry::TRIANGLES || pGeo->getIndices().size() < MIN_TRIANGLES * 3
+                || !pGeo->getMeshlets().empty() || pGeo->getVertexBuffer() == NULL)
+                return;
+
+            Job job;
+            job.pGeometry = pGeo;
+            job.pVB = pGeo->getVertexBuffer().get();
+            m_jobs.push_back(job);
+        }
+
+        void buildRange(Uint begin, Uint end)
+        {
+            for (Uint j = begin; j < end; j++)
+            {
+                m_jobs[j].indices = m_jobs[j].pGeometry->getIndices();
+                Meshlets::build(*m_jobs[j].pVB, m_jobs[j].indices, m_jobs[j].meshlets);
+            }
+        }
+    };
+
+    void SceneOptimizer::buildMeshlets(Ptr<Scene> pScene)
+    {
+        StopWatch watch;
+
+        GeometryCollector collector;
+        collector.collect(pScene->getNodes());
+
+        // the workers must not touch reference counts, they get raw vertex buffers
+        MeshletBuilder builder;
+        for (size_t i = 0; i < collector.m_geometries.size(); i++)
+        {
+            Geometry* pGeo = collector.m_geometries[i];
+            builder.add(pGeo);
+
+            const std::vector<Geometry::Lod>& lods = pGeo->getLods();
+            for (size_t l = 0; l < lods.size(); l++)
+                builder.add(lods[l].pGeometry.get());
+        }
+
+        parallelFor((Uint)builder.m_jobs.size(), boost::bind(&MeshletBuilder::buildRange, &builder, _1, _2), 1);
+
+        size_t nTriangles = 0, nMeshlets = 0;
+        for (size_t j = 0; j < builder.m_jobs.size(); j++)
+        {
+            MeshletBuilder::Job& job = builder.m_jobs[j];
+            nTriangles += job.indices.size() / 3;
+            nMeshlets += job.meshlets.size();
+            job.pGeometry->setMeshlets(job.indices, job.meshlets);
+        }
+
+        std::cout << "SceneOptimizer::buildMeshlets: " << builder.m_jobs.size() << " geometries, " << nTriangles << " triangles in "
+                  << nMeshlets << " meshlets (" << (nMeshlets ? (float)nTriangles / nMeshlets : 0.f) << " per meshlet) in "
+                  << watch.elapsed() << " ms" << std::endl;
+    }
+}
@@ -0,0 +1,39 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "Scene.h"
+
+namespace eh
+{
+    // Passes over a loaded scene, SceneIO runs them after reading depending on its load flags.
+    class API_3D SceneOptimizer
+    {
+    public:
+        // replaces the vertex buffers of all geometries by quantized copies (CreateCompactVertexBuffer),
+        // returns the statistics of all buffers, the largest error and the sums of the rest
+        static CompactStatistics compactVertices(Ptr<Scene> pScene);
+
+        // Collapses chains of non-animated GroupNodes. Shapes reached by a single path get their
+        // geometry transformed into world space, shared shapes and geometries stay shared below one
+        // GroupNode per chain. Animated and flagged groups are kept, their children are flattened.
+        static void flattenTransforms(Ptr<Scene> pScene);
+
+        // Finds shapes with the same mesh up to a rotation and translation, in parallel. Each mesh is
+        // stored once relative to its centroid and principal axes, the instances get a GroupNode each.
+        static void shareInstances(Ptr<Scene> pScene);
+
+        // Merges small triangle shapes in world space (flattenTransforms) that are near each other into
+        // one shape per AABB tree node, with a geometry per material, to save draw calls. The batches
+        // are culled by their own bounds. Shared, flagged and blended shapes stay on their own.
+        static void batchShapes(Ptr<Scene> pScene);
+
+        // Simplifies triangle geometries into up to nLevels coarser index lists on their vertex buffers,
+        // each halving the triangles, in parallel. Adds a LodSelector to the scene to draw them by distance.
+        static void generateLods(Ptr<Scene> pScene, Uint nLevels = 4);
+
+        // Reorders the triangles of large triangle geometries and their levels of detail into meshlets
+        // (Meshlets::build), in parallel, for the driver to cull them one by one.
+        static void buildMeshlets(Ptr<Scene> pScene);
+    };
+}
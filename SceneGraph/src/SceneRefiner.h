@@ -0,0 +1,29 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "RefCounted.h"
+#include <vector>
+
+namespace eh
+{
+    // Refines the geometry of a scene while it is shown, e.g. re-tessellation of curved surfaces
+    // by their size on screen. The work is done by a thread of the refiner, the viewport only
+    // hands over the view and swaps in finished geometry between two frames.
+    class ISceneRefiner: public RefCounted
+    {
+    public:
+        virtual ~ISceneRefiner(){};
+
+        // the view of the next frame, must return immediately
+        virtual void update(const Matrix& view, const Matrix& proj, const Rect& viewport) = 0;
+
+        // swaps finished geometry into the scene nodes, returns true if anything changed. The
+        // geometries replaced go to released, a frame in flight may still draw them.
+        virtual bool apply(std::vector< Ptr<RefCounted> >& released) = 0;
+
+        // finished geometry is waiting for apply()
+        virtual bool isPending() const = 0;
+    };
+}
@@ -51,6 +51,32 @@ namespace eh
 
         void addGeometry(Ptr<Material> pMat, Ptr<Geometry> pGeo);
 
+        // replaces the geometry of pMat by pGeo of the same type, e.g. a refined tessellation, and
+        // returns the one replaced. The bounding stays, the new geometry has to cover the same surface.
+        Ptr<Geometry> replaceGeometry(Ptr<Material> pMat, Ptr<Geometry> pGeo)
+        {
+            Ptr<Geometry>& pSlot = m_geometry[ std::make_pair(pMat, pGeo->getType()) ];
+            Ptr<Geometry> pOld = pSlot;
+            pSlot = pGeo;
+            m_nRevision++;
+            geometryReplaced();
+            return pOld;
+        }
+
+        // a shape with the geometries of this one that have no material, NULL if all have one
+        Ptr<ShapeNode> createWithoutMaterials() const
+        {
+            Ptr<ShapeNode> pShape;
+            for (MATERIAL_GEOMETRY_CONTAINER::const_iterator it = m_geometry.begin(); it != m_geometry.end(); ++it)
+                if (it->first.first == NULL)
+                {
+                    if (pShape == NULL)
+                        pShape = create();
+                    pShape->addGeometry(NULL, it->second);
+                }
+            return pShape;
+        }
+
         GeometryIterator GeometryBegin() const
         {
             return GeometryIterator(m_geometry.begin());
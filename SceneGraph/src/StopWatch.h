@@ -0,0 +1,35 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace eh
+{
+    // wall clock timer for the load/render statistics
+    class StopWatch
+    {
+    public:
+        StopWatch():m_start(now())
+        {}
+
+        void restart()
+        {
+            m_start = now();
+        }
+
+        // milliseconds since construction or restart()
+        double elapsed() const
+        {
+            return (now() - m_start).total_microseconds() / 1000.0;
+        }
+
+    private:
+        static boost::posix_time::ptime now()
+        {
+            return boost::posix_time::microsec_clock::universal_time();
+        }
+
+        boost::posix_time::ptime m_start;
+    };
+}
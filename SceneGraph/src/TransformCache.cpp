@@ -0,0 +1,203 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "TransformCache.h"
+
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <boost/detail/atomic_count.hpp>
+
+namespace eh
+{
+    namespace
+    {
+        // a cache built anew at the address of one destroyed doesn't repeat its build count
+        boost::detail::atomic_count g_nBuilds(0);
+
+        // box of the transformed box by its center and extents, without going over the corners
+        AABBox transformBox(const AABBox& box, const Matrix& m)
+        {
+            Vec3 c = transform(box.getCenter(), m);
+            Vec3 h = box.getSize() * 0.5f;
+
+            Vec3 e( fabs(m[0])*h.x + fabs(m[4])*h.y + fabs(m[8])*h.z,
+                    fabs(m[1])*h.x + fabs(m[5])*h.y + fabs(m[9])*h.z,
+                    fabs(m[2])*h.x + fabs(m[6])*h.y + fabs(m[10])*h.z );
+
+            return AABBox(c - e, c + e);
+        }
+    }
+
+    TransformCache::TransformCache():
+        m_nTime(0),
+        m_nBuilds(0)
+    {
+    }
+
+    void TransformCache::clear()
+    {
+        m_entries.clear();
+        m_groups.clear();
+        m_marked.clear();
+        m_clips.clear();
+    }
+
+    void TransformCache::build(const SceneNodeVector& roots, Uint t)
+    {
+        clear();
+
+        for (size_t i = 0; i < roots.size(); i++)
+            if (roots[i])
+                add(roots[i].get(), NO_PARENT);
+
+        m_marked.assign(m_entries.size(), 0);
+        m_nTime = t;
+        m_nBuilds = (Uint)++g_nBuilds;
+
+        for (size_t i = 0; i < m_clips.size(); i++)
+            m_clips[i]->update(t);
+
+        for (Uint i = 0; i < m_entries.size(); i = m_entries[i].nEnd)
+            computeSubtree(i, t);
+    }
+
+    void TransformCache::add(SceneNode* pNode, Uint nParent)
+    {
+        Uint n = (Uint)m_entries.size();
+
+        Entry entry;
+        entry.pNode = pNode;
+        entry.pGroup = dynamic_cast<GroupNode*>(pNode);
+        entry.nParent = nParent;
+        entry.nEnd = n + 1;
+        m_entries.push_back(entry);
+
+        if (GroupNode* pGroup = entry.pGroup)
+        {
+            Group group;
+            group.nEntry = n;
+            group.nRevision = pGroup->getRevision();
+            group.bAnimated = pGroup->isAnimated();
+            m_groups.push_back(group);
+
+            AnimationClip* pClip = pGroup->getAnimationClip();
+            if (pClip && std::find(m_clips.begin(), m_clips.end(), pClip) == m_clips.end())
+                m_clips.push_back(pClip);
+
+            const SceneNodeVector& childs = pGroup->getChildNodes();
+            for (size_t i = 0; i < childs.size(); i++)
+                if (childs[i])
+                    add(childs[i].get(), n);
+
+            m_entries[n].nEnd = (Uint)m_entries.size();
+        }
+    }
+
+    void TransformCache::computeSubtree(Uint nEntry, Uint t)
+    {
+        Uint end = m_entries[nEntry].nEnd;
+
+        // parents come before their children
+        for (Uint i = nEntry; i < end; i++)
+        {
+            Entry& entry = m_entries[i];
+            const Matrix& parent = entry.nParent == NO_PARENT ? Matrix::Identity() : m_entries[entry.nParent].world;
+
+            if (entry.pGroup)
+                entry.world = entry.pGroup->getTransform(t) * parent;
+            else
+                entry.world = parent;
+        }
+
+        for (Uint i = end; i-- > nEntry; )
+            computeBound(i);
+    }
+
+    void TransformCache::computeBound(Uint nEntry)
+    {
+        Entry& entry = m_entries[nEntry];
+
+        if (entry.pGroup == NULL)
+        {
+            entry.bound = transformBox(entry.pNode->getBounding(), entry.world);
+            return;
+        }
+
+        entry.bound = AABBox();
+        for (Uint i = nEntry + 1; i < entry.nEnd; i = m_entries[i].nEnd)
+            if (m_entries[i].bound.valid())
+                entry.bound = entry.bound + m_entries[i].bound;
+    }
+
+    Uint TransformCache::update(Uint t)
+    {
+        bool bTime = t != m_nTime;
+        m_nTime = t;
+
+        for (size_t i = 0; i < m_clips.size(); i++)
+            m_clips[i]->update(t);
+
+        Uint nComputed = 0;
+        Uint nDoneEnd = 0;
+        std::vector<Uint> ancestors;
+
+        // the groups are in depth first order too, a group inside a recomputed subtree is done with it
+        for (size_t g = 0; g < m_groups.size(); g++)
+        {
+            Group& group = m_groups[g];
+            Uint nRevision = m_entries[group.nEntry].pGroup->getRevision();
+
+            bool bDirty = nRevision != group.nRevision || (group.bAnimated && bTime);
+            group.nRevision = nRevision;
+
+            if (!bDirty || group.nEntry < nDoneEnd)
+                continue;
+
+            computeSubtree(group.nEntry, t);
+            nDoneEnd = m_entries[group.nEntry].nEnd;
+            nComputed += nDoneEnd - group.nEntry;
+
+            for (Uint p = m_entries[group.nEntry].nParent; p != NO_PARENT && !m_marked[p]; p = m_entries[p].nParent)
+            {
+                m_marked[p] = 1;
+                ancestors.push_back(p);
+            }
+        }
+
+        // the bounds of the ancestors once each, children first
+        std::sort(ancestors.begin(), ancestors.end(), std::greater<Uint>());
+        for (size_t i = 0; i < ancestors.size(); i++)
+        {
+            computeBound(ancestors[i]);
+            m_marked[ancestors[i]] = 0;
+        }
+
+        return nComputed;
+    }
+
+    AABBox TransformCache::getBounding() const
+    {
+        AABBox bound;
+        for (Uint i = 0; i < m_entries.size(); i = m_entries[i].nEnd)
+        {
+            if (m_entries[i].pNode->getFlags() & SceneNode::FLAG_UNVISIBLE)
+                continue;
+
+            if (m_entries[i].bound.valid())
+                bound = bound + m_entries[i].bound;
+        }
+        return bound;
+    }
+
+    Ptr<SceneNode> TransformCache::place(Uint nEntry, Ptr<SceneNode> pNode) const
+    {
+        const Entry& entry = m_entries[nEntry];
+        if (pNode == NULL)
+            pNode = entry.pNode;
+
+        if (entry.nParent == NO_PARENT)
+            return pNode;
+
+        return GroupNode::create(SceneNodeVector(pNode), m_entries[entry.nParent].world);
+    }
+}
@@ -0,0 +1,88 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "SceneNode.h"
+#include "GroupNode.h"
+
+namespace eh
+{
+    // World matrices and world bounds of all node instances below a list of root nodes, in one flat
+    // array in depth first order. A node referenced by several groups gets an entry per reference.
+    // update() recomputes only the subtrees of groups whose transform changed since the last call,
+    // by GroupNode::setTransform() or because they are animated and the time moved on.
+    class API_3D TransformCache
+    {
+    public:
+        static const Uint NO_PARENT = 0xffffffff;
+
+        struct Entry
+        {
+            SceneNode* pNode;
+            GroupNode* pGroup;  // pNode if it is a group, else NULL
+            Uint nParent;       // NO_PARENT for the roots
+            Uint nEnd;          // the subtree of the entry is followed by entry nEnd
+            Matrix world;       // for groups including their own transform
+            AABBox bound;       // of the subtree, in world space
+        };
+
+        TransformCache();
+
+        // the hierarchy is copied, call build() again after adding or removing child nodes
+        void build(const SceneNodeVector& roots, Uint t = 0);
+        void clear();
+
+        bool isEmpty() const
+        {
+            return m_entries.empty();
+        }
+
+        // brings the entries to frame t (see GroupNode::getTransform), returns the number of entries recomputed;
+        // the animation clips of the groups are evaluated for frame t first, on the calling thread
+        Uint update(Uint t);
+
+        // the frame of the last build() or update()
+        Uint getTime() const
+        {
+            return m_nTime;
+        }
+
+        // changes with each build() and differs from the builds of all other caches, indices of
+        // entries kept elsewhere are valid while it stays the same
+        Uint getBuildCount() const
+        {
+            return m_nBuilds;
+        }
+
+        const std::vector<Entry>& getEntries() const
+        {
+            return m_entries;
+        }
+
+        // union of the root bounds, invisible roots excluded
+        AABBox getBounding() const;
+
+        // pNode, by default the node of entry nEntry, in a group with the world of the parent of the
+        // entry, a root as it is. For the single nodes drawn by a visitor starting at the identity.
+        Ptr<SceneNode> place(Uint nEntry, Ptr<SceneNode> pNode = NULL) const;
+
+    private:
+        void add(SceneNode* pNode, Uint nParent);
+        void computeSubtree(Uint nEntry, Uint t);
+        void computeBound(Uint nEntry);
+
+        struct Group
+        {
+            Uint nEntry;
+            Uint nRevision;
+            bool bAnimated;
+        };
+
+        std::vector<Entry> m_entries;
+        std::vector<Group> m_groups;
+        std::vector<char> m_marked;
+        std::vector<AnimationClip*> m_clips;    // each once, kept by their groups
+        Uint m_nTime;
+        Uint m_nBuilds;
+    };
+}
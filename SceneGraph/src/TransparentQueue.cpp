@@ -0,0 +1,152 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "TransparentQueue.h"
+#include "IDriver.h"
+#include "Geometry.h"
+#include "TriangleSorter.h"
+#include "StopWatch.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__SSE__)
+#define EH_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace eh
+{
+    TransparentQueue::TransparentQueue():
+        m_pSorter(NULL),
+        m_nCount(0),
+        m_fSortTime(0)
+    {
+    }
+
+    void TransparentQueue::push(Geometry* pGeometry, const Material* pMaterial, const Matrix* pWorld)
+    {
+        Item item = { pGeometry, pMaterial, pWorld, 0 };
+        m_items.push_back(item);
+        pushCenter(*pGeometry, *pWorld);
+    }
+
+    void TransparentQueue::push(Geometry* pGeometry, const Material* pMaterial, const Matrix& world)
+    {
+        Item item = { pGeometry, pMaterial, NULL, (Uint)m_arena.size() };
+        m_items.push_back(item);
+        m_arena.push_back(world);
+        pushCenter(*pGeometry, world);
+    }
+
+    void TransparentQueue::pushCenter(const Geometry& geometry, const Matrix& world)
+    {
+        Vec3 c = transform(geometry.getBounding().getCenter(), world);
+        m_x.push_back(c.x);
+        m_y.push_back(c.y);
+        m_z.push_back(c.z);
+    }
+
+    void TransparentQueue::computeDistances(const Vec3& eye)
+    {
+        Uint n = (Uint)m_items.size();
+        m_distances.resize(n);
+
+        const Float* x = &m_x[0];
+        const Float* y = &m_y[0];
+        const Float* z = &m_z[0];
+        Float* d = &m_distances[0];
+
+        Uint i = 0;
+#ifdef EH_SSE
+        __m128 ex = _mm_set1_ps(eye.x), ey = _mm_set1_ps(eye.y), ez = _mm_set1_ps(eye.z);
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 dx = _mm_sub_ps(_mm_loadu_ps(x + i), ex);
+            __m128 dy = _mm_sub_ps(_mm_loadu_ps(y + i), ey);
+            __m128 dz = _mm_sub_ps(_mm_loadu_ps(z + i), ez);
+            __m128 sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+            _mm_storeu_ps(d + i, _mm_sqrt_ps(sq));
+        }
+#endif
+        for (; i < n; i++)
+        {
+            Float dx = x[i] - eye.x, dy = y[i] - eye.y, dz = z[i] - eye.z;
+            d[i] = sqrt(dx * dx + dy * dy + dz * dz);
+        }
+    }
+
+    void TransparentQueue::sort()
+    {
+        Uint n = (Uint)m_items.size();
+        m_keys.resize(n);
+        m_temp.resize(n);
+
+        Float fMin = *std::min_element(m_distances.begin(), m_distances.end());
+        Float fMax = *std::max_element(m_distances.begin(), m_distances.end());
+        Float fScale = fMax > fMin ? 65535.f / (fMax - fMin) : 0;
+
+        // the farthest gets key 0
+        for (Uint i = 0; i < n; i++)
+        {
+            m_keys[i].nKey = (Uint)((fMax - m_distances[i]) * fScale);
+            m_keys[i].nItem = i;
+        }
+
+        // least significant byte first, each pass keeps the order of equal bytes
+        for (Uint nShift = 0; nShift < 16; nShift += 8)
+        {
+            Uint counts[257] = { 0 };
+            for (Uint i = 0; i < n; i++)
+                counts[((m_keys[i].nKey >> nShift) & 0xff) + 1]++;
+            for (Uint b = 0; b < 256; b++)
+                counts[b + 1] += counts[b];
+
+            for (Uint i = 0; i < n; i++)
+                m_temp[counts[(m_keys[i].nKey >> nShift) & 0xff]++] = m_keys[i];
+
+            m_keys.swap(m_temp);
+        }
+    }
+
+    void TransparentQueue::draw(IDriver& driver, const Matrix& view)
+    {
+        m_nCount = (Uint)m_items.size();
+        m_fSortTime = 0;
+        if (m_items.empty())
+            return;
+
+        StopWatch watch;
+
+        Matrix inv = Matrix::Inverse(view);
+        Vec3 eye(inv[12], inv[13], inv[14]);
+        computeDistances(eye);
+        sort();
+
+        m_fSortTime = watch.elapsed();
+
+        driver.enableBlending(true);
+        driver.enableZWriting(false);
+
+        const Material* pMaterial = NULL;
+        for (size_t i = 0; i < m_keys.size(); i++)
+        {
+            const Item& item = m_items[m_keys[i].nItem];
+            if (i == 0 || item.pMaterial != pMaterial)
+                driver.setMaterial(pMaterial = item.pMaterial);
+
+            const Matrix& world = item.pWorld ? *item.pWorld : m_arena[item.nWorld];
+            driver.setWorldMatrix(world);
+            driver.drawPrimitive(m_pSorter ? m_pSorter->getSorted(*item.pGeometry, world, eye) : *item.pGeometry);
+        }
+
+        driver.enableZWriting(true);
+        driver.enableBlending(false);
+
+        // the capacities stay for the next frame
+        m_items.clear();
+        m_arena.clear();
+        m_x.clear();
+        m_y.clear();
+        m_z.clear();
+    }
+}
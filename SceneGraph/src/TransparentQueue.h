@@ -0,0 +1,76 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "config.h"
+#include "math3d.hpp"
+#include <vector>
+
+namespace eh
+{
+    class IDriver;
+    class Geometry;
+    class Material;
+    class TriangleSorter;
+
+    // The blended geometries of a frame, drawn back to front after the opaque ones. An item is a
+    // few pointers and an index; the world matrices stay where they are or, when they only live on a
+    // matrix stack, go to an arena of the queue. The order comes from a radix sort of the distances
+    // to the eye quantized to 16 bits, far items first. With a TriangleSorter the triangles of large
+    // geometries are drawn back to front as well.
+    class API_3D TransparentQueue
+    {
+    public:
+        TransparentQueue();
+
+        // world must stay unchanged until draw(), e.g. an entry of a TransformCache
+        void push(Geometry* pGeometry, const Material* pMaterial, const Matrix* pWorld);
+
+        // copies world into the arena of the queue
+        void push(Geometry* pGeometry, const Material* pMaterial, const Matrix& world);
+
+        // NULL to draw the triangles in their own order
+        void setTriangleSorter(TriangleSorter* pSorter) { m_pSorter = pSorter; }
+
+        // draws the items sorted for the eye of view and empties the queue
+        void draw(IDriver& driver, const Matrix& view);
+
+        bool empty() const { return m_items.empty(); }
+
+        // of the last draw(), the sort includes the distances, in milliseconds
+        Uint getCount() const { return m_nCount; }
+        double getSortTime() const { return m_fSortTime; }
+
+    private:
+        struct Item
+        {
+            Geometry* pGeometry;
+            const Material* pMaterial;
+            const Matrix* pWorld;
+            Uint nWorld;        // into the arena when pWorld is NULL
+        };
+
+        struct Key
+        {
+            Uint nKey;
+            Uint nItem;
+        };
+
+        void pushCenter(const Geometry& geometry, const Matrix& world);
+        void computeDistances(const Vec3& eye);
+        void sort();
+
+        std::vector<Item> m_items;
+        std::vector<Matrix> m_arena;
+
+        // world centres of the items, one array per coordinate so four distances go at once
+        std::vector<Float> m_x, m_y, m_z;
+        std::vector<Float> m_distances;
+
+        std::vector<Key> m_keys, m_temp;
+        TriangleSorter* m_pSorter;
+
+        Uint m_nCount;
+        double m_fSortTime;
+    };
+}
@@ -0,0 +1,251 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "TriangleSorter.h"
+#include "Parallel.h"
+#include "StopWatch.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace eh
+{
+    namespace
+    {
+        struct Key
+        {
+            Uint nKey;
+            Uint nTriangle;
+        };
+
+        // unsigned integers in the order of the floats
+        inline Uint sortable(Float f)
+        {
+            Uint u;
+            memcpy(&u, &f, sizeof(u));
+            return (u & 0x80000000) ? ~u : (u | 0x80000000);
+        }
+
+        // three times the centroids, the order along a direction is the same
+        void sumCorners(const IVertexBuffer* pVB, const Uint* pIndices, Float* pSums, Uint begin, Uint end)
+        {
+            for (Uint t = begin; t < end; t++)
+            {
+                Vec3 s = pVB->getCoord(pIndices[3*t]) + pVB->getCoord(pIndices[3*t+1]) + pVB->getCoord(pIndices[3*t+2]);
+                pSums[3*t] = s.x;
+                pSums[3*t+1] = s.y;
+                pSums[3*t+2] = s.z;
+            }
+        }
+
+        // the farthest from eye gets the smallest key, the sums are compared with three times the eye
+        void computeKeys(const Float* pSums, const Uint* pOrder, Vec3 eye, Key* pKeys, Uint begin, Uint end)
+        {
+            eye = eye * 3.f;
+            for (Uint i = begin; i < end; i++)
+            {
+                const Float* s = pSums + 3 * pOrder[i];
+                Float dx = s[0] - eye.x, dy = s[1] - eye.y, dz = s[2] - eye.z;
+                pKeys[i].nKey = sortable(-(dx * dx + dy * dy + dz * dz));
+                pKeys[i].nTriangle = pOrder[i];
+            }
+        }
+
+        void copyTriangles(const Uint* pIndices, const Key* pKeys, Uint* pResult, Uint begin, Uint end)
+        {
+            for (Uint i = begin; i < end; i++)
+            {
+                const Uint* t = pIndices + 3 * pKeys[i].nTriangle;
+                pResult[3*i] = t[0];
+                pResult[3*i+1] = t[1];
+                pResult[3*i+2] = t[2];
+            }
+        }
+    }
+
+    TriangleSorter::TriangleSorter():
+        m_fMoveThreshold(0.05f),
+        m_nFrame(0),
+        m_nSorts(0),
+        m_fSortTime(0),
+        m_bStop(false),
+        m_nPending(0)
+    {
+    }
+
+    TriangleSorter::~TriangleSorter()
+    {
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_bStop = true;
+            m_changed.notify_all();
+        }
+        m_thread.join();
+
+        for (boost::unordered_map<const Geometry*, Entry*>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+            delete it->second;
+    }
+
+    void TriangleSorter::setMoveThreshold(Float fFraction)
+    {
+        m_fMoveThreshold = fFraction;
+    }
+
+    Geometry& TriangleSorter::getSorted(Geometry& geometry, const Matrix& world, const Vec3& eye)
+    {
+        if (geometry.getType() != Geometry::TRIANGLES || geometry.getIndices().size() < 3 * MIN_TRIANGLES)
+            return geometry;
+
+        Entry*& pEntry = m_entries[&geometry];
+        if (pEntry == NULL)
+        {
+            pEntry = new Entry();
+            pEntry->pSource = &geometry;
+            pEntry->bBusy = false;
+            pEntry->fTime = 0;
+        }
+
+        Entry& entry = *pEntry;
+        entry.nFrame = m_nFrame;
+
+        // the distances in the coordinates of the geometry are the world ones up to a uniform scale
+        Vec3 local = transform(eye, Matrix::Inverse(world));
+
+        const AABBox& bound = geometry.getBounding();
+        Float fMove = m_fMoveThreshold * std::max(bound.getSize().getLen(), (local - bound.getCenter()).getLen());
+
+        if (!entry.bBusy && (entry.pSorted == NULL || (local - entry.eye).getLen() > fMove))
+        {
+            entry.bBusy = true;
+            entry.pVB = geometry.getVertexBuffer().get();
+            entry.pIndices = &geometry.getIndices();
+            entry.jobEye = local;
+
+            boost::mutex::scoped_lock lock(m_mutex);
+
+            if (m_thread.get_id() == boost::thread::id())
+                m_thread = boost::thread(boost::bind(&TriangleSorter::run, this));
+
+            m_jobs.push_back(&entry);
+            m_nPending++;
+            m_changed.notify_all();
+        }
+
+        return entry.pSorted != NULL ? *entry.pSorted : geometry;
+    }
+
+    void TriangleSorter::endFrame(std::vector< Ptr<RefCounted> >& released)
+    {
+        m_nFrame++;
+        m_nSorts = 0;
+        m_fSortTime = 0;
+
+        std::vector<Entry*> done;
+        {
+            boost::mutex::scoped_lock lock(m_mutex);
+            done.swap(m_done);
+        }
+        m_nSorts = (Uint)done.size();
+
+        for (size_t i = 0; i < done.size(); i++)
+        {
+            Entry& entry = *done[i];
+            released.push_back(entry.pSorted);
+            entry.pSorted = Geometry::createSwapped(Geometry::TRIANGLES, entry.pSource->getVertexBuffer(), entry.result);
+
+            entry.eye = entry.jobEye;
+            entry.bBusy = false;
+            m_fSortTime += entry.fTime;
+        }
+
+        for (boost::unordered_map<const Geometry*, Entry*>::iterator it = m_entries.begin(); it != m_entries.end(); )
+        {
+            if (!it->second->bBusy && m_nFrame - it->second->nFrame > KEEP_FRAMES)
+            {
+                released.push_back(it->second->pSorted);
+                released.push_back(it->second->pSource);
+                delete it->second;
+                it = m_entries.erase(it);
+            }
+            else
+                ++it;
+        }
+    }
+
+    void TriangleSorter::wait()
+    {
+        boost::mutex::scoped_lock lock(m_mutex);
+        while (m_nPending > 0)
+            m_changed.wait(lock);
+    }
+
+    void TriangleSorter::run()
+    {
+        for (;;)
+        {
+            Entry* pEntry = NULL;
+            {
+                boost::mutex::scoped_lock lock(m_mutex);
+                while (m_jobs.empty() && !m_bStop)
+                    m_changed.wait(lock);
+
+                if (m_bStop)
+                    return;
+
+                pEntry = m_jobs.front();
+                m_jobs.pop_front();
+            }
+
+            sort(*pEntry);
+
+            boost::mutex::scoped_lock lock(m_mutex);
+            m_done.push_back(pEntry);
+            m_nPending--;
+            m_changed.notify_all();
+        }
+    }
+
+    void TriangleSorter::sort(Entry& entry)
+    {
+        StopWatch watch;
+
+        const Uint* pIndices = &(*entry.pIndices)[0];
+        Uint n = (Uint)entry.pIndices->size() / 3;
+
+        if (entry.centroids.empty())
+        {
+            entry.centroids.resize(3 * n);
+            parallelFor(n, boost::bind(&sumCorners, entry.pVB, pIndices, &entry.centroids[0], _1, _2), 16384);
+
+            entry.order.resize(n);
+            for (Uint t = 0; t < n; t++)
+                entry.order[t] = t;
+        }
+
+        // starts from the last order, triangles at the same depth keep their places from frame to frame
+        std::vector<Key> keys(n), temp(n);
+        parallelFor(n, boost::bind(&computeKeys, &entry.centroids[0], &entry.order[0], entry.jobEye, &keys[0], _1, _2), 16384);
+
+        // least significant digit first, 11 + 11 + 10 bits
+        for (Uint nShift = 0; nShift < 32; nShift += 11)
+        {
+            Uint counts[2049] = { 0 };
+            for (Uint i = 0; i < n; i++)
+                counts[((keys[i].nKey >> nShift) & 0x7ff) + 1]++;
+            for (Uint b = 0; b < 2048; b++)
+                counts[b + 1] += counts[b];
+
+            for (Uint i = 0; i < n; i++)
+                temp[counts[(keys[i].nKey >> nShift) & 0x7ff]++] = keys[i];
+
+            keys.swap(temp);
+        }
+
+        for (Uint i = 0; i < n; i++)
+            entry.order[i] = keys[i].nTriangle;
+
+        entry.result.resize(3 * n);
+        parallelFor(n, boost::bind(&copyTriangles, pIndices, &keys[0], &entry.result[0], _1, _2), 16384);
+
+        entry.fTime = watch.elapsed();
+    }
+}
@@ -0,0 +1,83 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#pragma once
+
+#include "Geometry.h"
+#include <deque>
+#include <vector>
+#include <boost/thread.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace eh
+{
+    // Orders the triangles of large blended geometries back to front, so a glass shell overlapping
+    // itself blends right. The sorted triangles are a copy of a geometry on the same vertex buffer,
+    // sorted by the distance of their centroids to the eye in the coordinates of the geometry, which
+    // holds for close-up views and views from inside as well. A worker thread sorts it again when the
+    // eye has moved by more than the move threshold; until then the last order is drawn.
+    class API_3D TriangleSorter
+    {
+    public:
+        // smaller geometries are sorted as a whole by the TransparentQueue only
+        static const Uint MIN_TRIANGLES = 256;
+
+        TriangleSorter();
+        ~TriangleSorter();
+
+        // a fraction of the size of the bound, or of the distance to its centre when farther away
+        void setMoveThreshold(Float fFraction);
+
+        // render thread: the geometry to draw for geometry seen from eye, with world its transform
+        Geometry& getSorted(Geometry& geometry, const Matrix& world, const Vec3& eye);
+
+        // render thread, once per frame: takes over the finished sorts and forgets the geometries
+        // not drawn for a while. A sort comes as a new geometry, the ones replaced or forgotten go
+        // to released, a frame in flight on a DriverThread may still draw them.
+        void endFrame(std::vector< Ptr<RefCounted> >& released);
+
+        // blocks until the worker has no sorts left, endFrame() takes them over
+        void wait();
+
+        // sorts taken over by the last endFrame() and their time on the worker, in milliseconds
+        Uint getSortCount() const { return m_nSorts; }
+        double getSortTime() const { return m_fSortTime; }
+
+    private:
+        static const Uint KEEP_FRAMES = 120;
+
+        struct Entry
+        {
+            Ptr<Geometry> pSource;      // render thread only
+            Ptr<Geometry> pSorted;      // replaced, never changed
+            Vec3 eye;                   // pSorted is sorted for it, in the coordinates of the geometry
+            Uint nFrame;                // last drawn
+            bool bBusy;                 // queued or on the worker
+
+            // the worker's while bBusy
+            const IVertexBuffer* pVB;
+            const Uint_vec* pIndices;
+            Vec3 jobEye;
+            std::vector<Float> centroids;
+            std::vector<Uint> order;    // triangles in the last sorted order
+            Uint_vec result;
+            double fTime;
+        };
+
+        void run();
+        static void sort(Entry& entry);
+
+        boost::unordered_map<const Geometry*, Entry*> m_entries;
+        Float m_fMoveThreshold;
+        Uint m_nFrame;
+        Uint m_nSorts;
+        double m_fSortTime;
+
+        boost::thread m_thread;
+        mutable boost::mutex m_mutex;
+        boost::condition_variable m_changed;
+        bool m_bStop;
+        Uint m_nPending;                // queued or running
+        std::deque<Entry*> m_jobs;
+        std::vector<Entry*> m_done;
+    };
+}
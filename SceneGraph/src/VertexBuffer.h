@@ -4,28 +4,203 @@
 
 #include "config.h"
 #include "IDriver.h"
+#include <algorithm>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
 
 namespace eh
 {
     class IVertexBuffer: public RefCounted
     {
     public:
+        enum FORMAT
+        {
+            FORMAT_FLOAT   = 0,  // interleaved floats: position, normal, texcoord (as far as getStride() reaches)
+            FORMAT_COMPACT = 1   // quantized, see CreateCompactVertexBuffer(); use decode() to get floats
+        };
+
         virtual ~IVertexBuffer(){};
 
         virtual Uint addVertex(const Vec3& v, const Vec3& n = Vec3(), const Vec3& t = Vec3()) = 0;
         virtual Uint pushVertex(const Vec3& v, const Vec3& n = Vec3(), const Vec3& t = Vec3()) = 0;
 
-        virtual const Vec3& getCoord(Uint i) const = 0;
-        virtual const Vec3& getNormal(Uint i) const = 0;
-        virtual const Vec3& getTexCoord(Uint i) const = 0;
+        virtual Vec3 getCoord(Uint i) const = 0;
+        virtual Vec3 getNormal(Uint i) const = 0;
+        virtual Vec3 getTexCoord(Uint i) const = 0;
         virtual Uint getVertexCount() const = 0;
 
         virtual  const void* getBuffer(Uint offset = 0) const = 0;
         virtual  Uint getStride() const = 0;
         virtual  Uint getBufferSize() const = 0;
 
+        virtual FORMAT getFormat() const
+        {
+            return FORMAT_FLOAT;
+        }
+
+        // makes room for nCount more vertices
+        virtual void reserve(Uint /*nCount*/)
+        {
+        }
+
+        // appends nCount zeroed vertices and returns their interleaved floats (getStride() bytes per vertex)
+        // to be filled in place, valid until the next append. NULL if the buffer can't hand out its
+        // storage, e.g. because it isn't FORMAT_FLOAT, nothing is appended then. Float buffers override it,
+        // appendVertices() builds on it.
+        virtual Float* appendRange(Uint /*nCount*/, Uint& first)
+        {
+            first = getVertexCount();
+            return NULL;
+        }
+
+        // appends nCount vertices without looking for duplicates and returns the index of the first,
+        // pNormals and pTexCoords may be NULL
+        virtual Uint appendVertices(Uint nCount, const Vec3* pCoords, const Vec3* pNormals = NULL, const Vec3* pTexCoords = NULL)
+        {
+            Uint first = 0;
+            Float* p = appendRange(nCount, first);
+            if(p == NULL)
+            {
+                reserve(nCount);
+                for(Uint i = 0; i < nCount; i++)
+                    pushVertex(pCoords[i], pNormals ? pNormals[i] : Vec3(), pTexCoords ? pTexCoords[i] : Vec3());
+                return first;
+            }
+
+            // as far as the stride reaches, the range comes zeroed
+            Uint nFloats = getStride() / sizeof(Float);
+            for(Uint i = 0; i < nCount; i++, p += nFloats)
+            {
+                p[0] = pCoords[i].x; p[1] = pCoords[i].y; p[2] = pCoords[i].z;
+                if(pNormals && nFloats >= 6)
+                {
+                    p[3] = pNormals[i].x; p[4] = pNormals[i].y; p[5] = pNormals[i].z;
+                }
+                if(pTexCoords && nFloats >= 8)
+                {
+                    p[6] = pTexCoords[i].x; p[7] = pTexCoords[i].y;
+                }
+            }
+            return first;
+        }
+
+        // writes nCount vertices starting at first as 8 floats each (position, normal, u, v)
+        virtual void decode(Float* pDest, Uint first, Uint nCount) const
+        {
+            for(Uint i = first; i < first + nCount; i++, pDest += 8)
+            {
+                Vec3 v = getCoord(i), n = getNormal(i), t = getTexCoord(i);
+                pDest[0] = v.x; pDest[1] = v.y; pDest[2] = v.z;
+                pDest[3] = n.x; pDest[4] = n.y; pDest[5] = n.z;
+                pDest[6] = t.x; pDest[7] = t.y;
+            }
+        }
+
         Ptr<IResource> m_resource;
     };
 
     API_3D Ptr<IVertexBuffer> CreateVertexBuffer(Uint nStride, const void* pBuffer = NULL, Uint nCount = 0);
+
+    // Collects vertices for a loader and hands them to the buffer in batches through appendVertices().
+    // push() returns the final index, so nothing else may append to the buffer while the batch is in use.
+    class VertexBatch: public boost::noncopyable
+    {
+    public:
+        VertexBatch(Ptr<IVertexBuffer> pVB, Uint nBatchSize = 4096):
+            m_pVB(pVB), m_nBatchSize(nBatchSize), m_nFirst(pVB->getVertexCount())
+        {
+            m_coords.reserve(nBatchSize);
+            m_normals.reserve(nBatchSize);
+            m_texcoords.reserve(nBatchSize);
+        }
+        ~VertexBatch()
+        {
+            flush();
+        }
+
+        Uint push(const Vec3& v, const Vec3& n = Vec3(), const Vec3& t = Vec3())
+        {
+            if(m_coords.size() == m_nBatchSize)
+                flush();
+
+            m_coords.push_back(v);
+            m_normals.push_back(n);
+            m_texcoords.push_back(t);
+
+            return m_nFirst + (Uint)m_coords.size() - 1;
+        }
+
+        // like IVertexBuffer::addVertex(), returns the vertex pushed before with the same values,
+        // looking at the vertices added through this batch only
+        Uint add(const Vec3& v, const Vec3& n = Vec3(), const Vec3& t = Vec3())
+        {
+            Key key = { { v.x, v.y, v.z, n.x, n.y, n.z, t.x, t.y, t.z } };
+
+            std::pair<boost::unordered_map<Key, Uint, KeyHash>::iterator, bool> inserted = m_added.insert(std::make_pair(key, 0));
+            if(inserted.second)
+                inserted.first->second = push(v, n, t);
+            return inserted.first->second;
+        }
+
+        // vertices pushed so far, including the ones not yet flushed
+        Uint getVertexCount() const
+        {
+            return m_nFirst + (Uint)m_coords.size();
+        }
+
+        void flush()
+        {
+            if(m_coords.empty())
+                return;
+
+            m_pVB->appendVertices((Uint)m_coords.size(), &m_coords[0], &m_normals[0], &m_texcoords[0]);
+
+            m_nFirst += (Uint)m_coords.size();
+            m_coords.clear();
+            m_normals.clear();
+            m_texcoords.clear();
+        }
+
+    private:
+        struct Key
+        {
+            Float f[9];
+
+            bool operator == (const Key& other) const
+            {
+                return std::equal(f, f + 9, other.f);
+            }
+        };
+
+        struct KeyHash
+        {
+            size_t operator()(const Key& key) const
+            {
+                return boost::hash_range(key.f, key.f + 9);
+            }
+        };
+
+        Ptr<IVertexBuffer> m_pVB;
+        Uint m_nBatchSize;
+        Uint m_nFirst;
+        std::vector<Vec3> m_coords;
+        std::vector<Vec3> m_normals;
+        std::vector<Vec3> m_texcoords;
+        boost::unordered_map<Key, Uint, KeyHash> m_added;
+    };
+
+    // what CreateCompactVertexBuffer() saved and what decoding costs
+    struct CompactStatistics
+    {
+        size_t nSourceBytes;
+        size_t nCompactBytes;   // with the block bounds
+        double fEncodeTime;     // ms
+        double fDecodeTime;     // ms for decoding all vertices once
+        Float fMaxError;        // largest deviation of a position
+    };
+
+    // Quantized copy of pSource: positions as 16bit relative to the bounds of each block of
+    // 256 vertices, octahedral normals in 4 bytes and half float texcoords.
+    // pStatistics is filled if given, measuring the decode costs a pass over all vertices.
+    API_3D Ptr<IVertexBuffer> CreateCompactVertexBuffer(Ptr<IVertexBuffer> pSource, CompactStatistics* pStatistics = NULL);
 }
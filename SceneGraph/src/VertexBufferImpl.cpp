@@ -0,0 +1,170 @@
+// Copyright (c) 2007,2010, Eduard Heidt
+
+#include "VertexBuffer.h"
+
+#include <vector>
+#include <algorithm>
+
+namespace eh
+{
+	// FORMAT_FLOAT: position, normal, u and v as far as the stride reaches, in one vector that
+	// grows by resize, so appendRange() hands out its storage and loaders fill it in place
+	class FloatVertexBuffer: public IVertexBuffer
+	{
+	public:
+		FloatVertexBuffer(Uint nStride, const void* pBuffer, Uint nCount):
+			m_nStride(nStride),
+			m_nFloats(nStride / sizeof(Float)),
+			m_nIndexed(0)
+		{
+			if(pBuffer != NULL && nCount > 0)
+				m_data.assign((const Float*)pBuffer, (const Float*)pBuffer + nCount * m_nFloats);
+		}
+
+		// the vertices are indexed by value on the first call only, buffers that are pushed to or
+		// appended to never pay for it
+		virtual Uint addVertex(const Vec3& v, const Vec3& n = Vec3(), const Vec3& t = Vec3())
+		{
+			for(; m_nIndexed < getVertexCount(); m_nIndexed++)
+				m_index.insert(std::make_pair(key(at(m_nIndexed)), m_nIndexed));
+
+			Float f[8];
+			write(f, 8, v, n, t);
+
+			std::pair<Index::iterator, bool> inserted = m_index.insert(std::make_pair(key(f), getVertexCount()));
+			if(inserted.second)
+			{
+				pushVertex(v, n, t);
+				m_nIndexed++;
+			}
+			return inserted.first->second;
+		}
+
+		virtual Uint pushVertex(const Vec3& v, const Vec3& n = Vec3(), const Vec3& t = Vec3())
+		{
+			Uint i = getVertexCount();
+			m_data.resize(m_data.size() + m_nFloats);
+			write(at(i), m_nFloats, v, n, t);
+			return i;
+		}
+
+		// appendVertices() reserves for each batch, growing by the batch only would copy the
+		// buffer every time
+		virtual void reserve(Uint nCount)
+		{
+			size_t nSize = m_data.size() + nCount * m_nFloats;
+			if(nSize > m_data.capacity())
+				m_data.reserve(std::max(nSize, m_data.capacity() * 2));
+		}
+
+		virtual Float* appendRange(Uint nCount, Uint& first)
+		{
+			first = getVertexCount();
+			if(nCount == 0)
+				return NULL;
+
+			m_data.resize(m_data.size() + nCount * m_nFloats);
+			return at(first);
+		}
+
+		virtual Vec3 getCoord(Uint i) const
+		{
+			const Float* p = at(i);
+			return Vec3(p[0], p[1], p[2]);
+		}
+
+		virtual Vec3 getNormal(Uint i) const
+		{
+			if(m_nFloats < 6)
+				return Vec3();
+			const Float* p = at(i);
+			return Vec3(p[3], p[4], p[5]);
+		}
+
+		virtual Vec3 getTexCoord(Uint i) const
+		{
+			if(m_nFloats < 8)
+				return Vec3();
+			const Float* p = at(i);
+			return Vec3(p[6], p[7], 0);
+		}
+
+		virtual Uint getVertexCount() const
+		{
+			return m_nFloats ? (Uint)(m_data.size() / m_nFloats) : 0;
+		}
+
+		virtual const void* getBuffer(Uint offset = 0) const
+		{
+			return m_data.empty() ? NULL : at(offset);
+		}
+
+		virtual Uint getStride() const
+		{
+			return m_nStride;
+		}
+
+		virtual Uint getBufferSize() const
+		{
+			return (Uint)(m_data.size() * sizeof(Float));
+		}
+
+	private:
+		struct Key
+		{
+			Float f[8];
+
+			bool operator == (const Key& other) const
+			{
+				return std::equal(f, f + 8, other.f);
+			}
+		};
+
+		struct KeyHash
+		{
+			size_t operator()(const Key& key) const
+			{
+				return boost::hash_range(key.f, key.f + 8);
+			}
+		};
+
+		typedef boost::unordered_map<Key, Uint, KeyHash> Index;
+
+		const Float* at(Uint i) const
+		{
+			return &m_data[i * m_nFloats];
+		}
+		Float* at(Uint i)
+		{
+			return &m_data[i * m_nFloats];
+		}
+
+		// the floats of a vertex, those the stride doesn't reach are 0
+		Key key(const Float* p) const
+		{
+			Key k;
+			for(Uint i = 0; i < 8; i++)
+				k.f[i] = i < m_nFloats ? p[i] : 0;
+			return k;
+		}
+
+		static void write(Float* p, Uint nFloats, const Vec3& v, const Vec3& n, const Vec3& t)
+		{
+			const Float f[8] = { v.x, v.y, v.z, n.x, n.y, n.z, t.x, t.y };
+			std::copy(f, f + std::min<Uint>(nFloats, 8), p);
+			std::fill(p + std::min<Uint>(nFloats, 8), p + nFloats, 0.f);
+		}
+
+		Uint m_nStride;
+		Uint m_nFloats;
+		std::vector<Float> m_data;
+
+		Index m_index;
+		Uint m_nIndexed;	// vertices in m_index
+	};
+
+	Ptr<IVertexBuffer> CreateVertexBuffer(Uint nStride, const void* pBuffer, Uint nCount)
+	{
+		return new FloatVertexBuffer(nStride, pBuffer, nCount);
+	}
+}
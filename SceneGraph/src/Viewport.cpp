@@ -8,13 +8,33 @@
 #include "Controller.h"
 #include "IDriver.h"
 #include "Camera.h"
+#include "OcclusionCuller.h"
+#include "SceneCuller.h"
+#include "InstanceList.h"
+#include "TransparentQueue.h"
+#include "TriangleSorter.h"
+#include "ParallelDrawList.h"
+#include "DriverThread.h"
+#include "Geometry.h"
+#include "VertexBuffer.h"
+#include "SceneIO.h"
 
 #include <iostream>
+#include <sstream>
+#include <memory>
 
 using namespace eh;
 
 Viewport::Viewport(Ptr<IDriver> pDriver):
 	m_pRenderingVisitor(NULL),
+	m_pOcclusionCuller(new OcclusionCuller()),
+	m_pSceneCuller(new SceneCuller()),
+	m_pInstanceList(new InstanceList()),
+	m_pTransparentQueue(new TransparentQueue()),
+	m_pTriangleSorter(new TriangleSorter()),
+	m_pDrawList(new ParallelDrawList()),
+	m_pDriverThread(NULL),
+	m_fPixelThreshold(1.f),
 	m_pDriver(pDriver),
 	m_pScene(NULL),
 	m_pCamera(NULL),
@@ -31,8 +51,83 @@ Viewport::Viewport(Ptr<IDriver> pDriver):
 }
 Viewport::~Viewport()
 {
+	setDriverThread(false);
+
 	if(m_pRenderingVisitor)
 		delete m_pRenderingVisitor;
+
+	delete m_pOcclusionCuller;
+	delete m_pSceneCuller;
+	delete m_pInstanceList;
+	delete m_pTransparentQueue;
+	delete m_pTriangleSorter;
+	delete m_pDrawList;
+}
+
+// the boxes as one solid shape, drawn in place of the nodes culled for their size
+static Ptr<SceneNode> createProxies(const std::vector<AABBox>& boxes)
+{
+	static const int faces[6][4] = { {0,2,6,4}, {1,5,7,3}, {0,4,5,1}, {2,3,7,6}, {0,1,3,2}, {4,6,7,5} };
+	static const Float normals[6][3] = { {-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1} };
+
+	std::vector<Vec3> coords, normal;
+	coords.reserve(boxes.size() * 24);
+	normal.reserve(boxes.size() * 24);
+
+	Uint_vec indices;
+	indices.reserve(boxes.size() * 36);
+
+	for(size_t b = 0; b < boxes.size(); b++)
+	{
+		const Vec3& bmin = boxes[b].getMin();
+		const Vec3& bmax = boxes[b].getMax();
+
+		for(int f = 0; f < 6; f++)
+		{
+			Uint first = (Uint)coords.size();
+			for(int i = 0; i < 4; i++)
+			{
+				int c = faces[f][i];
+				coords.push_back(Vec3(c & 1 ? bmax.x : bmin.x, c & 2 ? bmax.y : bmin.y, c & 4 ? bmax.z : bmin.z));
+				normal.push_back(Vec3(normals[f][0], normals[f][1], normals[f][2]));
+			}
+
+			static const Uint quad[6] = { 0, 1, 2, 0, 2, 3 };
+			for(int i = 0; i < 6; i++)
+				indices.push_back(first + quad[i]);
+		}
+	}
+
+	Ptr<IVertexBuffer> pVB = CreateVertexBuffer(sizeof(Vec3)*2 + sizeof(Float)*2);
+	pVB->appendVertices((Uint)coords.size(), &coords[0], &normal[0]);
+
+	static Ptr<Material> pMaterial = Material::create(RGBA(0.5f, 0.5f, 0.5f), false);
+	return ShapeNode::create(pMaterial, Geometry::createSwapped(Geometry::TRIANGLES, pVB, indices));
+}
+
+void Viewport::setDriver(Ptr<IDriver> pDriver)
+{
+	// the thread keeps the driver it was started with
+	setDriverThread(false);
+	m_pDriver = pDriver;
+}
+
+void Viewport::setDriverThread(bool bEnable, IDriverContext* pContext)
+{
+	if(bEnable == (m_pDriverThread != NULL) || m_pDriver == NULL)
+		return;
+
+	if(bEnable)
+	{
+		m_pDriverThread = new DriverThread(m_pDriver, pContext);
+		m_pDriver = m_pDriverThread->getRecorder();
+	}
+	else
+	{
+		m_pDriver = m_pDriverThread->getDriver();
+		delete m_pDriverThread;
+		m_pDriverThread = NULL;
+	}
 }
 
 void Viewport::setDisplayRect(int x, int y, int dx, int dy)
@@ -47,8 +142,12 @@ const Rect& Viewport::getDisplayRect() const
 
 void Viewport::setScene(Ptr<Scene> pScene, Ptr<Camera> pCamera )
 {
-	m_pScene = pScene;
-	m_pCamera = pCamera;
+	{
+		// the frames in flight may draw the scene replaced, its last references go with the driver's context
+		std::auto_ptr<DriverThread::Lock> pLock(m_pDriverThread ? new DriverThread::Lock(*m_pDriverThread) : NULL);
+		m_pScene = pScene;
+		m_pCamera = pCamera;
+	}
 
 	if( m_pCamera == NULL )
 	{
@@ -66,8 +165,49 @@ void Viewport::drawScene()
 	if(m_pCamera == NULL)
 		return;
 
-	drawScene( control().getViewMatrix(), control().getProjectionMatrix(), true );
+	Matrix view = control().getViewMatrix();
+	Matrix proj = control().getProjectionMatrix();
+
+	// refined geometry is swapped in before the frame, the refiners continue with its view; frames
+	// in flight on the DriverThread hold on to the geometry they draw, the frame recorded next
+	// keeps the geometry replaced until it is drawn, so its buffers are freed on the driver thread
+	if(m_pScene)
+	{
+		std::vector< Ptr<RefCounted> > released;
+		const std::vector< Ptr<ISceneRefiner> >& refiners = m_pScene->getRefiners();
+		for(size_t i = 0; i < refiners.size(); i++)
+		{
+			refiners[i]->apply(released);
+			refiners[i]->update(view, proj, getDisplayRect());
+		}
+
+		if(m_pDriverThread)
+			m_pDriverThread->release(released);
+	}
+
+	// the oldest input the frame shows
+	bool bInput = control().m_bInput;
+	StopWatch input = control().m_input;
+	control().m_bInput = false;
+
+	drawScene( view, proj, true );
 	m_valid = true;
+
+	if(m_pDriverThread)
+		m_pDriverThread->endFrame(bInput ? &input : NULL);
+}
+
+bool Viewport::isRefinementPending() const
+{
+	if(m_pScene == NULL)
+		return false;
+
+	const std::vector< Ptr<ISceneRefiner> >& refiners = m_pScene->getRefiners();
+	for(size_t i = 0; i < refiners.size(); i++)
+		if(refiners[i]->isPending())
+			return true;
+
+	return false;
 }
 
 void Viewport::drawScene(const Matrix& view, const Matrix& proj, bool bRenderToWindow)
@@ -83,16 +223,86 @@ void Viewport::drawScene(const Matrix& view, const Matrix& proj, bool bRenderToW
 		m_pDriver->enableDepthTest(true);
 
 		m_pDriver->enableWireframe(getModeFlag(Viewport::MODE_WIREFRAME));
+		m_pDriver->enableMeshletCulling(getModeFlag(Viewport::MODE_MESHLETS));
 
 		m_pRenderingVisitor->init(view, proj);
 
+		// the animation clips are evaluated once for the frame, here before any traversal
+		if(getScene()->isAnimated())
+			getScene()->getTransforms(m_pRenderingVisitor->t);
+
 		//TODO
 		//for(size_t i = 0; i < getScene()->getCameras().size(); i++)
 		//{
 		//	Camera::ptr cam = getScene()->getCameras()[i];
 		//}
 
-		m_pRenderingVisitor->drawScene(getScene()->getAABBTree());
+		// the occluders come from the world transforms of the frame, the visible nodes are drawn as a list
+		bool bOcclusion = getModeFlag(Viewport::MODE_OCCLUSION);
+		bool bSmall = getModeFlag(Viewport::MODE_SMALLFEATURES);
+
+		// the draw list is asked for only, the default frame stays with the visitor, which offsets
+		// the depth of edges drawn over their faces
+		bool bParallel = getModeFlag(Viewport::MODE_PARALLEL) && !bOcclusion && !bSmall;
+
+		// the triangles are sorted in the TransparentQueue, which then holds all blended geometries
+		// but those of flagged nodes
+		bool bSort = getModeFlag(Viewport::MODE_SORTTRIANGLES);
+		bool bInstancing = getModeFlag(Viewport::MODE_INSTANCING) || bSort;
+		bool bQueue = false;
+
+		if((bOcclusion || bSmall || bInstancing || bParallel) && getScene()->getAABBTree())
+		{
+			SceneNodeVector visible;
+			std::vector<AABBox> proxies;
+
+			if(bOcclusion || bSmall)
+			{
+				if(bOcclusion)
+					m_pOcclusionCuller->begin(view, proj, getDisplayRect(), getScene()->getTransforms(m_pRenderingVisitor->t));
+
+				// while the view is dragged a coarser picture keeps the frame rate up
+				Float fThreshold = 0;
+				if(bSmall)
+					fThreshold = control().isDragging() ? m_fPixelThreshold * DRAG_THRESHOLD_FACTOR : m_fPixelThreshold;
+
+				m_pSceneCuller->setPixelThreshold(fThreshold);
+				m_pSceneCuller->begin(view, proj, getDisplayRect(), bOcclusion ? m_pOcclusionCuller : NULL);
+				m_pSceneCuller->collectVisible(getScene()->getAABBTree(), visible, getModeFlag(Viewport::MODE_PROXIES) ? &proxies : NULL);
+			}
+			else if(bParallel)
+			{
+				// culled and drawn from the lists of all cores, the visitor gets the roots left over
+				m_pDrawList->draw(*m_pDriver, view, proj, getScene()->getAABBTree(), getScene()->getTransforms(m_pRenderingVisitor->t), visible, *m_pTransparentQueue);
+			}
+			else
+				visible = getScene()->getNodes();
+
+			// the opaque shapes go to the driver grouped by geometry, the blended ones to the queue
+			// drawn back to front at last, the visitor draws what is left
+			if(bInstancing && !bParallel)
+			{
+				SceneNodeVector rest;
+				m_pInstanceList->draw(*m_pDriver, view, proj, getScene()->getTransforms(m_pRenderingVisitor->t), visible, rest, *m_pTransparentQueue);
+				visible.swap(rest);
+			}
+
+			if(!proxies.empty())
+				visible.push_back(createProxies(proxies));
+
+			m_pRenderingVisitor->drawNodes(visible);
+
+			m_pTransparentQueue->setTriangleSorter(bSort ? m_pTriangleSorter : NULL);
+			m_pTransparentQueue->draw(*m_pDriver, view);
+			bQueue = true;
+
+			std::vector< Ptr<RefCounted> > released;
+			m_pTriangleSorter->endFrame(released);
+			if(m_pDriverThread)
+				m_pDriverThread->release(released);
+		}
+		else
+			m_pRenderingVisitor->drawScene(getScene()->getAABBTree());
 
 		/// AXIS ///
 
@@ -108,6 +318,17 @@ void Viewport::drawScene(const Matrix& view, const Matrix& proj, bool bRenderToW
 		}
 
 		m_pDriver->endScene( getModeFlag(Viewport::MODE_FPS) );
+
+		// after the text of the driver, which is set later on a driver thread
+		if(getModeFlag(Viewport::MODE_FPS) && bQueue && m_pTransparentQueue->getCount() > 0 && m_pDriverThread == NULL)
+		{
+			std::wostringstream str;
+			str << SceneIO::getStatusText() << L" Blended: " << m_pTransparentQueue->getCount()
+				<< L" sorted in " << m_pTransparentQueue->getSortTime() << L" ms";
+			if(bSort)
+				str << L", " << m_pTriangleSorter->getSortCount() << L" triangle sorts in " << m_pTriangleSorter->getSortTime() << L" ms";
+			SceneIO::setStatusText(str.str());
+		}
 	}
 }
 
@@ -9,6 +9,14 @@
 namespace eh{
 
 class RenderingVisitor;
+class OcclusionCuller;
+class SceneCuller;
+class InstanceList;
+class TransparentQueue;
+class TriangleSorter;
+class ParallelDrawList;
+class DriverThread;
+class IDriverContext;
 class Controller;
 class IDriver;
 class Scene;
@@ -29,8 +37,18 @@ public:
 		MODE_DRAWPRIMBOUNDS	= 0x00000200,
 		MODE_TRANSPARENS	= 0x00000400,
 		MODE_FPS		= 0x00000800,
+		MODE_OCCLUSION		= 0x00001000,
+		MODE_SMALLFEATURES	= 0x00002000,	// skip nodes smaller than the pixel threshold
+		MODE_PROXIES		= 0x00004000,	// draw the skipped nodes as boxes
+		MODE_MESHLETS		= 0x00008000,	// cull the meshlets of geometries one by one
+		MODE_INSTANCING		= 0x00010000,	// draw the instances of a geometry with one call
+		MODE_SORTTRIANGLES	= 0x00020000,	// draw the triangles of large blended geometries back to front, implies MODE_INSTANCING
+		MODE_PARALLEL		= 0x00040000,	// cull and collect the draws on all cores
 	};
 
+	// the pixel threshold is multiplied by this while the view is dragged
+	static const int DRAG_THRESHOLD_FACTOR = 4;
+
 public:
 
 	Viewport(Ptr<IDriver> pDriver);
@@ -44,9 +62,17 @@ public:
 	void setDisplayRect(int x, int y, int dx, int dy);
 	const Rect& getDisplayRect() const;
 
-	void setDriver(Ptr<IDriver> pDriver) { m_pDriver = pDriver; }
+	void setDriver(Ptr<IDriver> pDriver);
 	const Ptr<IDriver> getDriver() const { return m_pDriver; }
 
+	// makes the driver calls of the frames on a thread of its own, see DriverThread; pContext is
+	// the window side of it. getDriver() returns the recorder of the frames meanwhile.
+	void setDriverThread(bool bEnable, IDriverContext* pContext = NULL);
+	bool isDriverThreadEnabled() const { return m_pDriverThread != NULL; }
+
+	// counters of the frames drawn by the driver thread, NULL while it is disabled
+	const DriverThread* getDriverThread() const { return m_pDriverThread; }
+
 	void setScene(Ptr<Scene> pScene, Ptr<Camera> pCamera = NULL);
 	Ptr<Scene> getScene() const {return m_pScene;}
 
@@ -55,6 +81,25 @@ public:
 	bool isValid() const { return m_valid; }
 	void invalidate() { m_valid = false; }
 
+	// refined geometry of the scene is waiting for the next frame
+	bool isRefinementPending() const;
+
+	// projected size in pixels of the nodes skipped with MODE_SMALLFEATURES
+	void setPixelThreshold(Float fPixels) { m_fPixelThreshold = fPixels; }
+	Float getPixelThreshold() const { return m_fPixelThreshold; }
+
+	// counters of the last frame drawn with MODE_OCCLUSION or MODE_SMALLFEATURES
+	const OcclusionCuller& getOcclusionCuller() const { return *m_pOcclusionCuller; }
+	const SceneCuller& getSceneCuller() const { return *m_pSceneCuller; }
+
+	// counters of the last frame drawn with MODE_INSTANCING
+	const InstanceList& getInstanceList() const { return *m_pInstanceList; }
+	const TransparentQueue& getTransparentQueue() const { return *m_pTransparentQueue; }
+	const TriangleSorter& getTriangleSorter() const { return *m_pTriangleSorter; }
+
+	// counters of the last frame drawn with MODE_PARALLEL
+	const ParallelDrawList& getParallelDrawList() const { return *m_pDrawList; }
+
 	Ray DPtoRay(int x, int y) const;
 	Vec3 WPtoDP(const Vec3& world_coord) const;
 
@@ -67,6 +112,14 @@ private:
 	void drawScene(const Matrix& view, const Matrix& proj, bool bSwapBuffer = true);
 
 	RenderingVisitor* m_pRenderingVisitor;
+	OcclusionCuller* m_pOcclusionCuller;
+	SceneCuller* m_pSceneCuller;
+	InstanceList* m_pInstanceList;
+	TransparentQueue* m_pTransparentQueue;
+	TriangleSorter* m_pTriangleSorter;
+	ParallelDrawList* m_pDrawList;
+	DriverThread* m_pDriverThread;
+	Float m_fPixelThreshold;
 	Ptr<IDriver>	m_pDriver;
 
 	Ptr<Scene>	m_pScene;
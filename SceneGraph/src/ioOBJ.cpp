@@ -1,6 +1,8 @@
 // Copyright (c) 2007,2010, Eduard Heidt
 
 #include "SceneIO.h"
+#include "NormalGenerator.h"
+#include "StopWatch.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/unordered_map.hpp>
@@ -29,17 +31,108 @@ private:
 	progress_callback progress;
 
 	Ptr<IVertexBuffer> m_pVB;
+	std::auto_ptr<VertexBatch> m_pBatch;
+
+	struct VNT
+	{
+		Uint v, n, t;
+
+		VNT(Uint v, Uint n, Uint t):v(v),n(n),t(t){}
+
+		bool operator==(const VNT& other) const
+		{
+			return v == other.v && n == other.n && t == other.t;
+		}
+		friend size_t hash_value(const VNT& vnt)
+		{
+			size_t seed = 0;
+			boost::hash_combine(seed, vnt.v);
+			boost::hash_combine(seed, vnt.n);
+			boost::hash_combine(seed, vnt.t);
+			return seed;
+		}
+	};
+
+	// each v/vn/vt combination becomes one vertex
+	boost::unordered_map< VNT, Uint > m_vnt;
 
 	inline Uint addVNT(size_t vi, size_t ni, size_t ti)
 	{
-		if(vi < m_vertices.size() && ni < m_normals.size() && ti < m_texcoords.size())
-			return m_pVB->addVertex( m_vertices[vi], m_normals[ni], m_texcoords[ti] );
-		else if(vi < m_vertices.size() && ni < m_normals.size())
-			return m_pVB->addVertex( m_vertices[vi], m_normals[ni], Vec3::Null() );
-		else if(vi < m_vertices.size())
-			return m_pVB->addVertex( m_vertices[vi], Vec3::Null(), Vec3::Null() );
-		else
+		const Uint NONE = ~0u;
+
+		if(vi >= m_vertices.size())
 			return 0;
+		if(ni >= m_normals.size())
+			ni = ti = NONE;
+		else if(ti >= m_texcoords.size())
+			ti = NONE;
+
+		std::pair< boost::unordered_map< VNT, Uint >::iterator, bool > it = m_vnt.insert( std::make_pair(VNT((Uint)vi, (Uint)ni, (Uint)ti), 0) );
+		if(it.second)
+			it.first->second = m_pBatch->push( m_vertices[vi],
+				ni != NONE ? m_normals[ni] : Vec3::Null(),
+				ti != NONE ? m_texcoords[ti] : Vec3::Null() );
+
+		return it.first->second;
+	}
+
+	static const int CREASE_ANGLE = 60;
+
+	// corners of faces without vn, their vertices are made by generateNormals() once all faces are read
+	struct Deferred
+	{
+		Uint_vec* pFace;
+		size_t pos;
+		Uint t;
+	};
+	std::vector<Deferred> m_deferred;
+	Uint_vec m_deferredCoords;
+
+	inline void deferVertex(Uint_vec& face, size_t vi, size_t ti)
+	{
+		const Uint NONE = ~0u;
+
+		Deferred d = { &face, face.size(), ti < m_texcoords.size() ? (Uint)ti : NONE };
+		m_deferred.push_back(d);
+		m_deferredCoords.push_back( vi < m_vertices.size() ? (Uint)vi : 0 );
+		face.push_back(0);
+	}
+
+	void generateNormals()
+	{
+		const Uint NONE = ~0u;
+
+		if(m_deferred.empty() || m_vertices.empty())
+			return;
+
+		StopWatch sw;
+
+		NormalGenerator normals(CREASE_ANGLE);
+		normals.generate(&m_vertices[0], (Uint)m_vertices.size(), &m_deferredCoords[0], (Uint)m_deferredCoords.size());
+
+		// a generated vertex still needs its own buffer vertex for each vt it is used with
+		typedef boost::unordered_map< std::pair<Uint, Uint>, Uint > VertexMap;
+		VertexMap vertices;
+
+		for(size_t i = 0; i < m_deferred.size(); i++)
+		{
+			Uint v = normals.getCornerVertices()[i];
+			Uint t = m_deferred[i].t;
+
+			std::pair< VertexMap::iterator, bool > it = vertices.insert( std::make_pair(std::make_pair(v, t), 0) );
+			if(it.second)
+				it.first->second = m_pBatch->push( m_vertices[ normals.getVertexCoords()[v] ],
+					normals.getNormals()[v],
+					t != NONE ? m_texcoords[t] : Vec3::Null() );
+
+			(*m_deferred[i].pFace)[ m_deferred[i].pos ] = it.first->second;
+		}
+
+		std::cout << "OBJ normals: " << sw.elapsed() << " ms, " << m_deferred.size()/3 << " triangles -> "
+			<< vertices.size() << " vertices" << std::endl;
+
+		m_deferred.clear();
+		m_deferredCoords.clear();
 	}
 
 	typedef boost::unordered_map< std::string, boost::unordered_map< std::string, Uint_vec> > FaceMap;
@@ -134,18 +227,24 @@ public:
 	bool read(std::istream& stream, SceneNodeVector& nodes, progress_callback progress)
 	{
 		m_pVB = CreateVertexBuffer( sizeof(Vec3)*2 + sizeof(Float)*2);
+		m_pBatch.reset( new VertexBatch(m_pVB) );
 
 		float nCount = 0;
 		float iCount = 0;
-
+		Uint nVertices = 0;
 
 		std::string line;
 		while( !stream.eof() )
 		{
 			nCount+=1;
 			std::getline(stream, line);
+
+			if(line.size() > 1 && line[0] == 'v' && line[1] == ' ')
+				nVertices++;
 		}
 
+		m_pVB->reserve(nVertices);
+
 		stream.clear();
 		stream.seekg(0, std::ios_base::beg );
 
@@ -167,32 +266,41 @@ public:
 			//else if(!strncmp("s", line.c_str(), 1))		; // ignore
 		}
 
+		generateNormals();
+		m_pBatch->flush();
+
 		if(m_faces.size() == 0 || m_pVB->getVertexCount() == 0)
 		{
 			Uint_vec indices;
-			for(size_t i = 0; i < m_vertices.size(); i++)
-				indices.push_back( m_pVB->addVertex( m_vertices[i] ) );
+			if(m_vertices.size() > 0)
+			{
+				Uint first = m_pVB->appendVertices( (Uint)m_vertices.size(), &m_vertices[0] );
+				for(size_t i = 0; i < m_vertices.size(); i++)
+					indices.push_back( first + (Uint)i );
+			}
 
-			nodes.push_back( ShapeNode::create( Material::Black(),Geometry::create( Geometry::POINTS, m_pVB, indices )  ) );
+			nodes.push_back( ShapeNode::create( Material::Black(),Geometry::createSwapped( Geometry::POINTS, m_pVB, indices )  ) );
 		}
 		else
 		{
 
-			for(FaceMap::const_iterator it = m_faces.begin(); it != m_faces.end(); ++it)
+			for(FaceMap::iterator it = m_faces.begin(); it != m_faces.end(); ++it)
 			{
 				Ptr<ShapeNode> aShape = ShapeNode::create();
-				for(boost::unordered_map<std::string, Uint_vec>::const_iterator it2 = it->second.begin();
+				for(boost::unordered_map<std::string, Uint_vec>::iterator it2 = it->second.begin();
 					it2 != it->second.end(); ++it2)
-					aShape->addGeometry( m_materials[it2->first], Geometry::create(Geometry::TRIANGLES, m_pVB, it2->second) );
+					aShape->addGeometry( m_materials[it2->first], Geometry::createSwapped(Geometry::TRIANGLES, m_pVB, it2->second) );
 
 				if(m_edges[it->first].size() > 0)
-					aShape->addGeometry( Material::Black(), Geometry::create(Geometry::LINES, m_pVB, m_edges[it->first]) );
+					aShape->addGeometry( Material::Black(), Geometry::createSwapped(Geometry::LINES, m_pVB, m_edges[it->first]) );
 
 				nodes.push_back( aShape );
 			}
 		}
 
 		std::cout << "OBJ loaded.. " << m_faces.size() << " Materials, " << m_pVB->getVertexCount() << " Vertices" << std::endl;
+		m_pBatch.reset();
+		m_vnt.clear();
 		m_pVB = NULL;
 
 		return true;
@@ -256,17 +364,15 @@ bool OBJLoader::makeFace(const std::string& line)
 			if(t[i] < 0) t[i] = m_texcoords.size()+t[i]+1;
 		}
 
-		Vec3 n = calcNormal(m_vertices[v[0]-1], m_vertices[v[1]-1], m_vertices[v[2]-1]);
-
 		for(int i = 0; i < r/2; i++)
 		{
 			if( i < 3 )
-				face.push_back( m_pVB->addVertex( m_vertices[v[i]-1], n, m_texcoords[t[i]-1] ) );
+				deferVertex( face, v[i]-1, t[i]-1 );
 			else
 			{
-				face.push_back( face[face.size()-3] );
-				face.push_back( face[face.size()-2] );
-				face.push_back( m_pVB->addVertex( m_vertices[v[3]-1], n, m_texcoords[t[3]-1] ) );
+				deferVertex( face, v[0]-1, t[0]-1 );
+				deferVertex( face, v[2]-1, t[2]-1 );
+				deferVertex( face, v[3]-1, t[3]-1 );
 			}
 		}
 	}
@@ -278,17 +384,15 @@ bool OBJLoader::makeFace(const std::string& line)
 			if(v[i] < 0) v[i] = m_vertices.size()+v[i]+1;
 		}
 
-		Vec3 n = calcNormal(m_vertices[v[0]-1], m_vertices[v[1]-1], m_vertices[v[2]-1]);
-
 		for(int i = 0; i < r; i++)
 		{
 			if( i < 3 )
-				face.push_back( m_pVB->addVertex( m_vertices[v[i]-1], n, Vec3::Null() ) );
+				deferVertex( face, v[i]-1, -1 );
 			else
 			{
-				face.push_back( face[face.size()-3] );
-				face.push_back( face[face.size()-2] );
-				face.push_back( m_pVB->addVertex( m_vertices[v[3]-1], n, Vec3::Null() ) );
+				deferVertex( face, v[0]-1, -1 );
+				deferVertex( face, v[2]-1, -1 );
+				deferVertex( face, v[3]-1, -1 );
 			}
 		}
 	}
@@ -15,6 +15,7 @@
 ****************************************************************************/
 
 #include <SceneIO.h>
+#include <NormalGenerator.h>
 using namespace eh;
 
 #include <Inventor/SoDB.h>
@@ -32,10 +33,14 @@ using namespace eh;
 #include <Inventor/VRMLnodes/SoVRMLGeometry.h>
 #include <Inventor/VRMLnodes/SoVRMLTransform.h>
 #include <Inventor/VRMLnodes/SoVRMLIndexedFaceSet.h>
+#include <Inventor/VRMLnodes/SoVRMLCoordinate.h>
+#include <Inventor/VRMLnodes/SoVRMLAppearance.h>
+#include <Inventor/VRMLnodes/SoVRMLMaterial.h>
 #include <Inventor/VRMLnodes/SoVRMLPositionInterpolator.h>
 #include <Inventor/VRMLnodes/SoVRMLOrientationInterpolator.h>
 
 #include <Inventor/SoPrimitiveVertex.h>
+#include <Inventor/SbTesselator.h>
 #include <Inventor/actions/SoCallbackAction.h>
 
 #include <Inventor/actions/SoGetMatrixAction.h>
@@ -55,6 +60,7 @@ using namespace eh;
 #include <string.h>
 #include <math.h>
 #include <map>
+#include <algorithm>
 
 #include <boost/static_assert.hpp>
 
@@ -65,7 +71,7 @@ class Coin3DLoader: public SceneIO::IPlugIn
 {
     struct GeoetryStruct
     {
-        Ptr<IVertexBuffer> m_pVB;
+        VertexBatch* m_pBatch;
         std::map<int, Ptr<Material> > m_mapMaterials;
         std::map<int, Uint_vec> m_mapMaterialTriangles;
         std::map<int, Uint_vec> m_mapMaterialLines;
@@ -74,7 +80,11 @@ class Coin3DLoader: public SceneIO::IPlugIn
 
 public:
 
-    Coin3DLoader()
+    Coin3DLoader():
+        m_pVB(NULL),
+        m_pMapNodes(NULL),
+        m_nIndexedCorners(0),
+        m_nIndexedVertices(0)
     {
     }
     virtual ~Coin3DLoader()
@@ -101,9 +111,10 @@ public:
             _this->m_mapMaterials[material_index] = m;
         }
 
-        _this->m_mapMaterialTriangles[material_index].push_back( _this->m_pVB->addVertex( (Vec3&)v0->getPoint(), (Vec3&)v0->getNormal()) );
-        _this->m_mapMaterialTriangles[material_index].push_back( _this->m_pVB->addVertex( (Vec3&)v1->getPoint(), (Vec3&)v1->getNormal()) );
-        _this->m_mapMaterialTriangles[material_index].push_back( _this->m_pVB->addVertex( (Vec3&)v2->getPoint(), (Vec3&)v2->getNormal()) );
+        Uint_vec& triangles = _this->m_mapMaterialTriangles[material_index];
+        triangles.push_back( _this->m_pBatch->add( (Vec3&)v0->getPoint(), (Vec3&)v0->getNormal()) );
+        triangles.push_back( _this->m_pBatch->add( (Vec3&)v1->getPoint(), (Vec3&)v1->getNormal()) );
+        triangles.push_back( _this->m_pBatch->add( (Vec3&)v2->getPoint(), (Vec3&)v2->getNormal()) );
 
     }
     static void addLineSegmentCB(void* data, SoCallbackAction* action, const SoPrimitiveVertex *v0, const SoPrimitiveVertex *v1)
@@ -111,48 +122,62 @@ public:
         GeoetryStruct* _this = (GeoetryStruct*)(data);
         int material_index = v0->getMaterialIndex();
 
-        _this->m_mapMaterialLines[material_index].push_back( _this->m_pVB->addVertex( (Vec3&)v0->getPoint(), (Vec3&)v0->getNormal()) );
-        _this->m_mapMaterialLines[material_index].push_back( _this->m_pVB->addVertex( (Vec3&)v1->getPoint(), (Vec3&)v1->getNormal()) );
+        Uint_vec& lines = _this->m_mapMaterialLines[material_index];
+        lines.push_back( _this->m_pBatch->add( (Vec3&)v0->getPoint(), (Vec3&)v0->getNormal()) );
+        lines.push_back( _this->m_pBatch->add( (Vec3&)v1->getPoint(), (Vec3&)v1->getNormal()) );
     }
     static void addPointCB(void* data, SoCallbackAction* action,  const SoPrimitiveVertex *v0)
     {
         GeoetryStruct* _this = (GeoetryStruct*)(data);
         int material_index = v0->getMaterialIndex();
 
-        _this->m_mapMaterialPoints[material_index].push_back( _this->m_pVB->addVertex( (Vec3&)v0->getPoint(), (Vec3&)v0->getNormal()) );
+        _this->m_mapMaterialPoints[material_index].push_back( _this->m_pBatch->add( (Vec3&)v0->getPoint(), (Vec3&)v0->getNormal()) );
     }
 
     IVertexBuffer* m_pVB;
     std::map<uint32_t, Ptr<SceneNode> >* m_pMapNodes;
 
+    static const int CREASE_ANGLE = 60;
+    Uint m_nIndexedCorners;
+    Uint m_nIndexedVertices;
+
     Ptr<SceneNode> makeShape(SoNode* node)
     {
         std::map<uint32_t, Ptr<SceneNode> >::iterator it = m_pMapNodes->find(node->getNodeId());
         if (it != m_pMapNodes->end())
             return it->second;
 
+        if (SoVRMLShape* shape = dynamic_cast<SoVRMLShape*>(node))
+        {
+            if (Ptr<SceneNode> s = makeIndexedShape(shape))
+                return (*m_pMapNodes)[node->getNodeId()] = s;
+        }
+
         SoCallbackAction cbAction;
 
+        VertexBatch batch(m_pVB);
+
         GeoetryStruct tmp;
-        tmp.m_pVB = m_pVB;
+        tmp.m_pBatch = &batch;
 
         cbAction.addTriangleCallback(SoVRMLGeometry::getClassTypeId(), addTriangleCB, &tmp);
         cbAction.addLineSegmentCallback(SoVRMLGeometry::getClassTypeId(), addLineSegmentCB, &tmp);
         cbAction.addPointCallback(SoVRMLGeometry::getClassTypeId(), addPointCB, &tmp);
 
         cbAction.apply(node);
+        batch.flush();
 
         Ptr<ShapeNode> s = ShapeNode::create();
         (*m_pMapNodes)[node->getNodeId()] = s;
 
-        for (std::map<int, Uint_vec>::const_iterator it = tmp.m_mapMaterialTriangles.begin();  it != tmp.m_mapMaterialTriangles.end(); ++it)
-            s->addGeometry( tmp.m_mapMaterials[it->first], Geometry::create(Geometry::TRIANGLES, tmp.m_pVB, it->second) );
+        for (std::map<int, Uint_vec>::iterator it = tmp.m_mapMaterialTriangles.begin();  it != tmp.m_mapMaterialTriangles.end(); ++it)
+            s->addGeometry( tmp.m_mapMaterials[it->first], Geometry::createSwapped(Geometry::TRIANGLES, m_pVB, it->second) );
 
-        for (std::map<int, Uint_vec>::const_iterator it = tmp.m_mapMaterialLines.begin();  it != tmp.m_mapMaterialLines.end(); ++it)
-            s->addGeometry( tmp.m_mapMaterials[it->first], Geometry::create(Geometry::LINES, tmp.m_pVB, it->second) );
+        for (std::map<int, Uint_vec>::iterator it = tmp.m_mapMaterialLines.begin();  it != tmp.m_mapMaterialLines.end(); ++it)
+            s->addGeometry( tmp.m_mapMaterials[it->first], Geometry::createSwapped(Geometry::LINES, m_pVB, it->second) );
 
-        for (std::map<int, Uint_vec>::const_iterator it = tmp.m_mapMaterialPoints.begin();  it != tmp.m_mapMaterialPoints.end(); ++it)
-            s->addGeometry( tmp.m_mapMaterials[it->first], Geometry::create(Geometry::POINTS, tmp.m_pVB, it->second) );
+        for (std::map<int, Uint_vec>::iterator it = tmp.m_mapMaterialPoints.begin();  it != tmp.m_mapMaterialPoints.end(); ++it)
+            s->addGeometry( tmp.m_mapMaterials[it->first], Geometry::createSwapped(Geometry::POINTS, m_pVB, it->second) );
 
 
         if (s->GeometryBegin() == s->GeometryEnd())
@@ -162,47 +187,125 @@ public:
 
     }
 
-    Ptr<SceneNode> makeShape(SoCoordinate3* pCoordNode, SoMaterial* pMaterials, SoIndexedFaceSet* pIFSNode)
+    static void addTesselatedCB(void* v0, void* v1, void* v2, void* data)
     {
-        if (!pCoordNode || !pIFSNode )
-            return NULL;
+        Uint_vec& face = *(Uint_vec*)data;
+        face.push_back( *(const int32_t*)v0 );
+        face.push_back( *(const int32_t*)v1 );
+        face.push_back( *(const int32_t*)v2 );
+    }
 
-        std::map<uint32_t, Ptr<SceneNode> >::iterator it = m_pMapNodes->find(pIFSNode->getNodeId());
-        if (it != m_pMapNodes->end())
-            return it->second;
+    // Triangulates the coordIndex polygons on the points as they are, one vertex per point and crease
+    // instead of three per triangle. Returns the triangles by material index, midx is used per face or
+    // per corner when its size matches. Polygons with invalid indices are skipped, polygons that
+    // may be concave (bConvex false) are tessellated instead of fanned.
+    void makeIndexedTriangles(const SbVec3f* coords, int nCoords, const int32_t* idx, int nIdx,
+        const int32_t* midx, int nMidx, Float fCreaseAngle, bool bCCW, bool bConvex, std::map<int32_t, Uint_vec>& indices)
+    {
+        int nFaces = 0;
+        for (int i = 0; i < nIdx; i++)
+            if (idx[i] == -1 || i == nIdx-1)
+                nFaces++;
 
-        Ptr<ShapeNode> s = ShapeNode::create();
-        (*m_pMapNodes)[pIFSNode->getNodeId()] = s;
+        const bool bPerFace = nMidx == nFaces;
+        const bool bPerCorner = !bPerFace && nMidx == nIdx;
 
-        std::map<int32_t, Uint_vec> indices;
-        Ptr<IVertexBuffer> pVB = m_pVB;
+        Uint_vec corners;
+        std::vector<int32_t> materials;
+
+        Uint_vec face;
+        SbTesselator tesselator(addTesselatedCB, &face);
 
-        const int32_t* idx = pIFSNode->coordIndex.getValues(0);
-        const int32_t* midx = pIFSNode->materialIndex.getValues(0);
-        const SbVec3f* coords = pCoordNode->point.getValues(0);
-        for (int i = 0, m = 0; i < pIFSNode->coordIndex.getNum();)
+        for (int i = 0, f = 0; i < nIdx; f++)
         {
-            const Vec3 p1((Vec3&)coords[idx[i]]); i++;
-            const Vec3 p2((Vec3&)coords[idx[i]]); i++;
-            const Vec3 p3((Vec3&)coords[idx[i]]); i++;
-            const Vec3& n = math3D::calcNormal(p1, p2, p3);
+            int begin = i;
+            while (i < nIdx && idx[i] != -1)
+                i++;
+            int end = i++;
+
+            bool bValid = true;
+            for (int k = begin; k < end; k++)
+                bValid = bValid && idx[k] >= 0 && idx[k] < nCoords;
+
+            if (!bValid)
+                continue;
 
             int32_t mid = 0;
+            if (bPerFace)
+                mid = midx[f];
+            else if (bPerCorner)
+                mid = midx[begin];
 
-            if ( pIFSNode->materialIndex.getNum() == pIFSNode->coordIndex.getNum() / 4 )
-                mid = midx[m++];
-            else if ( pIFSNode->materialIndex.getNum() == pIFSNode->coordIndex.getNum() )
-                mid = midx[i];
+            face.clear();
+            if (bConvex || end - begin <= 3)
+            {
+                for (int k = begin+2; k < end; k++)
+                {
+                    face.push_back( idx[begin] );
+                    face.push_back( idx[k-1] );
+                    face.push_back( idx[k] );
+                }
+            }
+            else
+            {
+                // the tesselator keeps the winding of the polygon, the vertex data are the coordIndex entries
+                tesselator.beginPolygon();
+                for (int k = begin; k < end; k++)
+                    tesselator.addVertex( coords[idx[k]], (void*)&idx[k] );
+                tesselator.endPolygon();
+            }
 
-            indices[mid].push_back( pVB->addVertex(p1, n) );
-            indices[mid].push_back( pVB->addVertex(p2, n) );
-            indices[mid].push_back( pVB->addVertex(p3, n) );
+            for (size_t t = 0; t + 2 < face.size(); t += 3)
+            {
+                corners.push_back( face[t] );
+                corners.push_back( face[bCCW ? t+1 : t+2] );
+                corners.push_back( face[bCCW ? t+2 : t+1] );
+                materials.push_back( mid );
+            }
+        }
+
+        if (corners.empty())
+            return;
+
+        NormalGenerator normals(fCreaseAngle);
+        normals.generate(reinterpret_cast<const Vec3*>(coords), nCoords, &corners[0], (Uint)corners.size());
 
-            while (idx[i++] != -1);
+        std::vector<Vec3> points(normals.getVertexCount());
+        for (Uint v = 0; v < normals.getVertexCount(); v++)
+            points[v] = reinterpret_cast<const Vec3&>(coords[ normals.getVertexCoords()[v] ]);
+
+        Uint first = m_pVB->appendVertices(normals.getVertexCount(), &points[0], &normals.getNormals()[0]);
+
+        for (size_t t = 0; t < materials.size(); t++)
+        {
+            Uint_vec& triangles = indices[ materials[t] ];
+            triangles.push_back( first + normals.getCornerVertices()[3*t+0] );
+            triangles.push_back( first + normals.getCornerVertices()[3*t+1] );
+            triangles.push_back( first + normals.getCornerVertices()[3*t+2] );
         }
 
+        m_nIndexedCorners += (Uint)corners.size();
+        m_nIndexedVertices += normals.getVertexCount();
+    }
+
+    Ptr<SceneNode> makeShape(SoCoordinate3* pCoordNode, SoMaterial* pMaterials, SoIndexedFaceSet* pIFSNode)
+    {
+        if (!pCoordNode || !pIFSNode )
+            return NULL;
+
+        std::map<uint32_t, Ptr<SceneNode> >::iterator it = m_pMapNodes->find(pIFSNode->getNodeId());
+        if (it != m_pMapNodes->end())
+            return it->second;
 
-        for (std::map<int32_t, Uint_vec>::const_iterator it = indices.begin(); it != indices.end(); ++it)
+        Ptr<ShapeNode> s = ShapeNode::create();
+        (*m_pMapNodes)[pIFSNode->getNodeId()] = s;
+
+        std::map<int32_t, Uint_vec> indices;
+        makeIndexedTriangles(pCoordNode->point.getValues(0), pCoordNode->point.getNum(),
+            pIFSNode->coordIndex.getValues(0), pIFSNode->coordIndex.getNum(),
+            pIFSNode->materialIndex.getValues(0), pIFSNode->materialIndex.getNum(), CREASE_ANGLE, true, true, indices);
+
+        for (std::map<int32_t, Uint_vec>::iterator it = indices.begin(); it != indices.end(); ++it)
         {
             Ptr<Material> mat = NULL;
             if (pMaterials)
@@ -218,9 +321,54 @@ public:
                 mat = Material::create( rgba );
             }
 
-            s->addGeometry( mat, Geometry::create( Geometry::TRIANGLES, pVB, it->second ));
+            s->addGeometry( mat, Geometry::createSwapped( Geometry::TRIANGLES, m_pVB, it->second ));
+        }
+
+        return s;
+    }
+
+    // VRML shapes with a plain IndexedFaceSet keep their coordIndex topology, everything with
+    // explicit normals, colors or texture coordinates still goes through the callback action.
+    Ptr<SceneNode> makeIndexedShape(SoVRMLShape* pShape)
+    {
+        SoVRMLIndexedFaceSet* pIFS = dynamic_cast<SoVRMLIndexedFaceSet*>( pShape->geometry.getValue() );
+        if (!pIFS || pIFS->normal.getValue() || pIFS->color.getValue() || pIFS->texCoord.getValue())
+            return NULL;
+
+        SoVRMLCoordinate* pCoord = dynamic_cast<SoVRMLCoordinate*>( pIFS->coord.getValue() );
+        if (!pCoord)
+            return NULL;
+
+        Ptr<Material> mat = Material::create( RGBA(0.8f, 0.8f, 0.8f) );
+        if (SoVRMLAppearance* pAppearance = dynamic_cast<SoVRMLAppearance*>( pShape->appearance.getValue() ))
+        {
+            if (SoVRMLMaterial* pMat = dynamic_cast<SoVRMLMaterial*>( pAppearance->material.getValue() ))
+            {
+                const SbColor& diffuse = pMat->diffuseColor.getValue();
+                const SbColor& specular = pMat->specularColor.getValue();
+                const SbColor& emission = pMat->emissiveColor.getValue();
+
+                mat = Material::create( RGBA(diffuse[0], diffuse[1], diffuse[2], 1.f-pMat->transparency.getValue()) );
+                mat->setSpecular( RGBA(specular[0], specular[1], specular[2]) );
+                mat->setSpecularFactor( pMat->shininess.getValue() );
+                mat->setEmission( RGBA(emission[0], emission[1], emission[2]) );
+            }
         }
 
+        std::map<int32_t, Uint_vec> indices;
+        makeIndexedTriangles(pCoord->point.getValues(0), pCoord->point.getNum(),
+            pIFS->coordIndex.getValues(0), pIFS->coordIndex.getNum(), NULL, 0,
+            std::max(RAD2DEG(pIFS->creaseAngle.getValue()), 1.f), pIFS->ccw.getValue() != FALSE,
+            pIFS->convex.getValue() != FALSE, indices);
+
+        // nothing to triangulate, the callback action still finds what there is
+        if (indices.empty())
+            return NULL;
+
+        Ptr<ShapeNode> s = ShapeNode::create();
+        for (std::map<int32_t, Uint_vec>::iterator it = indices.begin(); it != indices.end(); ++it)
+            s->addGeometry( mat, Geometry::createSwapped( Geometry::TRIANGLES, m_pVB, it->second ));
+
         return s;
     }
 
@@ -299,6 +447,8 @@ public:
         m_pMapNodes = &NodesMap;
         Ptr<IVertexBuffer> pVB = CreateVertexBuffer( sizeof(Float)*6 );
         m_pVB = pVB.get();
+        m_nIndexedCorners = 0;
+        m_nIndexedVertices = 0;
 
         std::auto_ptr<char> data;
         size_t size = SceneIO::File(sFile).getContent(data);
@@ -330,6 +480,10 @@ public:
 
             pScene->insertNode( traverseGraph(rootWRLNode) );
 
+            if (m_nIndexedCorners > 0)
+                std::cout << "indexed face sets: " << m_nIndexedCorners << " triangle corners -> "
+                          << m_nIndexedVertices << " vertices" << std::endl;
+
             rootWRLNode->unref();
             return true;
         }
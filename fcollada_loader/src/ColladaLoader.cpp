@@ -19,6 +19,8 @@ using namespace eh;
 
 #include <iostream>
 #include <boost/unordered_map.hpp>
+#include <Parallel.h>
+#include <StopWatch.h>
 
 #include <FCollada.h>
 
@@ -59,13 +61,47 @@ private:
 	Ptr<IVertexBuffer> m_pVB;
 	boost::unordered_map< std::string, Ptr<Material> > m_materials;
 
-	typedef boost::unordered_map< Geometry::TYPE, Uint_vec > PRIM_INDICES;
-	typedef boost::unordered_map< std::wstring, PRIM_INDICES > MAT_PRIM_INDICES;
-	boost::unordered_map< std::string, MAT_PRIM_INDICES > m_geometry;
+	typedef boost::unordered_map< Geometry::TYPE, Ptr<Geometry> > PRIM_GEOMETRY;
+	typedef boost::unordered_map< std::wstring, PRIM_GEOMETRY > MAT_PRIM_GEOMETRY;
+	boost::unordered_map< std::string, MAT_PRIM_GEOMETRY > m_geometry;
 
-	void addPolygons(FCDGeometryPolygons* pPolys, MAT_PRIM_INDICES& matprims )
-	{
+	// geometry instances with the same material binding share one ShapeNode
+	boost::unordered_map< std::string, Ptr<ShapeNode> > m_shapes;
+
+	Uint m_nInstances;
+	Uint m_nSharedInstances;
+	size_t m_nSharedIndices;
+
+	// keyframes of all animated nodes, resampled at 30 fps by getTransform() and reduced by the clip
+	Ptr<AnimationClip> m_pClip;
+	Uint m_nAnimated;
+	size_t m_nSamples;
 
+	// one polygon set of a library geometry. The FCollada objects are only touched on the loading
+	// thread, convertPolygons() reads the raw arrays and fills the vertices on a worker thread.
+	struct PolygonsMesh
+	{
+		std::string id;
+		std::wstring semantic;
+		Geometry::TYPE type;
+
+		size_t nIndices;
+		const uint32* pPositionIndices;
+		const uint32* pNormalIndices;
+		const uint32* pTexCoordIndices;
+		const float* pPositions;
+		const float* pNormals;
+		const float* pTexCoords;
+		uint32 nTexCoordStride;
+
+		std::vector<Vec3> coords;
+		std::vector<Vec3> normals;
+		std::vector<Vec3> texcoords;
+		Uint_vec indices;
+	};
+
+	static void collectPolygons(FCDGeometryPolygons* pPolys, const std::string& id, std::vector<PolygonsMesh>& meshes)
+	{
 		// indices to vertex
 		FCDGeometryPolygonsInput* pi = pPolys->FindInput(FUDaeGeometryInput::POSITION);
 		FCDGeometryPolygonsInput* ni = pPolys->FindInput(FUDaeGeometryInput::NORMAL);
@@ -76,6 +112,8 @@ private:
 		FCDGeometrySource* normals   = pPolys->GetParent()->FindSourceByType(FUDaeGeometryInput::NORMAL);
 		FCDGeometrySource* texcoords  = pPolys->GetParent()->FindSourceByType(FUDaeGeometryInput::TEXCOORD);
 
+		if(pi == NULL || positions == NULL)
+			return;
 
 		Geometry::TYPE PrimMode = Geometry::TRIANGLES;
 		switch(pPolys->GetPrimitiveType())
@@ -100,49 +138,144 @@ private:
 			break;
 		}
 
-		Uint_vec& idx = matprims[pPolys->GetMaterialSemantic().c_str()][PrimMode];
+		meshes.push_back(PolygonsMesh());
+		PolygonsMesh& mesh = meshes.back();
+
+		mesh.id = id;
+		mesh.semantic = pPolys->GetMaterialSemantic().c_str();
+		mesh.type = PrimMode;
+		mesh.nIndices = pi->GetIndexCount();
+		mesh.pPositionIndices = pi->GetIndices();
+		mesh.pNormalIndices = (normals && ni) ? ni->GetIndices() : NULL;
+		mesh.pTexCoordIndices = (texcoords && ti) ? ti->GetIndices() : NULL;
+		mesh.pPositions = positions->GetData();
+		mesh.pNormals = mesh.pNormalIndices ? normals->GetData() : NULL;
+		mesh.pTexCoords = mesh.pTexCoordIndices ? texcoords->GetData() : NULL;
+		mesh.nTexCoordStride = mesh.pTexCoordIndices ? texcoords->GetStride() : 0;
+	}
+
+	static void convertPolygons(std::vector<PolygonsMesh>* pMeshes, Uint begin, Uint end)
+	{
+		typedef std::pair<uint32, std::pair<uint32, uint32> > CORNER;
 
-		for (size_t i = 0; i < pi->GetIndexCount(); i++)
+		for(Uint m = begin; m < end; m++)
 		{
-			uint32 _pi = (uint32)pi->GetIndices()[i];
+			PolygonsMesh& mesh = (*pMeshes)[m];
 
-			const Vec3* v = NULL;
-			const Vec3* n = NULL;
+			// corners with the same position, normal and texcoord index share a vertex
+			boost::unordered_map<CORNER, Uint> vertices;
+			mesh.indices.reserve(mesh.nIndices);
 
-			v = reinterpret_cast<math3D::Vec3*>(&positions->GetData()[_pi*3]);
-			if(normals)
+			for (size_t i = 0; i < mesh.nIndices; i++)
 			{
-				uint32 _ni = (uint32)ni->GetIndices()[i];
-				n = reinterpret_cast<math3D::Vec3*>(&normals->GetData()[_ni*3]);
+				uint32 _pi = mesh.pPositionIndices[i];
+				uint32 _ni = mesh.pNormalIndices ? mesh.pNormalIndices[i] : 0;
+				uint32 _ti = mesh.pTexCoordIndices ? mesh.pTexCoordIndices[i] : 0;
+
+				std::pair<boost::unordered_map<CORNER, Uint>::iterator, bool> it =
+					vertices.insert( std::make_pair(CORNER(_pi, std::make_pair(_ni, _ti)), (Uint)mesh.coords.size()) );
+
+				if(it.second)
+				{
+					mesh.coords.push_back( reinterpret_cast<const Vec3&>(mesh.pPositions[_pi*3]) );
+
+					if(mesh.pNormals)
+						mesh.normals.push_back( reinterpret_cast<const Vec3&>(mesh.pNormals[_ni*3]) );
+					else
+						mesh.normals.push_back( Vec3::Null() );
+
+					Vec3 t = Vec3::Null();
+					if(mesh.pTexCoords)
+					{
+						t.x = mesh.pTexCoords[_ti*mesh.nTexCoordStride];
+						t.y = mesh.pTexCoords[_ti*mesh.nTexCoordStride+1];
+					}
+					mesh.texcoords.push_back(t);
+				}
+
+				mesh.indices.push_back( it.first->second );
 			}
-			else
-				n = &math3D::Vec3::Null();
+		}
+	}
+
+	// converts the library geometries, each once and in parallel, into m_pVB and m_geometry
+	void addGeometries(FCDGeometryLibrary* geolib, SceneIO::progress_callback& progress)
+	{
+		StopWatch sw;
+		std::vector<PolygonsMesh> meshes;
+
+		for (size_t i = 0; i < geolib->GetEntityCount(); i++)
+		{
+			progress(0.5f*i/geolib->GetEntityCount());
 
-			if(texcoords)
+			FCDGeometry* pGeo = geolib->GetEntity(i);
+
+			if (pGeo->IsMesh())
 			{
-				uint32 _ti = (uint32)ti->GetIndices()[i];
-				Vec3 t;
-				t.x = texcoords->GetData()[_ti*texcoords->GetStride()];
-				t.y = texcoords->GetData()[_ti*texcoords->GetStride()+1];
+				FCDGeometryMesh* pMesh = pGeo->GetMesh();
+				if (!pMesh->IsTriangles())
+					FCDGeometryPolygonsTools::Triangulate(pMesh);
 
-				idx.push_back( m_pVB->addVertex( *v, *n, t ) );
+				for (size_t j = 0; j < pMesh->GetPolygonsCount(); j++)
+				{
+					if(FCDGeometryPolygons* pPolys = pMesh->GetPolygons(j))
+						collectPolygons( pPolys, pMesh->GetDaeId().c_str(), meshes );
+				}
 			}
-			else
+
+			if (pGeo->IsPSurface())
 			{
-				idx.push_back( m_pVB->addVertex( *v, *n, Vec3::Null() ) );
+			    std::cerr << "pGeo->IsPSurface()" << std::endl;
+			}
+
+			if (pGeo->IsSpline())
+			{
+			    std::cerr << "pGeo->IsSpline()" << std::endl;
 			}
 		}
-	}
-	void addMesh(FCDGeometryMesh* pMesh)
-	{
-		if (!pMesh->IsTriangles())
-			FCDGeometryPolygonsTools::Triangulate(pMesh);
 
-		for (size_t j = 0; j < pMesh->GetPolygonsCount(); j++)
+		if(meshes.empty())
+			return;
+
+		parallelFor((Uint)meshes.size(), boost::bind(&COLLADALoader::convertPolygons, &meshes, _1, _2), 1);
+
+		// merged in document order, so the buffer is the same for any number of threads
+		Uint nVertices = 0;
+		for(size_t m = 0; m < meshes.size(); m++)
+			nVertices += (Uint)meshes[m].coords.size();
+		m_pVB->reserve(nVertices);
+
+		typedef boost::unordered_map< std::pair<std::string, std::wstring>, boost::unordered_map<Geometry::TYPE, Uint_vec> > INDICES;
+		INDICES indices;
+
+		for(size_t m = 0; m < meshes.size(); m++)
 		{
-			if(FCDGeometryPolygons* pPolys = pMesh->GetPolygons(j))
-				addPolygons( pPolys, m_geometry[ pMesh->GetDaeId().c_str()] );
+			progress(0.5f + 0.5f*m/meshes.size());
+
+			PolygonsMesh& mesh = meshes[m];
+			if(mesh.coords.empty())
+				continue;
+
+			Uint first = m_pVB->appendVertices((Uint)mesh.coords.size(), &mesh.coords[0], &mesh.normals[0], &mesh.texcoords[0]);
+
+			Uint_vec& idx = indices[ std::make_pair(mesh.id, mesh.semantic) ][ mesh.type ];
+			for(size_t k = 0; k < mesh.indices.size(); k++)
+				idx.push_back( first + mesh.indices[k] );
+
+			std::vector<Vec3>().swap(mesh.coords);
+			std::vector<Vec3>().swap(mesh.normals);
+			std::vector<Vec3>().swap(mesh.texcoords);
 		}
+
+		for(INDICES::iterator it = indices.begin(); it != indices.end(); it++)
+		{
+			for(boost::unordered_map<Geometry::TYPE, Uint_vec>::iterator piit = it->second.begin(); piit != it->second.end(); piit++)
+				m_geometry[it->first.first][it->first.second][piit->first] = Geometry::createSwapped(piit->first, m_pVB, piit->second);
+		}
+
+		std::cout << "Collada: " << geolib->GetEntityCount() << " geometries, " << meshes.size() << " polygon sets converted in "
+			<< sw.elapsed() << " ms on " << std::max(1u, boost::thread::hardware_concurrency()) << " threads, "
+			<< m_pVB->getVertexCount() << " vertices (" << m_pVB->getBufferSize() / 1024 << " KB)" << std::endl;
 	}
 
 	const Matrix& getTransform(FCDSceneNode* pNode, std::vector<Matrix>& transforms)
@@ -179,9 +312,15 @@ private:
 		std::vector< Matrix > transforms(1, Matrix::Identity());
 		Matrix tra = _tra * getTransform(pNode, transforms);
 
-		Ptr<GroupNode> pGroup = GroupNode::createAnimated( SceneNodeVector(), transforms );
-
-		Ptr<ShapeNode> pShape = ShapeNode::create();
+		Ptr<GroupNode> pGroup = NULL;
+		if(transforms.size() > 1)
+		{
+			pGroup = GroupNode::createAnimated( SceneNodeVector(), m_pClip, m_pClip->addTrack(transforms) );
+			m_nAnimated++;
+			m_nSamples += transforms.size();
+		}
+		else
+			pGroup = GroupNode::create( SceneNodeVector(), transforms[0] );
 
 		for(size_t i = 0; i< pNode->GetInstanceCount(); i++)
 		{
@@ -199,10 +338,16 @@ private:
 
 			//assert(m_geometry.find(id) != m_geometry.end());
 
-			for(MAT_PRIM_INDICES::const_iterator it = m_geometry[id].begin(),
-				end = m_geometry[id].end(); it != end; it++)
+			const MAT_PRIM_GEOMETRY& geometry = m_geometry[id];
+
+			// the material binding decides whether an earlier instance can be shared
+			std::vector< Ptr<Material> > materials;
+			std::string key = id;
+
+			for(MAT_PRIM_GEOMETRY::const_iterator it = geometry.begin(), end = geometry.end(); it != end; it++)
 			{
 				Ptr<Material> pMat = NULL;
+				key += "|";
 
 				for( size_t k = 0; k < pGeoInst->GetMaterialInstanceCount(); k++)
 				{
@@ -212,20 +357,42 @@ private:
 					if (std::wstring(pMatInst->GetSemantic().c_str()) == it->first)
 					{
 						pMat = m_materials[ matid ];
+						key += matid;
 						break;
 					}
 				}
 
-				for(PRIM_INDICES::const_iterator piit = it->second.begin(); piit != it->second.end(); piit++)
+				materials.push_back(pMat);
+			}
+
+			Ptr<ShapeNode>& pShape = m_shapes[key];
+			m_nInstances++;
+
+			if(pShape == NULL)
+			{
+				pShape = ShapeNode::create();
+
+				size_t m = 0;
+				for(MAT_PRIM_GEOMETRY::const_iterator it = geometry.begin(), end = geometry.end(); it != end; it++, m++)
 				{
-					pShape->addGeometry( pMat, Geometry::create(piit->first, m_pVB, piit->second) );
-					geo_count++;
+					for(PRIM_GEOMETRY::const_iterator piit = it->second.begin(); piit != it->second.end(); piit++)
+						pShape->addGeometry( materials[m], piit->second );
 				}
 			}
-		}
+			else
+			{
+				m_nSharedInstances++;
+				for(MAT_PRIM_GEOMETRY::const_iterator it = geometry.begin(), end = geometry.end(); it != end; it++)
+					for(PRIM_GEOMETRY::const_iterator piit = it->second.begin(); piit != it->second.end(); piit++)
+						m_nSharedIndices += piit->second->getIndices().size();
+			}
 
-		if(pShape->GeometryBegin() != pShape->GeometryEnd())
-			pGroup->addChildNodes(pShape);
+			if(pShape->GeometryBegin() != pShape->GeometryEnd())
+			{
+				pGroup->addChildNodes(pShape);
+				geo_count += (int)geometry.size();
+			}
+		}
 
 		for (size_t i = 0; i < pNode->GetChildrenCount(); i++)
 			geo_count += traverseSG( pNode->GetChild(i), pGroup, tra);
@@ -237,7 +404,13 @@ private:
 	}
 public:
 	COLLADALoader():
-		m_pVB(NULL)
+		m_pVB(NULL),
+		m_nInstances(0),
+		m_nSharedInstances(0),
+		m_nSharedIndices(0),
+		m_pClip(NULL),
+		m_nAnimated(0),
+		m_nSamples(0)
 	{
 		FCollada::Initialize();
 	}
@@ -332,33 +505,29 @@ public:
 		}
 
 		if(FCDGeometryLibrary* geolib = doc.GetGeometryLibrary())
-		{
-			for (size_t i = 0; i < geolib->GetEntityCount(); i++)
-			{
-				progress(((float)i)/geolib->GetEntityCount());
+			addGeometries(geolib, progress);
 
-				FCDGeometry* pGeo = geolib->GetEntity(i);
+		FCDSceneNode* root = doc.GetVisualSceneRoot();
 
-				if (pGeo->IsMesh())
-					addMesh(pGeo->GetMesh());
-
-				if (pGeo->IsPSurface())
-				{
-				    std::cerr << "pGeo->IsPSurface()" << std::endl;
-				}
+		m_nInstances = m_nSharedInstances = 0;
+		m_nSharedIndices = 0;
 
-				if (pGeo->IsSpline())
-				{
-				    std::cerr << "pGeo->IsSpline()" << std::endl;
-				}
-			}
-		}
-
-		FCDSceneNode* root = doc.GetVisualSceneRoot();
+		m_pClip = AnimationClip::create(30.f);
+		m_nAnimated = 0;
+		m_nSamples = 0;
 
 		Ptr<GroupNode> g = GroupNode::create();
 		if( traverseSG(root, g) > 0)
 		{
+			// the loader used to copy the indices of every instance into a Geometry of its own
+			std::cout << "Collada: " << m_nInstances << " geometry instances, " << m_nSharedInstances << " share the shape of an earlier one, "
+				<< m_nSharedIndices * sizeof(Uint) / 1024 << " KB of indices not duplicated" << std::endl;
+
+			if(m_nAnimated > 0)
+				std::cout << "Collada: " << m_nAnimated << " animated nodes, " << m_pClip->getTrackCount() << " tracks with "
+					<< m_pClip->getKeyCount() << " keys, " << m_pClip->getMemoryUsage() / 1024 << " KB instead of "
+					<< m_nSamples * sizeof(Matrix) / 1024 << " KB of sampled matrices" << std::endl;
+
 			for(size_t i = 0; i < g->getChildNodes().size(); i++)
 				pScene->insertNode( g->getChildNodes()[i] );
 
@@ -391,21 +560,23 @@ public:
 		}
 		else
 		{
-			for(boost::unordered_map< std::string, MAT_PRIM_INDICES >::const_iterator id = m_geometry.begin(); id != m_geometry.end(); id++)
-			for(MAT_PRIM_INDICES::const_iterator it = m_geometry[id->first].begin(),
-				end = m_geometry[id->first].end(); it != end; it++)
+			for(boost::unordered_map< std::string, MAT_PRIM_GEOMETRY >::const_iterator id = m_geometry.begin(); id != m_geometry.end(); id++)
+			for(MAT_PRIM_GEOMETRY::const_iterator it = id->second.begin(),
+				end = id->second.end(); it != end; it++)
 			{
-				for(PRIM_INDICES::const_iterator piit = it->second.begin(); piit != it->second.end(); piit++)
+				for(PRIM_GEOMETRY::const_iterator piit = it->second.begin(); piit != it->second.end(); piit++)
 				{
 					Ptr<Material> pMat = Material::Blue();
-					pScene->insertNode( ShapeNode::create( pMat, Geometry::create(piit->first, m_pVB, piit->second) ) );
+					pScene->insertNode( ShapeNode::create( pMat, piit->second ) );
 				}
 			}
 		}
 
 		m_cams.clear();
 		m_geometry.clear();
+		m_shapes.clear();
 		m_materials.clear();
+		m_pClip = NULL;
 		m_pVB = NULL;
 
 		return true;
@@ -15,6 +15,8 @@
 ****************************************************************************/
 
 #include <SceneIO.h>
+#include <NormalGenerator.h>
+#include <StopWatch.h>
 using namespace eh;
 
 #include <lib3ds.h>
@@ -22,19 +24,38 @@ using namespace eh;
 #include <string.h>
 #include <math.h>
 #include <map>
+#include <iostream>
+#include <boost/unordered_map.hpp>
 
 class C3DSLoader: public SceneIO::IPlugIn
 {
 private:
 	float m_nCount;
 	float m_iCount;
+	Uint m_nVertices;
+	double m_fNormalTime;
 	Ptr<IVertexBuffer> m_pVB;
+
+	typedef boost::unordered_map< Lib3dsMesh*, Ptr<ShapeNode> > ShapeMap;
+	ShapeMap m_shapes;
+	Uint m_nInstances;
+	Uint m_nConvertedFaces;
+	Uint m_nSharedFaces;
+	double m_fConvertTime;
+
+	static const int CREASE_ANGLE = 60;
 public:
 
 	C3DSLoader():
 		m_nCount(0),
 		m_iCount(0),
-		m_pVB(NULL)
+		m_nVertices(0),
+		m_fNormalTime(0),
+		m_pVB(NULL),
+		m_nInstances(0),
+		m_nConvertedFaces(0),
+		m_nSharedFaces(0),
+		m_fConvertTime(0)
 	{
 	}
 	virtual ~C3DSLoader()
@@ -49,8 +70,13 @@ public:
 			if (p->type == LIB3DS_NODE_MESH_INSTANCE)
 			{
 				if (Lib3dsMesh *mesh = lib3ds_file_mesh_for_node(f, (Lib3dsNode*)p))
+				{
 					m_nCount += mesh->nfaces;
 
+					if(m_shapes.insert( std::make_pair(mesh, Ptr<ShapeNode>()) ).second)
+						m_nVertices += mesh->nvertices;
+				}
+
 				countNodes(f, p->childs);
 			}
 		}
@@ -69,31 +95,41 @@ public:
 			}
 		}
 	}
-	Ptr<SceneNode> makeNode(Lib3dsFile *f, Lib3dsMeshInstanceNode *node, SceneIO::progress_callback& progress)
+	Ptr<ShapeNode> makeShape(Lib3dsFile *f, Lib3dsMesh *mesh)
 	{
-		Lib3dsMesh *mesh = lib3ds_file_mesh_for_node(f, (Lib3dsNode*)node);
-		if (!mesh || !mesh->vertices)
-			return NULL;
+		Uint_vec corners;
+		corners.resize(3 * mesh->nfaces);
+		for (int i = 0; i < mesh->nfaces; ++i)
+		{
+			corners[3*i+0] = mesh->faces[i].index[0];
+			corners[3*i+1] = mesh->faces[i].index[1];
+			corners[3*i+2] = mesh->faces[i].index[2];
+		}
 
-		//fprintf(o, "# object %s\n", node->base.name);
-		//fprintf(o, "g %s\n", node->instance_name[0]? node->instance_name : node->base.name);
+		StopWatch sw;
 
-		std::vector<Vec3> normals(mesh->nvertices);
+		// mesh vertices are only split where the faces around them meet at a crease
+		NormalGenerator normals(CREASE_ANGLE);
+		normals.generate(reinterpret_cast<const Vec3*>(mesh->vertices), mesh->nvertices, corners.empty() ? NULL : &corners[0], (Uint)corners.size());
 
-		for (int i = 0; i < mesh->nfaces; ++i)
+		m_fNormalTime += sw.elapsed();
+
+		Uint nVertices = normals.getVertexCount();
+		std::vector<Vec3> coords(nVertices), texcoords(mesh->texcos != 0 ? nVertices : 0);
+
+		for (Uint i = 0; i < nVertices; ++i)
 		{
-			progress(++m_iCount/m_nCount);
+			Uint v = normals.getVertexCoords()[i];
 
-			const Vec3& va = reinterpret_cast<const Vec3&>(mesh->vertices[mesh->faces[i].index[0]]);
-			const Vec3& vb = reinterpret_cast<const Vec3&>(mesh->vertices[mesh->faces[i].index[1]]);
-			const Vec3& vc = reinterpret_cast<const Vec3&>(mesh->vertices[mesh->faces[i].index[2]]);
+			coords[i] = Vec3(mesh->vertices[v][0], mesh->vertices[v][1], mesh->vertices[v][2]);
 
-			Vec3 n = calcNormal(va,vb,vc);
-			normals[mesh->faces[i].index[0]] = (normals[mesh->faces[i].index[0]]+n).normalized();
-			normals[mesh->faces[i].index[1]] = (normals[mesh->faces[i].index[1]]+n).normalized();
-			normals[mesh->faces[i].index[2]] = (normals[mesh->faces[i].index[2]]+n).normalized();
+			if (mesh->texcos != 0)
+				texcoords[i] = Vec3(mesh->texcos[v][0], mesh->texcos[v][1], 0);
 		}
 
+		Uint first = nVertices == 0 ? m_pVB->getVertexCount() :
+			m_pVB->appendVertices(nVertices, &coords[0], &normals.getNormals()[0], texcoords.empty() ? NULL : &texcoords[0]);
+
 		std::map<int, Uint_vec > faces;
 		Uint_vec edges;
 
@@ -101,42 +137,17 @@ public:
 		{
 			Uint_vec& indices = faces[mesh->faces[i].material];
 
-			const Vec3& va = reinterpret_cast<const Vec3&>(mesh->vertices[mesh->faces[i].index[0]]);
-			const Vec3& vb = reinterpret_cast<const Vec3&>(mesh->vertices[mesh->faces[i].index[1]]);
-			const Vec3& vc = reinterpret_cast<const Vec3&>(mesh->vertices[mesh->faces[i].index[2]]);
-
-			const Vec3& na = reinterpret_cast<const Vec3&>(normals[mesh->faces[i].index[0]]);
-			const Vec3& nb = reinterpret_cast<const Vec3&>(normals[mesh->faces[i].index[1]]);
-			const Vec3& nc = reinterpret_cast<const Vec3&>(normals[mesh->faces[i].index[2]]);
-
-			Vec3 ta = Vec3::Null();
-			Vec3 tb = Vec3::Null();
-			Vec3 tc = Vec3::Null();
-
-			if (mesh->texcos != 0)
-			{
-				ta.x = mesh->texcos[mesh->faces[i].index[0]][0];
-				ta.y = mesh->texcos[mesh->faces[i].index[0]][1];
-
-				tb.x = mesh->texcos[mesh->faces[i].index[1]][0];
-				tb.y = mesh->texcos[mesh->faces[i].index[1]][1];
-
-				tc.x = mesh->texcos[mesh->faces[i].index[2]][0];
-				tc.y = mesh->texcos[mesh->faces[i].index[2]][1];
-			}
-
-			indices.push_back( m_pVB->addVertex( va, na, ta) );
-			indices.push_back( m_pVB->addVertex( vb, nb, tb) );
-			indices.push_back( m_pVB->addVertex( vc, nc, tc) );
-
+			indices.push_back( first + normals.getCornerVertices()[3*i+0] );
+			indices.push_back( first + normals.getCornerVertices()[3*i+1] );
+			indices.push_back( first + normals.getCornerVertices()[3*i+2] );
 		}
 
 		Ptr<ShapeNode> pShape = ShapeNode::create();
 
 		if(edges.size() > 0)
-			pShape->addGeometry( Material::Black(), Geometry::create(Geometry::LINES, m_pVB, edges) );
+			pShape->addGeometry( Material::Black(), Geometry::createSwapped(Geometry::LINES, m_pVB, edges) );
 
-		for(std::map<int, Uint_vec >::const_iterator it = faces.begin(); it != faces.end(); it++)
+		for(std::map<int, Uint_vec >::iterator it = faces.begin(); it != faces.end(); it++)
 		{
 			if(it->first != -1)
 			{
@@ -164,12 +175,41 @@ public:
 				//	pMat->addTexture( Texture::createFromFile( m_sPath + sTextureFile2, true ) );
 				//}
 
-				pShape->addGeometry( pMat, Geometry::create(Geometry::TRIANGLES, m_pVB, it->second) );
+				pShape->addGeometry( pMat, Geometry::createSwapped(Geometry::TRIANGLES, m_pVB, it->second) );
 			}
 			else
-				pShape->addGeometry( Material::White(), Geometry::create(Geometry::TRIANGLES, m_pVB, it->second ) );
+				pShape->addGeometry( Material::White(), Geometry::createSwapped(Geometry::TRIANGLES, m_pVB, it->second ) );
 		}
 
+		return pShape;
+	}
+	Ptr<SceneNode> makeNode(Lib3dsFile *f, Lib3dsMeshInstanceNode *node, SceneIO::progress_callback& progress)
+	{
+		Lib3dsMesh *mesh = lib3ds_file_mesh_for_node(f, (Lib3dsNode*)node);
+		if (!mesh || !mesh->vertices)
+			return NULL;
+
+		//fprintf(o, "# object %s\n", node->base.name);
+		//fprintf(o, "g %s\n", node->instance_name[0]? node->instance_name : node->base.name);
+
+		m_iCount += mesh->nfaces;
+		progress(m_iCount/m_nCount);
+
+		// instances of the same mesh share one shape under their own transform
+		Ptr<ShapeNode>& pShape = m_shapes[mesh];
+
+		m_nInstances++;
+		if(pShape)
+		{
+			m_nSharedFaces += mesh->nfaces;
+		}
+		else
+		{
+			StopWatch sw;
+			pShape = makeShape(f, mesh);
+			m_fConvertTime += sw.elapsed();
+			m_nConvertedFaces += mesh->nfaces;
+		}
 
 		float inv_matrix[4][4], M[4][4];
 
@@ -189,6 +229,13 @@ public:
 	    m_pVB = CreateVertexBuffer( sizeof(Float)*8 );
 		m_nCount = 0;
 		m_iCount = 0;
+		m_nVertices = 0;
+		m_fNormalTime = 0;
+		m_shapes.clear();
+		m_nInstances = 0;
+		m_nConvertedFaces = 0;
+		m_nSharedFaces = 0;
+		m_fConvertTime = 0;
 
 		struct FileIO: public Lib3dsIo
 		{
@@ -284,8 +331,21 @@ public:
 		SceneNodeVector nodes;
 
 		countNodes(f, f->nodes);
+		m_pVB->reserve(m_nVertices);
 		makeNodes(f, f->nodes, nodes, progress);
 
+		std::cout << "3DS normals: " << m_fNormalTime << " ms, " << m_nVertices << " mesh vertices -> "
+			<< m_pVB->getVertexCount() << " vertices" << std::endl;
+
+		if(m_nConvertedFaces > 0)
+		{
+			std::cout << "3DS instancing: " << m_nInstances << " mesh instances of " << m_shapes.size() << " meshes, "
+				<< m_nConvertedFaces << " faces converted for " << m_nConvertedFaces + m_nSharedFaces << " faces in the scene ("
+				<< (Float)(m_nConvertedFaces + m_nSharedFaces) / m_nConvertedFaces << "x), "
+				<< m_fConvertTime << " ms converting, ~" << m_fConvertTime * m_nSharedFaces / m_nConvertedFaces << " ms saved" << std::endl;
+		}
+		m_shapes.clear();
+
 		for(size_t i = 0; i < nodes.size(); i++)
 			pScene->insertNode( nodes[i] );
 
@@ -24,6 +24,7 @@ using namespace eh;
 
 #include <vector>
 #include <string>
+#include <algorithm>
 
 #include <g3d/g3d.h>
 #include <g3d/plugins.h>
@@ -224,6 +225,13 @@ public:
 		FaceMap faces;
 
 		Vec3 v, n(0,0,0), t;
+
+		Uint nCount = 0;
+		for(GSList* fit = object->faces; fit != NULL; fit = fit->next)
+			if(((G3DFace *)fit->data)->vertex_count > 2)
+				nCount += 3 * (((G3DFace *)fit->data)->vertex_count - 2);
+
+		VertexBatch batch(pVB, std::max<Uint>(nCount, 1));
 #if 0
 		for(GSList* fit = object->faces; fit != NULL; fit = fit->next)
 		{
@@ -305,15 +313,17 @@ public:
 					else
 						t = Vec3::Null();
 
-					faces[face->material].push_back( pVB->addVertex(v, n, t) );
+					faces[face->material].push_back( batch.add(v, n, t) );
 				}
 			}
 		}
 
-		Ptr<GroupNode> pObject = GroupNode::create();
+		batch.flush();
+
+		SceneNodeVector childs;
 
 		for(GSList* oit = object->objects; oit != NULL; oit = oit->next)
-			pObject->addChildNodes( doObject( (G3DObject*) oit->data, pVB ) );
+			childs.push_back( doObject( (G3DObject*) oit->data, pVB ) );
 
 		if( faces.size() > 0 )
 		{
@@ -329,17 +339,17 @@ public:
 					if(it->first->tex_image)
 						pMat->setTexture( SceneIO::createTexture(it->first->tex_image->name) );
 				}
-				pShape->addGeometry(pMat, Geometry::create(eh::Geometry::TRIANGLES, pVB, it->second));
+				pShape->addGeometry(pMat, Geometry::createSwapped(eh::Geometry::TRIANGLES, pVB, it->second));
 			}
 
-			pObject->addChildNodes( pShape );
+			childs.push_back( pShape );
 
 		}
 
 		if(object->transformation)
-			pObject->setTransform( reinterpret_cast<const Matrix&>(*object->transformation) );
+			return GroupNode::createSwapped( childs, reinterpret_cast<const Matrix&>(*object->transformation) );
 		
-		return pObject;
+		return GroupNode::createSwapped( childs );
 
 	}
 
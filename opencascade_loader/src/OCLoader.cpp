@@ -24,6 +24,7 @@ using namespace eh;
 #include <boost/unordered_map.hpp>
 
 #include <Precision.hxx>
+#include <Standard_Version.hxx>
 #include <STEPCAFControl_Reader.hxx>
 #include <IGESCAFControl_Reader.hxx>		//IGES
 #include <BRepTools.hxx>					//BREP
@@ -47,6 +48,7 @@ using namespace eh;
 #include <TopoDS.hxx>
 #include <TopoDS_Shape.hxx>
 #include <TopoDS_Face.hxx>
+#include <TopoDS_Compound.hxx>
 #include <Transfer_TransientProcess.hxx>
 #include <Poly_Triangulation.hxx>
 #include <BRepMesh_IncrementalMesh.hxx>
@@ -68,6 +70,29 @@ using namespace eh;
 
 #include <BRepGProp_Face.hxx>
 
+#include <TopExp.hxx>
+#include <TopTools_IndexedMapOfShape.hxx>
+#include <Poly_Triangle.hxx>
+#include <Standard_Failure.hxx>
+
+#include <NormalGenerator.h>
+#include <Parallel.h>
+#include <StopWatch.h>
+#include <SceneRefiner.h>
+#include <iostream>
+#include <deque>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/uuid/uuid.hpp>
+#include <boost/uuid/uuid_io.hpp>
+#include <boost/uuid/nil_generator.hpp>
+#include <boost/uuid/name_generator.hpp>
+#include <ctime>
+
 #if defined(_MSC_VER)
 
 #pragma comment ( lib, "TKBO" )		//BOPTools
@@ -92,6 +117,670 @@ using namespace eh;
 
 #endif
 
+// The loader and the refiners of scenes still shown mesh on different threads,
+// the OCC mesher keeps global state before OCC 6.5.
+static boost::mutex s_meshMutex;
+
+#if defined(OCC_VERSION_HEX) && OCC_VERSION_HEX >= 0x060500
+#define OCC_CONCURRENT_MESH
+#endif
+
+// Splits aShape into parts meshed on their own: each solid once, instances of a solid share its
+// triangulations, and a compound of the faces outside of solids. BRepMesh writes the polygons
+// of the edges, so if parts share an edge aShape is meshed as a whole.
+static void splitForMeshing(const TopoDS_Shape& aShape, std::vector<TopoDS_Shape>& parts)
+{
+	boost::unordered_set<const void*> solids;
+	boost::unordered_map<const void*, size_t> edges;	// to the part owning them
+
+	for (TopExp_Explorer anSolidExp(aShape, TopAbs_SOLID); anSolidExp.More(); anSolidExp.Next())
+	{
+		const TopoDS_Shape& aSolid = anSolidExp.Current();
+		if (!solids.insert(aSolid.TShape().operator->()).second)
+			continue;
+
+		for (TopExp_Explorer anEdgeExp(aSolid, TopAbs_EDGE); anEdgeExp.More(); anEdgeExp.Next())
+		{
+			if (edges.insert(std::make_pair(anEdgeExp.Current().TShape().operator->(), parts.size())).first->second != parts.size())
+			{
+				parts.assign(1, aShape);
+				return;
+			}
+		}
+
+		parts.push_back(aSolid);
+	}
+
+	TopoDS_Compound aFaces;
+	BRep_Builder aBuilder;
+	aBuilder.MakeCompound(aFaces);
+	bool bFaces = false;
+
+	for (TopExp_Explorer anFaceExp(aShape, TopAbs_FACE, TopAbs_SOLID); anFaceExp.More(); anFaceExp.Next())
+	{
+		for (TopExp_Explorer anEdgeExp(anFaceExp.Current(), TopAbs_EDGE); anEdgeExp.More(); anEdgeExp.Next())
+		{
+			if (edges.insert(std::make_pair(anEdgeExp.Current().TShape().operator->(), parts.size())).first->second != parts.size())
+			{
+				parts.assign(1, aShape);
+				return;
+			}
+		}
+
+		aBuilder.Add(aFaces, anFaceExp.Current());
+		bFaces = true;
+	}
+
+	if (bFaces)
+		parts.push_back(aFaces);
+}
+
+static void meshParts(const std::vector<TopoDS_Shape>* pParts, double fDeflection, double fDeflAngle, Uint begin, Uint end)
+{
+	for (Uint i = begin; i < end; i++)
+	{
+#if !defined(OCC_CONCURRENT_MESH)
+		boost::mutex::scoped_lock lock(s_meshMutex);
+#endif
+		BRepMesh_IncrementalMesh IM((*pParts)[i], fDeflection, Standard_False, fDeflAngle);
+	}
+}
+
+template<class T>
+Vec3 to_Vector3D(const T& t)
+{
+	return Vec3((Float)t.X(), (Float)t.Y(), (Float)t.Z());
+}
+
+// triangulation of one face, filled by makeFaces() on a worker thread.
+// OCC handles aren't thread safe, so they are only copied on the thread owning the shape.
+struct FaceMesh
+{
+	FaceMesh():
+		color(0.7f,0.7f,0.7f),
+		bReversed(false)
+	{
+	}
+
+	RGBA color;
+	TopoDS_Face face;
+	Handle(Poly_Triangulation) tri;
+	gp_Trsf trsf;
+	bool bReversed;
+
+	std::vector<Vec3> coords;
+	std::vector<Vec3> normals;
+	Uint_vec indices;
+};
+
+static void makeFaces(std::vector<FaceMesh>* pMeshes, Uint begin, Uint end)
+{
+	for (Uint f = begin; f < end; f++)
+	{
+		FaceMesh& mesh = (*pMeshes)[f];
+
+		if (mesh.tri.IsNull())
+			continue;
+
+		const TColgp_Array1OfPnt&    arrPolyNodes = mesh.tri->Nodes();
+		const Poly_Array1OfTriangle& arrTriangles = mesh.tri->Triangles();
+
+		std::vector<Vec3> nodes(arrPolyNodes.Length());
+		for (int i = 0; i < arrPolyNodes.Length(); i++)
+		{
+			gp_Pnt p = arrPolyNodes(arrPolyNodes.Lower() + i);
+			p.Transform(mesh.trsf);
+			nodes[i] = to_Vector3D(p);
+		}
+
+		Uint_vec corners;
+		corners.reserve(3 * arrTriangles.Length());
+		for (int i = arrTriangles.Lower(); i <= arrTriangles.Upper(); i++)
+		{
+			int ia = 0, ib = 0, ic = 0;
+
+			if(mesh.bReversed)
+				arrTriangles(i).Get(ia,ic,ib);
+			else
+				arrTriangles(i).Get(ia,ib,ic);
+
+			corners.push_back( ia - arrPolyNodes.Lower() );
+			corners.push_back( ib - arrPolyNodes.Lower() );
+			corners.push_back( ic - arrPolyNodes.Lower() );
+		}
+
+		if (corners.empty())
+			continue;
+
+		// a face is one smooth patch, the normals come from its triangulation since evaluating the
+		// surface isn't safe on several threads (BSpline surfaces cache their evaluation)
+		NormalGenerator normals;
+		normals.generate(&nodes[0], (Uint)nodes.size(), &corners[0], (Uint)corners.size());
+
+		mesh.coords.resize(normals.getVertexCount());
+		for (Uint v = 0; v < normals.getVertexCount(); v++)
+			mesh.coords[v] = nodes[ normals.getVertexCoords()[v] ];
+
+		mesh.normals = normals.getNormals();
+		mesh.indices = normals.getCornerVertices();
+	}
+}
+
+// Re-tessellates the loaded shapes by the size of their faces on screen. After loading the refiner
+// thread is the only user of the OCC shapes, it meshes the faces again and converts them like the
+// loader does. apply() swaps the new triangles into the ShapeNodes on the render thread.
+// The faces of a shape are meshed together at one level, the edges between them are discretized
+// once for both sides and don't open cracks. The edge lines are taken from that discretization,
+// so they stay on the faces. A shape the mesher fails on keeps its level and isn't refined again.
+// The thread doesn't print, the summary of a pass is logged by apply().
+class OCRefiner: public ISceneRefiner
+{
+public:
+	OCRefiner(double fDeflection, double fDeflAngle);
+	virtual ~OCRefiner();
+
+	// loading thread, before the scene is shown
+	void addShape(Ptr<ShapeNode> pShape, const TopoDS_Shape& aShape, const std::vector<FaceMesh>& meshes,
+		const boost::unordered_map< RGBA, Ptr<Material> >& materials, Ptr<Material> pEdgeMaterial);
+	void addInstance(const SceneNode* pShape, const Matrix& m);
+	bool isEmpty() const
+	{
+		return m_shapes.empty();
+	}
+
+	virtual void update(const Matrix& view, const Matrix& proj, const Rect& viewport);
+	virtual bool apply(std::vector< Ptr<RefCounted> >& released);
+	virtual bool isPending() const;
+
+private:
+	// a face is meshed at m_fDeflection * 2^level
+	static const int MIN_LEVEL = -6;
+	static const int MAX_LEVEL = 3;
+	static const Uint TRIANGLE_BUDGET = 4000000;
+	static const double PIXEL_ERROR;
+	static const double APPLY_TIME;
+
+	struct Face
+	{
+		Face():
+			color(0.7f,0.7f,0.7f),
+			fRadius(0),
+			nTriangles(0)
+		{
+		}
+
+		TopoDS_Face face;
+		RGBA color;
+		Vec3 center;
+		Float fRadius;
+		Uint nTriangles;
+	};
+	struct Shape
+	{
+		Shape():
+			nLevel(0),
+			nTarget(0),
+			bFailed(false)
+		{
+		}
+
+		Ptr<ShapeNode> pNode;		// render thread only
+		boost::unordered_map< RGBA, Ptr<Material> > materials;
+		Ptr<Material> pEdgeMaterial;	// render thread only, NULL until the shape has edge lines
+		std::vector<Face> faces;
+		std::vector<TopoDS_Edge> edges;
+		std::vector<Matrix> instances;
+		int nLevel;
+		int nTarget;				// the finest level one of the faces needs
+		bool bFailed;
+	};
+	struct Result
+	{
+		size_t iShape;
+		std::vector<FaceMesh> meshes;
+		std::vector<Vec3> lines;	// pairs of points
+	};
+
+	void run();
+	Uint refine(size_t iShape);
+	static void makeEdgeLines(const TopoDS_Edge& aEdge, std::vector<Vec3>& lines);
+	int targetLevel(const Face& face, const std::vector<Matrix>& instances, const Matrix& viewProj, const Matrix& proj, Float fHeight) const;
+	bool isInterrupted() const;
+
+	const double m_fDeflection;
+	const double m_fDeflAngle;
+
+	std::vector<Shape> m_shapes;
+	boost::unordered_map<const SceneNode*, size_t> m_index;
+
+	boost::thread m_thread;
+	mutable boost::mutex m_mutex;
+	boost::condition_variable m_changed;
+	bool m_bStop;
+	bool m_bView;
+	Matrix m_view;
+	Matrix m_proj;
+	Float m_fHeight;
+	std::deque<Result> m_results;
+	std::string m_sLog;			// passes done, printed by apply()
+};
+
+const double OCRefiner::PIXEL_ERROR = 0.5;	// deflection on screen
+const double OCRefiner::APPLY_TIME = 4;		// ms per frame
+
+OCRefiner::OCRefiner(double fDeflection, double fDeflAngle):
+	m_fDeflection(fDeflection),
+	m_fDeflAngle(fDeflAngle),
+	m_bStop(false),
+	m_bView(false),
+	m_fHeight(0)
+{
+}
+
+OCRefiner::~OCRefiner()
+{
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		m_bStop = true;
+		m_changed.notify_one();
+	}
+	m_thread.join();
+}
+
+void OCRefiner::addShape(Ptr<ShapeNode> pShape, const TopoDS_Shape& aShape, const std::vector<FaceMesh>& meshes,
+	const boost::unordered_map< RGBA, Ptr<Material> >& materials, Ptr<Material> pEdgeMaterial)
+{
+	Shape shape;
+	shape.pNode = pShape;
+	shape.materials = materials;
+	shape.pEdgeMaterial = pEdgeMaterial;
+
+	for(size_t i = 0; i < meshes.size(); i++)
+	{
+		const FaceMesh& mesh = meshes[i];
+		if(mesh.coords.empty())
+			continue;
+
+		Vec3 b_min = mesh.coords[0], b_max = mesh.coords[0];
+		for(size_t k = 1; k < mesh.coords.size(); k++)
+		{
+			const Vec3& p = mesh.coords[k];
+			b_min = Vec3(std::min(b_min.x, p.x), std::min(b_min.y, p.y), std::min(b_min.z, p.z));
+			b_max = Vec3(std::max(b_max.x, p.x), std::max(b_max.y, p.y), std::max(b_max.z, p.z));
+		}
+
+		Face face;
+		face.face = mesh.face;
+		face.color = mesh.color;
+		face.center = (b_min + b_max) * 0.5f;
+		face.fRadius = (b_max - b_min).getLen() * 0.5f;
+		face.nTriangles = (Uint)mesh.indices.size() / 3;
+		shape.faces.push_back(face);
+	}
+
+	if(shape.faces.empty())
+		return;
+
+	// each edge once, the explorer visits an edge for every face it bounds
+	TopTools_IndexedMapOfShape aEdges;
+	TopExp::MapShapes(aShape, TopAbs_EDGE, aEdges);
+	for(int i = 1; i <= aEdges.Extent(); i++)
+		shape.edges.push_back(TopoDS::Edge(aEdges(i)));
+
+	m_index[pShape.get()] = m_shapes.size();
+	m_shapes.push_back(shape);
+}
+
+void OCRefiner::addInstance(const SceneNode* pShape, const Matrix& m)
+{
+	boost::unordered_map<const SceneNode*, size_t>::const_iterator it = m_index.find(pShape);
+	if(it != m_index.end())
+		m_shapes[it->second].instances.push_back(m);
+}
+
+void OCRefiner::update(const Matrix& view, const Matrix& proj, const Rect& viewport)
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+
+	// the thread starts with the first frame, loading is done by then
+	bool bStart = m_thread.get_id() == boost::thread::id();
+
+	if(!bStart && view == m_view && proj == m_proj && viewport.Height() == m_fHeight)
+		return;
+
+	m_view = view;
+	m_proj = proj;
+	m_fHeight = viewport.Height();
+	m_bView = true;
+
+	if(bStart)
+		m_thread = boost::thread(boost::bind(&OCRefiner::run, this));
+	else
+		m_changed.notify_one();
+}
+
+bool OCRefiner::isPending() const
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return !m_results.empty();
+}
+
+bool OCRefiner::isInterrupted() const
+{
+	boost::mutex::scoped_lock lock(m_mutex);
+	return m_bStop || m_bView;
+}
+
+void OCRefiner::run()
+{
+	for(;;)
+	{
+		Matrix view, proj;
+		Float fHeight = 0;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			while(!m_bView && !m_bStop)
+				m_changed.wait(lock);
+
+			if(m_bStop)
+				return;
+
+			view = m_view;
+			proj = m_proj;
+			fHeight = m_fHeight;
+			m_bView = false;
+		}
+
+		StopWatch sw;
+		Matrix viewProj = view * proj;
+
+		// triangles grow about linear with 1/deflection, halving it doubles the shape
+		double fTriangles = 0;
+		for(size_t s = 0; s < m_shapes.size(); s++)
+		{
+			Shape& shape = m_shapes[s];
+			shape.nTarget = MAX_LEVEL;
+
+			Uint nTriangles = 0;
+			for(size_t f = 0; f < shape.faces.size(); f++)
+			{
+				shape.nTarget = std::min(shape.nTarget, targetLevel(shape.faces[f], shape.instances, viewProj, proj, fHeight));
+				nTriangles += shape.faces[f].nTriangles;
+			}
+			fTriangles += nTriangles * std::pow(2.0, shape.nLevel - shape.nTarget);
+		}
+
+		// over budget everything gets coarser by the same number of levels
+		int nBias = 0;
+		while(fTriangles > TRIANGLE_BUDGET && nBias < MAX_LEVEL - MIN_LEVEL)
+		{
+			fTriangles /= 2;
+			nBias++;
+		}
+
+		Uint nFaces = 0, nShapes = 0, nFailed = 0;
+		for(size_t s = 0; s < m_shapes.size() && !isInterrupted(); s++)
+		{
+			if(nBias > 0)
+				m_shapes[s].nTarget = std::min(MAX_LEVEL, m_shapes[s].nTarget + nBias);
+
+			bool bFailed = m_shapes[s].bFailed;
+			if(Uint n = refine(s))
+			{
+				nFaces += n;
+				nShapes++;
+			}
+			else if(m_shapes[s].bFailed && !bFailed)
+				nFailed++;
+		}
+
+		if(nFaces > 0 || nFailed > 0)
+		{
+			Uint nTriangles = 0;
+			for(size_t s = 0; s < m_shapes.size(); s++)
+				for(size_t f = 0; f < m_shapes[s].faces.size(); f++)
+					nTriangles += m_shapes[s].faces[f].nTriangles;
+
+			std::ostringstream log;
+			log << "OpenCascade refiner: " << nFaces << " faces of " << nShapes << " shapes re-meshed in " << sw.elapsed()
+				<< " ms, " << nTriangles << " triangles (budget " << TRIANGLE_BUDGET << ", coarser by " << nBias << ")";
+			if(nFailed > 0)
+				log << ", meshing failed on " << nFailed << " shapes";
+			log << std::endl;
+
+			boost::mutex::scoped_lock lock(m_mutex);
+			m_sLog += log.str();
+		}
+	}
+}
+
+int OCRefiner::targetLevel(const Face& face, const std::vector<Matrix>& instances, const Matrix& viewProj, const Matrix& proj, Float fHeight) const
+{
+	bool bOrtho = proj[11] == 0;
+	Float fScale = fabs(proj[5]) * fHeight / 2;
+
+	// pixels per unit at the nearest visible instance
+	Float fPixels = 0;
+	for(size_t i = 0; i < instances.size(); i++)
+	{
+		const Matrix& m = instances[i];
+		Float fRadius = face.fRadius * std::max(Vec3(m[0], m[1], m[2]).getLen(), std::max(Vec3(m[4], m[5], m[6]).getLen(), Vec3(m[8], m[9], m[10]).getLen()));
+
+		Vec4 p = transform(Vec4(transform(face.center, m), 1.f), viewProj);
+		Float w = bOrtho ? 1.f : p.w - fRadius;
+
+		if(w <= 0)
+			return MIN_LEVEL;	// the eye is inside or close to the face
+
+		Float fClip = fRadius * std::max(fabs(proj[0]), fabs(proj[5]));
+		if(fabs(p.x) - fClip > p.w || fabs(p.y) - fClip > p.w)
+			continue;			// outside of the view
+
+		fPixels = std::max(fPixels, fScale / w);
+	}
+
+	if(fPixels <= 0)
+		return MAX_LEVEL;
+
+	int nLevel = (int)floor( std::log(PIXEL_ERROR / fPixels / m_fDeflection) / std::log(2.0) );
+	return std::max(MIN_LEVEL, std::min(MAX_LEVEL, nLevel));
+}
+
+Uint OCRefiner::refine(size_t iShape)
+{
+	Shape& shape = m_shapes[iShape];
+	if(shape.bFailed || shape.nTarget == shape.nLevel)
+		return 0;
+
+	std::vector<FaceMesh> meshes(shape.faces.size());
+	std::vector<Vec3> lines;
+
+	try
+	{
+		// Clean() drops the triangulations kept by IncrementalMesh and the polygons of their edges.
+		// Meshing a compound of all faces discretizes an edge shared by two of them once for both,
+		// a face meshed alone would split it differently than its neighbour and leave a crack.
+		{
+			TopoDS_Compound aFaces;
+			BRep_Builder aBuilder;
+			aBuilder.MakeCompound(aFaces);
+			for(size_t f = 0; f < shape.faces.size(); f++)
+				aBuilder.Add(aFaces, shape.faces[f].face);
+
+			boost::mutex::scoped_lock lock(s_meshMutex);
+			BRepTools::Clean(aFaces);
+			BRepMesh_IncrementalMesh IM(aFaces, m_fDeflection * std::pow(2.0, shape.nTarget), Standard_False, m_fDeflAngle);
+		}
+
+		for(size_t f = 0; f < shape.faces.size(); f++)
+		{
+			TopLoc_Location aLoc;
+			meshes[f].color = shape.faces[f].color;
+			meshes[f].tri = BRep_Tool::Triangulation(shape.faces[f].face, aLoc);
+			meshes[f].trsf = aLoc.Transformation();
+			meshes[f].bReversed = shape.faces[f].face.Orientation() == TopAbs_REVERSED;
+		}
+
+		for(size_t e = 0; e < shape.edges.size(); e++)
+			makeEdgeLines(shape.edges[e], lines);
+	}
+	catch(Standard_Failure&)
+	{
+		// the ShapeNode still shows the last triangles that were applied
+		shape.bFailed = true;
+		return 0;
+	}
+
+	shape.nLevel = shape.nTarget;
+	Uint nFaces = (Uint)shape.faces.size();
+
+	parallelFor((Uint)meshes.size(), boost::bind(&makeFaces, &meshes, _1, _2), 16);
+
+	// the render thread gets plain arrays only
+	for(size_t f = 0; f < meshes.size(); f++)
+	{
+		shape.faces[f].nTriangles = (Uint)meshes[f].indices.size() / 3;
+		meshes[f].tri.Nullify();
+	}
+
+	boost::mutex::scoped_lock lock(m_mutex);
+	m_results.push_back(Result());
+	m_results.back().iShape = iShape;
+	m_results.back().meshes.swap(meshes);
+	m_results.back().lines.swap(lines);
+
+	return nFaces;
+}
+
+// the polygon of the edge on the triangulation of one of its faces, the nodes are shared with
+// the triangles just made. Edges without a face keep the polygon the loader made for them.
+void OCRefiner::makeEdgeLines(const TopoDS_Edge& aEdge, std::vector<Vec3>& lines)
+{
+	std::vector<Vec3> points;
+
+	Handle(Poly_PolygonOnTriangulation) aPT;
+	Handle(Poly_Triangulation) aT;
+	TopLoc_Location aLoc;
+	BRep_Tool::PolygonOnTriangulation(aEdge, aPT, aT, aLoc, 1);
+
+	if(!aPT.IsNull() && !aT.IsNull())
+	{
+		const TColStd_Array1OfInteger& arrIndices = aPT->Nodes();
+		const TColgp_Array1OfPnt& arrNodes = aT->Nodes();
+		for(int i = arrIndices.Lower(); i <= arrIndices.Upper(); i++)
+		{
+			gp_Pnt p = arrNodes(arrIndices(i));
+			p.Transform(aLoc.Transformation());
+			points.push_back(to_Vector3D(p));
+		}
+	}
+	else
+	{
+		Handle(Poly_Polygon3D) aPol = BRep_Tool::Polygon3D(aEdge, aLoc);
+		if(aPol.IsNull())
+			return;
+
+		const TColgp_Array1OfPnt& arrNodes = aPol->Nodes();
+		for(int i = arrNodes.Lower(); i <= arrNodes.Upper(); i++)
+		{
+			gp_Pnt p = arrNodes(i);
+			p.Transform(aLoc.Transformation());
+			points.push_back(to_Vector3D(p));
+		}
+	}
+
+	for(size_t i = 1; i < points.size(); i++)
+	{
+		lines.push_back(points[i-1]);
+		lines.push_back(points[i]);
+	}
+}
+
+bool OCRefiner::apply(std::vector< Ptr<RefCounted> >& released)
+{
+	StopWatch sw;
+	bool bChanged = false;
+
+	// what doesn't fit into the frame is left for the next one
+	while(sw.elapsed() < APPLY_TIME)
+	{
+		Result result;
+		{
+			boost::mutex::scoped_lock lock(m_mutex);
+			if(m_results.empty())
+				break;
+
+			result.iShape = m_results.front().iShape;
+			result.meshes.swap(m_results.front().meshes);
+			result.lines.swap(m_results.front().lines);
+			m_results.pop_front();
+		}
+
+		Shape& shape = m_shapes[result.iShape];
+
+		Uint nVertices = (Uint)result.lines.size();
+		for(size_t f = 0; f < result.meshes.size(); f++)
+			nVertices += (Uint)result.meshes[f].coords.size();
+
+		Ptr<IVertexBuffer> pVB = CreateVertexBuffer( sizeof(Vec3)*2 );
+		pVB->reserve(nVertices);
+
+		boost::unordered_map< RGBA, Uint_vec > faces;
+		for(size_t f = 0; f < result.meshes.size(); f++)
+		{
+			FaceMesh& mesh = result.meshes[f];
+			if(mesh.coords.empty())
+				continue;
+
+			Uint first = pVB->appendVertices((Uint)mesh.coords.size(), &mesh.coords[0], &mesh.normals[0]);
+
+			Uint_vec& indices = faces[mesh.color];
+			for(size_t k = 0; k < mesh.indices.size(); k++)
+				indices.push_back( first + mesh.indices[k] );
+		}
+
+		for( boost::unordered_map< RGBA, Uint_vec >::iterator it = faces.begin(); it != faces.end(); it++)
+		{
+			Ptr<Material>& pMat = shape.materials[it->first];
+			if(pMat == NULL)
+			{
+				pMat = Material::create( it->first );
+				shape.pNode->addGeometry( pMat, Geometry::createSwapped(Geometry::TRIANGLES, pVB, it->second) );
+			}
+			else
+				released.push_back( shape.pNode->replaceGeometry( pMat, Geometry::createSwapped(Geometry::TRIANGLES, pVB, it->second) ) );
+		}
+
+		if(!result.lines.empty())
+		{
+			Uint first = pVB->appendVertices((Uint)result.lines.size(), &result.lines[0]);
+
+			Uint_vec edges(result.lines.size());
+			for(size_t k = 0; k < edges.size(); k++)
+				edges[k] = first + (Uint)k;
+
+			if(shape.pEdgeMaterial == NULL)
+			{
+				shape.pEdgeMaterial = Material::Black();
+				shape.pNode->addGeometry( shape.pEdgeMaterial, Geometry::createSwapped(Geometry::LINES, pVB, edges) );
+			}
+			else
+				released.push_back( shape.pNode->replaceGeometry( shape.pEdgeMaterial, Geometry::createSwapped(Geometry::LINES, pVB, edges) ) );
+		}
+
+		bChanged = true;
+	}
+
+	std::string sLog;
+	{
+		boost::mutex::scoped_lock lock(m_mutex);
+		sLog.swap(m_sLog);
+	}
+	std::cout << sLog;
+
+	return bChanged;
+}
+
 class OCLoader: public SceneIO::IPlugIn
 {
 private:
@@ -111,10 +800,32 @@ private:
 	boost::unordered_set<int> m_reffered_shapes;
 	boost::unordered_map<int, Ptr<SceneNode> > m_hashes;
 
+	Uint m_nFaces;
+	double m_fMeshTime;
+	double m_fFaceTime;
+
+	// BREP tessellation cache, the face triangulations of a file are stored in the temp directory
+	// under a SHA-1 of the file content and the deflection parameters
+	struct CacheKey
+	{
+		std::string sPath;			// empty if the file can't be cached
+		boost::uint64_t nSize;		// of the file
+		boost::uuids::uuid hash;
+	};
+	bool m_bMeshed;
+	CacheKey cacheKey(const std::wstring& sFile) const;
+	bool readCache(const CacheKey& key, const TopTools_IndexedMapOfShape& aFaces);
+	void writeCache(const CacheKey& key, const TopTools_IndexedMapOfShape& aFaces) const;
+	static void pruneCache(const boost::filesystem::path& dir);
+
+	// view dependent re-tessellation of the shapes of the current file
+	Ptr<OCRefiner> m_pRefiner;
+	void attachRefiner();
+
 	Ptr<SceneNode> createShape(const TDF_Label& label);
 	Ptr<SceneNode> createShape(const TopoDS_Shape& aShape, const Handle_XCAFDoc_ColorTool& Colors);
-	bool makeFace(const TopoDS_Face& aFace, Uint_vec& indices);
 	bool makeEdge(const TopoDS_Edge& aEdge, Uint_vec& indices);
+	void printStats() const;
 
 	void iterateChilds(const TDF_Label& label, Matrix tra = Matrix(), bool bRef = false);
 	void proceedChilds(const TDF_Label& label);
@@ -127,7 +838,12 @@ public:
 		m_iCount(0),
 		m_pScene(NULL),
 		m_fDeflection(1),
-		m_fDeflAngle(0.5)
+		m_fDeflAngle(0.5),
+		m_nFaces(0),
+		m_fMeshTime(0),
+		m_fFaceTime(0),
+		m_bMeshed(false),
+		m_pRefiner(NULL)
 	{
 	}
 
@@ -192,6 +908,11 @@ bool OCLoader::read(const std::wstring& sFile, Ptr<Scene> pScene, SceneIO::progr
 	m_pVB = CreateVertexBuffer( sizeof(Vec3)*2 );
 	m_reffered_shapes.clear();
 	m_hashes.clear();
+	m_nFaces = 0;
+	m_fMeshTime = 0;
+	m_fFaceTime = 0;
+	m_bMeshed = false;
+	m_pRefiner = new OCRefiner(m_fDeflection, m_fDeflAngle);
 
 	class MyProgressIndicator : public Message_ProgressIndicator
 	{
@@ -234,6 +955,8 @@ bool OCLoader::read(const std::wstring& sFile, Ptr<Scene> pScene, SceneIO::progr
 			return false;
 
 		proceedChilds(pDoc->Main());
+		printStats();
+		attachRefiner();
 
 		return true;
 	}
@@ -259,6 +982,8 @@ bool OCLoader::read(const std::wstring& sFile, Ptr<Scene> pScene, SceneIO::progr
 			return false;
 
 		proceedChilds(pDoc->Main());
+		printStats();
+		attachRefiner();
 
 		return true;
 	}
@@ -272,6 +997,12 @@ bool OCLoader::read(const std::wstring& sFile, Ptr<Scene> pScene, SceneIO::progr
 
         if(result)
         {
+            TopTools_IndexedMapOfShape aFaces;
+            TopExp::MapShapes(aShape, TopAbs_FACE, aFaces);
+
+            CacheKey cache = cacheKey(sFile);
+            m_bMeshed = readCache(cache, aFaces);
+
             m_bCount = true;
             m_nCount = 0;
             m_iCount = 0;
@@ -279,7 +1010,14 @@ bool OCLoader::read(const std::wstring& sFile, Ptr<Scene> pScene, SceneIO::progr
 
             m_bCount = false;
 
-            pScene->insertNode( createShape(aShape, NULL) );
+            Ptr<SceneNode> pShape = createShape(aShape, NULL);
+            pScene->insertNode( pShape );
+            m_pRefiner->addInstance( pShape.get(), Matrix() );
+            printStats();
+            attachRefiner();
+
+            if(!m_bMeshed)
+                writeCache(cache, aFaces);
 
             return true;
         }
@@ -365,6 +1103,7 @@ void OCLoader::iterateChilds(const TDF_Label& label, Matrix tra /*= Matrix()*/,
 			if(Ptr<SceneNode> pShape = createShape( label ))
 			{
 				m_pScene->insertNode( GroupNode::create( pShape, tra ) );
+				m_pRefiner->addInstance( pShape.get(), tra );
 			}
 		}
 		else
@@ -406,6 +1145,20 @@ Ptr<SceneNode> OCLoader::createShape(const TopoDS_Shape& aShape, const Handle_XC
 	boost::unordered_map< RGBA, Uint_vec > faces;
 	Uint_vec edges;
 
+	if(!m_bCount && !m_bMeshed)
+	{
+		// Triangulate the faces by the standard OCC mesher, faces that already carry a fine enough
+		// triangulation are kept. Solids are meshed on all cores, the faces of one share the edge
+		// discretization.
+		StopWatch sw;
+		std::vector<TopoDS_Shape> parts;
+		splitForMeshing(aShape, parts);
+		parallelFor((Uint)parts.size(), boost::bind(&meshParts, &parts, m_fDeflection, m_fDeflAngle, _1, _2), 1);
+		m_fMeshTime += sw.elapsed();
+	}
+
+	std::vector<FaceMesh> meshes;
+
 	for (TopExp_Explorer anFaceExp(aShape, TopAbs_FACE); anFaceExp.More(); anFaceExp.Next())
 	{
 		const TopoDS_Shape& bShape = anFaceExp.Current();
@@ -415,13 +1168,58 @@ Ptr<SceneNode> OCLoader::createShape(const TopoDS_Shape& aShape, const Handle_XC
 			color = RGBA((Float)aColor.Red(), (Float)aColor.Green(), (Float)aColor.Blue());
 
 		if (aFace.IsNull() == Standard_False)
-			 makeFace(aFace, faces[color] );
+		{
+			if(m_bCount)
+			{
+				m_nCount += 1;
+				continue;
+			}
+
+			TopLoc_Location aLoc;
+			FaceMesh mesh;
+			mesh.color = color;
+			mesh.face = aFace;
+			mesh.tri = BRep_Tool::Triangulation(aFace, aLoc);
+			mesh.trsf = aLoc.Transformation();
+			mesh.bReversed = aFace.Orientation() == TopAbs_REVERSED;
+
+			if (mesh.tri.IsNull() == Standard_False)
+				meshes.push_back(mesh);
+		}
 	}
 
-	for( boost::unordered_map< RGBA, Uint_vec >::const_iterator it = faces.begin(); it != faces.end(); it++)
+	if(!meshes.empty())
+	{
+		StopWatch sw;
+
+		parallelFor((Uint)meshes.size(), boost::bind(&makeFaces, &meshes, _1, _2), 16);
+
+		// merged in face order, so the buffer is the same for any number of threads
+		for(size_t i = 0; i < meshes.size(); i++)
+		{
+			m_iCount += 1;
+			progress(0.5f+(m_iCount/m_nCount)/2);
+
+			FaceMesh& mesh = meshes[i];
+			if(mesh.coords.empty())
+				continue;
+
+			Uint first = m_pVB->appendVertices((Uint)mesh.coords.size(), &mesh.coords[0], &mesh.normals[0]);
+
+			Uint_vec& indices = faces[mesh.color];
+			for(size_t k = 0; k < mesh.indices.size(); k++)
+				indices.push_back( first + mesh.indices[k] );
+		}
+
+		m_nFaces += (Uint)meshes.size();
+		m_fFaceTime += sw.elapsed();
+	}
+
+	boost::unordered_map< RGBA, Ptr<Material> > materials;
+	for( boost::unordered_map< RGBA, Uint_vec >::iterator it = faces.begin(); it != faces.end(); it++)
 	{
 		if(it->second.size() > 0)
-			shape->addGeometry( Material::create( it->first ), Geometry::create(Geometry::TRIANGLES, m_pVB, it->second) );
+			shape->addGeometry( materials[it->first] = Material::create( it->first ), Geometry::createSwapped(Geometry::TRIANGLES, m_pVB, it->second) );
 	}
 
 	for (TopExp_Explorer anEdgeExp (aShape, TopAbs_EDGE); anEdgeExp.More(); anEdgeExp.Next())
@@ -434,8 +1232,12 @@ Ptr<SceneNode> OCLoader::createShape(const TopoDS_Shape& aShape, const Handle_XC
 			makeEdge(aEdge, edges);
 	}
 
+	Ptr<Material> pEdgeMaterial;
 	if(edges.size() > 0)
-		shape->addGeometry( Material::Black(), Geometry::create(Geometry::LINES, m_pVB, edges) );
+		shape->addGeometry( pEdgeMaterial = Material::Black(), Geometry::createSwapped(Geometry::LINES, m_pVB, edges) );
+
+	if(!m_bCount)
+		m_pRefiner->addShape(shape, aShape, meshes, materials, pEdgeMaterial);
 
 	if(m_bCount)
 		return NULL;
@@ -443,95 +1245,276 @@ Ptr<SceneNode> OCLoader::createShape(const TopoDS_Shape& aShape, const Handle_XC
 		return m_hashes[hash] = shape;
 }
 
+void OCLoader::printStats() const
+{
+	std::cout << "OpenCascade: " << m_nFaces << " faces, meshing " << m_fMeshTime << " ms, triangulations to buffer "
+		<< m_fFaceTime << " ms on " << std::max(1u, boost::thread::hardware_concurrency()) << " threads, "
+		<< m_pVB->getVertexCount() << " vertices" << std::endl;
+}
+
+void OCLoader::attachRefiner()
+{
+	if(!m_pRefiner->isEmpty())
+		m_pScene->addRefiner(m_pRefiner);
+
+	m_pRefiner = NULL;
+}
+
+static const boost::uint32_t CACHE_MAGIC = 0x43545054;	// "TPTC"
+static const boost::uint32_t CACHE_VERSION = 2;
+
+// the cache directory is pruned after each write, oldest entries first
+static const boost::uint64_t CACHE_MAX_BYTES = 512 << 20;
+static const std::time_t CACHE_MAX_AGE = 30 * 24 * 3600;
+
 template<class T>
-Vec3 to_Vector3D(const T& t)
+static void writeValue(std::ostream& out, const T& value)
 {
-	return Vec3((Float)t.X(), (Float)t.Y(), (Float)t.Z());
+	out.write(reinterpret_cast<const char*>(&value), sizeof(T));
 }
 
-bool OCLoader::makeFace(const TopoDS_Face& aFace, Uint_vec& indices)
+template<class T>
+static bool readValue(std::istream& in, T& value)
 {
-	if(m_bCount)
+	in.read(reinterpret_cast<char*>(&value), sizeof(T));
+	return in.good();
+}
+
+OCLoader::CacheKey OCLoader::cacheKey(const std::wstring& sFile) const
+{
+	CacheKey key;
+	key.nSize = 0;
+	key.hash = boost::uuids::nil_uuid();
+
+	std::auto_ptr<char> data;
+	size_t size = SceneIO::File(sFile).getContent(data);
+	if(size == 0)
+		return key;
+
+	// a name based uuid is the SHA-1 of the bytes, the deflection parameters are hashed along
+	std::string bytes(data.get(), size);
+	bytes.append(reinterpret_cast<const char*>(&m_fDeflection), sizeof(m_fDeflection));
+	bytes.append(reinterpret_cast<const char*>(&m_fDeflAngle), sizeof(m_fDeflAngle));
+
+	boost::uuids::name_generator sha1(boost::uuids::nil_uuid());
+	key.hash = sha1(bytes);
+	key.nSize = size;
+
+	try
 	{
-		m_nCount += 1;
-		return NULL;
+		boost::filesystem::path dir = boost::filesystem::temp_directory_path() / "teapot-viewer";
+		boost::filesystem::create_directories(dir);
+		key.sPath = (dir / (boost::uuids::to_string(key.hash) + ".tess")).string();
 	}
-	else
+	catch(boost::filesystem::filesystem_error& e)
 	{
-		m_iCount += 1;
-		progress(0.5f+(m_iCount/m_nCount)/2);
+		std::cerr << "tessellation cache: " << e.what() << std::endl;
 	}
+	return key;
+}
 
-	TopLoc_Location aLoc;
-	Handle(Poly_Triangulation) aTri = BRep_Tool::Triangulation (aFace, aLoc);
+bool OCLoader::readCache(const CacheKey& key, const TopTools_IndexedMapOfShape& aFaces)
+{
+	if(key.sPath.empty())
+		return false;
 
-	if( aTri.IsNull() || aTri->Deflection() > m_fDeflection+ Precision::Confusion() )
+	std::ifstream in(key.sPath.c_str(), std::ios::binary);
+	if(!in)
 	{
-		// Triangulate the face by the standard OCC mesher
-		BRepMesh_IncrementalMesh IM(aFace, m_fDeflection, Standard_False, m_fDeflAngle);
-		//BRepMesh_FastDiscret DM(m_fDeflection, aFace, Bnd_Box(), Standard_True, m_fDeflAngle);
+		std::cout << "tessellation cache: miss, " << aFaces.Extent() << " faces to mesh" << std::endl;
+		return false;
 	}
 
-	BRepAdaptor_Surface sf(aFace, Standard_False);
-	BRepGProp_Face prop(aFace);
+	StopWatch sw;
 
-	aTri = BRep_Tool::Triangulation(aFace, aLoc);
+	boost::uint32_t magic = 0, version = 0, nFaces = 0;
+	boost::uint64_t nSize = 0;
+	boost::uuids::uuid hash = boost::uuids::nil_uuid();
+	double fDeflection = 0, fDeflAngle = 0, fMeshTime = 0;
 
-	if (aTri.IsNull() == Standard_False)
+	// the name is the hash already, the header repeats it with the size so a collision can't match
+	if(!readValue(in, magic) || !readValue(in, version) || !readValue(in, nSize) || !readValue(in, hash) ||
+		!readValue(in, fDeflection) || !readValue(in, fDeflAngle) || !readValue(in, fMeshTime) || !readValue(in, nFaces) ||
+		magic != CACHE_MAGIC || version != CACHE_VERSION || nSize != key.nSize || hash != key.hash ||
+		fDeflection != m_fDeflection || fDeflAngle != m_fDeflAngle || nFaces != (boost::uint32_t)aFaces.Extent())
 	{
-//		const Standard_Integer nNodes(aTri->NbNodes());
-		const Standard_Integer nTriangles(aTri->NbTriangles());
-		const TColgp_Array1OfPnt&    arrPolyNodes = aTri->Nodes();
-		const Poly_Array1OfTriangle& arrTriangles = aTri->Triangles();
-		const TColgp_Array1OfPnt2d&  arrUvnodes = aTri->UVNodes();
+		std::cout << "tessellation cache: stale " << key.sPath << std::endl;
+		return false;
+	}
 
-		Handle(Geom_Surface) aSurface = BRep_Tool::Surface(aFace, aLoc);
+	// everything is read before the first face is touched, a truncated file leaves the shape as it was
+	std::vector<Handle(Poly_Triangulation)> triangulations(nFaces);
+	Uint nHits = 0;
 
-		TopAbs_Orientation orientation = aFace.Orientation();
+	for(boost::uint32_t f = 0; f < nFaces; f++)
+	{
+		boost::int32_t nNodes = 0, nTriangles = 0;
+		double fFaceDeflection = 0;
+		if(!readValue(in, nNodes) || !readValue(in, nTriangles) || !readValue(in, fFaceDeflection) || nNodes < 0 || nTriangles < 0)
+			return false;
+
+		if(nNodes == 0 || nTriangles == 0)
+			continue;
 
-		for (Uint i = 0; i < (Uint)nTriangles; i++)
+		std::vector<double> nodes(3 * nNodes);
+		std::vector<boost::int32_t> triangles(3 * nTriangles);
+		in.read(reinterpret_cast<char*>(&nodes[0]), nodes.size() * sizeof(double));
+		in.read(reinterpret_cast<char*>(&triangles[0]), triangles.size() * sizeof(boost::int32_t));
+		if(!in.good())
+			return false;
+
+		Handle(Poly_Triangulation) tri = new Poly_Triangulation(nNodes, nTriangles, Standard_False);
+		for(int i = 0; i < nNodes; i++)
+			tri->ChangeNodes()(i+1) = gp_Pnt(nodes[3*i+0], nodes[3*i+1], nodes[3*i+2]);
+		for(int i = 0; i < nTriangles; i++)
 		{
-			int ia = 0, ib = 0, ic = 0;
-			const Poly_Triangle& tri = arrTriangles(i+1);
+			for(int k = 0; k < 3; k++)
+				if(triangles[3*i+k] < 1 || triangles[3*i+k] > nNodes)
+					return false;
 
-			if(orientation == TopAbs_REVERSED)
-				tri.Get(ia,ic,ib);
-			else
-				tri.Get(ia,ib,ic);
-
-			gp_Pnt va, vb, vc;
-			va = arrPolyNodes(ia);
-			va.Transform(aLoc.Transformation());
-			vb = arrPolyNodes(ib);
-			vb.Transform(aLoc.Transformation());
-			vc = arrPolyNodes(ic);
-			vc.Transform(aLoc.Transformation());
-
-			gp_Dir na, nb, nc;
-			BOPTools_Tools3D::GetNormalToSurface( aSurface, arrUvnodes(ia).X(), arrUvnodes(ia).Y(), na);
-			na.Transform(aLoc.Transformation());
-			BOPTools_Tools3D::GetNormalToSurface( aSurface, arrUvnodes(ia).X(), arrUvnodes(ia).Y(), nb);
-			nb.Transform(aLoc.Transformation());
-			BOPTools_Tools3D::GetNormalToSurface( aSurface, arrUvnodes(ia).X(), arrUvnodes(ia).Y(), nc);
-			nc.Transform(aLoc.Transformation());
-
-			//if(orientation == TopAbs_REVERSED)
-			//	normals[(Uint)ia-1] = to_Vector3D(aD).getNormalized() * -1;
-			//else
-			//	normals[(Uint)ia-1] = to_Vector3D(aD).getNormalized();
-
-			indices.push_back( m_pVB->addVertex( to_Vector3D(va), to_Vector3D(na), Vec3::Null()) );
-			indices.push_back( m_pVB->addVertex( to_Vector3D(vb), to_Vector3D(nb), Vec3::Null()) );
-			indices.push_back( m_pVB->addVertex( to_Vector3D(vc), to_Vector3D(nc), Vec3::Null()) );
+			tri->ChangeTriangles()(i+1) = Poly_Triangle(triangles[3*i+0], triangles[3*i+1], triangles[3*i+2]);
 		}
+		tri->Deflection(fFaceDeflection);
 
-		return true;
+		triangulations[f] = tri;
+		nHits++;
 	}
 
-	return false;
+	BRep_Builder aBuilder;
+	for(boost::uint32_t f = 0; f < nFaces; f++)
+		if(!triangulations[f].IsNull())
+			aBuilder.UpdateFace(TopoDS::Face(aFaces(f+1)), triangulations[f]);
 
+	std::cout << "tessellation cache: hit, " << nHits << "/" << nFaces << " faces restored in " << sw.elapsed()
+		<< " ms, ~" << fMeshTime - sw.elapsed() << " ms meshing saved" << std::endl;
 
+	// used entries are the last ones pruned
+	in.close();
+	try
+	{
+		boost::filesystem::last_write_time(key.sPath, std::time(NULL));
+	}
+	catch(boost::filesystem::filesystem_error&)
+	{
+	}
+
+	return true;
 }
+
+void OCLoader::writeCache(const CacheKey& key, const TopTools_IndexedMapOfShape& aFaces) const
+{
+	if(key.sPath.empty())
+		return;
+
+	std::string sTmp = key.sPath + ".tmp";
+	{
+		std::ofstream out(sTmp.c_str(), std::ios::binary);
+		if(!out)
+			return;
+
+		writeValue(out, CACHE_MAGIC);
+		writeValue(out, CACHE_VERSION);
+		writeValue(out, key.nSize);
+		writeValue(out, key.hash);
+		writeValue(out, m_fDeflection);
+		writeValue(out, m_fDeflAngle);
+		writeValue(out, m_fMeshTime);
+		writeValue(out, (boost::uint32_t)aFaces.Extent());
+
+		for(int f = 1; f <= aFaces.Extent(); f++)
+		{
+			TopLoc_Location aLoc;
+			Handle(Poly_Triangulation) aTri = BRep_Tool::Triangulation(TopoDS::Face(aFaces(f)), aLoc);
+
+			if(aTri.IsNull())
+			{
+				writeValue(out, (boost::int32_t)0);
+				writeValue(out, (boost::int32_t)0);
+				writeValue(out, 0.0);
+				continue;
+			}
+
+			const TColgp_Array1OfPnt& arrNodes = aTri->Nodes();
+			const Poly_Array1OfTriangle& arrTriangles = aTri->Triangles();
+
+			writeValue(out, (boost::int32_t)arrNodes.Length());
+			writeValue(out, (boost::int32_t)arrTriangles.Length());
+			writeValue(out, aTri->Deflection());
+
+			for(int i = arrNodes.Lower(); i <= arrNodes.Upper(); i++)
+			{
+				writeValue(out, arrNodes(i).X());
+				writeValue(out, arrNodes(i).Y());
+				writeValue(out, arrNodes(i).Z());
+			}
+			for(int i = arrTriangles.Lower(); i <= arrTriangles.Upper(); i++)
+			{
+				int a = 0, b = 0, c = 0;
+				arrTriangles(i).Get(a, b, c);
+				writeValue(out, (boost::int32_t)(a - arrNodes.Lower() + 1));
+				writeValue(out, (boost::int32_t)(b - arrNodes.Lower() + 1));
+				writeValue(out, (boost::int32_t)(c - arrNodes.Lower() + 1));
+			}
+		}
+
+		if(!out.good())
+			return;
+	}
+
+	// renamed into place only when complete, so another instance never reads half a file
+	try
+	{
+		boost::filesystem::remove(key.sPath);
+		boost::filesystem::rename(sTmp, key.sPath);
+		std::cout << "tessellation cache: wrote " << aFaces.Extent() << " faces to " << key.sPath << std::endl;
+
+		pruneCache(boost::filesystem::path(key.sPath).parent_path());
+	}
+	catch(boost::filesystem::filesystem_error& e)
+	{
+		std::cerr << "tessellation cache: " << e.what() << std::endl;
+	}
+}
+
+// removes entries older than CACHE_MAX_AGE, then the least recently used ones until the rest
+// fits into CACHE_MAX_BYTES. Leftover .tmp files of crashed writers age out the same way.
+void OCLoader::pruneCache(const boost::filesystem::path& dir)
+{
+	std::vector< std::pair<std::time_t, boost::filesystem::path> > entries;
+	boost::uint64_t nBytes = 0;
+	std::time_t now = std::time(NULL);
+	Uint nRemoved = 0;
+
+	for(boost::filesystem::directory_iterator it(dir), end; it != end; ++it)
+	{
+		const boost::filesystem::path& path = it->path();
+		if(!boost::filesystem::is_regular_file(path) || (path.extension() != ".tess" && path.extension() != ".tmp"))
+			continue;
+
+		std::time_t t = boost::filesystem::last_write_time(path);
+		if(now - t > CACHE_MAX_AGE)
+		{
+			boost::filesystem::remove(path);
+			nRemoved++;
+			continue;
+		}
+
+		nBytes += boost::filesystem::file_size(path);
+		entries.push_back(std::make_pair(t, path));
+	}
+
+	std::sort(entries.begin(), entries.end());
+	for(size_t i = 0; i < entries.size() && nBytes > CACHE_MAX_BYTES; i++)
+	{
+		nBytes -= boost::filesystem::file_size(entries[i].second);
+		boost::filesystem::remove(entries[i].second);
+		nRemoved++;
+	}
+
+	if(nRemoved > 0)
+		std::cout << "tessellation cache: pruned " << nRemoved << " entries, " << (nBytes >> 20) << " MB left" << std::endl;
+}
+
 bool OCLoader::makeEdge(const TopoDS_Edge& aEdge, Uint_vec& indices)
 {
 	if(m_bCount)
@@ -622,6 +1605,8 @@ bool OCLoader::makeEdge(const TopoDS_Edge& aEdge, Uint_vec& indices)
 	const Standard_Integer nNodes (aPol->NbNodes());
 	const TColgp_Array1OfPnt& arrPolyNodes = aPol->Nodes();
 
+	VertexBatch batch(m_pVB, 2*nNodes);
+
 	for(int i = 0; i < nNodes-1; i++)
 	{
 		gp_Pnt p1 = arrPolyNodes(i+1);
@@ -630,8 +1615,8 @@ bool OCLoader::makeEdge(const TopoDS_Edge& aEdge, Uint_vec& indices)
 		gp_Pnt p2 = arrPolyNodes(i+2);
 		p2.Transform(aLoc.Transformation());
 
-		indices.push_back( m_pVB->addVertex( to_Vector3D(p1), Vec3::Null(), Vec3::Null())  );
-		indices.push_back( m_pVB->addVertex( to_Vector3D(p2), Vec3::Null(), Vec3::Null())  );
+		indices.push_back( batch.add( to_Vector3D(p1) ) );
+		indices.push_back( batch.add( to_Vector3D(p2) ) );
 	}
 
 	return true;
@@ -256,12 +256,12 @@ private:
 			{	
 				Ptr<ShapeNode> shape = ShapeNode::create();
 
-				for(std::map<long, Uint_vec>::const_iterator it = faces.begin(); it != faces.end(); it++)
-					shape->addGeometry( m_materials[it->first], Geometry::create(Geometry::TRIANGLES, pVB, it->second) );
+				for(std::map<long, Uint_vec>::iterator it = faces.begin(); it != faces.end(); it++)
+					shape->addGeometry( m_materials[it->first], Geometry::createSwapped(Geometry::TRIANGLES, pVB, it->second) );
 
 
 				if(edges.size() > 0)
-					shape->addGeometry( Material::Black(), Geometry::create(Geometry::LINES, pVB, edges) );
+					shape->addGeometry( Material::Black(), Geometry::createSwapped(Geometry::LINES, pVB, edges) );
 
 				m_objects[objId] = shape;
 				m_pScene->insertNode( GroupNode::create(shape, tra) );